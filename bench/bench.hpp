@@ -0,0 +1,74 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "environment.hpp"
+#include "vm.hpp"
+
+// Small helpers shared by the benchmarks in this folder. Each benchmark is
+// its own executable (see the bench target in the Makefile) and prints one
+// line per measurement.
+
+class Timer {
+public:
+    Timer(): start(std::chrono::steady_clock::now()) {}
+    double seconds() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+private:
+    std::chrono::steady_clock::time_point start;
+};
+
+inline std::vector<Stmt*> parse_program(std::string program) {
+    Lexer lexer;
+    Parser parser(lexer.lex(program));
+    return parser.parse();
+}
+
+// Runs the program with the tree walking interpreter and returns the seconds
+// spent executing it (lexing and parsing are not included)
+inline double time_program(std::string program, std::string* output = nullptr) {
+    std::vector<Stmt*> statements = parse_program(program);
+    std::stringstream out;
+    Environment env(out);
+    Timer timer;
+    for (Stmt* stmt : statements) env.execute_stmt(stmt);
+    double elapsed = timer.seconds();
+    for (Stmt* stmt : statements) delete stmt;
+    if (output) *output = out.str();
+    return elapsed;
+}
+
+// Same as time_program but compiles and runs the program with the bytecode
+// VM, compilation is included in the time
+inline double time_program_vm(std::string program, std::string* output = nullptr) {
+    std::vector<Stmt*> statements = parse_program(program);
+    std::stringstream out;
+    VM vm(out);
+    Timer timer;
+    vm.run(statements);
+    double elapsed = timer.seconds();
+    for (Stmt* stmt : statements) delete stmt;
+    if (output) *output = out.str();
+    return elapsed;
+}
+
+#endif // BENCH_H_
@@ -0,0 +1,51 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+// Adds a bias to every row and to every column of an n x n matrix ten
+// times, first expanding the bias to the matrix's shape with sa as programs
+// had to before broadcasting, then letting the operator broadcast it.
+
+#include <iostream>
+
+#include "bench.hpp"
+
+std::string bias_add(size_t n, const std::string& bias) {
+    std::string size = std::to_string(n);
+    return R"(
+        a m = [1, 2, 3, 4, 5, 6, 7] sa [)" + size + ", " + size + R"(];
+        a row = [3, 1, 4, 1, 5] sa [)" + size + R"(];
+        a col = [2, 7, 1, 8] sa [)" + size + R"(, 1];
+        a total = 0;
+        a x = 0;
+        w (x < 10) {
+            total = total + sum(m * 2 + )" + bias + R"();
+            x = x + 1;
+        }
+        p total;
+    )";
+}
+
+int main() {
+    for (size_t n : {64, 512, 2048}) {
+        std::string size = std::to_string(n);
+        std::string expanded_row = "(row sa [" + size + ", " + size + "])";
+        std::string expanded_col = "tr ([2, 7, 1, 8] sa [" + size + "] sa [" + size + ", " + size + "])";
+        for (auto [name, expanded_bias] : {std::pair{"row", expanded_row}, std::pair{"col", expanded_col}}) {
+            std::string expanded_output, broadcast_output;
+            double expanded = time_program_vm(bias_add(n, expanded_bias), &expanded_output);
+            double broadcast = time_program_vm(bias_add(n, name), &broadcast_output);
+            std::cout << n << " x " << n << " " << name << " bias: expanded " << expanded * 1e3 << " ms, broadcast "
+                      << broadcast * 1e3 << " ms" << (expanded_output == broadcast_output ? "" : " (OUTPUT DIFFERS)") << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+// Measures the cost of a function call in a program that declares many
+// functions. Calls used to copy every declared function and operator into
+// the callee, so this cost grew with the size of the program.
+
+#include <iostream>
+
+#include "bench.hpp"
+
+const size_t FUNCTIONS = 200;
+const size_t CALLS = 1000000;
+
+std::string program() {
+    std::string source;
+    for (size_t i = 0; i < FUNCTIONS - 1; i++) {
+        source += "f unused" + std::to_string(i) + "(x) { r x * " + std::to_string(i) + "; }\n";
+    }
+    source += "f tiny(x) { r x + 1; }\n";
+    source += "a j = 0;\n";
+    source += "w (j < " + std::to_string(CALLS) + ") { j = tiny(j); }\n";
+    source += "p j;\n";
+    return source;
+}
+
+int main() {
+    std::string source = program();
+    std::string tree_output, vm_output;
+    double tree = time_program(source, &tree_output);
+    double vm = time_program_vm(source, &vm_output);
+    std::cout << FUNCTIONS << " functions, " << CALLS << " calls" << std::endl;
+    std::cout << "tree: " << tree << " s, " << tree / CALLS * 1e9 << " ns/call" << std::endl;
+    std::cout << "vm:   " << vm << " s, " << vm / CALLS * 1e9 << " ns/call"
+              << (tree_output == vm_output ? "" : " (OUTPUT DIFFERS)") << std::endl;
+    return 0;
+}
@@ -0,0 +1,94 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+// Measures the cost of picking the handler for an AST node. The first part
+// compares the old CAN_MAKE chain of dynamic_casts with a switch on the
+// node's kind tag over the nodes of a tight while loop, the second part
+// times the whole loop in the interpreter.
+
+#include <iostream>
+
+#include "bench.hpp"
+#include "util.hpp"
+
+const size_t ITERATIONS = 1000000;
+
+void collect(Expr* expr, std::vector<Expr*>& nodes) {
+    nodes.push_back(expr);
+    if (expr->kind == EXPR_BINARY) {
+        collect(static_cast<Binary*>(expr)->left, nodes);
+        collect(static_cast<Binary*>(expr)->right, nodes);
+    }
+    else if (expr->kind == EXPR_ASSIGN) {
+        collect(static_cast<Assign*>(expr)->value, nodes);
+    }
+}
+
+// Same order of checks as Environment::evaluate_expr used before nodes were
+// tagged
+int dispatch_dynamic_cast(Expr* expr) {
+    if (CAN_MAKE(ArrAccess*, arrAccess)_FROM(expr)) return 0;
+    else if (CAN_MAKE(Assign*, assign)_FROM(expr)) return 1;
+    else if (CAN_MAKE(Binary*, binary)_FROM(expr)) return 2;
+    else if (CAN_MAKE(Func*, func)_FROM(expr)) return 3;
+    else if (CAN_MAKE(Literal*, literal)_FROM(expr)) return 4;
+    else if (CAN_MAKE(Unary*, unary)_FROM(expr)) return 5;
+    else if (CAN_MAKE(Var*, var)_FROM(expr)) return 6;
+    else if (CAN_MAKE(Nil*, nil)_FROM(expr)) return 7;
+    return -1;
+}
+
+int dispatch_kind(Expr* expr) {
+    switch (expr->kind) {
+    case EXPR_ARR_ACCESS: return 0;
+    case EXPR_ASSIGN: return 1;
+    case EXPR_BINARY: return 2;
+    case EXPR_FUNC: return 3;
+    case EXPR_LITERAL: return 4;
+    case EXPR_UNARY: return 5;
+    case EXPR_VAR: return 6;
+    case EXPR_NIL: return 7;
+    }
+    return -1;
+}
+
+template <typename F>
+double time_dispatch(std::vector<Expr*>& nodes, F dispatch, long& checksum) {
+    Timer timer;
+    for (size_t i = 0; i < ITERATIONS; i++) {
+        for (Expr* node : nodes) checksum += dispatch(node);
+    }
+    return timer.seconds();
+}
+
+int main() {
+    std::string loop = "a j = 0; w (j < " + std::to_string(ITERATIONS) + ") { j = j + 1; }";
+    std::vector<Stmt*> statements = parse_program(loop);
+    While* whileStmt = static_cast<While*>(statements.at(1));
+    std::vector<Expr*> nodes;
+    collect(whileStmt->cond, nodes);
+    collect(static_cast<ExprStmt*>(whileStmt->stmts.at(0))->expr, nodes);
+
+    long checksum = 0;
+    double chain = time_dispatch(nodes, dispatch_dynamic_cast, checksum);
+    double tagged = time_dispatch(nodes, dispatch_kind, checksum);
+    double dispatched = (double) ITERATIONS * nodes.size();
+    std::cout << "dynamic_cast chain: " << chain / dispatched * 1e9 << " ns/node" << std::endl;
+    std::cout << "kind switch:        " << tagged / dispatched * 1e9 << " ns/node" << std::endl;
+    std::cout << "(checksum " << checksum << ")" << std::endl;
+
+    double elapsed = time_program(loop);
+    std::cout << "w loop, " << ITERATIONS << " iterations: " << elapsed << " s, "
+              << elapsed / dispatched * 1e9 << " ns/node evaluated" << std::endl;
+    for (Stmt* stmt : statements) delete stmt;
+    return 0;
+}
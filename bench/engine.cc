@@ -0,0 +1,81 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+// Compares the tree walking interpreter with the bytecode VM on scalar heavy
+// programs: a counting loop, a loop calling a small function and the element
+// by element array loop of the advent of code example.
+
+#include <iostream>
+
+#include "bench.hpp"
+
+const std::string COUNTING = R"(
+    a j = 0;
+    a total = 0;
+    w (j < 1000000) {
+        i (j / 3 > 100 A j != 500) {
+            total = total + j * 2 - 1;
+        }
+        j = j + 1;
+    }
+    p total;
+)";
+
+const std::string CALLS = R"(
+    f step(x, k) {
+        r x + k * 2;
+    }
+    a j = 0;
+    a total = 0;
+    w (j < 200000) {
+        total = step(total, j);
+        j = j + 1;
+    }
+    p total;
+)";
+
+const std::string ARRAY_LOOP = R"(
+    f part_one(depths, len) {
+        a j = 1;
+        a count = 0;
+        w (j < len) {
+            i (depths[j] > depths[j-1]) {
+                count = count + 1;
+            }
+            j = j + 1;
+        }
+        r count;
+    }
+    a len = 20000;
+    a depths = [0] sa [len];
+    a j = 0;
+    w (j < len) {
+        depths[j] = (j * 7919) - (j / 13) * 13;
+        j = j + 1;
+    }
+    p part_one(depths, len);
+)";
+
+void compare(const std::string& name, const std::string& program) {
+    std::string tree_output, vm_output;
+    double tree = time_program(program, &tree_output);
+    double vm = time_program_vm(program, &vm_output);
+    std::cout << name << ": tree " << tree << " s, vm " << vm << " s, "
+              << tree / vm << "x" << (tree_output == vm_output ? "" : " (OUTPUT DIFFERS)") << std::endl;
+}
+
+int main() {
+    compare("counting loop", COUNTING);
+    compare("function calls", CALLS);
+    compare("array loop", ARRAY_LOOP);
+    return 0;
+}
@@ -0,0 +1,74 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+// Effective memory bandwidth of elementwise expressions on 10M element
+// arrays. A fused tree reads each input once and writes one output, so the
+// bytes counted per element are 8 for each array read plus 8 for the
+// result. The inputs are stored by writing one of their elements, as a
+// fused tree reads the constant fill of an sa as a number. The time spent
+// creating the arrays is measured separately and subtracted.
+
+#include <iostream>
+
+#include "bench.hpp"
+
+const size_t LENGTH = 10000000;
+const size_t REPEATS = 20;
+
+struct Case {
+    std::string name;
+    std::string stmt;
+    size_t arrays_read;
+};
+
+std::string program(const std::string& stmt) {
+    std::string n = std::to_string(LENGTH);
+    return R"(
+        a x = [1.5] sa [)" + n + R"(];
+        a y = [2.5] sa [)" + n + R"(];
+        a z = [0.5] sa [)" + n + R"(];
+        a out = [0] sa [)" + n + R"(];
+        x[0] = 1.5;
+        y[0] = 2.5;
+        z[0] = 0.5;
+        out[0] = 0;
+        a n = 0;
+        w (n < )" + std::to_string(REPEATS) + R"() {
+            )" + stmt + R"(
+            n = n + 1;
+        }
+        p out[0];
+        p x[0];
+    )";
+}
+
+int main() {
+    std::vector<Case> cases = {
+        {"out = 4 * x + 1", "out = 4 * x + 1;", 1},
+        {"out = x * 2 + y * z - 1", "out = x * 2 + y * z - 1;", 3},
+        {"x = x * 0.5 + y * 0.25 + 1", "x = x * 0.5 + y * 0.25 + 1;", 2},
+    };
+    double tree_setup = time_program(program(""));
+    double vm_setup = time_program_vm(program(""));
+    for (const Case& c : cases) {
+        std::string source = program(c.stmt);
+        std::string tree_output, vm_output;
+        double tree = (time_program(source, &tree_output) - tree_setup) / REPEATS;
+        double vm = (time_program_vm(source, &vm_output) - vm_setup) / REPEATS;
+        double bytes = (c.arrays_read + 1) * 8.0 * LENGTH;
+        std::cout << c.name << ": tree " << tree * 1e3 << " ms (" << bytes / tree / 1e9 << " GB/s), vm "
+                  << vm * 1e3 << " ms (" << bytes / vm / 1e9 << " GB/s)"
+                  << (tree_output == vm_output ? "" : " (OUTPUT DIFFERS)") << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,52 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+// Reads and then writes k scattered elements of a million element array,
+// first an element at a time in a w loop as programs had to before ndarray
+// indices, then with one gather and one scatter through x[idx].
+
+#include <iostream>
+
+#include "bench.hpp"
+
+std::string program(size_t k, const std::string& body) {
+    std::string count = std::to_string(k);
+    return R"(
+        a x = range(1000000) * 0.5;
+        a idx = range()" + count + R"() * )" + std::to_string(1000000 / k - 1) + R"(;
+        a out = [0] sa [)" + count + R"(];
+        a n = )" + count + R"(;
+        a c = 0;
+        )" + body + R"(
+        p sum(out);
+        p sum(x);
+    )";
+}
+
+int main() {
+    std::string looped = R"(
+        w (c < n) {
+            out[c] = x[idx[c]];
+            x[idx[c]] = 0;
+            c = c + 1;
+        }
+    )";
+    std::string gathered = "out = x[idx]; x[idx] = 0;";
+    for (size_t k : {1000, 10000, 100000}) {
+        std::string looped_output, gathered_output;
+        double loop = time_program_vm(program(k, looped), &looped_output);
+        double gather = time_program_vm(program(k, gathered), &gathered_output);
+        std::cout << k << " elements: loop " << loop * 1e3 << " ms, gather/scatter " << gather * 1e3 << " ms"
+                  << (looped_output == gathered_output ? "" : " (OUTPUT DIFFERS)") << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,71 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+// GFLOP/s of square matrix multiplication with the native GEMM and with
+// every BLAS provider that loads on this machine, for sizes 64 to 4096.
+// Each size is repeated until it has run for a while, and the largest
+// difference from the native result is reported as a check.
+
+#include <algorithm>
+#include <iostream>
+#include <math.h>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "blas.hpp"
+#include "gemm.hpp"
+#include "thread_pool.hpp"
+
+const size_t SIZES[] = {64, 128, 256, 512, 1024, 2048, 4096};
+const double MIN_SECONDS = 0.5;
+
+// GFLOP/s of c = a b on n x n matrices with the current backend
+static double gflops(size_t n, const std::vector<double>& a, const std::vector<double>& b, std::vector<double>& c) {
+    size_t runs = 0;
+    Timer timer;
+    do {
+        matmul(n, n, n, a.data(), b.data(), c.data());
+        runs++;
+    } while (timer.seconds() < MIN_SECONDS);
+    return 2.0 * n * n * n * runs / timer.seconds() / 1e9;
+}
+
+int main() {
+    std::cout << "native kernel: " << gemm_kernel_name() << ", threads: " << thread_pool().num_threads() << std::endl;
+    std::vector<std::string> providers;
+    for (const std::string& name : blas_provider_names()) {
+        if (name != "auto" && load_blas_provider(name)) {
+            providers.push_back(name);
+            if (!blas_provider().path.empty()) std::cout << name << ": " << blas_provider().path << std::endl;
+        }
+    }
+    for (size_t n : SIZES) {
+        std::vector<double> a(n * n), b(n * n), native(n * n), blas(n * n);
+        for (size_t i = 0; i < n * n; i++) {
+            a[i] = (double) (i % 17) / 16 - 0.5;
+            b[i] = (double) (i % 13) / 12 - 0.5;
+        }
+        set_matmul_backend(MATMUL_NATIVE);
+        std::cout << "n = " << n << ": native " << gflops(n, a, b, native) << " GFLOP/s";
+        set_matmul_backend(MATMUL_BLAS);
+        double diff = 0;
+        for (const std::string& name : providers) {
+            load_blas_provider(name);
+            std::cout << ", " << name << " " << gflops(n, a, b, blas) << " GFLOP/s";
+            for (size_t i = 0; i < n * n; i++) diff = std::max(diff, fabs(native[i] - blas[i]));
+        }
+        std::cout << ", max difference " << diff << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,54 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+// Fills an array element by element and then counts the increases like
+// part_one in examples/advent_of_code_day1.weak, for growing array sizes.
+// Element reads and writes take constant time, so the time per element
+// should stay flat as the array grows to 1M elements.
+
+#include <iostream>
+
+#include "bench.hpp"
+
+std::string program(size_t length) {
+    std::string n = std::to_string(length);
+    return R"(
+        a depths = [0] sa [)" + n + R"(];
+        a j = 0;
+        w (j < )" + n + R"() {
+            depths[j] = j * 7 - (j / 13) * 13;
+            j = j + 1;
+        }
+        a count = 0;
+        j = 1;
+        w (j < )" + n + R"() {
+            i (depths[j] > depths[j-1]) {
+                count = count + 1;
+            }
+            j = j + 1;
+        }
+        p count;
+    )";
+}
+
+int main() {
+    for (size_t length : {10000, 100000, 1000000}) {
+        std::string source = program(length);
+        std::string tree_output, vm_output;
+        double tree = time_program(source, &tree_output);
+        double vm = time_program_vm(source, &vm_output);
+        std::cout << length << " elements: tree " << tree << " s (" << tree / length * 1e9 << " ns/element), vm "
+                  << vm << " s (" << vm / length * 1e9 << " ns/element)"
+                  << (tree_output == vm_output ? "" : " (OUTPUT DIFFERS)") << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,96 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+// Time per element of the elementwise kernels of each instruction set this
+// CPU supports, next to a plain loop like the one the arithmetic operators
+// used before, for arrays of 64 up to 100M elements. Every kernel writes to
+// a separate destination array.
+
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <math.h>
+
+#include "bench.hpp"
+#include "kernels.hpp"
+
+const size_t SIZES[] = {64, 4096, 262144, 16777216, 100000000};
+// Elements processed per measurement, small arrays are run repeatedly
+const size_t WORK = 400000000;
+
+const char* OP_NAMES[NUM_KERNEL_OPS] = {"+", "-", "*", "/", "^", "<", "<=", ">", ">=", "==", "!=", "A", "O"};
+
+static double power(double base, double exponent) {
+    return pow(base, exponent);
+}
+
+// The loop the operators ran before they had kernels
+template <typename F>
+static void plain_loop(F f, double* dst, const double* left, const double* right, size_t n) {
+    for (size_t i = 0; i < n; i++) dst[i] = f(left[i], right[i]);
+}
+
+static void plain(KernelOp op, double* dst, const double* left, const double* right, size_t n) {
+    switch (op) {
+    case KERNEL_ADD: return plain_loop(std::plus<double>(), dst, left, right, n);
+    case KERNEL_SUB: return plain_loop(std::minus<double>(), dst, left, right, n);
+    case KERNEL_MUL: return plain_loop(std::multiplies<double>(), dst, left, right, n);
+    case KERNEL_DIV: return plain_loop(std::divides<double>(), dst, left, right, n);
+    case KERNEL_POW: return plain_loop(power, dst, left, right, n);
+    case KERNEL_LT: return plain_loop(std::less<double>(), dst, left, right, n);
+    case KERNEL_LE: return plain_loop(std::less_equal<double>(), dst, left, right, n);
+    case KERNEL_GT: return plain_loop(std::greater<double>(), dst, left, right, n);
+    case KERNEL_GE: return plain_loop(std::greater_equal<double>(), dst, left, right, n);
+    case KERNEL_EQ: return plain_loop(std::equal_to<double>(), dst, left, right, n);
+    case KERNEL_NE: return plain_loop(std::not_equal_to<double>(), dst, left, right, n);
+    case KERNEL_AND: return plain_loop(std::logical_and<double>(), dst, left, right, n);
+    default: return plain_loop(std::logical_or<double>(), dst, left, right, n);
+    }
+}
+
+// Nanoseconds per element of f, which processes n elements per call
+template <typename F>
+static double time_per_element(size_t n, size_t work, F f) {
+    size_t repeats = std::max((size_t) 1, work / n);
+    f();
+    Timer timer;
+    for (size_t i = 0; i < repeats; i++) f();
+    return timer.seconds() * 1e9 / (repeats * n);
+}
+
+int main() {
+    std::vector<const Kernels*> supported = supported_kernels();
+    std::cout << "chosen kernels: " << kernels().name << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+    for (size_t n : SIZES) {
+        std::vector<double> left(n), right(n), dst(n);
+        for (size_t i = 0; i < n; i++) {
+            left[i] = 1 + (i % 100) * 0.01;
+            right[i] = 2 - (i % 50) * 0.01;
+        }
+        for (size_t op = 0; op < NUM_KERNEL_OPS; op++) {
+            KernelOp kernel = (KernelOp) op;
+            // Powers take far longer per element
+            size_t work = kernel == KERNEL_POW ? WORK / 20 : WORK;
+            std::cout << "n = " << n << ", array " << OP_NAMES[op] << " array (ns/element): plain loop "
+                      << time_per_element(n, work, [&]() { plain(kernel, dst.data(), left.data(), right.data(), n); });
+            for (const Kernels* k : supported) {
+                std::cout << ", " << k->name << " "
+                          << time_per_element(n, work, [&]() { k->array_array[op](dst.data(), left.data(), right.data(), n); });
+            }
+            std::cout << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,74 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+
+// Time per element of the math kernels of each instruction set this CPU
+// supports, next to a loop calling libm, on an array that fits in L2. Then
+// array ^ number for the exponents ^ takes shortcuts for, next to calling
+// pow on every element as it did before.
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <math.h>
+#include <vector>
+
+#include "bench.hpp"
+#include "kernels.hpp"
+#include "math_kernels.hpp"
+
+const size_t LENGTH = 16384;
+// Elements processed per measurement
+const size_t WORK = 200000000;
+
+const char* MATH_NAMES[NUM_MATH_OPS] = {"exp", "log", "sqrt", "sin", "cos", "tanh"};
+double (*const LIBM[NUM_MATH_OPS])(double) = {exp, log, sqrt, sin, cos, tanh};
+const double EXPONENTS[] = {0.5, -1, 2, 3, 4};
+
+// Nanoseconds per element of f, which processes LENGTH elements per call
+template <typename F>
+static double time_per_element(F f) {
+    size_t repeats = WORK / LENGTH;
+    f();
+    Timer timer;
+    for (size_t i = 0; i < repeats; i++) f();
+    return timer.seconds() * 1e9 / (repeats * LENGTH);
+}
+
+int main() {
+    std::vector<double> x(LENGTH), dst(LENGTH);
+    // Covers several periods of sin and cos and where tanh levels off
+    for (size_t i = 0; i < LENGTH; i++) x[i] = 0.01 + (double) (i % 1000) * 0.01;
+    std::cout << "chosen math kernels: " << math_kernels().name << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+    for (size_t op = 0; op < NUM_MATH_OPS; op++) {
+        std::cout << MATH_NAMES[op] << " (ns/element): libm " << time_per_element([&]() {
+            for (size_t i = 0; i < LENGTH; i++) dst[i] = LIBM[op](x[i]);
+        });
+        for (const MathKernels* k : supported_math_kernels()) {
+            std::cout << ", " << k->name << " " << time_per_element([&]() { k->apply[op](dst.data(), x.data(), LENGTH); });
+        }
+        std::cout << std::endl;
+    }
+    for (double exponent : EXPONENTS) {
+        std::cout << "array ^ " << exponent << " (ns/element): pow " << time_per_element([&]() {
+            for (size_t i = 0; i < LENGTH; i++) dst[i] = pow(x[i], exponent);
+        });
+        for (const Kernels* k : supported_kernels()) {
+            std::cout << ", " << k->name << " "
+                      << time_per_element([&]() { k->array_number[KERNEL_POW](dst.data(), x.data(), exponent, LENGTH); });
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
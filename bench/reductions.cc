@@ -0,0 +1,128 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+// First the sum, max and min kernels of every instruction set the CPU
+// supports, in ns per element of an array that fits in L2. Then the sum,
+// max, argmax and axis builtins on a 1M element array on both engines, next
+// to the w loops over indexed elements that Weak programs wrote before them.
+
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "bench.hpp"
+#include "kernels.hpp"
+
+const size_t KERNEL_LENGTH = 16384;
+const size_t KERNEL_RUNS = 20000;
+// Calls of a builtin per program, the w loops run once
+const size_t BUILTIN_RUNS = 100;
+
+struct Reduction {
+    const char* name;
+    std::string builtin;
+    std::string loop;
+};
+
+int main() {
+    std::vector<double> x(KERNEL_LENGTH);
+    for (size_t i = 0; i < KERNEL_LENGTH; i++) x[i] = (double) (i % 1000) * 0.001;
+    std::cout << std::fixed << std::setprecision(3);
+    for (const Kernels* k : supported_kernels()) {
+        double (*reductions[])(const double*, size_t) = {k->sum, k->max, k->min};
+        const char* names[] = {"sum", "max", "min"};
+        std::cout << k->name << " (ns/element):";
+        for (size_t r = 0; r < 3; r++) {
+            double result = 0;
+            Timer timer;
+            for (size_t run = 0; run < KERNEL_RUNS; run++) result += reductions[r](x.data(), KERNEL_LENGTH);
+            std::cout << " " << names[r] << " " << timer.seconds() * 1e9 / (KERNEL_RUNS * KERNEL_LENGTH);
+            // Keeps the calls from being optimized out
+            if (result == -1) std::cout << "!";
+        }
+        std::cout << std::endl;
+    }
+
+    std::string setup = "a x = [0.5, 0.25, 0.75, 1, 0] sa [1000, 1000];\n";
+    std::string repeat = "a k = 0;\nw (k < " + std::to_string(BUILTIN_RUNS) + ") {\n";
+    Reduction reductions[] = {
+        {"sum", "total = sum(x);", R"(
+            a total = 0;
+            a row = 0;
+            a col = 0;
+            w (row < 1000) {
+                col = 0;
+                w (col < 1000) {
+                    total = total + x[row, col];
+                    col = col + 1;
+                }
+                row = row + 1;
+            }
+        )"},
+        {"max", "best = max(x);", R"(
+            a best = x[0, 0];
+            a row = 0;
+            a col = 0;
+            w (row < 1000) {
+                col = 0;
+                w (col < 1000) {
+                    i (x[row, col] > best) {
+                        best = x[row, col];
+                    }
+                    col = col + 1;
+                }
+                row = row + 1;
+            }
+        )"},
+        {"argmax", "index = argmax(x);", R"(
+            a best = x[0, 0];
+            a index = 0;
+            a row = 0;
+            a col = 0;
+            w (row < 1000) {
+                col = 0;
+                w (col < 1000) {
+                    i (x[row, col] > best) {
+                        best = x[row, col];
+                        index = row * 1000 + col;
+                    }
+                    col = col + 1;
+                }
+                row = row + 1;
+            }
+        )"},
+        {"sum along axis 0", "sums = sum(x, 0);", R"(
+            a sums = [0] sa [1000];
+            a row = 0;
+            a col = 0;
+            w (row < 1000) {
+                col = 0;
+                w (col < 1000) {
+                    sums[col] = sums[col] + x[row, col];
+                    col = col + 1;
+                }
+                row = row + 1;
+            }
+        )"}
+    };
+    for (const Reduction& reduction : reductions) {
+        std::string declare = std::string("a ") + reduction.builtin.substr(0, reduction.builtin.find(' ')) + " = 0;\n";
+        std::string builtin = setup + declare + repeat + reduction.builtin + "\nk = k + 1;\n}\n";
+        std::string loop = setup + reduction.loop;
+        std::cout << reduction.name << " of 1M elements (ms): builtin tree " << time_program(builtin) * 1e3 / BUILTIN_RUNS
+                  << ", vm " << time_program_vm(builtin) * 1e3 / BUILTIN_RUNS
+                  << "; w loop tree " << time_program(loop) * 1e3
+                  << ", vm " << time_program_vm(loop) * 1e3 << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+// Takes the bottom half of an n x n matrix and multiplies the transpose of
+// the matrix by itself, first by copying elements with w loops as programs
+// had to before slicing, then with a slice and tr, which only make views.
+
+#include <iostream>
+
+#include "bench.hpp"
+
+std::string looped(size_t n) {
+    std::string size = std::to_string(n);
+    std::string half = std::to_string(n / 2);
+    return R"(
+        a m = [1, 2, 3, 4, 5, 6, 7] sa [)" + size + ", " + size + R"(];
+        a bottom = [0] sa [)" + half + ", " + size + R"(];
+        a x = 0;
+        a y = 0;
+        w (x < )" + half + R"() {
+            y = 0;
+            w (y < )" + size + R"() {
+                bottom[x, y] = m[x + )" + half + R"(, y];
+                y = y + 1;
+            }
+            x = x + 1;
+        }
+        a mt = [0] sa [)" + size + ", " + size + R"(];
+        x = 0;
+        w (x < )" + size + R"() {
+            y = 0;
+            w (y < )" + size + R"() {
+                mt[x, y] = m[y, x];
+                y = y + 1;
+            }
+            x = x + 1;
+        }
+        p sum(bottom) + sum(mt @ m);
+    )";
+}
+
+std::string sliced(size_t n) {
+    std::string size = std::to_string(n);
+    std::string half = std::to_string(n / 2);
+    return R"(
+        a m = [1, 2, 3, 4, 5, 6, 7] sa [)" + size + ", " + size + R"(];
+        a bottom = m[)" + half + R"(:, :];
+        p sum(bottom) + sum(tr m @ m);
+    )";
+}
+
+int main() {
+    for (size_t n : {64, 256, 512}) {
+        std::string loop_output, slice_output;
+        double loop = time_program_vm(looped(n), &loop_output);
+        double slice = time_program_vm(sliced(n), &slice_output);
+        std::cout << n << " x " << n << ": w loops " << loop * 1e3 << " ms, slice and tr " << slice * 1e3 << " ms"
+                  << (loop_output == slice_output ? "" : " (OUTPUT DIFFERS)") << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+// Nanoseconds per product of small square matrices: 10M products through
+// matmul, which uses the unrolled kernels, next to the packed native GEMM
+// and the BLAS dgemm the kernels replace at these sizes. Then the same
+// through @ in a Weak loop on both engines, which adds the interpreter's
+// own cost per operator.
+
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include <cblas.h>
+
+#include "bench.hpp"
+#include "blas.hpp"
+#include "gemm.hpp"
+
+const size_t SIZES[] = {2, 3, 4, 8};
+const size_t PRODUCTS = 10000000;
+// The general paths are timed on fewer products, they take far longer
+const size_t GENERAL_PRODUCTS = 1000000;
+
+template <typename F>
+static double ns_per_product(size_t products, F f) {
+    f();
+    Timer timer;
+    for (size_t i = 0; i < products; i++) f();
+    return timer.seconds() * 1e9 / products;
+}
+
+int main() {
+    load_blas_provider("auto");
+    std::cout << std::fixed << std::setprecision(1);
+    for (size_t n : SIZES) {
+        std::vector<double> a(n * n), b(n * n), c(n * n);
+        for (size_t i = 0; i < n * n; i++) {
+            a[i] = 1 + i * 0.01;
+            b[i] = 0.5 - i * 0.01;
+        }
+        // Feeding the result back in keeps the products from being skipped
+        std::cout << n << "x" << n << " (ns/product): unrolled "
+                  << ns_per_product(PRODUCTS, [&]() { matmul(n, n, n, a.data(), b.data(), c.data()); b[0] = c[0] * 1e-9; })
+                  << ", native gemm "
+                  << ns_per_product(GENERAL_PRODUCTS, [&]() { native_gemm(n, n, n, a.data(), b.data(), c.data()); b[0] = c[0] * 1e-9; })
+                  << ", " << blas_provider().name << " dgemm "
+                  << ns_per_product(GENERAL_PRODUCTS, [&]() {
+                         blas_provider().dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, n, n, n, 1., a.data(), n, b.data(), n, 0., c.data(), n);
+                         b[0] = c[0] * 1e-9;
+                     })
+                  << std::endl;
+    }
+
+    std::string program = R"(
+        a m = [0.5, 0.25, -0.25, 0.5] sa [2, 2];
+        a x = [1, 0, 0, 1] sa [2, 2];
+        a k = 0;
+        w (k < 1000000) {
+            x = m @ x;
+            k = k + 1;
+        }
+    )";
+    std::cout << "1M 2x2 products in a w loop (s): tree " << time_program(program)
+              << ", vm " << time_program_vm(program) << std::endl;
+    return 0;
+}
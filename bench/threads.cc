@@ -0,0 +1,70 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+// Speedup of the array operators on 10M element arrays as the thread pool
+// grows from 1 to 16 threads. The time spent creating the input arrays is
+// measured separately and subtracted. An element of each input is written
+// once, so the inputs are stored rather than computed from their sa fill.
+// Speedups are limited by the cores and memory bandwidth of the machine.
+
+#include <iostream>
+
+#include "bench.hpp"
+#include "thread_pool.hpp"
+
+const size_t LENGTH = 10000000;
+const size_t REPEATS = 20;
+const size_t THREADS[] = {1, 2, 4, 8, 16};
+
+std::string program(const std::string& stmt) {
+    std::string n = std::to_string(LENGTH);
+    return R"(
+        a x = [1.5] sa [)" + n + R"(];
+        a y = [2.5] sa [)" + n + R"(];
+        a z = [0.5] sa [)" + n + R"(];
+        a out = [0] sa [)" + n + R"(];
+        x[0] = 1.5;
+        y[0] = 2.5;
+        z[0] = 0.5;
+        out[0] = 0;
+        a n = 0;
+        w (n < )" + std::to_string(REPEATS) + R"() {
+            )" + stmt + R"(
+            n = n + 1;
+        }
+        p out[0];
+    )";
+}
+
+int main() {
+    std::vector<std::string> cases = {
+        "out = x * y;",
+        "out = x * 2 + y * z - 1;",
+        "out = exp(x);",
+    };
+    std::cout << "cores: " << std::thread::hardware_concurrency() << std::endl;
+    for (const std::string& stmt : cases) {
+        std::cout << stmt;
+        double single = 0;
+        for (size_t threads : THREADS) {
+            set_num_threads(threads);
+            double setup = time_program(program(""));
+            double elapsed = (time_program(program(stmt)) - setup) / REPEATS;
+            if (threads == 1) single = elapsed;
+            std::cout << (threads == 1 ? " " : ", ") << threads << " threads " << elapsed * 1e3 << " ms ("
+                      << single / elapsed << "x)";
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
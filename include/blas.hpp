@@ -0,0 +1,53 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#ifndef BLAS_H_
+#define BLAS_H_
+
+#include <string>
+#include <vector>
+
+// BLAS libraries the blas matmul backend can call into. Providers other
+// than "linked" are shared libraries opened with dlopen, so Weak can use
+// whatever optimized BLAS is installed without being rebuilt. "linked" is
+// the CBLAS Weak was linked against, and is used when no other provider
+// can be loaded. Builds without dlopen or a linked BLAS
+// (WEB_TARGET) have no providers.
+
+typedef double (*DdotFn)(int n, const double* x, int incx, const double* y, int incy);
+typedef void (*DgemvFn)(int layout, int trans, int m, int n, double alpha, const double* a, int lda,
+                        const double* x, int incx, double beta, double* y, int incy);
+typedef void (*DgemmFn)(int layout, int trans_a, int trans_b, int m, int n, int k,
+                        double alpha, const double* a, int lda, const double* b, int ldb,
+                        double beta, double* c, int ldc);
+
+struct BlasProvider {
+    std::string name;
+    // Library the provider was loaded from, empty for the linked one
+    std::string path;
+    DdotFn ddot;
+    DgemvFn dgemv;
+    DgemmFn dgemm;
+};
+
+// Names accepted by load_blas_provider, "auto" first
+const std::vector<std::string>& blas_provider_names();
+// Makes name the active provider. "auto" picks the first of openblas,
+// blis and cblas that loads, else linked. False if name isn't a provider
+// or its library couldn't be loaded, the active provider is unchanged.
+bool load_blas_provider(const std::string& name);
+// Active provider. Until load_blas_provider succeeds it is the one named
+// by the WEAK_BLAS environment variable, else auto.
+const BlasProvider& blas_provider();
+
+#endif // BLAS_H_
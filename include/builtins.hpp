@@ -0,0 +1,69 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#ifndef BUILTINS_H_
+#define BUILTINS_H_
+
+#include <cstddef>
+#include <string>
+
+#include "token.hpp"
+#include "variable.hpp"
+
+// Functions written in C++ that Weak programs call like their own. The
+// Resolver looks a call's name up here before the program's functions, so
+// a builtin can't be redefined. Each takes a fixed number of arguments; a
+// name taking a varying number has an entry per count.
+//
+// The reductions sum(x), max(x), min(x), mean(x) and argmax(x) reduce the
+// whole ndarray x to a number, argmax giving the flat index of the first
+// greatest element. With a second argument, as in sum(x, axis), they reduce
+// along that dimension only, counting from the end when it is negative,
+// and give an ndarray without it or a number when x is 1d. NaNs carry
+// through max, min and mean, and are what argmax points at.
+//
+// The math functions exp(x), log(x), sqrt(x), sin(x), cos(x) and tanh(x)
+// take a number or an ndarray, applying the function to each element of
+// the latter.
+//
+// Masks are the ndarrays that comparisons give, 1 where they hold and 0
+// elsewhere, though any element other than 0 counts as set. any(mask) and
+// all(mask) tell whether some or every element of mask is set.
+// filter(x, mask) gives the 1d ndarray of the elements of x where mask is
+// set, in order. where(mask, a, b) takes each element from a where mask is
+// set and from b elsewhere, a and b being numbers or ndarrays shaped like
+// mask.
+//
+// range(n) gives the 1d ndarray 0, 1, ..., n - 1, and range(begin, end)
+// the numbers from begin up to but not including end, a step of 1 apart.
+// Its elements are computed as they are read rather than stored.
+
+#define NO_BUILTIN ((size_t) -1)
+#define MAX_BUILTIN_ARGS 3
+
+struct Builtin {
+    const char* name;
+    size_t num_args;
+    // loc is the call's name, where its runtime errors are reported. The
+    // arguments are the builtin's to move from, so an ndarray that doesn't
+    // share its buffer can be reused for the result.
+    Variable (*call)(Variable* args, const Token& loc);
+};
+
+// Id of the builtin called name taking num_args arguments, else of the
+// first one called name, whose calls fail the argument count check, else
+// NO_BUILTIN
+size_t find_builtin(const std::string& name, size_t num_args);
+const Builtin& builtin(size_t id);
+
+#endif // BUILTINS_H_
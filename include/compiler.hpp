@@ -0,0 +1,194 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef COMPILER_H_
+#define COMPILER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "stmt.hpp"
+#include "expr.hpp"
+#include "variable.hpp"
+#include "resolver.hpp"
+
+// Operands named B or C in the comments below are "RK" operands: a register
+// number, or a constant index with the RK_CONSTANT bit set.
+#define RK_CONSTANT 0x80000000u
+
+enum OpCode : uint8_t {
+    OP_MOVE,            // R[A] = B
+    OP_CHECK_DEFINED,   // error unless local A has been declared
+    OP_DECLARE,         // declare local A with value B, unless already declared
+    OP_DECL_FUNC,       // add function prototype A under function id B
+    OP_DECL_OP,         // add operator prototype A under operator id B
+    OP_ADD,             // R[A] = B + C
+    OP_SUB,             // R[A] = B - C
+    OP_MUL,             // R[A] = B * C
+    OP_DIV,             // R[A] = B / C
+    OP_LT,              // R[A] = B < C
+    OP_LE,              // R[A] = B <= C
+    OP_GT,              // R[A] = B > C
+    OP_GE,              // R[A] = B >= C
+    OP_EQ,              // R[A] = B == C
+    OP_NE,              // R[A] = B != C
+    OP_BINARY,          // R[A] = B op C for any other operator, op is the instruction's token
+    OP_NOT,             // R[A] = !B
+    OP_NEG,             // R[A] = -B
+    OP_UNARY,           // R[A] = op B for any other operator
+    OP_JUMP,            // pc = A
+    OP_BRANCH_FALSE,    // error M[C] unless B is a bool, pc = A if B is false
+    // The next instruction of OP_JUMP_UNLESS_* is an OP_BRANCH_FALSE. For two
+    // numbers they skip it or take its jump themselves, otherwise they put
+    // the value of the comparison in its register for it to check.
+    OP_JUMP_UNLESS_LT,  // pc = next's A unless B < C
+    OP_JUMP_UNLESS_LE,  // pc = next's A unless B <= C
+    OP_JUMP_UNLESS_GT,  // pc = next's A unless B > C
+    OP_JUMP_UNLESS_GE,  // pc = next's A unless B >= C
+    OP_JUMP_UNLESS_EQ,  // pc = next's A unless B == C
+    OP_JUMP_UNLESS_NE,  // pc = next's A unless B != C
+    OP_SHORT_CIRCUIT,   // pc = A if B alone decides the A or O that is the instruction's token, error unless B is a bool or an ndarray
+    OP_LOGICAL,         // R[A] = R[A] op R[B] for the A or O that R[A] didn't decide
+    OP_CHECK_NUMBER,    // error M[B] unless A is a number
+    OP_FUSE,            // R[A] = value of the fused tree of elementwise operators F[B]
+    OP_CHECK_CHAIN,     // error unless R[A+B-1] can multiply the product of R[A]... before it
+    OP_CHAIN,           // R[A] = product of the operands in R[B]... of the chain of @s H[C]
+    OP_NEW_ARRAY,       // R[A] = 1d array of the C numbers in R[B]...
+    OP_CHECK_ARRAY,     // error unless A is an ndarray with B dimensions
+    OP_CHECK_INDEX,     // error unless A is a valid index into dimension C of array B, an ndarray becoming the positions it picks
+    OP_GET_ELEM,        // R[A] = element of array B at the indices in R[C]..., or the elements picked when one is an ndarray
+    OP_CHECK_SLICE,     // error unless R[A] and R[A+1] bound a slice of dimension C of array B, a Nil R[A+1] becoming its length
+    OP_SLICE,           // R[A] = view of array B at the slices and indices in pairs of registers R[C]..., an index paired with Nil
+    OP_CHECK_SET_ELEM,  // error unless B is a number or ndarray and local A is an ndarray
+    OP_CHECK_SET_INDEX, // OP_CHECK_INDEX for local B
+    OP_CHECK_SET_SLICE, // R[A] = positions of the slice bounded by R[A+1] and R[A+2] of dimension C of local B, once checked
+    OP_SET_ELEM,        // local A at the C indices in R[B+1]... = R[B], scattered when one is an ndarray
+    OP_CHECK_FUNC,      // error unless function id A is defined
+    OP_CHECK_ARGC,      // error unless function id A takes B arguments
+    OP_CALL,            // R[A] = function id B called with the arguments in R[C]...
+    OP_CALL_OP,         // R[A] = operator id B called with R[C] and R[C+1]
+    OP_CHECK_BUILTIN,   // error unless builtin A takes B arguments
+    OP_BUILTIN,         // R[A] = builtin B called with the arguments in R[C]...
+    OP_PRINT,           // print A
+    OP_ASSERT,          // error unless A is the bool True
+    OP_RETURN,          // return A
+    OP_RETURN_NIL       // return Nil
+};
+
+struct Instr {
+    OpCode op;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+};
+
+// One step of a fused tree of elementwise operators in postfix order:
+// apply op to the top two values, or push operand when op is null
+struct FusedStep {
+    const Token* op;
+    uint32_t operand;
+};
+
+// Operators of a chain of @s, with the order cached on its root node
+struct CompiledChain {
+    std::vector<const Token*> ops;
+    ChainOrder* order;
+};
+
+// A compiled function, operator or top level program. Registers 0 to
+// num_locals - 1 hold the named locals in their Resolver slots, the rest are
+// temporaries.
+struct Proto {
+    std::string name;
+    std::vector<Instr> code;
+    // Source location for the runtime error raised by each instruction
+    std::vector<const Token*> locs;
+    std::vector<Variable> constants;
+    std::vector<std::string> messages;
+    std::vector<std::vector<FusedStep>> fusions;
+    std::vector<CompiledChain> chains;
+    // Locals that receive the arguments of a call, in order
+    std::vector<uint32_t> params;
+    uint32_t num_locals = 0;
+    uint32_t num_regs = 0;
+};
+
+struct CompiledProgram {
+    std::vector<std::unique_ptr<Proto>> protos;
+    // Index of the prototype for the top level statements
+    size_t main = 0;
+    // Number of function and operator ids given out by the Resolver
+    size_t num_funcs = 0;
+    size_t num_ops = 0;
+};
+
+// Compiles the statements produced by Parser::parse into register based
+// bytecode for the VM. The AST must outlive the compiled program since
+// instructions refer to its tokens for error reporting.
+class Compiler {
+public:
+    CompiledProgram compile(const std::vector<Stmt*>& program);
+private:
+    // What is known at compile time about whether a local has been declared
+    enum DeclState : uint8_t {
+        UNDECLARED,
+        DECLARED,
+        MAYBE_DECLARED
+    };
+
+    struct Scope {
+        Proto* proto;
+        std::vector<DeclState> state;
+        uint32_t next_temp;
+    };
+
+    CompiledProgram result;
+    std::unordered_map<Stmt*, uint32_t> decl_protos;
+    Scope* scope = nullptr;
+
+    uint32_t compile_proto(std::string name, const std::vector<size_t>& params, size_t num_slots, const std::vector<Stmt*>& stmts);
+
+    void analyze(const std::vector<Stmt*>& stmts, std::vector<DeclState>& state);
+    void analyze(Stmt* stmt, std::vector<DeclState>& state);
+    static void join(std::vector<DeclState>& into, const std::vector<DeclState>& other);
+
+    void compile_stmts(const std::vector<Stmt*>& stmts);
+    void compile_stmt(Stmt* stmt);
+    void compile_while(While* whileStmt);
+    void compile_expr(Expr* expr, uint32_t dst);
+    uint32_t compile_operand(Expr* expr, bool copy_locals);
+    void compile_binary(Binary* binary, uint32_t dst);
+    bool compile_fused(Binary* binary, uint32_t dst);
+    void compile_chain(Binary* binary, uint32_t dst);
+    void compile_assign(Assign* assign, uint32_t dst);
+    void compile_arr_access(ArrAccess* arrAccess, uint32_t dst);
+    void compile_literal(Literal* literal, uint32_t dst);
+    void compile_call(Func* func, uint32_t dst);
+    void compile_branch_unless(Expr* cond, const Token& keyword, const std::string& message, size_t& jump);
+    void ensure_declared(const Token& name, uint32_t slot);
+
+    size_t emit(OpCode op, uint32_t a, uint32_t b, uint32_t c, const Token* loc);
+    void patch(size_t jump, size_t target);
+    uint32_t constant(Variable value);
+    uint32_t message(const std::string& msg);
+    uint32_t alloc_temp();
+    void free_temps(uint32_t mark);
+
+    static void collect_fused(Binary* binary, std::vector<Expr*>& postfix, std::vector<Binary*>& ops);
+    static bool has_assign(Expr* expr);
+    static bool refers_to(Expr* expr, uint32_t slot);
+};
+
+#endif // COMPILER_H_
@@ -13,54 +13,18 @@
 #ifndef ENVIRONMENT_H_
 #define ENVIRONMENT_H_
 
-#include <unordered_map>
+#include <memory>
 #include <stdexcept>
 #include <iostream>
-#ifndef WEB_TARGET
-    #include <cblas.h>
-#endif
 #include <string>
-#include <math.h>
+#include <vector>
 
 #include "variable.hpp"
 #include "parser.hpp"
 #include "error.hpp"
-#include "util.hpp"
-
-#define FUNC_EXISTS(func) (func_symbol_table.find(func) != func_symbol_table.end())
-#define OP_EXISTS(op) (op_symbol_table.find(op) != op_symbol_table.end())
-#define VAR_EXISTS(var) (var_symbol_table.find(var) != var_symbol_table.end())
-
-#define ELEMENTWISE_OP(OP) { \
-    if (left_var.is_double() && right_var.is_double()) { \
-	return Variable(std::get<double>(left_var.value) OP std::get<double>(right_var.value)); \
-    } \
-    if (left_var.is_double() && right_var.is_ndarray()) { \
-	auto right_arr = std::get<std::pair<std::vector<double>, std::vector<size_t>>>(right_var.value).first; \
-	for (size_t i = 0; i < right_arr.size(); i++) { \
-	    right_arr.at(i) = std::get<double>(left_var.value) OP right_arr.at(i); \
-	} \
-	return Variable(std::pair<std::vector<double>, std::vector<size_t>>(right_arr, std::get<std::pair<std::vector<double>, std::vector<size_t>>>(right_var.value).second)); \
-    } \
-    if (left_var.is_ndarray() && right_var.is_double()) { \
-	auto left_arr = std::get<std::pair<std::vector<double>, std::vector<size_t>>>(left_var.value).first; \
-	for (size_t i = 0; i < left_arr.size(); i++) { \
-	    left_arr.at(i) = left_arr.at(i) OP std::get<double>(right_var.value); \
-	} \
-	return Variable(std::pair<std::vector<double>, std::vector<size_t>>(left_arr, std::get<std::pair<std::vector<double>, std::vector<size_t>>>(left_var.value).second)); \
-    } \
-    if (left_var.is_ndarray() && right_var.is_ndarray()) { \
-	auto left_var_pair = std::get<std::pair<std::vector<double>, std::vector<size_t>>>(left_var.value); \
-	auto right_var_pair = std::get<std::pair<std::vector<double>, std::vector<size_t>>>(right_var.value); \
-	runtime_assert(left_var_pair.second == right_var_pair.second, binary->op, "Expressions evaluate to arrays of differing sizes"); \
-	std::vector<double> zipped; \
-	for (size_t i = 0; i < left_var_pair.first.size(); i++) { \
-	    zipped.push_back(left_var_pair.first.at(i) OP right_var_pair.first.at(i)); \
-	} \
-	return Variable(std::pair<std::vector<double>, std::vector<size_t>>(zipped, left_var_pair.second)); \
-    } \
-    runtime_assert(false, binary->op, "At least one of left and right expressions are neither numbers nor ndarrays"); \
-}
+#include "operations.hpp"
+#include "resolver.hpp"
+#include "fusion.hpp"
 
 class Environment {
 public:
@@ -70,18 +34,56 @@ public:
     void add_func(std::string name, FuncDecl* func);
     void add_op(std::string name, OpDecl* op);
     void add_var(std::string name, Variable var);
+    bool has_func(const std::string& name);
+    bool has_op(const std::string& name);
+    bool has_var(const std::string& name);
     bool has_hit_return();
     Variable get_return_val();
+    // Resolves stmt and runs it as a top level statement of the program
     void execute_stmt(Stmt* stmt);
-    std::unordered_map<std::string, FuncDecl*> func_symbol_table; 
-    std::unordered_map<std::string, OpDecl*> op_symbol_table; 
-    std::unordered_map<std::string, Variable> var_symbol_table;
 private:
+    // Calls share the caller's function and operator tables, a table is
+    // only copied when a frame declares something while sharing it
+    struct Frame {
+        size_t base;
+        std::shared_ptr<std::vector<FuncDecl*>> funcs;
+        std::shared_ptr<std::vector<OpDecl*>> ops;
+    };
+    std::unique_ptr<Resolver> resolver;
+    // Variables of every active call, with the current frame's slots
+    // starting at frame.base
+    std::vector<Variable> slots;
+    std::vector<char> declared;
+    Frame frame;
+    std::vector<std::unique_ptr<FusedExpr>> fused_exprs;
+    size_t fused_depth = 0;
     bool hit_return;
     Variable return_val;
+    void grow();
+    void declare(size_t slot, Variable var);
+    Variable call(const std::vector<Stmt*>& body, size_t base, const std::vector<size_t>& param_slots, size_t num_slots);
+    void execute(Stmt* stmt);
+    void execute_expr_stmt(ExprStmt* exprStmt);
+    void execute_func_decl(FuncDecl* funcDecl);
+    void execute_if(If* ifStmt);
+    void execute_op_decl(OpDecl* opDecl);
+    void execute_print(Print* print);
+    void execute_return(Return* returnStmt);
+    void execute_var_decl(VarDecl* varDecl);
+    void execute_while(While* whileStmt);
+    void execute_assert(Assert* assertStmt);
     Variable evaluate_expr(Expr* expr);
-    void runtime_assert(bool cond, Token loc, std::string error_msg);
-    std::string create_error(std::string error_msg, Token loc);
+    Variable evaluate_arr_access(ArrAccess* arrAccess);
+    Variable evaluate_assign(Assign* assign);
+    Variable evaluate_binary(Binary* binary);
+    Variable evaluate_fused(Binary* binary);
+    void fuse(Binary* binary, FusedExpr& fused);
+    Variable evaluate_chain(Binary* binary);
+    Variable evaluate_func(Func* func);
+    Variable evaluate_builtin(Func* func);
+    Variable evaluate_literal(Literal* literal);
+    Variable evaluate_unary(Unary* unary);
+    Variable evaluate_var(Var* var);
     std::ostream& out;
 };
 
@@ -15,11 +15,33 @@
 
 #include <vector>
 
+#include "builtins.hpp"
+#include "matrix_chain.hpp"
+#include "ndarray.hpp"
 #include "token.hpp"
 
+// Slot or id the Resolver hasn't filled in yet
+#define UNRESOLVED ((size_t) -1)
+
+enum ExprKind {
+    EXPR_ARR_ACCESS,
+    EXPR_ASSIGN,
+    EXPR_BINARY,
+    EXPR_FUNC,
+    EXPR_LITERAL,
+    EXPR_SLICE,
+    EXPR_UNARY,
+    EXPR_VAR,
+    EXPR_NIL
+};
+
 class Expr {
 public:
+    Expr(ExprKind kind);
     virtual ~Expr();
+    // Tag used by the environment to dispatch on the node type with a
+    // single switch instead of a chain of dynamic_casts
+    const ExprKind kind;
     virtual std::pair<std::string, std::string> to_string() = 0; 
     static size_t node_counter;
     static std::pair<std::string, std::string> make_string(std::string label, Expr* child);
@@ -35,6 +57,12 @@ public:
     Expr* id;
     Token brack;
     std::vector<Expr*> idx;
+    // Set by the Parser when one of the indices is a Slice, making the
+    // value a view of part of the array
+    bool sliced = false;
+    // Set by the Resolver when id is a variable that none of the indices
+    // assign to, so the element can be read without copying the array out
+    bool in_place = false;
 };
 
 class Assign : public Expr {
@@ -46,6 +74,8 @@ public:
     Token name;
     std::vector<Expr*> idx;
     Expr* value;
+    // Frame slot of the assigned variable
+    size_t slot = UNRESOLVED;
 };
 
 class Binary : public Expr {
@@ -56,6 +86,23 @@ public:
     Expr* left;
     Token op; 
     Expr* right;
+    // Only set for custom operators
+    size_t op_id = UNRESOLVED;
+    // Set by the Resolver on elementwise operators: the number of them in
+    // the tree evaluated as one loop starting here. Operators that are part
+    // of a larger tree are marked fused.
+    size_t fused_ops = 0;
+    bool fused = false;
+    // Set by the Environment while the root of a fused tree evaluates to
+    // numbers, which don't need fusing
+    bool fused_numbers = false;
+    // Set by the Resolver on @: the number of operands of the chain of @s
+    // down the left side ending here. Operators that are part of a longer
+    // chain are marked chained.
+    size_t chain_length = 0;
+    bool chained = false;
+    // Order the engines last multiplied the chain in
+    ChainOrder chain_order;
 };
 
 class Func : public Expr {
@@ -66,13 +113,18 @@ public:
     Token func;
     Token paren;
     std::vector<Expr*> args;
+    size_t func_id = UNRESOLVED;
+    // Set instead of func_id when the name is a builtin's
+    size_t builtin_id = NO_BUILTIN;
 };
 
 enum LiteralType {
     LITERAL_STRING,
     LITERAL_DOUBLE,
     LITERAL_BOOL,
-    LITERAL_ARRAY
+    LITERAL_ARRAY,
+    // Value of a constant array literal or operator, folded by the Resolver
+    LITERAL_NDARRAY
 };
 
 class Literal : public Expr {
@@ -81,6 +133,7 @@ public:
     Literal(Token token, double val);
     Literal(Token token, bool val);
     Literal(Token token, std::vector<Expr*> vals);
+    Literal(Token token, NDArray val);
     std::pair<std::string, std::string> to_string();
     ~Literal();
     Token token;
@@ -89,7 +142,19 @@ public:
     double double_val;
     bool bool_val;
     std::vector<Expr*> array_vals;
-    
+    NDArray ndarray_val = NDArray({}, {0});
+};
+
+// begin:end as an index of an array access
+class Slice : public Expr {
+public:
+    Slice(Token colon, Expr* begin, Expr* end);
+    std::pair<std::string, std::string> to_string();
+    ~Slice();
+    Token colon;
+    // Null when left out, for the start or end of the dimension
+    Expr* begin;
+    Expr* end;
 };
 
 class Unary : public Expr {
@@ -107,6 +172,10 @@ public:
     std::pair<std::string, std::string> to_string();
     ~Var();
     Token name;
+    size_t slot = UNRESOLVED;
+    // Set by the Resolver when the variable isn't read again before it is
+    // assigned or its frame ends, so the value can be moved out of the slot
+    bool last_use = false;
 };
 
 class Nil : public Expr {
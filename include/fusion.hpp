@@ -0,0 +1,85 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#ifndef FUSION_H_
+#define FUSION_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "kernels.hpp"
+#include "ndarray.hpp"
+#include "token.hpp"
+#include "variable.hpp"
+
+// Most elementwise operators in one fused tree, the Resolver starts a new
+// tree past this
+#define MAX_FUSED 16
+
+bool is_elementwise(TokenType type);
+
+// Evaluates a tree of elementwise operators (+ - * / ^) in one pass over
+// its ndarray operands. The engine pushes the tree's operands and applies
+// its operators in postfix order, just as it would evaluate them one by
+// one. Each operator is checked right away with the same errors as
+// binary_operation, numbers are combined right away, and only the work on
+// array elements is deferred to result(). That runs the whole tree a block
+// of elements at a time over the shape of the whole tree, inputs of a
+// smaller shape being broadcast to it, so intermediate arrays are never
+// allocated and each input is read once. Large arrays are split between
+// the threads of the pool.
+class FusedExpr {
+public:
+    void clear();
+    void push(Variable val);
+    void apply(const Token& op);
+    // Value of the whole tree, once every operand has been pushed and
+    // every operator applied
+    Variable result();
+private:
+    // Where a step reads an operand from
+    struct Source {
+        enum { NUMBER, INPUT, BLOCK } kind;
+        double number;
+        size_t index;
+    };
+    // block = left op right for one block of elements
+    struct Step {
+        KernelOp op;
+        Source left;
+        Source right;
+        size_t block;
+    };
+    // A pushed value, or the deferred result of a step and its shape
+    struct Operand {
+        Variable value;
+        bool deferred = false;
+        size_t step = 0;
+        std::vector<size_t> shape;
+    };
+    Operand stack[MAX_FUSED + 1];
+    size_t depth = 0;
+    Step steps[MAX_FUSED];
+    size_t num_steps = 0;
+    std::vector<NDArray> inputs;
+    // Strides of each input broadcast to the result's shape, empty for the
+    // inputs of that shape
+    std::vector<size_t> input_strides[MAX_FUSED + 1];
+
+    Source source(Operand& operand, size_t position);
+    void run(size_t begin, size_t end, double* out, const double* const* input_data, double* blocks) const;
+    const double* elements(const Source& src, const double* const* input_data, const double* blocks, size_t start, size_t count, double* scratch) const;
+    const std::vector<size_t>& shape(const Operand& operand) const;
+};
+
+#endif // FUSION_H_
@@ -0,0 +1,72 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#ifndef GEMM_H_
+#define GEMM_H_
+
+#include <cstddef>
+#include <string>
+
+// Matrix multiplication behind the @ operator. The native backend is a
+// cache blocked GEMM: B is packed a KC x NC panel at a time to stay in L3,
+// A an MC x KC block at a time to stay in L2, and a register blocked
+// micro-kernel multiplies MR rows of A by NR columns of B out of L1.
+// Blocks of A are split between the threads of the pool. The blas
+// backend calls ddot, dgemv and dgemm from the active BLAS provider
+// (blas.hpp); builds without one (WEB_TARGET) only have the native
+// backend.
+
+// Products with every dimension at most this go through a kernel unrolled
+// for their exact size, with either backend
+#define SMALL_GEMM_SIZE 8
+
+enum MatmulBackend {
+    MATMUL_NATIVE,
+    MATMUL_BLAS
+};
+
+// c = a b for row major a (m x k), b (k x n) and c (m x n). c's elements
+// don't need to be initialized. Small products use the unrolled kernels, a
+// 1 x 1 result is a dot product and a single row or column of c a
+// matrix-vector product, which go to ddot and dgemv instead of the GEMM.
+void matmul(size_t m, size_t n, size_t k, const double* a, const double* b, double* c);
+// matmul for a and b laid out as BLAS takes them: element (i, p) of a is
+// at a[i * lda + p], or at a[p * lda + i] when trans_a is set, and likewise
+// for b, so slices and transposes of arrays multiply without being copied
+void matmul(size_t m, size_t n, size_t k, const double* a, size_t lda, bool trans_a,
+            const double* b, size_t ldb, bool trans_b, double* c);
+// count products c_i = a_i b_i stored one after another in c, where a_i
+// starts i * stride_a elements into a and b_i i * stride_b into b. A stride
+// of 0 multiplies every product by the same matrix. Small products are
+// split between threads, large ones split themselves.
+void batched_matmul(size_t count, size_t m, size_t n, size_t k, const double* a, size_t stride_a,
+                    const double* b, size_t stride_b, double* c);
+void native_gemm(size_t m, size_t n, size_t k, const double* a, const double* b, double* c);
+// Sum of a[i] b[i] for n elements
+double native_dot(size_t n, const double* a, const double* b);
+// y = a x for row major a (m x n) and x of n elements, or y = x a for x of
+// m elements when transpose is set
+void native_gemv(bool transpose, size_t m, size_t n, const double* a, const double* x, double* y);
+
+// Backend used by matmul. It is the last one given to set_matmul_backend,
+// else the one named by the WEAK_MATMUL environment variable, else blas
+// when built with -DMATMUL_BLAS and native otherwise.
+MatmulBackend matmul_backend();
+void set_matmul_backend(MatmulBackend backend);
+// Backend called name ("native" or "blas"), false if there's no such
+// backend in this build
+bool find_matmul_backend(const std::string& name, MatmulBackend& backend);
+// Name of the micro-kernel native_gemm uses on this CPU
+const char* gemm_kernel_name();
+
+#endif // GEMM_H_
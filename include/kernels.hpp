@@ -0,0 +1,173 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#ifndef KERNELS_H_
+#define KERNELS_H_
+
+#include <cstddef>
+#include <vector>
+#include <math.h>
+
+#include "token.hpp"
+
+// Loops of the elementwise operators + - * / ^, the comparisons and A and
+// O, and of the reductions over contiguous elements, written with the
+// vector instructions of each instruction set the build targets. The
+// widest set the CPU supports is chosen once at startup. A destination may
+// be the same buffer as one of the operands.
+//
+// Comparisons and A and O give masks: 1 where they hold and 0 elsewhere.
+// A and O treat every element other than 0 as true, NaN included.
+
+enum KernelOp {
+    KERNEL_ADD,
+    KERNEL_SUB,
+    KERNEL_MUL,
+    KERNEL_DIV,
+    KERNEL_POW,
+    KERNEL_LT,
+    KERNEL_LE,
+    KERNEL_GT,
+    KERNEL_GE,
+    KERNEL_EQ,
+    KERNEL_NE,
+    KERNEL_AND,
+    KERNEL_OR,
+    NUM_KERNEL_OPS
+};
+
+struct Kernels {
+    const char* name;
+    // dst[i] = left[i] op right[i]
+    void (*array_array[NUM_KERNEL_OPS])(double* dst, const double* left, const double* right, size_t n);
+    // dst[i] = left op right[i]
+    void (*number_array[NUM_KERNEL_OPS])(double* dst, double left, const double* right, size_t n);
+    // dst[i] = left[i] op right
+    void (*array_number[NUM_KERNEL_OPS])(double* dst, const double* left, double right, size_t n);
+    // Sum of x[0] to x[n - 1], added pairwise so rounding error grows with
+    // log n rather than n
+    double (*sum)(const double* x, size_t n);
+    // Greatest and least of x[0] to x[n - 1], NaN if any of them is. n > 0.
+    double (*max)(const double* x, size_t n);
+    double (*min)(const double* x, size_t n);
+    // Number of elements of mask other than 0
+    size_t (*count)(const double* mask, size_t n);
+    // dst[i] = mask[i] != 0 ? a[i * a_step] : b[i * b_step], where a step
+    // of 0 repeats a number
+    void (*blend)(double* dst, const double* mask, const double* a, size_t a_step, const double* b, size_t b_step, size_t n);
+    // Writes the elements of x where mask isn't 0 to the start of dst in
+    // order, returning how many there were. dst has room for that many.
+    size_t (*compress)(double* dst, const double* x, const double* mask, size_t n);
+    // dst[i] = src[offsets[i]]
+    void (*gather)(double* dst, const double* src, const size_t* offsets, size_t n);
+    // dst[offsets[i]] = x[i * x_step] in order of i, so the last of
+    // repeated offsets wins. x_step is 1, or 0 to repeat a number.
+    void (*scatter)(double* dst, const size_t* offsets, const double* x, size_t x_step, size_t n);
+};
+
+// Ranges of at most this many elements are summed straight through, larger
+// ones are split in half and the halves summed separately
+#define PAIRWISE_BLOCK 128
+
+// Arrays of at most this many elements, an 8 x 8 matrix, go through kernels
+// unrolled for their exact length, which skip the loop and tail logic that
+// dominate at these sizes
+#define SMALL_KERNEL_SIZE 64
+
+// Only the arithmetic operators, up to ^, have them
+#define NUM_SMALL_KERNEL_OPS (KERNEL_POW + 1)
+
+// Indexed by operator and then by length, from 0 to SMALL_KERNEL_SIZE
+struct SmallKernels {
+    void (*array_array[NUM_SMALL_KERNEL_OPS][SMALL_KERNEL_SIZE + 1])(double* dst, const double* left, const double* right);
+    void (*number_array[NUM_SMALL_KERNEL_OPS][SMALL_KERNEL_SIZE + 1])(double* dst, double left, const double* right);
+    void (*array_number[NUM_SMALL_KERNEL_OPS][SMALL_KERNEL_SIZE + 1])(double* dst, const double* left, double right);
+};
+
+inline bool gives_mask(KernelOp op) {
+    return op >= KERNEL_LT;
+}
+
+// Kernel of an elementwise operator token (PLUS, MINUS, STAR, SLASH, EXP,
+// a comparison, AND or OR)
+KernelOp kernel_op(TokenType type);
+
+// Kernels chosen for this CPU
+const Kernels& kernels();
+// Every set of kernels this CPU can run, from the portable loops up to the
+// chosen ones
+std::vector<const Kernels*> supported_kernels();
+const SmallKernels& small_kernels();
+
+// The chosen kernels, or the small ones for arithmetic on arrays of up to
+// SMALL_KERNEL_SIZE elements
+inline void array_array_kernel(KernelOp op, double* dst, const double* left, const double* right, size_t n) {
+    if (n <= SMALL_KERNEL_SIZE && op < NUM_SMALL_KERNEL_OPS) small_kernels().array_array[op][n](dst, left, right);
+    else kernels().array_array[op](dst, left, right, n);
+}
+
+inline void number_array_kernel(KernelOp op, double* dst, double left, const double* right, size_t n) {
+    if (n <= SMALL_KERNEL_SIZE && op < NUM_SMALL_KERNEL_OPS) small_kernels().number_array[op][n](dst, left, right);
+    else kernels().number_array[op](dst, left, right, n);
+}
+
+inline void array_number_kernel(KernelOp op, double* dst, const double* left, double right, size_t n) {
+    if (n <= SMALL_KERNEL_SIZE && op < NUM_SMALL_KERNEL_OPS) small_kernels().array_number[op][n](dst, left, right);
+    else kernels().array_number[op](dst, left, right, n);
+}
+
+// Greater and lesser of two numbers, NaN if either is
+inline double max_number(double left, double right) {
+    return left > right || left != left ? left : right;
+}
+
+inline double min_number(double left, double right) {
+    return left < right || left != left ? left : right;
+}
+
+// Whole exponents up to this are multiplied out by ^, which stays within
+// 2 ulp of pow
+#define MULTIPLIED_POWER_LIMIT 4
+
+inline bool multiplied_power(double exponent) {
+    return exponent >= 0 && exponent <= MULTIPLIED_POWER_LIMIT && exponent == (int) exponent;
+}
+
+// left ^ right. The exponents programs use most skip pow: 0.5 is a square
+// root, -1 a division and small whole exponents are multiplied out by
+// repeated squaring. The kernels take the same shortcuts with the same
+// results.
+inline double pow_number(double left, double right) {
+    if (right == 0.5) return left == -INFINITY ? INFINITY : sqrt(left) + 0.0;
+    if (right == -1) return 1 / left;
+    if (!multiplied_power(right)) return pow(left, right);
+    double result = 1;
+    for (int power = right; power; power >>= 1) {
+        if (power & 1) result *= left;
+        left *= left;
+    }
+    return result;
+}
+
+// Value of an elementwise operator on two numbers
+inline double elementwise_number(TokenType op, double left, double right) {
+    switch (op) {
+    case PLUS: return left + right;
+    case MINUS: return left - right;
+    case STAR: return left * right;
+    case SLASH: return left / right;
+    default: return pow_number(left, right);
+    }
+}
+
+#endif // KERNELS_H_
@@ -0,0 +1,52 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#ifndef MATH_KERNELS_H_
+#define MATH_KERNELS_H_
+
+#include <cstddef>
+#include <vector>
+
+// Loops of the math builtins over contiguous elements, for each
+// instruction set the build targets, the widest the CPU supports chosen
+// once at startup like the arithmetic kernels (kernels.hpp). Apart from
+// sqrt, which the hardware rounds correctly, the vector sets work on a
+// vector of elements at a time with polynomial approximations good to
+// within 1 ulp, 2 for tanh, and hand elements outside the range they cover
+// (huge, infinite, NaN, or outside log's domain) to libm. The portable set
+// calls libm throughout. A destination may be the same buffer as the
+// source.
+
+enum MathOp {
+    MATH_EXP,
+    MATH_LOG,
+    MATH_SQRT,
+    MATH_SIN,
+    MATH_COS,
+    MATH_TANH,
+    NUM_MATH_OPS
+};
+
+struct MathKernels {
+    const char* name;
+    // dst[i] = op(x[i])
+    void (*apply[NUM_MATH_OPS])(double* dst, const double* x, size_t n);
+};
+
+// Kernels chosen for this CPU
+const MathKernels& math_kernels();
+// Every set of kernels this CPU can run, from the portable loops up to the
+// chosen ones
+std::vector<const MathKernels*> supported_math_kernels();
+
+#endif // MATH_KERNELS_H_
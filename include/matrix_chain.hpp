@@ -0,0 +1,46 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#ifndef MATRIX_CHAIN_H_
+#define MATRIX_CHAIN_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "token.hpp"
+#include "variable.hpp"
+
+// Chains of @ operators, a @ b @ c ..., multiplied in the order that takes
+// the fewest multiply-adds instead of left to right. The engine evaluates
+// the operands left to right and calls check_chain after each one but the
+// first, so every error is raised just where evaluating the operators one
+// by one would raise it. multiply_chain then picks the order with the
+// classic dynamic program over the dimensions of the matrices.
+
+// Order chosen for a chain, cached on its root node while the dimensions
+// it was chosen for stay the same
+struct ChainOrder {
+    std::vector<size_t> dims;
+    // Operand the product of operands i to j splits after, at i * n + j
+    std::vector<size_t> splits;
+};
+
+// Checks operands[n - 1] against the product of the operands before it,
+// which have been checked already, with the errors binary_operation raises
+// on op
+void check_chain(const Variable* operands, size_t n, const Token& op);
+// Value of operands[0] @ ... @ operands[n - 1] once every product has been
+// checked, ops[i] being the operator between operands i and i + 1
+Variable multiply_chain(const Variable* operands, const Token* const* ops, size_t n, ChainOrder& order);
+
+#endif // MATRIX_CHAIN_H_
@@ -0,0 +1,158 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#ifndef NDARRAY_H_
+#define NDARRAY_H_
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Allocator for the elements of arrays. Buffers start on a cache line, so
+// vector loads and the GEMM's stores never split one, and elements are left
+// uninitialized when a buffer is created with only a size, so an operator
+// writes its result once instead of after a pass of zeros.
+template <typename T>
+struct ElementAllocator {
+    typedef T value_type;
+    static constexpr std::align_val_t ALIGNMENT {64};
+
+    ElementAllocator() = default;
+    template <typename U>
+    ElementAllocator(const ElementAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), ALIGNMENT));
+    }
+    void deallocate(T* ptr, size_t) {
+        ::operator delete(ptr, ALIGNMENT);
+    }
+    // Default initialization instead of the value initialization that
+    // zeroes numbers
+    template <typename U>
+    void construct(U* ptr) {
+        ::new((void*) ptr) U;
+    }
+    template <typename U, typename... Args>
+    void construct(U* ptr, Args&&... args) {
+        ::new((void*) ptr) U(std::forward<Args>(args)...);
+    }
+
+    template <typename U>
+    bool operator==(const ElementAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const ElementAllocator<U>&) const { return false; }
+};
+
+// Elements of an array. Elements(n) holds n uninitialized numbers, use
+// Elements(n, 0) for zeros.
+typedef std::vector<double, ElementAllocator<double>> Elements;
+
+// Value of a Weak ndarray: a shape plus a reference counted buffer of
+// elements in row major order. Copies share the buffer, and a copy only gets
+// a buffer of its own when it is written to, so passing, returning and
+// reading arrays never copies their elements.
+//
+// A view, as made by slicing or transposing, shares the buffer of the array
+// it was taken from instead: its element (i0, i1, ...) is at offset + i0 *
+// strides[0] + i1 * strides[1] + ... of it. A view is dense when its
+// elements follow each other in row major order there, as a block of rows
+// does. data() and mutable_data() copy a view's elements out into a buffer
+// of its own, after which it is an ordinary array.
+//
+// A computed array, as made by sa or range, stores a pattern instead of its
+// elements: its element i is pattern[i % period] + (i / period) * drift.
+// Its elements are computed when read one at a time or a block at a time,
+// and like a view's only copied out when data(), mutable_data() or
+// elements() need them all in a buffer.
+//
+// A mask, as made by a comparison, A, O or !, is flagged as one, which
+// makes indexing with it pick the positions where it isn't 0 instead of
+// the positions it holds. Views, reshapes and repetitions of a mask are
+// masks too.
+class NDArray {
+public:
+    NDArray(Elements data, std::vector<size_t> shape);
+    // Computed array of shape repeating pattern, with each repetition
+    // drift more than the last
+    static NDArray computed(Elements pattern, std::vector<size_t> shape, double drift = 0);
+    // Same for the elements of another array, sharing its buffer
+    static NDArray computed(const NDArray& pattern, std::vector<size_t> shape, double drift = 0);
+    // View of the buffer of parent, with offset and strides counted in
+    // elements of that buffer
+    NDArray(const NDArray& parent, size_t offset, std::vector<size_t> shape, std::vector<size_t> strides);
+    const Elements& data() const;
+    // Copies the buffer first if another array shares it
+    Elements& mutable_data();
+    // Whether no other array shares the buffer, so writing to it is free
+    bool unique() const;
+    const std::vector<size_t>& shape() const;
+    size_t size() const;
+    // First of size() elements in row major order. Unlike data(), a dense
+    // view gives its place in the shared buffer without copying.
+    const double* elements() const;
+    bool is_view() const;
+    bool dense() const;
+    // Buffer the elements are in, at offset() and strides() within it,
+    // which is shared by a view
+    const double* buffer_data() const;
+    size_t offset() const;
+    std::vector<size_t> strides() const;
+    // Element at one index per dimension
+    double at(const size_t* indices) const;
+    bool is_computed() const;
+    // Whether the array is computed with no drift, so it repeats its
+    // pattern. A constant array repeats a pattern of period 1.
+    bool repeats() const;
+    const double* pattern() const;
+    size_t period() const;
+    // Copies elements [begin, begin + n) of a computed array to dst
+    void compute(double* dst, size_t begin, size_t n) const;
+    // View with the dimensions in reverse order
+    NDArray transpose() const;
+    // The same elements in a shape of the same size, sharing the buffer. A
+    // view that isn't dense is copied out first.
+    NDArray reshape(std::vector<size_t> shape) const;
+    bool is_mask() const;
+    void set_mask(bool mask);
+    // Compares (data, shape) lexicographically
+    bool operator==(const NDArray& other) const;
+    bool operator!=(const NDArray& other) const;
+    bool operator<(const NDArray& other) const;
+    bool operator<=(const NDArray& other) const;
+    bool operator>(const NDArray& other) const;
+    bool operator>=(const NDArray& other) const;
+private:
+    // Views are made ordinary arrays by const reads, which leaves their
+    // value as it was
+    mutable std::shared_ptr<Elements> buffer;
+    std::vector<size_t> dims;
+    // Empty unless the array is a view
+    mutable std::vector<size_t> steps;
+    mutable size_t start = 0;
+    // Number of elements of a view or computed array
+    size_t count = 0;
+    // Period and drift of a computed array, the period being 0 for any
+    // other
+    mutable size_t cycle = 0;
+    double drift = 0;
+    bool masks = false;
+
+    NDArray() = default;
+    void materialize() const;
+    const std::shared_ptr<Elements>& stored() const;
+};
+
+#endif // NDARRAY_H_
@@ -0,0 +1,114 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef OPERATIONS_H_
+#define OPERATIONS_H_
+
+// Semantics of Weak's built in operators on values. These are shared by the
+// tree walking Environment and the bytecode VM so both engines compute the
+// same results and raise the same runtime errors.
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <math.h>
+
+#include "token.hpp"
+#include "variable.hpp"
+
+void runtime_assert(bool cond, const Token& loc, const std::string& error_msg);
+std::string create_runtime_error(const std::string& error_msg, const Token& loc);
+
+// Every binary operator except the short circuiting A and O and custom
+// operators, which need to evaluate their operands themselves. Comparisons
+// involving an ndarray of numbers are made element by element, giving an
+// ndarray mask of 1 where they hold and 0 elsewhere.
+Variable binary_operation(const Token& op, const Variable& left_var, const Variable& right_var);
+// Same as above for operands that are temporaries: an ndarray operand that
+// doesn't share its buffer is reused for the result
+Variable binary_operation(const Token& op, Variable&& left_var, Variable&& right_var);
+// target = target op other, or other op target without target_left.
+// Elementwise operators write over target's elements instead of allocating.
+void binary_operation_in_place(const Token& op, Variable& target, const Variable& other, bool target_left);
+// Value of left A right or left O right, op being the A or O, once left
+// has been checked to be a bool or an ndarray. A bool left is the one that
+// doesn't decide the value alone, so the value is right, which must be a
+// bool too. An ndarray left is a mask, combined element by element with
+// the mask right.
+Variable logical_operation(const Token& op, const Variable& left_var, const Variable& right_var);
+Variable unary_operation(const Token& op, const Variable& val);
+// Shape of the value of left @ right for arrays of these shapes, empty when
+// it is a number. Raises the errors binary_operation raises for them.
+std::vector<size_t> matrix_product_shape(const Token& op, std::vector<size_t> left_shape, std::vector<size_t> right_shape);
+
+// Shape of the value of an elementwise operator on arrays of these shapes.
+// Shapes are lined up from their last dimension, and an array repeats
+// along the dimensions it lacks or has of length 1.
+std::vector<size_t> broadcast_shape(const Token& op, const std::vector<size_t>& left_shape, const std::vector<size_t>& right_shape);
+// Steps through the elements of an array of shape for a step along each
+// dimension of result_shape, 0 along the ones it repeats along
+std::vector<size_t> broadcast_strides(const std::vector<size_t>& shape, const std::vector<size_t>& result_shape);
+// Copies elements [start, start + count) of an array broadcast to shape,
+// read from src with the strides broadcast_strides gives, to dst
+void broadcast_elements(double* dst, const double* src, const std::vector<size_t>& shape, const std::vector<size_t>& strides, size_t start, size_t count);
+
+void print_variable(std::ostream& out, const Variable& var);
+
+// Array element access: check_array_access validates the array before any
+// index is evaluated, then check_index validates each index in turn
+void check_array_access(const Variable& var, size_t num_indices, const Token& loc);
+size_t check_index(const Variable& index_val, const std::vector<size_t>& shape, size_t dim, const Token& loc);
+size_t flat_index(const size_t* indices, size_t num_indices, const std::vector<size_t>& shape);
+
+// What an index of an array access containing a slice or an ndarray picks
+// from its dimension: positions [begin, end) of a slice, picks[0] to
+// picks[end - 1] of an ndarray, else the position begin alone, dropping
+// the dimension
+struct IndexRange {
+    size_t begin;
+    size_t end;
+    bool slice;
+    const double* picks = nullptr;
+};
+
+// Validates the bounds of a slice in place of check_index, an end of Nil
+// standing for the length of the dimension
+IndexRange check_slice(const Variable& begin, const Variable& end, const std::vector<size_t>& shape, size_t dim, const Token& loc);
+// Positions a checked slice picks as an ndarray index, which is how
+// assignments take slices
+Variable slice_positions(const IndexRange& slice);
+// Validates an index that may be an ndarray in place of check_index: a 1d
+// ndarray of positions, each checked as check_index checks a number, or a
+// mask as long as the dimension. A mask is replaced by the positions where
+// it isn't 0, the index is returned as it is otherwise.
+Variable check_selection(const Variable& index_val, const std::vector<size_t>& shape, size_t dim, const Token& loc);
+// What an index check_selection returned picks. It points into the index,
+// which has to outlive the range.
+IndexRange selection_range(const Variable& index);
+// View of the part of arr picked by one range per dimension, sharing its
+// buffer, or the element itself when none of the ranges is a slice. Ranges
+// of ndarrays gather the elements they pick into an ndarray instead.
+Variable slice_array(const NDArray& arr, const IndexRange* ranges);
+// Part of arr picked by one index per dimension, each a number or an
+// ndarray returned by check_selection
+Variable select(const NDArray& arr, const Variable* indices);
+// Checks made before assigning value to an element or part of target
+void check_element_assign(const Variable& value, const Variable& target, const Token& loc);
+// Scatters value, a number or an ndarray of the shape of the part picked by
+// indices as select picks it, over that part of arr. A single element only
+// takes a number.
+void assign_selection(NDArray& arr, const Variable* indices, size_t num_indices, const Variable& value, const Token& loc);
+
+void check_assertion(const Variable& cond, const Token& loc);
+
+#endif // OPERATIONS_H_
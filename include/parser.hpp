@@ -67,6 +67,7 @@ private:
     Expr* factor();
     Expr* unary();
     Expr* arrAccess();
+    Expr* arrIndex();
     Expr* primary();
 };
 
@@ -0,0 +1,43 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#ifndef REDUCTIONS_H_
+#define REDUCTIONS_H_
+
+#include <cstddef>
+
+// Reductions behind the sum, max, min, mean and argmax builtins, over a
+// whole buffer or along one axis of an array. Whole buffers bigger than
+// PARALLEL_THRESHOLD are cut into blocks of that many elements, reduced on
+// the threads of the pool and the partial results combined, so the blocks
+// and the rounding of a sum don't depend on the number of threads.
+
+enum ReduceOp {
+    REDUCE_SUM,
+    REDUCE_MAX,
+    REDUCE_MIN,
+    REDUCE_MEAN,
+    REDUCE_ARGMAX
+};
+
+// op over x[0] to x[n - 1]. n > 0 for every op but REDUCE_SUM. The result
+// of REDUCE_ARGMAX is the index of the first greatest element, or of the
+// first NaN.
+double reduce(ReduceOp op, const double* x, size_t n);
+
+// op along the middle dimension of x, an outer x len x inner row major
+// array, into out, an outer x inner one. len > 0 for every op but
+// REDUCE_SUM.
+void reduce_axis(ReduceOp op, const double* x, size_t outer, size_t len, size_t inner, double* out);
+
+#endif // REDUCTIONS_H_
@@ -0,0 +1,76 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#ifndef RESOLVER_H_
+#define RESOLVER_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "stmt.hpp"
+#include "expr.hpp"
+
+// Runs between parsing and execution. Every variable gets a slot in the
+// frame of the function, operator or top level program using it, and every
+// function and operator name gets an id indexing the declaration tables.
+// Slots and ids are stored on the AST nodes, so neither engine has to look
+// a name up while the program runs.
+//
+// Declarations happen at runtime (a function can be declared inside an if),
+// so a call site is bound to its name's id, not to one FuncDecl. Whether a
+// slot or id is actually declared is still checked when it is used.
+class Resolver {
+public:
+    // Resolves top level statements. Can be called again with more
+    // statements of the same program: names keep the slots they were given.
+    void resolve(Stmt* stmt);
+    void resolve(const std::vector<Stmt*>& program);
+    size_t num_slots() const;
+    size_t num_funcs() const;
+    size_t num_ops() const;
+    // Slot of a top level variable and ids of function and operator names,
+    // new names are given the next free one
+    size_t var_slot(const std::string& name);
+    size_t func_id(const std::string& name);
+    size_t op_id(const std::string& name);
+    // Same as above but return UNRESOLVED for names not seen yet
+    size_t find_var(const std::string& name) const;
+    size_t find_func(const std::string& name) const;
+    size_t find_op(const std::string& name) const;
+private:
+    typedef std::unordered_map<std::string, size_t> Names;
+    Names globals;
+    Names funcs;
+    Names ops;
+    // Variables of the body being resolved
+    Names* scope = nullptr;
+
+    void resolve_stmts(const std::vector<Stmt*>& stmts);
+    void resolve_stmt(Stmt* stmt);
+    void resolve_expr(Expr*& expr);
+    static bool fold(Expr*& expr);
+    static bool assigns_to(Expr* expr, size_t slot);
+    // Backwards liveness over a resolved body. live holds the slots read
+    // later on when called and the slots read earlier on when it returns.
+    // With mark set, each Var read followed by no other read of its slot is
+    // flagged as a last use.
+    static void mark_last_uses(const std::vector<Stmt*>& stmts, std::vector<char>& live, bool mark);
+    static void mark_last_uses(Stmt* stmt, std::vector<char>& live, bool mark);
+    static void mark_last_uses(Expr* expr, std::vector<char>& live, bool mark);
+    static void join(std::vector<char>& into, const std::vector<char>& other);
+    static size_t intern(Names& names, const std::string& name);
+    static size_t find(const Names& names, const std::string& name);
+};
+
+#endif // RESOLVER_H_
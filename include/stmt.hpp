@@ -18,9 +18,24 @@
 #include "token.hpp"
 #include "expr.hpp"
 
+enum StmtKind {
+    STMT_EXPR,
+    STMT_FUNC_DECL,
+    STMT_IF,
+    STMT_OP_DECL,
+    STMT_PRINT,
+    STMT_RETURN,
+    STMT_VAR_DECL,
+    STMT_WHILE,
+    STMT_ASSERT
+};
+
 class Stmt {
 public:
+    Stmt(StmtKind kind);
     virtual ~Stmt();
+    // See Expr::kind
+    const StmtKind kind;
     virtual std::pair<std::string, std::string> to_string() = 0;
     static size_t statement_counter;
     template <typename T>
@@ -47,6 +62,11 @@ public:
     Token name;
     std::vector<Token> params;
     std::vector<Stmt*> stmts;
+    // Filled in by the Resolver, the body runs in a frame of num_slots
+    // variables with the arguments in param_slots
+    size_t func_id = UNRESOLVED;
+    std::vector<size_t> param_slots;
+    size_t num_slots = 0;
 };
 
 class If : public Stmt {
@@ -68,6 +88,11 @@ public:
     Token left;
     Token right;
     std::vector<Stmt*> stmts;
+    // See FuncDecl
+    size_t op_id = UNRESOLVED;
+    size_t left_slot = UNRESOLVED;
+    size_t right_slot = UNRESOLVED;
+    size_t num_slots = 0;
 };
 
 class Print : public Stmt {
@@ -95,6 +120,7 @@ public:
     std::pair<std::string, std::string> to_string();
     Token name;
     Expr* expr;
+    size_t slot = UNRESOLVED;
 };
 
 class While : public Stmt {
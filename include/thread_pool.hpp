@@ -0,0 +1,93 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Arrays with fewer elements than this are processed on the calling thread,
+// waking other threads costs more than it saves on them
+#define PARALLEL_THRESHOLD (1 << 16)
+
+// Persistent worker threads that split loops over large arrays between
+// cores. A loop is cut into chunks and every thread, the caller included,
+// starts on a contiguous share of them. A thread that finishes its share
+// steals half of what is left of another thread's, so a slow or busy core
+// doesn't hold the loop up.
+class ThreadPool {
+public:
+    ThreadPool(size_t num_threads);
+    ~ThreadPool();
+    size_t num_threads() const;
+    // Calls f(begin, end) on disjoint ranges covering [0, n) and returns
+    // once all of them are done. A call made while the pool is running
+    // another loop runs the whole range on the calling thread.
+    void parallel_for(size_t n, const std::function<void(size_t, size_t)>& f);
+private:
+    // Chunks [next, end) that a thread hasn't started yet
+    struct Share {
+        std::mutex lock;
+        size_t next = 0;
+        size_t end = 0;
+    };
+    std::vector<std::thread> workers;
+    std::unique_ptr<Share[]> shares;
+    size_t threads;
+    // The loop being run
+    const std::function<void(size_t, size_t)>* job = nullptr;
+    size_t length = 0;
+    size_t chunk = 0;
+    size_t num_chunks = 0;
+    // Workers start a loop when generation changes and report back by
+    // decrementing running
+    std::mutex lock;
+    std::condition_variable start;
+    std::condition_variable done;
+    size_t generation = 0;
+    size_t running = 0;
+    bool busy = false;
+    bool stopping = false;
+
+    void work(size_t id);
+    void run_worker(size_t id);
+    bool take(size_t id, size_t& chunk_index);
+};
+
+// Pool used by the array operators. Its size is the last value given to
+// set_num_threads, else the WEAK_THREADS environment variable, else the
+// number of cores. Setting 0 goes back to the default.
+ThreadPool& thread_pool();
+void set_num_threads(size_t num_threads);
+
+// Runs f(begin, end) over [0, n), split between the pool's threads when n
+// is at least PARALLEL_THRESHOLD. f isn't called when n is 0.
+template <typename F>
+void parallel_for(size_t n, F f) {
+    if (n == 0) return;
+    if (n < PARALLEL_THRESHOLD) {
+        f((size_t) 0, n);
+        return;
+    }
+    ThreadPool& pool = thread_pool();
+    if (pool.num_threads() == 1) f((size_t) 0, n);
+    else pool.parallel_for(n, f);
+}
+
+#endif // THREAD_POOL_H_
@@ -23,6 +23,7 @@ enum TokenType {
     EXP,
     AT,
     COMMA,
+    COLON,
     SEMI,
     LEFT_PAREN,
     RIGHT_PAREN,
@@ -57,6 +58,7 @@ enum TokenType {
     STRING,
     SHAPE,
     AS_SHAPE,
+    TRANSPOSE,
     EMPTY,
     ASSERT
 };
@@ -17,20 +17,22 @@
 #include <vector>
 #include <string>
 
+#include "ndarray.hpp"
+
 class Variable {
 public:
     Variable();
     Variable(std::string var);
     Variable(bool var);
     Variable(double var);
-    Variable(std::pair<std::vector<double>, std::vector<size_t>> var);
+    Variable(NDArray var);
     ~Variable() = default;
-    bool is_string();
-    bool is_bool();
-    bool is_double();
-    bool is_ndarray();
-    bool is_nil();
-    std::variant<std::string, bool, double, std::pair<std::vector<double>, std::vector<size_t>>, void*> value;
+    bool is_string() const;
+    bool is_bool() const;
+    bool is_double() const;
+    bool is_ndarray() const;
+    bool is_nil() const;
+    std::variant<std::string, bool, double, NDArray, void*> value;
 };
 
 #endif // VARIABLE_H_
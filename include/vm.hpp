@@ -0,0 +1,59 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef VM_H_
+#define VM_H_
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "compiler.hpp"
+#include "fusion.hpp"
+#include "operations.hpp"
+#include "variable.hpp"
+
+// Register based virtual machine, an alternative to the tree walking
+// Environment that runs the whole program after compiling it to bytecode
+#define NO_PROTO 0xFFFFFFFFu
+
+class VM {
+public:
+    VM();
+    VM(std::ostream& out_override);
+    void run(const std::vector<Stmt*>& program);
+private:
+    // A call pushes its registers onto the stack starting at base. The
+    // declaration tables map function and operator ids to prototypes
+    // (NO_PROTO while undeclared) and are shared with callees, a frame
+    // copies a table only when declaring into it while it is shared.
+    struct Frame {
+        size_t base;
+        std::shared_ptr<std::vector<uint32_t>> funcs;
+        std::shared_ptr<std::vector<uint32_t>> ops;
+    };
+    CompiledProgram compiled;
+    std::vector<Variable> stack;
+    std::vector<char> declared;
+    FusedExpr fused;
+    std::ostream& out;
+    Variable execute(const Proto& proto, Frame& frame);
+    // args is the caller's register holding the first argument
+    Variable call(const Proto& callee, Frame& caller, size_t args);
+    // Rest of an OP_FUSE from the first operand that isn't a number, the
+    // numbers before it are on the stack nums
+    void fuse_arrays(const Proto& proto, const std::vector<FusedStep>& steps, size_t step,
+                     const double* nums, size_t top, Variable* regs, Variable& dst);
+};
+
+#endif // VM_H_
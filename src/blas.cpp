@@ -0,0 +1,125 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#include <cstdlib>
+#ifndef WEB_TARGET
+    #include <cblas.h>
+    #include <dlfcn.h>
+#endif
+
+#include "blas.hpp"
+
+// Shared libraries to try for each provider, in order
+struct Library {
+    const char* name;
+    std::vector<const char*> paths;
+};
+
+static const std::vector<Library> libraries = {
+    {"openblas", {"libopenblas.so.0", "libopenblas.so", "libopenblas.dylib"}},
+    {"blis", {"libblis.so.4", "libblis.so.3", "libblis.so", "libblis.dylib"}},
+    {"cblas", {"libcblas.so.3", "libcblas.so", "libcblas.dylib"}}
+};
+
+const std::vector<std::string>& blas_provider_names() {
+    static const std::vector<std::string> names = [] {
+        std::vector<std::string> names = {"auto"};
+        #ifndef WEB_TARGET
+            for (const Library& library : libraries) names.push_back(library.name);
+            names.push_back("linked");
+        #endif
+        return names;
+    }();
+    return names;
+}
+
+#ifndef WEB_TARGET
+
+static double linked_ddot(int n, const double* x, int incx, const double* y, int incy) {
+    return cblas_ddot(n, x, incx, y, incy);
+}
+
+static void linked_dgemv(int layout, int trans, int m, int n, double alpha, const double* a, int lda,
+                         const double* x, int incx, double beta, double* y, int incy) {
+    cblas_dgemv((CBLAS_ORDER)layout, (CBLAS_TRANSPOSE)trans, m, n, alpha, a, lda, x, incx, beta, y, incy);
+}
+
+static void linked_dgemm(int layout, int trans_a, int trans_b, int m, int n, int k,
+                         double alpha, const double* a, int lda, const double* b, int ldb,
+                         double beta, double* c, int ldc) {
+    cblas_dgemm((CBLAS_ORDER)layout, (CBLAS_TRANSPOSE)trans_a, (CBLAS_TRANSPOSE)trans_b,
+                m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+}
+
+// Opens library and looks up the routines Weak calls. The handle is never
+// closed, so they stay valid for the rest of the run.
+static bool open_library(const Library& library, BlasProvider& provider) {
+    for (const char* path : library.paths) {
+        void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+        if (!handle) continue;
+        void* ddot = dlsym(handle, "cblas_ddot");
+        void* dgemv = dlsym(handle, "cblas_dgemv");
+        void* dgemm = dlsym(handle, "cblas_dgemm");
+        if (!ddot || !dgemv || !dgemm) {
+            dlclose(handle);
+            continue;
+        }
+        provider = {library.name, path, (DdotFn)ddot, (DgemvFn)dgemv, (DgemmFn)dgemm};
+        return true;
+    }
+    return false;
+}
+
+static bool open_provider(const std::string& name, BlasProvider& provider) {
+    if (name == "linked") {
+        provider = {"linked", "", linked_ddot, linked_dgemv, linked_dgemm};
+        return true;
+    }
+    for (const Library& library : libraries) {
+        if (name == library.name || name == "auto") {
+            if (open_library(library, provider)) return true;
+            if (name != "auto") return false;
+        }
+    }
+    return name == "auto" && open_provider("linked", provider);
+}
+
+#else
+
+static bool open_provider(const std::string&, BlasProvider&) {
+    return false;
+}
+
+#endif
+
+// Set once a provider has been loaded
+static bool provider_loaded = false;
+static BlasProvider active_provider = {"none", "", nullptr, nullptr, nullptr};
+
+bool load_blas_provider(const std::string& name) {
+    BlasProvider provider;
+    if (!open_provider(name, provider)) return false;
+    active_provider = provider;
+    provider_loaded = true;
+    return true;
+}
+
+const BlasProvider& blas_provider() {
+    if (!provider_loaded) {
+        const char* env = std::getenv("WEAK_BLAS");
+        if (!env || !load_blas_provider(env)) load_blas_provider("auto");
+        // Without any provider (WEB_TARGET) don't try again
+        provider_loaded = true;
+    }
+    return active_provider;
+}
@@ -0,0 +1,219 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#include <atomic>
+#include <math.h>
+
+#include "builtins.hpp"
+#include "kernels.hpp"
+#include "math_kernels.hpp"
+#include "operations.hpp"
+#include "reductions.hpp"
+#include "thread_pool.hpp"
+
+static const NDArray& array_arg(const Variable& arg, const Token& loc) {
+    runtime_assert(arg.is_ndarray(), loc, "Expression evaluates to a non-ndarray");
+    return std::get<NDArray>(arg.value);
+}
+
+static size_t axis_arg(const Variable& arg, size_t num_dims, const Token& loc) {
+    runtime_assert(arg.is_double(), loc, "Expression evaluates to a non-number");
+    double axis = std::get<double>(arg.value);
+    runtime_assert(axis == floor(axis), loc, "An expression used as an axis is not close to an integer");
+    if (axis < 0) axis += num_dims;
+    runtime_assert(axis >= 0 && axis < num_dims, loc, "An expression used as an axis is out of range of the dimensions of the ndarray");
+    return (size_t) axis;
+}
+
+template <ReduceOp OP>
+static Variable reduce_all(Variable* args, const Token& loc) {
+    const NDArray& array = array_arg(args[0], loc);
+    runtime_assert(OP == REDUCE_SUM || array.size() > 0, loc, "Can't reduce an empty ndarray");
+    return Variable(reduce(OP, array.elements(), array.size()));
+}
+
+template <ReduceOp OP>
+static Variable reduce_along(Variable* args, const Token& loc) {
+    const NDArray& array = array_arg(args[0], loc);
+    const std::vector<size_t>& shape = array.shape();
+    size_t axis = axis_arg(args[1], shape.size(), loc);
+    runtime_assert(OP == REDUCE_SUM || shape[axis] > 0, loc, "Can't reduce an empty ndarray");
+    if (shape.size() == 1) return Variable(reduce(OP, array.elements(), array.size()));
+    size_t outer = 1;
+    size_t inner = 1;
+    for (size_t i = 0; i < axis; i++) outer *= shape[i];
+    for (size_t i = axis + 1; i < shape.size(); i++) inner *= shape[i];
+    std::vector<size_t> result_shape = shape;
+    result_shape.erase(result_shape.begin() + axis);
+    Elements result(outer * inner);
+    reduce_axis(OP, array.elements(), outer, shape[axis], inner, result.data());
+    return Variable(NDArray(std::move(result), std::move(result_shape)));
+}
+
+template <MathOp OP>
+static Variable math(Variable* args, const Token& loc) {
+    // Numbers take the same path as elements so both round the same way
+    if (args[0].is_double()) {
+        double x = std::get<double>(args[0].value);
+        math_kernels().apply[OP](&x, &x, 1);
+        return Variable(x);
+    }
+    runtime_assert(args[0].is_ndarray(), loc, "Expression evaluates to neither a number nor an ndarray");
+    NDArray& array = std::get<NDArray>(args[0].value);
+    auto apply = math_kernels().apply[OP];
+    if (array.unique()) {
+        double* data = array.mutable_data().data();
+        parallel_for(array.size(), [&](size_t begin, size_t end) {
+            apply(data + begin, data + begin, end - begin);
+        });
+        array.set_mask(false);
+        return std::move(args[0]);
+    }
+    Elements result(array.size());
+    double* dst = result.data();
+    const double* x = array.elements();
+    parallel_for(result.size(), [&](size_t begin, size_t end) {
+        apply(dst + begin, x + begin, end - begin);
+    });
+    return Variable(NDArray(std::move(result), array.shape()));
+}
+
+static size_t count(const NDArray& mask) {
+    auto count = kernels().count;
+    const double* data = mask.elements();
+    std::atomic<size_t> total = 0;
+    parallel_for(mask.size(), [&](size_t begin, size_t end) {
+        total += count(data + begin, end - begin);
+    });
+    return total;
+}
+
+static Variable any(Variable* args, const Token& loc) {
+    return Variable(count(array_arg(args[0], loc)) > 0);
+}
+
+static Variable all(Variable* args, const Token& loc) {
+    const NDArray& mask = array_arg(args[0], loc);
+    return Variable(count(mask) == mask.size());
+}
+
+static Variable filter(Variable* args, const Token& loc) {
+    const NDArray& array = array_arg(args[0], loc);
+    const NDArray& mask = array_arg(args[1], loc);
+    runtime_assert(array.shape() == mask.shape(), loc, "Expressions evaluate to arrays of differing sizes");
+    Elements result(count(mask));
+    kernels().compress(result.data(), array.elements(), mask.elements(), array.size());
+    std::vector<size_t> shape = {result.size()};
+    return Variable(NDArray(std::move(result), std::move(shape)));
+}
+
+// Elements of a where(mask, a, b) branch, which is a number repeated
+// across the mask when step is 0
+static const double* branch_arg(const Variable& arg, const NDArray& mask, size_t& step, const Token& loc) {
+    if (arg.is_double()) {
+        step = 0;
+        return &std::get<double>(arg.value);
+    }
+    runtime_assert(arg.is_ndarray(), loc, "Expression evaluates to neither a number nor an ndarray");
+    const NDArray& array = std::get<NDArray>(arg.value);
+    runtime_assert(array.shape() == mask.shape(), loc, "Expressions evaluate to arrays of differing sizes");
+    step = 1;
+    return array.elements();
+}
+
+static Variable where(Variable* args, const Token& loc) {
+    runtime_assert(args[0].is_ndarray(), loc, "Expression evaluates to a non-ndarray");
+    NDArray& mask = std::get<NDArray>(args[0].value);
+    size_t a_step, b_step;
+    const double* a = branch_arg(args[1], mask, a_step, loc);
+    const double* b = branch_arg(args[2], mask, b_step, loc);
+    auto blend = kernels().blend;
+    const double* m = mask.elements();
+    // Each element of the mask is read before its result is written, so
+    // the mask's buffer can take the result
+    Elements result;
+    double* dst;
+    if (mask.unique()) dst = mask.mutable_data().data();
+    else {
+        result = Elements(mask.size());
+        dst = result.data();
+    }
+    parallel_for(mask.size(), [&](size_t begin, size_t end) {
+        blend(dst + begin, m + begin, a + begin * a_step, a_step, b + begin * b_step, b_step, end - begin);
+    });
+    if (mask.unique()) {
+        mask.set_mask(false);
+        return std::move(args[0]);
+    }
+    return Variable(NDArray(std::move(result), mask.shape()));
+}
+
+static double number_arg(const Variable& arg, const Token& loc) {
+    runtime_assert(arg.is_double(), loc, "Expression evaluates to a non-number");
+    double number = std::get<double>(arg.value);
+    runtime_assert(isfinite(number), loc, "An expression used as a bound of a range is not finite");
+    return number;
+}
+
+static Variable numbers_between(double begin, double end) {
+    size_t length = end > begin ? (size_t) ceil(end - begin) : 0;
+    return Variable(NDArray::computed(Elements(1, begin), {length}, 1));
+}
+
+static Variable range(Variable* args, const Token& loc) {
+    return numbers_between(0, number_arg(args[0], loc));
+}
+
+static Variable range_between(Variable* args, const Token& loc) {
+    double begin = number_arg(args[0], loc);
+    return numbers_between(begin, number_arg(args[1], loc));
+}
+
+static const Builtin builtins[] = {
+    {"sum", 1, reduce_all<REDUCE_SUM>},
+    {"sum", 2, reduce_along<REDUCE_SUM>},
+    {"max", 1, reduce_all<REDUCE_MAX>},
+    {"max", 2, reduce_along<REDUCE_MAX>},
+    {"min", 1, reduce_all<REDUCE_MIN>},
+    {"min", 2, reduce_along<REDUCE_MIN>},
+    {"mean", 1, reduce_all<REDUCE_MEAN>},
+    {"mean", 2, reduce_along<REDUCE_MEAN>},
+    {"argmax", 1, reduce_all<REDUCE_ARGMAX>},
+    {"argmax", 2, reduce_along<REDUCE_ARGMAX>},
+    {"exp", 1, math<MATH_EXP>},
+    {"log", 1, math<MATH_LOG>},
+    {"sqrt", 1, math<MATH_SQRT>},
+    {"sin", 1, math<MATH_SIN>},
+    {"cos", 1, math<MATH_COS>},
+    {"tanh", 1, math<MATH_TANH>},
+    {"any", 1, any},
+    {"all", 1, all},
+    {"filter", 2, filter},
+    {"where", 3, where},
+    {"range", 1, range},
+    {"range", 2, range_between}
+};
+
+size_t find_builtin(const std::string& name, size_t num_args) {
+    size_t found = NO_BUILTIN;
+    for (size_t id = 0; id < sizeof(builtins) / sizeof(builtins[0]); id++) {
+        if (name != builtins[id].name) continue;
+        if (builtins[id].num_args == num_args) return id;
+        if (found == NO_BUILTIN) found = id;
+    }
+    return found;
+}
+
+const Builtin& builtin(size_t id) {
+    return builtins[id];
+}
@@ -0,0 +1,611 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+#include <bit>
+#include <cstdint>
+
+#include "compiler.hpp"
+
+// Destination for expressions whose value is thrown away
+#define NO_REG 0xFFFFFFFFu
+
+CompiledProgram Compiler::compile(const std::vector<Stmt*>& program) {
+    Resolver resolver;
+    resolver.resolve(program);
+    result = CompiledProgram();
+    result.num_funcs = resolver.num_funcs();
+    result.num_ops = resolver.num_ops();
+    decl_protos.clear();
+    result.main = compile_proto("<main>", {}, resolver.num_slots(), program);
+    return std::move(result);
+}
+
+uint32_t Compiler::compile_proto(std::string name, const std::vector<size_t>& params, size_t num_slots, const std::vector<Stmt*>& stmts) {
+    uint32_t index = result.protos.size();
+    result.protos.push_back(std::make_unique<Proto>());
+    Proto* proto = result.protos.back().get();
+    proto->name = name;
+    proto->params.assign(params.begin(), params.end());
+    proto->num_locals = num_slots;
+    proto->num_regs = num_slots;
+
+    Scope inner;
+    inner.proto = proto;
+    inner.next_temp = num_slots;
+    inner.state.assign(num_slots, UNDECLARED);
+    for (uint32_t param : proto->params) inner.state.at(param) = DECLARED;
+    Scope* outer = scope;
+    scope = &inner;
+    compile_stmts(stmts);
+    emit(OP_RETURN_NIL, 0, 0, 0, nullptr);
+    scope = outer;
+    return index;
+}
+
+// Tracks which locals are declared after running stmts, without emitting
+// any code. Used to find the state at the top of a loop.
+void Compiler::analyze(const std::vector<Stmt*>& stmts, std::vector<DeclState>& state) {
+    for (Stmt* stmt : stmts) analyze(stmt, state);
+}
+
+void Compiler::analyze(Stmt* stmt, std::vector<DeclState>& state) {
+    switch (stmt->kind) {
+    case STMT_VAR_DECL:
+        state.at(static_cast<VarDecl*>(stmt)->slot) = DECLARED;
+        break;
+    case STMT_IF: {
+        std::vector<DeclState> body = state;
+        analyze(static_cast<If*>(stmt)->stmts, body);
+        join(state, body);
+        break;
+    }
+    case STMT_WHILE: {
+        std::vector<DeclState> entry = state;
+        while (true) {
+            std::vector<DeclState> body = entry;
+            analyze(static_cast<While*>(stmt)->stmts, body);
+            std::vector<DeclState> next = entry;
+            join(next, body);
+            if (next == entry) break;
+            entry = next;
+        }
+        state = entry;
+        break;
+    }
+    default: break;
+    }
+}
+
+void Compiler::join(std::vector<DeclState>& into, const std::vector<DeclState>& other) {
+    for (size_t i = 0; i < into.size(); i++) {
+        if (into[i] != other[i]) into[i] = MAYBE_DECLARED;
+    }
+}
+
+void Compiler::compile_stmts(const std::vector<Stmt*>& stmts) {
+    for (Stmt* stmt : stmts) compile_stmt(stmt);
+}
+
+void Compiler::compile_stmt(Stmt* stmt) {
+    uint32_t mark = scope->next_temp;
+    switch (stmt->kind) {
+    case STMT_EXPR: {
+        Expr* expr = static_cast<ExprStmt*>(stmt)->expr;
+        if (expr->kind == EXPR_ASSIGN) compile_assign(static_cast<Assign*>(expr), NO_REG);
+        else compile_expr(expr, alloc_temp());
+        break;
+    }
+    case STMT_FUNC_DECL: {
+        FuncDecl* funcDecl = static_cast<FuncDecl*>(stmt);
+        if (decl_protos.find(stmt) == decl_protos.end()) {
+            decl_protos.insert({stmt, compile_proto(funcDecl->name.lexeme, funcDecl->param_slots, funcDecl->num_slots, funcDecl->stmts)});
+        }
+        emit(OP_DECL_FUNC, decl_protos.at(stmt), funcDecl->func_id, 0, &funcDecl->name);
+        break;
+    }
+    case STMT_OP_DECL: {
+        OpDecl* opDecl = static_cast<OpDecl*>(stmt);
+        if (decl_protos.find(stmt) == decl_protos.end()) {
+            decl_protos.insert({stmt, compile_proto(opDecl->name.lexeme, {opDecl->left_slot, opDecl->right_slot}, opDecl->num_slots, opDecl->stmts)});
+        }
+        emit(OP_DECL_OP, decl_protos.at(stmt), opDecl->op_id, 0, &opDecl->name);
+        break;
+    }
+    case STMT_IF: {
+        If* ifStmt = static_cast<If*>(stmt);
+        size_t jump;
+        compile_branch_unless(ifStmt->cond, ifStmt->keyword, "If statement expected a boolean condition", jump);
+        free_temps(mark);
+        std::vector<DeclState> before = scope->state;
+        compile_stmts(ifStmt->stmts);
+        join(scope->state, before);
+        patch(jump, scope->proto->code.size());
+        break;
+    }
+    case STMT_PRINT:
+        emit(OP_PRINT, compile_operand(static_cast<Print*>(stmt)->expr, false), 0, 0, nullptr);
+        break;
+    case STMT_RETURN:
+        emit(OP_RETURN, compile_operand(static_cast<Return*>(stmt)->expr, false), 0, 0, nullptr);
+        break;
+    case STMT_VAR_DECL: {
+        VarDecl* varDecl = static_cast<VarDecl*>(stmt);
+        uint32_t slot = varDecl->slot;
+        DeclState state = scope->state.at(slot);
+        if (state == UNDECLARED) {
+            compile_expr(varDecl->expr, slot);
+            emit(OP_DECLARE, slot, slot, 0, nullptr);
+        }
+        else {
+            // Redeclaring keeps the old value, but the initializer still runs
+            uint32_t value = compile_operand(varDecl->expr, false);
+            if (state == MAYBE_DECLARED) emit(OP_DECLARE, slot, value, 0, nullptr);
+        }
+        scope->state.at(slot) = DECLARED;
+        break;
+    }
+    case STMT_WHILE:
+        compile_while(static_cast<While*>(stmt));
+        break;
+    case STMT_ASSERT: {
+        Assert* assertStmt = static_cast<Assert*>(stmt);
+        emit(OP_ASSERT, compile_operand(assertStmt->cond, false), 0, 0, &assertStmt->keyword);
+        break;
+    }
+    }
+    free_temps(mark);
+}
+
+void Compiler::compile_while(While* whileStmt) {
+    std::vector<DeclState> entry = scope->state;
+    analyze(whileStmt, entry);
+    scope->state = entry;
+
+    uint32_t mark = scope->next_temp;
+    size_t start = scope->proto->code.size();
+    size_t exit;
+    compile_branch_unless(whileStmt->cond, whileStmt->keyword, "While statement expected a boolean condition", exit);
+    free_temps(mark);
+    compile_stmts(whileStmt->stmts);
+    emit(OP_JUMP, start, 0, 0, nullptr);
+    patch(exit, scope->proto->code.size());
+    scope->state = entry;
+}
+
+// Emits a jump taken when cond is false and stores its index in jump so the
+// caller can patch in the target. Comparisons always produce a bool, so they
+// are fused with the jump.
+void Compiler::compile_branch_unless(Expr* cond, const Token& keyword, const std::string& msg, size_t& jump) {
+    if (cond->kind == EXPR_BINARY) {
+        Binary* binary = static_cast<Binary*>(cond);
+        OpCode op;
+        bool fused = true;
+        switch (binary->op.type) {
+        case LESSER: op = OP_JUMP_UNLESS_LT; break;
+        case LESSER_EQUALS: op = OP_JUMP_UNLESS_LE; break;
+        case GREATER: op = OP_JUMP_UNLESS_GT; break;
+        case GREATER_EQUALS: op = OP_JUMP_UNLESS_GE; break;
+        case EQUALS_EQUALS: op = OP_JUMP_UNLESS_EQ; break;
+        case EXCLA_EQUALS: op = OP_JUMP_UNLESS_NE; break;
+        default: fused = false;
+        }
+        if (fused) {
+            uint32_t left = compile_operand(binary->left, has_assign(binary->right));
+            uint32_t right = compile_operand(binary->right, false);
+            emit(op, 0, left, right, &binary->op);
+            // Checks the value of the comparison when it isn't of numbers
+            jump = emit(OP_BRANCH_FALSE, 0, alloc_temp(), message(msg), &keyword);
+            return;
+        }
+    }
+    jump = emit(OP_BRANCH_FALSE, 0, compile_operand(cond, false), message(msg), &keyword);
+}
+
+void Compiler::compile_expr(Expr* expr, uint32_t dst) {
+    uint32_t mark = scope->next_temp;
+    switch (expr->kind) {
+    case EXPR_ARR_ACCESS: compile_arr_access(static_cast<ArrAccess*>(expr), dst); break;
+    case EXPR_ASSIGN: compile_assign(static_cast<Assign*>(expr), dst); break;
+    case EXPR_BINARY: compile_binary(static_cast<Binary*>(expr), dst); break;
+    case EXPR_FUNC: compile_call(static_cast<Func*>(expr), dst); break;
+    case EXPR_LITERAL: compile_literal(static_cast<Literal*>(expr), dst); break;
+    case EXPR_UNARY: {
+        Unary* unary = static_cast<Unary*>(expr);
+        uint32_t val = compile_operand(unary->right, false);
+        OpCode op = unary->op.type == EXCLA ? OP_NOT : unary->op.type == MINUS ? OP_NEG : OP_UNARY;
+        emit(op, dst, val, 0, &unary->op);
+        break;
+    }
+    case EXPR_VAR: {
+        Var* var = static_cast<Var*>(expr);
+        ensure_declared(var->name, var->slot);
+        uint32_t slot = var->slot;
+        if (slot != dst) emit(OP_MOVE, dst, slot, 0, nullptr);
+        break;
+    }
+    case EXPR_NIL: emit(OP_MOVE, dst, constant(Variable()), 0, nullptr); break;
+    // Only compiled as an index, by compile_arr_access
+    case EXPR_SLICE: break;
+    }
+    free_temps(mark);
+}
+
+// Returns an RK operand holding the value of expr. Locals are used in place
+// unless copy_locals is set, which callers use when an expression evaluated
+// later could assign to the local before the operand is consumed.
+uint32_t Compiler::compile_operand(Expr* expr, bool copy_locals) {
+    if (expr->kind == EXPR_NIL) return constant(Variable());
+    if (expr->kind == EXPR_LITERAL) {
+        Literal* literal = static_cast<Literal*>(expr);
+        switch (literal->literal_type) {
+        case LITERAL_STRING: return constant(Variable(literal->string_val));
+        case LITERAL_DOUBLE: return constant(Variable(literal->double_val));
+        case LITERAL_BOOL: return constant(Variable(literal->bool_val));
+        case LITERAL_NDARRAY: return constant(Variable(literal->ndarray_val));
+        case LITERAL_ARRAY: break;
+        }
+    }
+    if (expr->kind == EXPR_VAR && !copy_locals) {
+        Var* var = static_cast<Var*>(expr);
+        ensure_declared(var->name, var->slot);
+        return var->slot;
+    }
+    uint32_t temp = alloc_temp();
+    compile_expr(expr, temp);
+    return temp;
+}
+
+void Compiler::compile_binary(Binary* binary, uint32_t dst) {
+    switch (binary->op.type) {
+    case IDENTIFIER: {
+        uint32_t left = alloc_temp();
+        uint32_t right = alloc_temp();
+        compile_expr(binary->left, left);
+        compile_expr(binary->right, right);
+        emit(OP_CALL_OP, dst, binary->op_id, left, &binary->op);
+        return;
+    }
+    case OR:
+    case AND: {
+        uint32_t result = alloc_temp();
+        compile_expr(binary->left, result);
+        size_t jump = emit(OP_SHORT_CIRCUIT, 0, result, 0, &binary->op);
+        // The right side might not run, so checks made in it don't count afterwards
+        std::vector<DeclState> before = scope->state;
+        uint32_t right = alloc_temp();
+        compile_expr(binary->right, right);
+        join(scope->state, before);
+        emit(OP_LOGICAL, result, right, 0, &binary->op);
+        patch(jump, scope->proto->code.size());
+        emit(OP_MOVE, dst, result, 0, nullptr);
+        return;
+    }
+    default: break;
+    }
+    if (binary->fused_ops > 1 && compile_fused(binary, dst)) return;
+    if (binary->chain_length > 2) {
+        compile_chain(binary, dst);
+        return;
+    }
+    OpCode op;
+    switch (binary->op.type) {
+    case PLUS: op = OP_ADD; break;
+    case MINUS: op = OP_SUB; break;
+    case STAR: op = OP_MUL; break;
+    case SLASH: op = OP_DIV; break;
+    case LESSER: op = OP_LT; break;
+    case LESSER_EQUALS: op = OP_LE; break;
+    case GREATER: op = OP_GT; break;
+    case GREATER_EQUALS: op = OP_GE; break;
+    case EQUALS_EQUALS: op = OP_EQ; break;
+    case EXCLA_EQUALS: op = OP_NE; break;
+    default: op = OP_BINARY;
+    }
+    // A left side needing a register of its own is computed straight into
+    // dst, so the VM can reuse its buffer for the result. That is only
+    // invisible when the right side doesn't use dst's old value.
+    bool into_dst = binary->left->kind != EXPR_VAR && binary->left->kind != EXPR_NIL
+        && !(binary->left->kind == EXPR_LITERAL && static_cast<Literal*>(binary->left)->literal_type != LITERAL_ARRAY)
+        && (dst >= scope->proto->num_locals || !refers_to(binary->right, dst));
+    uint32_t left = dst;
+    if (into_dst) compile_expr(binary->left, dst);
+    else left = compile_operand(binary->left, has_assign(binary->right));
+    uint32_t right = compile_operand(binary->right, false);
+    emit(op, dst, left, right, &binary->op);
+}
+
+// Compiles a tree of elementwise operators to a single OP_FUSE. Its
+// operands are evaluated first, which is only the same as evaluating them
+// between the operators when no operand after the first operator can raise
+// an error or have a side effect. Returns false without emitting anything
+// otherwise.
+bool Compiler::compile_fused(Binary* binary, uint32_t dst) {
+    // The tree in postfix order, with null for each operator
+    std::vector<Expr*> postfix;
+    std::vector<Binary*> ops;
+    collect_fused(binary, postfix, ops);
+    size_t first_op = 0;
+    while (postfix[first_op]) first_op++;
+    for (size_t i = first_op; i < postfix.size(); i++) {
+        Expr* operand = postfix[i];
+        if (!operand || operand->kind == EXPR_NIL) continue;
+        if (operand->kind == EXPR_LITERAL && static_cast<Literal*>(operand)->literal_type != LITERAL_ARRAY) continue;
+        if (operand->kind == EXPR_VAR && scope->state.at(static_cast<Var*>(operand)->slot) == DECLARED) continue;
+        return false;
+    }
+
+    std::vector<FusedStep> steps;
+    size_t next_op = 0;
+    for (size_t i = 0; i < postfix.size(); i++) {
+        if (!postfix[i]) {
+            steps.push_back({&ops[next_op++]->op, 0});
+            continue;
+        }
+        // A local is copied when a later operand could assign to it first
+        bool copy = false;
+        for (size_t j = i + 1; j < first_op; j++) copy = copy || has_assign(postfix[j]);
+        steps.push_back({nullptr, compile_operand(postfix[i], copy)});
+    }
+    scope->proto->fusions.push_back(std::move(steps));
+    emit(OP_FUSE, dst, scope->proto->fusions.size() - 1, 0, &binary->op);
+    return true;
+}
+
+// Evaluates the operands of a chain of @s into consecutive registers,
+// checking each product after its right operand like OP_BINARY would
+void Compiler::compile_chain(Binary* binary, uint32_t dst) {
+    size_t n = binary->chain_length;
+    CompiledChain chain {std::vector<const Token*>(n - 1), &binary->chain_order};
+    std::vector<Expr*> rights(n - 1);
+    Expr* first = binary;
+    for (size_t i = n - 1; i-- > 0;) {
+        Binary* op = static_cast<Binary*>(first);
+        chain.ops[i] = &op->op;
+        rights[i] = op->right;
+        first = op->left;
+    }
+    uint32_t base = scope->next_temp;
+    compile_expr(first, alloc_temp());
+    for (size_t i = 0; i < n - 1; i++) {
+        compile_expr(rights[i], alloc_temp());
+        emit(OP_CHECK_CHAIN, base, i + 2, 0, chain.ops[i]);
+    }
+    scope->proto->chains.push_back(std::move(chain));
+    emit(OP_CHAIN, dst, base, scope->proto->chains.size() - 1, &binary->op);
+}
+
+void Compiler::collect_fused(Binary* binary, std::vector<Expr*>& postfix, std::vector<Binary*>& ops) {
+    for (Expr* operand : {binary->left, binary->right}) {
+        if (operand->kind == EXPR_BINARY && static_cast<Binary*>(operand)->fused) collect_fused(static_cast<Binary*>(operand), postfix, ops);
+        else postfix.push_back(operand);
+    }
+    postfix.push_back(nullptr);
+    ops.push_back(binary);
+}
+
+void Compiler::compile_assign(Assign* assign, uint32_t dst) {
+    ensure_declared(assign->name, assign->slot);
+    uint32_t slot = assign->slot;
+    if (assign->idx.size() == 0) {
+        compile_expr(assign->value, slot);
+        if (dst != NO_REG && dst != slot) emit(OP_MOVE, dst, slot, 0, nullptr);
+        return;
+    }
+    // The value goes right before the indices so OP_SET_ELEM finds both
+    uint32_t value = alloc_temp();
+    compile_expr(assign->value, value);
+    emit(OP_CHECK_SET_ELEM, slot, value, 0, &assign->name);
+    for (size_t i = 0; i < assign->idx.size(); i++) {
+        uint32_t index = alloc_temp();
+        if (assign->idx.at(i)->kind != EXPR_SLICE) {
+            compile_expr(assign->idx.at(i), index);
+            emit(OP_CHECK_SET_INDEX, index, slot, i, &assign->name);
+            continue;
+        }
+        // The bounds of a slice go in temps past the index, which become
+        // the next index's once the slice is in place of them
+        Slice* slice = static_cast<Slice*>(assign->idx.at(i));
+        uint32_t mark = scope->next_temp;
+        uint32_t begin = alloc_temp();
+        uint32_t end = alloc_temp();
+        if (slice->begin) compile_expr(slice->begin, begin);
+        else emit(OP_MOVE, begin, constant(Variable(0.0)), 0, nullptr);
+        if (slice->end) compile_expr(slice->end, end);
+        else emit(OP_MOVE, end, constant(Variable()), 0, nullptr);
+        emit(OP_CHECK_SET_SLICE, index, slot, i, &assign->name);
+        free_temps(mark);
+    }
+    emit(OP_SET_ELEM, slot, value, assign->idx.size(), &assign->name);
+    if (dst != NO_REG) emit(OP_MOVE, dst, value, 0, nullptr);
+}
+
+void Compiler::compile_arr_access(ArrAccess* arrAccess, uint32_t dst) {
+    bool copy = false;
+    for (Expr* index : arrAccess->idx) copy = copy || has_assign(index);
+    uint32_t arr = compile_operand(arrAccess->id, copy);
+    emit(OP_CHECK_ARRAY, arr, arrAccess->idx.size(), 0, &arrAccess->brack);
+    uint32_t base = scope->next_temp;
+    if (arrAccess->sliced) {
+        // Two registers per dimension: the bounds of a slice, or an index
+        // followed by Nil
+        for (size_t i = 0; i < arrAccess->idx.size(); i++) {
+            uint32_t first = alloc_temp();
+            uint32_t second = alloc_temp();
+            if (arrAccess->idx.at(i)->kind != EXPR_SLICE) {
+                compile_expr(arrAccess->idx.at(i), first);
+                emit(OP_CHECK_INDEX, first, arr, i, &arrAccess->brack);
+                emit(OP_MOVE, second, constant(Variable()), 0, nullptr);
+                continue;
+            }
+            Slice* slice = static_cast<Slice*>(arrAccess->idx.at(i));
+            if (slice->begin) compile_expr(slice->begin, first);
+            else emit(OP_MOVE, first, constant(Variable(0.0)), 0, nullptr);
+            if (slice->end) compile_expr(slice->end, second);
+            else emit(OP_MOVE, second, constant(Variable()), 0, nullptr);
+            emit(OP_CHECK_SLICE, first, arr, i, &arrAccess->brack);
+        }
+        emit(OP_SLICE, dst, arr, base, &arrAccess->brack);
+        return;
+    }
+    for (size_t i = 0; i < arrAccess->idx.size(); i++) {
+        uint32_t index = alloc_temp();
+        compile_expr(arrAccess->idx.at(i), index);
+        emit(OP_CHECK_INDEX, index, arr, i, &arrAccess->brack);
+    }
+    emit(OP_GET_ELEM, dst, arr, base, &arrAccess->brack);
+}
+
+void Compiler::compile_literal(Literal* literal, uint32_t dst) {
+    if (literal->literal_type != LITERAL_ARRAY) {
+        emit(OP_MOVE, dst, compile_operand(literal, false), 0, nullptr);
+        return;
+    }
+    uint32_t base = scope->next_temp;
+    for (Expr* val : literal->array_vals) {
+        uint32_t elem = alloc_temp();
+        compile_expr(val, elem);
+        emit(OP_CHECK_NUMBER, elem, message("Expression in array literal evaluates to a non-number"), 0, &literal->token);
+    }
+    emit(OP_NEW_ARRAY, dst, base, literal->array_vals.size(), &literal->token);
+}
+
+void Compiler::compile_call(Func* func, uint32_t dst) {
+    if (func->builtin_id != NO_BUILTIN) {
+        // A builtin's argument count is known here, so it is only checked
+        // at runtime when it is wrong
+        if (func->args.size() != builtin(func->builtin_id).num_args) {
+            emit(OP_CHECK_BUILTIN, func->builtin_id, func->args.size(), 0, &func->paren);
+        }
+        uint32_t base = scope->next_temp;
+        for (Expr* arg : func->args) compile_expr(arg, alloc_temp());
+        emit(OP_BUILTIN, dst, func->builtin_id, base, &func->func);
+        return;
+    }
+    emit(OP_CHECK_FUNC, func->func_id, 0, 0, &func->func);
+    emit(OP_CHECK_ARGC, func->func_id, func->args.size(), 0, &func->paren);
+    uint32_t base = scope->next_temp;
+    for (Expr* arg : func->args) compile_expr(arg, alloc_temp());
+    emit(OP_CALL, dst, func->func_id, base, &func->func);
+}
+
+void Compiler::ensure_declared(const Token& name, uint32_t slot) {
+    if (scope->state.at(slot) == DECLARED) return;
+    emit(OP_CHECK_DEFINED, slot, 0, 0, &name);
+    // Past the check the local is known to exist
+    scope->state.at(slot) = DECLARED;
+}
+
+size_t Compiler::emit(OpCode op, uint32_t a, uint32_t b, uint32_t c, const Token* loc) {
+    scope->proto->code.push_back({op, a, b, c});
+    scope->proto->locs.push_back(loc);
+    return scope->proto->code.size() - 1;
+}
+
+void Compiler::patch(size_t jump, size_t target) {
+    scope->proto->code.at(jump).a = target;
+}
+
+// Whether two constants can share a slot of the pool. Numbers are compared
+// bit for bit, since 0 and -0 print differently, and an ndarray's mask flag
+// changes how indexing reads it, so it has to match too.
+static bool same_constant(const Variable& left, const Variable& right) {
+    if (left.is_double() && right.is_double()) {
+        return std::bit_cast<uint64_t>(std::get<double>(left.value)) == std::bit_cast<uint64_t>(std::get<double>(right.value));
+    }
+    if (left.value.index() != right.value.index() || left.value != right.value) return false;
+    return !left.is_ndarray() || std::get<NDArray>(left.value).is_mask() == std::get<NDArray>(right.value).is_mask();
+}
+
+uint32_t Compiler::constant(Variable value) {
+    std::vector<Variable>& constants = scope->proto->constants;
+    for (size_t i = 0; i < constants.size(); i++) {
+        if (same_constant(constants[i], value)) return i | RK_CONSTANT;
+    }
+    constants.push_back(value);
+    return (constants.size() - 1) | RK_CONSTANT;
+}
+
+uint32_t Compiler::message(const std::string& msg) {
+    std::vector<std::string>& messages = scope->proto->messages;
+    for (size_t i = 0; i < messages.size(); i++) {
+        if (messages[i] == msg) return i;
+    }
+    messages.push_back(msg);
+    return messages.size() - 1;
+}
+
+uint32_t Compiler::alloc_temp() {
+    uint32_t temp = scope->next_temp++;
+    if (scope->next_temp > scope->proto->num_regs) scope->proto->num_regs = scope->next_temp;
+    return temp;
+}
+
+void Compiler::free_temps(uint32_t mark) {
+    scope->next_temp = mark;
+}
+
+bool Compiler::has_assign(Expr* expr) {
+    switch (expr->kind) {
+    case EXPR_ASSIGN: return true;
+    case EXPR_ARR_ACCESS: {
+        ArrAccess* arrAccess = static_cast<ArrAccess*>(expr);
+        if (has_assign(arrAccess->id)) return true;
+        for (Expr* index : arrAccess->idx) if (has_assign(index)) return true;
+        return false;
+    }
+    case EXPR_BINARY: return has_assign(static_cast<Binary*>(expr)->left) || has_assign(static_cast<Binary*>(expr)->right);
+    case EXPR_FUNC:
+        for (Expr* arg : static_cast<Func*>(expr)->args) if (has_assign(arg)) return true;
+        return false;
+    case EXPR_LITERAL:
+        for (Expr* val : static_cast<Literal*>(expr)->array_vals) if (has_assign(val)) return true;
+        return false;
+    case EXPR_SLICE: {
+        Slice* slice = static_cast<Slice*>(expr);
+        return (slice->begin && has_assign(slice->begin)) || (slice->end && has_assign(slice->end));
+    }
+    case EXPR_UNARY: return has_assign(static_cast<Unary*>(expr)->right);
+    default: return false;
+    }
+}
+
+// Whether expr reads or assigns local slot
+bool Compiler::refers_to(Expr* expr, uint32_t slot) {
+    switch (expr->kind) {
+    case EXPR_VAR: return static_cast<Var*>(expr)->slot == slot;
+    case EXPR_ASSIGN: {
+        Assign* assign = static_cast<Assign*>(expr);
+        if (assign->slot == slot || refers_to(assign->value, slot)) return true;
+        for (Expr* index : assign->idx) if (refers_to(index, slot)) return true;
+        return false;
+    }
+    case EXPR_ARR_ACCESS: {
+        ArrAccess* arrAccess = static_cast<ArrAccess*>(expr);
+        if (refers_to(arrAccess->id, slot)) return true;
+        for (Expr* index : arrAccess->idx) if (refers_to(index, slot)) return true;
+        return false;
+    }
+    case EXPR_BINARY: return refers_to(static_cast<Binary*>(expr)->left, slot) || refers_to(static_cast<Binary*>(expr)->right, slot);
+    case EXPR_FUNC:
+        for (Expr* arg : static_cast<Func*>(expr)->args) if (refers_to(arg, slot)) return true;
+        return false;
+    case EXPR_LITERAL:
+        for (Expr* val : static_cast<Literal*>(expr)->array_vals) if (refers_to(val, slot)) return true;
+        return false;
+    case EXPR_SLICE: {
+        Slice* slice = static_cast<Slice*>(expr);
+        return (slice->begin && refers_to(slice->begin, slot)) || (slice->end && refers_to(slice->end, slot));
+    }
+    case EXPR_UNARY: return refers_to(static_cast<Unary*>(expr)->right, slot);
+    default: return false;
+    }
+}
@@ -10,22 +10,58 @@
 // You should have received a copy of the GNU Affero General Public License
 // along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
 
+#include <algorithm>
+#include <utility>
+
 #include "environment.hpp"
 
-Environment::Environment(): return_val(), hit_return(false), out(std::cout) {}
+Environment::Environment(): Environment(std::cout) {}
+
+Environment::Environment(std::ostream& out_override):
+    resolver(new Resolver()),
+    frame({0, std::make_shared<std::vector<FuncDecl*>>(), std::make_shared<std::vector<OpDecl*>>()}),
+    hit_return(false), return_val(), out(out_override) {}
 
-Environment::Environment(std::ostream& out_override): return_val(), hit_return(false), out(out_override) {}
+// Copy on write for the function and operator tables
+template <typename T>
+static std::vector<T*>& writable(std::shared_ptr<std::vector<T*>>& table) {
+    if (table.use_count() > 1) table = std::make_shared<std::vector<T*>>(*table);
+    return *table;
+}
 
 void Environment::add_func(std::string name, FuncDecl* func) {
-    func_symbol_table.insert(std::pair<std::string, FuncDecl*>(name, func));
+    resolver->resolve(func);
+    size_t id = resolver->func_id(name);
+    grow();
+    if (!(*frame.funcs)[id]) writable(frame.funcs)[id] = func;
 }
 
 void Environment::add_op(std::string name, OpDecl* op) {
-    op_symbol_table.insert(std::pair<std::string, OpDecl*>(name, op));
+    resolver->resolve(op);
+    size_t id = resolver->op_id(name);
+    grow();
+    if (!(*frame.ops)[id]) writable(frame.ops)[id] = op;
 }
 
 void Environment::add_var(std::string name, Variable var) {
-    var_symbol_table.insert(std::pair<std::string, Variable>(name, var));
+    size_t slot = resolver->var_slot(name);
+    grow();
+    declare(slot, var);
+}
+
+bool Environment::has_func(const std::string& name) {
+    size_t id = resolver->find_func(name);
+    return id != UNRESOLVED && (*frame.funcs)[id];
+}
+
+bool Environment::has_op(const std::string& name) {
+    size_t id = resolver->find_op(name);
+    return id != UNRESOLVED && (*frame.ops)[id];
+}
+
+bool Environment::has_var(const std::string& name) {
+    size_t slot = resolver->find_var(name);
+    return slot != UNRESOLVED && declared[slot];
 }
 
 bool Environment::has_hit_return() {
@@ -37,386 +73,390 @@ Variable Environment::get_return_val() {
 }
 
 void Environment::execute_stmt(Stmt* stmt) {
+    resolver->resolve(stmt);
+    grow();
+    execute(stmt);
+}
+
+// Makes room for the slots and ids the resolver has handed out so far
+void Environment::grow() {
+    slots.resize(resolver->num_slots());
+    declared.resize(resolver->num_slots());
+    if (frame.funcs->size() != resolver->num_funcs()) writable(frame.funcs).resize(resolver->num_funcs(), nullptr);
+    if (frame.ops->size() != resolver->num_ops()) writable(frame.ops).resize(resolver->num_ops(), nullptr);
+}
+
+// Like the other declarations, declaring a variable twice keeps the first value
+void Environment::declare(size_t slot, Variable var) {
+    if (declared[frame.base + slot]) return;
+    slots[frame.base + slot] = var;
+    declared[frame.base + slot] = true;
+}
+
+// Runs a function or operator body in a new frame. The caller has pushed
+// the arguments onto the slots starting at base.
+Variable Environment::call(const std::vector<Stmt*>& body, size_t base, const std::vector<size_t>& param_slots, size_t num_slots) {
+    size_t num_args = param_slots.size();
+    slots.resize(base + std::max(num_slots, num_args));
+    declared.resize(slots.size(), false);
+    // Parameters take slots in order, so an argument's slot is never after
+    // its position. A repeated parameter keeps the first argument.
+    for (size_t i = 0; i < num_args; i++) {
+        size_t slot = base + param_slots[i];
+        if (declared[slot]) continue;
+        if (slot != base + i) slots[slot] = std::move(slots[base + i]);
+        declared[slot] = true;
+    }
+    for (size_t i = 0; i < num_args; i++) {
+        if (!declared[base + i]) slots[base + i] = Variable();
+    }
+
+    Frame caller = frame;
+    frame.base = base;
+    bool caller_hit_return = hit_return;
+    Variable caller_return_val = std::move(return_val);
+    hit_return = false;
+    return_val = Variable();
+    Variable result;
+    try {
+        for (Stmt* stmt : body) execute(stmt);
+        result = std::move(return_val);
+    } catch (...) {
+        frame = caller;
+        hit_return = caller_hit_return;
+        return_val = caller_return_val;
+        slots.resize(base);
+        declared.resize(base);
+        throw;
+    }
+    frame = std::move(caller);
+    hit_return = caller_hit_return;
+    return_val = std::move(caller_return_val);
+    slots.resize(base);
+    declared.resize(base);
+    return result;
+}
+
+void Environment::execute(Stmt* stmt) {
     if (hit_return) return;
-    if (CAN_MAKE(ExprStmt*, exprStmt)_FROM(stmt)) {
-		evaluate_expr(exprStmt->expr);
+    switch (stmt->kind) {
+    case STMT_EXPR: return execute_expr_stmt(static_cast<ExprStmt*>(stmt));
+    case STMT_FUNC_DECL: return execute_func_decl(static_cast<FuncDecl*>(stmt));
+    case STMT_IF: return execute_if(static_cast<If*>(stmt));
+    case STMT_OP_DECL: return execute_op_decl(static_cast<OpDecl*>(stmt));
+    case STMT_PRINT: return execute_print(static_cast<Print*>(stmt));
+    case STMT_RETURN: return execute_return(static_cast<Return*>(stmt));
+    case STMT_VAR_DECL: return execute_var_decl(static_cast<VarDecl*>(stmt));
+    case STMT_WHILE: return execute_while(static_cast<While*>(stmt));
+    case STMT_ASSERT: return execute_assert(static_cast<Assert*>(stmt));
     }
-    else if (CAN_MAKE(FuncDecl*, funcDecl)_FROM(stmt)) {
-		add_func(funcDecl->name.lexeme, funcDecl);
+}
+
+void Environment::execute_expr_stmt(ExprStmt* exprStmt) {
+    evaluate_expr(exprStmt->expr);
+}
+
+void Environment::execute_func_decl(FuncDecl* funcDecl) {
+    if (!(*frame.funcs)[funcDecl->func_id]) writable(frame.funcs)[funcDecl->func_id] = funcDecl;
+}
+
+void Environment::execute_if(If* ifStmt) {
+    Variable cond = evaluate_expr(ifStmt->cond);
+    runtime_assert(cond.is_bool(), ifStmt->keyword, "If statement expected a boolean condition");
+    if (std::get<bool>(cond.value)) {
+        for (Stmt* stmtInIf : ifStmt->stmts) {
+            execute(stmtInIf);
+        }
     }
-    else if (CAN_MAKE(If*, ifStmt)_FROM(stmt)) {
-		Variable cond = evaluate_expr(ifStmt->cond);
-		runtime_assert(cond.is_bool(), ifStmt->keyword, "If statement expected a boolean condition");
-		if (std::get<bool>(cond.value)) {
-			for (Stmt* stmtInIf : ifStmt->stmts) {
-				execute_stmt(stmtInIf);
-			}
-		}
+}
+
+void Environment::execute_op_decl(OpDecl* opDecl) {
+    if (!(*frame.ops)[opDecl->op_id]) writable(frame.ops)[opDecl->op_id] = opDecl;
+}
+
+void Environment::execute_print(Print* print) {
+    print_variable(out, evaluate_expr(print->expr));
+}
+
+void Environment::execute_return(Return* returnStmt) {
+    hit_return = true;
+    return_val = evaluate_expr(returnStmt->expr);
+}
+
+void Environment::execute_var_decl(VarDecl* varDecl) {
+    declare(varDecl->slot, evaluate_expr(varDecl->expr));
+}
+
+void Environment::execute_while(While* whileStmt) {
+    Variable cond = evaluate_expr(whileStmt->cond);
+    runtime_assert(cond.is_bool(), whileStmt->keyword, "While statement expected a boolean condition");
+    while (std::get<bool>(cond.value)) {
+        for (Stmt* stmtInWhile : whileStmt->stmts) {
+            execute(stmtInWhile);
+        }
+        // A return inside the loop ends it, the condition is not evaluated again
+        if (hit_return) return;
+        cond = evaluate_expr(whileStmt->cond);
     }
-    else if (CAN_MAKE(OpDecl*, opDecl)_FROM(stmt)) {
-		add_op(opDecl->name.lexeme, opDecl);
+}
+
+void Environment::execute_assert(Assert* assertStmt) {
+    check_assertion(evaluate_expr(assertStmt->cond), assertStmt->keyword);
+}
+
+Variable Environment::evaluate_expr(Expr* expr) {
+    switch (expr->kind) {
+    case EXPR_ARR_ACCESS: return evaluate_arr_access(static_cast<ArrAccess*>(expr));
+    case EXPR_ASSIGN: return evaluate_assign(static_cast<Assign*>(expr));
+    case EXPR_BINARY: return evaluate_binary(static_cast<Binary*>(expr));
+    case EXPR_FUNC: return evaluate_func(static_cast<Func*>(expr));
+    case EXPR_LITERAL: return evaluate_literal(static_cast<Literal*>(expr));
+    case EXPR_UNARY: return evaluate_unary(static_cast<Unary*>(expr));
+    case EXPR_VAR: return evaluate_var(static_cast<Var*>(expr));
+    case EXPR_NIL: return Variable();
+    // Only evaluated as an index, by evaluate_arr_access
+    case EXPR_SLICE: break;
     }
-    else if (CAN_MAKE(Print*, print)_FROM(stmt)) {
-		Variable to_print = evaluate_expr(print->expr);
-		if (to_print.is_bool()) out << (std::get<bool>(to_print.value) ? "True" : "False") << std::endl;
-		else if (to_print.is_double()) out << std::get<double>(to_print.value) << std::endl;
-		else if (to_print.is_string()) out << std::get<std::string>(to_print.value) << std::endl;
-		else if (to_print.is_ndarray()) {
-			auto pair = std::get<std::pair<std::vector<double>, std::vector<size_t>>>(to_print.value);
-			out << '[';
-			for (size_t i = 0; i < pair.first.size(); i++) {
-				out << pair.first.at(i);
-				if (i < pair.first.size() - 1) out << ", ";
-			}
-			out << "] sa [";
-			for (size_t i = 0; i < pair.second.size(); i++) {
-				out << pair.second.at(i);
-				if (i < pair.second.size() - 1) out << ", ";
-			}
-			out << ']' << std::endl;
-		}
-		else out << "Nil" << std::endl;
+    throw std::runtime_error("Couldn't evaluate expression (evaluation for expression type might not be implemented?)");
+}
+
+// Checks an index of an array access. Indices are kept as positions while
+// they are numbers, and all of them as values in selection once one of
+// them is an ndarray.
+static void check_access_index(const Variable& index_val, const std::vector<size_t>& shape, size_t dim, const Token& loc, size_t* indices, std::vector<Variable>& selection) {
+    if (selection.empty() && !index_val.is_ndarray()) {
+        indices[dim] = check_index(index_val, shape, dim, loc);
+        return;
     }
-    else if (CAN_MAKE(Return*, returnStmt)_FROM(stmt)) {
-		hit_return = true;
-		return_val = evaluate_expr(returnStmt->expr);
+    for (size_t i = selection.size(); i < dim; i++) selection.push_back(Variable((double) indices[i]));
+    selection.push_back(check_selection(index_val, shape, dim, loc));
+}
+
+Variable Environment::evaluate_arr_access(ArrAccess* arrAccess) {
+    size_t num_indices = arrAccess->idx.size();
+    size_t indices[MAX_ARGS];
+    if (arrAccess->in_place) {
+        // Read straight out of the variable's slot. It is looked up again
+        // after each index, since calls made by an index can move the slots.
+        Var* var = static_cast<Var*>(arrAccess->id);
+        size_t slot = frame.base + var->slot;
+        runtime_assert(declared[slot], var->name, "Identifier doesn't correspond to a declared variable name");
+        check_array_access(slots[slot], num_indices, arrAccess->brack);
+        // Indices are only kept as values once one of them is an ndarray
+        std::vector<Variable> selection;
+        for (size_t i = 0; i < num_indices; i++) {
+            Variable index_val = evaluate_expr(arrAccess->idx[i]);
+            const std::vector<size_t>& shape = std::get<NDArray>(slots[slot].value).shape();
+            check_access_index(index_val, shape, i, arrAccess->brack, indices, selection);
+        }
+        if (!selection.empty()) return select(std::get<NDArray>(slots[slot].value), selection.data());
+        return Variable(std::get<NDArray>(slots[slot].value).at(indices));
     }
-    else if (CAN_MAKE(VarDecl*, varDecl)_FROM(stmt)) {
-		add_var(varDecl->name.lexeme, evaluate_expr(varDecl->expr));
+    Variable var = evaluate_expr(arrAccess->id);
+    check_array_access(var, num_indices, arrAccess->brack);
+    const NDArray& arr = std::get<NDArray>(var.value);
+    if (arrAccess->sliced) {
+        IndexRange ranges[MAX_ARGS];
+        // Keep ndarray indices alive for the ranges that point into them
+        std::vector<Variable> picked(num_indices);
+        for (size_t i = 0; i < num_indices; i++) {
+            if (arrAccess->idx[i]->kind != EXPR_SLICE) {
+                picked[i] = check_selection(evaluate_expr(arrAccess->idx[i]), arr.shape(), i, arrAccess->brack);
+                ranges[i] = selection_range(picked[i]);
+                continue;
+            }
+            Slice* slice = static_cast<Slice*>(arrAccess->idx[i]);
+            Variable begin = slice->begin ? evaluate_expr(slice->begin) : Variable(0.0);
+            Variable end = slice->end ? evaluate_expr(slice->end) : Variable();
+            ranges[i] = check_slice(begin, end, arr.shape(), i, arrAccess->brack);
+        }
+        return slice_array(arr, ranges);
     }
-    else if (CAN_MAKE(While*, whileStmt)_FROM(stmt)) {
-		Variable cond = evaluate_expr(whileStmt->cond);
-		runtime_assert(cond.is_bool(), whileStmt->keyword, "While statement expected a boolean condition");
-		while (std::get<bool>(cond.value)) {
-			for (Stmt* stmtInWhile : whileStmt->stmts) {
-				execute_stmt(stmtInWhile);
-			}
-			cond = evaluate_expr(whileStmt->cond);
-		}
+    std::vector<Variable> selection;
+    for (size_t i = 0; i < num_indices; i++) {
+        Variable index_val = evaluate_expr(arrAccess->idx[i]);
+        check_access_index(index_val, arr.shape(), i, arrAccess->brack, indices, selection);
     }
-	else if(CAN_MAKE(Assert*, assertStmt)_FROM(stmt)) {
-		Variable cond = evaluate_expr(assertStmt->cond); 
-		runtime_assert(cond.is_bool(), assertStmt->keyword, "Assert statement expected a boolean condition"); 
-		runtime_assert(std::get<bool>(cond.value), assertStmt->keyword, "Assert failed");
-	}
+    if (!selection.empty()) return select(arr, selection.data());
+    return Variable(arr.at(indices));
 }
 
-Variable Environment::evaluate_expr(Expr* expr) {
-    if (CAN_MAKE(ArrAccess*, arrAccess)_FROM(expr)) {
-		Variable var = evaluate_expr(arrAccess->id);
-		runtime_assert(var.is_ndarray(), arrAccess->brack, "Identifier in array access isn't an ndarray");
-		auto arr = std::get<std::pair<std::vector<double>, std::vector<size_t>>>(var.value);
-		runtime_assert(arr.second.size() == arrAccess->idx.size(), arrAccess->brack, "Number of dimensions in array element access differs from number of dimensions in array");
-		std::vector<size_t> indices;
-		for (size_t i = 0; i < arrAccess->idx.size(); i++) {
-			Expr* index = arrAccess->idx.at(i);
-			Variable index_val = evaluate_expr(index);
-			runtime_assert(index_val.is_double(), arrAccess->brack, "An expression used in array indexing is not a number");
-			size_t casted = (size_t) std::get<double>(index_val.value);
-			runtime_assert((double) casted == std::get<double>(index_val.value), arrAccess->brack, "An expression used in array indexing is not close to an integer");
-			runtime_assert(casted < arr.second.at(i), arrAccess->brack, "An expression used in array indexing is larger than a dimension of the ndarray");
-			indices.push_back(casted);
-		}
-		size_t flat_index = indices[0];
-		for (size_t i = 1; i < indices.size(); i++) {
-			flat_index = indices[i] + flat_index * arr.second[i - 1];
-		}
-		return Variable(arr.first.at(flat_index));
+Variable Environment::evaluate_assign(Assign* assign) {
+    runtime_assert(declared[frame.base + assign->slot], assign->name, "Identifier doesn't correspond to a declared variable name");
+    Variable var = evaluate_expr(assign->value);
+    if (assign->idx.size() > 0) {
+        size_t num_indices = assign->idx.size();
+        size_t indices[MAX_ARGS];
+        check_element_assign(var, slots[frame.base + assign->slot], assign->name);
+        std::vector<Variable> selection;
+        for (size_t i = 0; i < num_indices; i++) {
+            Variable index_val;
+            if (assign->idx[i]->kind == EXPR_SLICE) {
+                Slice* slice = static_cast<Slice*>(assign->idx[i]);
+                Variable begin = slice->begin ? evaluate_expr(slice->begin) : Variable(0.0);
+                Variable end = slice->end ? evaluate_expr(slice->end) : Variable();
+                const NDArray& arr = std::get<NDArray>(slots[frame.base + assign->slot].value);
+                index_val = slice_positions(check_slice(begin, end, arr.shape(), i, assign->name));
+            }
+            else index_val = evaluate_expr(assign->idx[i]);
+            // Looked up again each time since a call in the index can move the slots
+            const NDArray& arr = std::get<NDArray>(slots[frame.base + assign->slot].value);
+            check_access_index(index_val, arr.shape(), i, assign->name, indices, selection);
+        }
+        NDArray& arr = std::get<NDArray>(slots[frame.base + assign->slot].value);
+        if (!selection.empty() || !var.is_double()) {
+            for (size_t j = selection.size(); j < num_indices; j++) selection.push_back(Variable((double) indices[j]));
+            assign_selection(arr, selection.data(), num_indices, var, assign->name);
+            return var;
+        }
+        size_t flat = flat_index(indices, num_indices, arr.shape());
+        arr.mutable_data().at(flat) = std::get<double>(var.value);
     }
-    else if (CAN_MAKE(Assign*, assign)_FROM(expr)) {
-		runtime_assert(VAR_EXISTS(assign->name.lexeme), assign->name, "Identifier doesn't correspond to a declared variable name");
-		Variable var = evaluate_expr(assign->value);
-		if (assign->idx.size() > 0) {
-			runtime_assert(var.is_double(), assign->name, "Can't assign a non-number to an entry in an array");
-			std::vector<size_t> indices;
-			Variable &to_modify = var_symbol_table.at(assign->name.lexeme);
-			auto &arr = std::get<std::pair<std::vector<double>, std::vector<size_t>>>(to_modify.value);
-			runtime_assert(to_modify.is_ndarray(), assign->name, "Identifier isn't an array, so can't assign to an index of it");
-			for (size_t i = 0; i < assign->idx.size(); i++) {
-				Expr* index = assign->idx.at(i);
-				Variable index_val = evaluate_expr(index);
-				runtime_assert(index_val.is_double(), assign->name, "An expression used in array indexing is not a number");
-				size_t casted = (size_t) std::get<double>(index_val.value);
-				runtime_assert((double) casted == std::get<double>(index_val.value), assign->name, "An expression used in array indexing is not close to an integer");
-				runtime_assert(casted < arr.second.at(i), assign->name, "An expression used in array indexing is larger than a dimension of the ndarray");
-				indices.push_back(casted);
-			}
-			size_t flat_index = indices[0];
-			for (size_t i = 1; i < indices.size(); i++) {
-				flat_index = indices[i] + flat_index * arr.second[i - 1];
-			}
-			arr.first.at(flat_index) = std::get<double>(var.value);
-		}
-		else {
-			var_symbol_table.at(assign->name.lexeme) = var;
-		}
-		return var;
+    else {
+        slots[frame.base + assign->slot] = var;
     }
-    else if (CAN_MAKE(Binary*, binary)_FROM(expr)) {
-		switch (binary->op.type) {
-		case IDENTIFIER: {
-			Variable left_var = evaluate_expr(binary->left);
-			Variable right_var = evaluate_expr(binary->right);
-			runtime_assert(OP_EXISTS(binary->op.lexeme), binary->op, "Identifier doesn't correspond to a defined operator name");
-			OpDecl* opDecl = op_symbol_table.at(binary->op.lexeme);
-			Environment env (out);
-			env.func_symbol_table = func_symbol_table;
-			env.op_symbol_table = op_symbol_table;
-			env.add_var(opDecl->left.lexeme, left_var);
-			env.add_var(opDecl->right.lexeme, right_var);
-			for (Stmt* stmt : opDecl->stmts) {
-				env.execute_stmt(stmt);
-			}
-			return env.get_return_val();
-		}
-		case OR: {
-			Variable left_var = evaluate_expr(binary->left);
-			runtime_assert(left_var.is_bool(), binary->op, "Left expression evaluates to non-boolean value");
-			if (std::get<bool>(left_var.value)) return Variable(true);
-			Variable right_var = evaluate_expr(binary->right);
-			runtime_assert(right_var.is_bool(), binary->op, "Right expression evaluates to non-boolean value");
-			return Variable(std::get<bool>(right_var.value));
-		}
-		case AND: {
-			Variable left_var = evaluate_expr(binary->left);
-			runtime_assert(left_var.is_bool(), binary->op, "Left expression evaluates to non-boolean value");
-			if (!std::get<bool>(left_var.value)) return Variable(false);
-			Variable right_var = evaluate_expr(binary->right);
-			runtime_assert(right_var.is_bool(), binary->op, "Right expression evaluates to non-boolean value");
-			return Variable(std::get<bool>(right_var.value));
-		}
-		case EQUALS_EQUALS: {
-			Variable left_var = evaluate_expr(binary->left);
-			Variable right_var = evaluate_expr(binary->right);
-			return left_var.value.index() == right_var.value.index() && left_var.value == right_var.value;
-		}
-		case EXCLA_EQUALS: {
-			Variable left_var = evaluate_expr(binary->left);
-			Variable right_var = evaluate_expr(binary->right);
-			return left_var.value.index() != right_var.value.index() || left_var.value != right_var.value;
-		}
-		case GREATER_EQUALS: {
-			Variable left_var = evaluate_expr(binary->left);
-			Variable right_var = evaluate_expr(binary->right);
-			runtime_assert(left_var.value.index() == right_var.value.index(), binary->op, "Left and right expressions differ in type");
-			return left_var.value >= right_var.value;
-		}
-		case GREATER: {
-			Variable left_var = evaluate_expr(binary->left);
-			Variable right_var = evaluate_expr(binary->right);
-			runtime_assert(left_var.value.index() == right_var.value.index(), binary->op, "Left and right expressions differ in type");
-			return left_var.value > right_var.value;
-		}
-		case LESSER_EQUALS: {
-			Variable left_var = evaluate_expr(binary->left);
-			Variable right_var = evaluate_expr(binary->right);
-			runtime_assert(left_var.value.index() == right_var.value.index(), binary->op, "Left and right expressions differ in type");
-			return left_var.value <= right_var.value;
-		}
-		case LESSER: {
-			Variable left_var = evaluate_expr(binary->left);
-			Variable right_var = evaluate_expr(binary->right);
-			runtime_assert(left_var.value.index() == right_var.value.index(), binary->op, "Left and right expressions differ in type");
-			return left_var.value < right_var.value;
-		}
-		case MINUS: {
-			Variable left_var = evaluate_expr(binary->left);
-			Variable right_var = evaluate_expr(binary->right);
-			ELEMENTWISE_OP(-)
-		}
-		case PLUS: {
-			Variable left_var = evaluate_expr(binary->left);
-			Variable right_var = evaluate_expr(binary->right);
-			ELEMENTWISE_OP(+)
-		}
-		case SLASH: {
-			Variable left_var = evaluate_expr(binary->left);
-			Variable right_var = evaluate_expr(binary->right);
-			ELEMENTWISE_OP(/)
-		}
-		case STAR: {
-			Variable left_var = evaluate_expr(binary->left);
-			Variable right_var = evaluate_expr(binary->right);
-			ELEMENTWISE_OP(*)
-		}
-		case AT: {
-			Variable left_var = evaluate_expr(binary->left);
-			Variable right_var = evaluate_expr(binary->right);
-			runtime_assert(left_var.is_ndarray(), binary->op, "Left expression isn't an ndarray");
-			runtime_assert(right_var.is_ndarray(), binary->op, "Right expression isn't an ndarray");
-			auto extract_left = std::get<std::pair<std::vector<double>, std::vector<size_t>>>(left_var.value);
-			auto extract_right = std::get<std::pair<std::vector<double>, std::vector<size_t>>>(right_var.value);
-			runtime_assert(extract_left.second.size() == 2, binary->op, "Left expression isn't a 2d ndarray");
-			runtime_assert(extract_right.second.size() == 2, binary->op, "Left expression isn't a 2d ndarray");
-			runtime_assert(extract_left.second.at(1) == extract_right.second.at(0), binary->op, "Left array's num of cols differs from right array's num of rows");
-			size_t r = extract_left.second.at(0);
-			size_t m = extract_left.second.at(1);
-			size_t c = extract_right.second.at(1);
-			#ifndef WEB_TARGET
-				double *out = (double*) malloc(sizeof(double) * r * c);
-				cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, r, c, m, 1., extract_left.first.data(), m, extract_right.first.data(), c, 0., out, c);
-				std::vector<double> result;
-				result.reserve(r * c);
-				for (size_t i = 0; i < r * c; i++) result.push_back(out[i]);
-				free(out);
-				return Variable(std::pair<std::vector<double>, std::vector<size_t>>(result, {r, c}));
-			#else
-				double *out = (double*) calloc(r * c, sizeof(double));
-				double *a = extract_left.first.data();
-				double *b = extract_right.first.data();
-				size_t ic = 0, im = 0, kc = 0;
-				for (size_t i = 0; i < r; i++) {
-				    for (size_t k = 0; k < m; k++) {
-					for (size_t j = 0; j < c; j++) {
-					    out[ic + j] += a[im + k] * b[kc + j];
-					}
-					kc += c;
-				    }
-				    kc = 0;
-				    ic += c;
-				    im += m;
-				}
-				std::vector<double> result;
-				result.reserve(r * c);
-				for (size_t i = 0; i < r * c; i++) result.push_back(out[i]);
-				free(out);
-				return Variable(std::pair<std::vector<double>, std::vector<size_t>>(result, {r, c}));
-			#endif
-		}
-		case AS_SHAPE: {
-			Variable left_var = evaluate_expr(binary->left);
-			Variable right_var = evaluate_expr(binary->right);
-			runtime_assert(left_var.is_ndarray(), binary->op, "Left expression isn't an ndarray");
-			runtime_assert(right_var.is_ndarray(), binary->op, "Right expression isn't an ndarray");
-			auto new_size_double = std::get<std::pair<std::vector<double>, std::vector<size_t>>>(right_var.value).first;
-			std::vector<size_t> new_size;
-			for (size_t i = 0; i < new_size_double.size(); i++) {
-				size_t casted = (size_t) new_size_double.at(i);
-				runtime_assert((double) casted == new_size_double.at(i), binary->op, "An expression used in array size is not close to an integer");
-				new_size.push_back(casted);
-			}
-			auto values_to_fill_with = std::get<std::pair<std::vector<double>, std::vector<size_t>>>(left_var.value).first;
-			size_t full_length = new_size_double[0];
-			auto it = new_size_double.begin();
-			it++;
-			while(it != new_size_double.end()) {
-				full_length *= *it;
-				it++;
-			}
-			size_t original_idx = 0;
-			// Preallocate to avoid size doubling
-			std::vector<double> new_values (full_length);
-			for(size_t i = 0; i < full_length; ++i) {
-				new_values[i] = values_to_fill_with[original_idx];
-				original_idx++;
-				if(original_idx == values_to_fill_with.size()) {
-					original_idx = 0;
-				}
-			}
-			return Variable(std::pair<std::vector<double>, std::vector<size_t>>(new_values, new_size));
-		}
-		case EXP: {
-			Variable left_var = evaluate_expr(binary->left);
-			Variable right_var = evaluate_expr(binary->right);
-			if (left_var.is_double() && right_var.is_double()) {
-				return Variable(pow(std::get<double>(left_var.value), std::get<double>(right_var.value)));
-			}
-			if (left_var.is_double() && right_var.is_ndarray()) {
-				auto right_arr = std::get<std::pair<std::vector<double>, std::vector<size_t>>>(right_var.value).first;
-				for (size_t i = 0; i < right_arr.size(); i++) {
-					right_arr.at(i) = pow(std::get<double>(left_var.value), right_arr.at(i));
-				}
-				return Variable(std::pair<std::vector<double>, std::vector<size_t>>(right_arr, std::get<std::pair<std::vector<double>, std::vector<size_t>>>(right_var.value).second));
-			}
-			if (left_var.is_ndarray() && right_var.is_double()) {
-				auto left_arr = std::get<std::pair<std::vector<double>, std::vector<size_t>>>(left_var.value).first;
-				for (size_t i = 0; i < left_arr.size(); i++) {
-					left_arr.at(i) = pow(left_arr.at(i), std::get<double>(right_var.value));
-				}
-				return Variable(std::pair<std::vector<double>, std::vector<size_t>>(left_arr, std::get<std::pair<std::vector<double>, std::vector<size_t>>>(left_var.value).second));
-			}
-			if (left_var.is_ndarray() && right_var.is_ndarray()) {
-				auto left_var_pair = std::get<std::pair<std::vector<double>, std::vector<size_t>>>(left_var.value);
-				auto right_var_pair = std::get<std::pair<std::vector<double>, std::vector<size_t>>>(right_var.value);
-				runtime_assert(left_var_pair.second == right_var_pair.second, binary->op, "Expressions evaluate to arrays of differing sizes");
-				std::vector<double> zipped;
-				for (size_t i = 0; i < left_var_pair.first.size(); i++) {
-					zipped.push_back(pow(left_var_pair.first.at(i), right_var_pair.first.at(i)));
-				}
-				return Variable(std::pair<std::vector<double>, std::vector<size_t>>(zipped, left_var_pair.second));
-			}
-			runtime_assert(false, binary->op, "At least one of left and right expressions are neither numbers nor ndarrays");
-		}
-		default: runtime_assert(false, binary->op, "Invalid binary operator");
-		}
+    return var;
+}
+
+Variable Environment::evaluate_binary(Binary* binary) {
+    switch (binary->op.type) {
+    case IDENTIFIER: {
+        Variable left_var = evaluate_expr(binary->left);
+        Variable right_var = evaluate_expr(binary->right);
+        OpDecl* opDecl = (*frame.ops)[binary->op_id];
+        runtime_assert(opDecl != nullptr, binary->op, "Identifier doesn't correspond to a defined operator name");
+        size_t base = slots.size();
+        slots.push_back(std::move(left_var));
+        slots.push_back(std::move(right_var));
+        return call(opDecl->stmts, base, {opDecl->left_slot, opDecl->right_slot}, opDecl->num_slots);
     }
-    else if (CAN_MAKE(Func*, func)_FROM(expr)) {
-		runtime_assert(FUNC_EXISTS(func->func.lexeme), func->func, "Identifier doesn't correspond to a defined function name");
-		FuncDecl* funcDecl = func_symbol_table.at(func->func.lexeme);
-		Environment env (out);
-		env.func_symbol_table = func_symbol_table;
-		env.op_symbol_table = op_symbol_table;
-		runtime_assert(func->args.size() == funcDecl->params.size(), func->paren, "Function called with different number of args than defined with");
-		for (size_t i = 0; i < func->args.size(); i++) {
-			env.add_var(funcDecl->params.at(i).lexeme, evaluate_expr(func->args.at(i)));
-		}
-		for (Stmt* stmt: funcDecl->stmts) {
-			env.execute_stmt(stmt);
-		}
-		return env.get_return_val();
+    case OR:
+    case AND: {
+        Variable left_var = evaluate_expr(binary->left);
+        runtime_assert(left_var.is_bool() || left_var.is_ndarray(), binary->op, "Left expression evaluates to non-boolean value");
+        // Masks are combined whole, without short circuiting
+        if (left_var.is_bool() && std::get<bool>(left_var.value) == (binary->op.type == OR)) return left_var;
+        Variable right_var = evaluate_expr(binary->right);
+        return logical_operation(binary->op, left_var, right_var);
     }
-    else if (CAN_MAKE(Literal*, literal)_FROM(expr)) {
-		switch (literal->literal_type) {
-		case LITERAL_STRING: return Variable(literal->string_val);
-		case LITERAL_DOUBLE: return Variable(literal->double_val);
-		case LITERAL_BOOL: return Variable(literal->bool_val);
-		case LITERAL_ARRAY: {
-			std::vector<double> nums;
-			for (Expr* expr : literal->array_vals) {
-				Variable val = evaluate_expr(expr);
-				runtime_assert(val.is_double(), literal->token, "Expression in array literal evaluates to a non-number");
-				nums.push_back(std::get<double>(val.value));
-			}
-			return Variable(std::pair<std::vector<double>, std::vector<size_t>>(nums, {nums.size()}));
-		}
-		}
+    default: {
+        // Both ways give the same result, a tree that last computed a
+        // number is evaluated one operator at a time to skip the fusion
+        // overhead until it computes an array again
+        if (binary->fused_ops > 1 && !binary->fused_numbers) return evaluate_fused(binary);
+        if (binary->chain_length > 2) return evaluate_chain(binary);
+        Variable left_var = evaluate_expr(binary->left);
+        Variable right_var = evaluate_expr(binary->right);
+        Variable result = binary_operation(binary->op, std::move(left_var), std::move(right_var));
+        if (binary->fused_ops > 1 && result.is_ndarray()) binary->fused_numbers = false;
+        return result;
     }
-    else if (CAN_MAKE(Unary*, unary)_FROM(expr)) {
-		Variable val = evaluate_expr(unary->right);
-		switch(unary->op.type) {
-		case EXCLA: {
-			runtime_assert(val.is_bool(), unary->op, "Expression evaluates to a non-bool");
-			return Variable(!std::get<bool>(val.value));
-		}
-		case MINUS: {
-			runtime_assert(val.is_double(), unary->op, "Expression evaluates to a non-number");
-			return Variable(-std::get<double>(val.value));
-		}
-		case SHAPE: {
-			runtime_assert(val.is_ndarray(), unary->op, "Expression evaluates to a non-ndarray");
-			std::vector<double> casted_shape;
-			for (size_t d : std::get<std::pair<std::vector<double>, std::vector<size_t>>>(val.value).second) {
-				casted_shape.push_back((double) d);
-			}
-			return Variable(std::pair<std::vector<double>, std::vector<size_t>>(casted_shape, {casted_shape.size()}));
-		}
-		default: runtime_assert(false, unary->op, "Invalid unary operator");
-		}
     }
-    else if (CAN_MAKE(Var*, var)_FROM(expr)) {
-		runtime_assert(VAR_EXISTS(var->name.lexeme), var->name, "Identifier doesn't correspond to a declared variable name");
-		return var_symbol_table.at(var->name.lexeme);
+}
+
+Variable Environment::evaluate_fused(Binary* binary) {
+    // Calls and indices in the operands can evaluate fused trees of their
+    // own, so each nesting level keeps a FusedExpr
+    if (fused_depth == fused_exprs.size()) fused_exprs.push_back(std::make_unique<FusedExpr>());
+    FusedExpr& fused = *fused_exprs[fused_depth++];
+    try {
+        fuse(binary, fused);
+    } catch (...) {
+        fused.clear();
+        fused_depth--;
+        throw;
+    }
+    fused_depth--;
+    Variable result = fused.result();
+    binary->fused_numbers = !result.is_ndarray();
+    return result;
+}
+
+// Evaluates the operands of a fused tree and applies its operators in the
+// order evaluate_binary would for each operator on its own
+void Environment::fuse(Binary* binary, FusedExpr& fused) {
+    for (Expr* operand : {binary->left, binary->right}) {
+        if (operand->kind == EXPR_BINARY && static_cast<Binary*>(operand)->fused) fuse(static_cast<Binary*>(operand), fused);
+        else fused.push(evaluate_expr(operand));
+    }
+    fused.apply(binary->op);
+}
+
+// Evaluates the operands of a chain of @s left to right, checking each
+// product where evaluate_binary would compute it, then multiplies them in
+// the cheapest order
+Variable Environment::evaluate_chain(Binary* binary) {
+    size_t n = binary->chain_length;
+    std::vector<const Token*> ops(n - 1);
+    std::vector<Expr*> rights(n - 1);
+    Expr* first = binary;
+    for (size_t i = n - 1; i-- > 0;) {
+        Binary* op = static_cast<Binary*>(first);
+        ops[i] = &op->op;
+        rights[i] = op->right;
+        first = op->left;
+    }
+    std::vector<Variable> operands;
+    operands.reserve(n);
+    operands.push_back(evaluate_expr(first));
+    for (size_t i = 0; i < n - 1; i++) {
+        operands.push_back(evaluate_expr(rights[i]));
+        check_chain(operands.data(), i + 2, *ops[i]);
+    }
+    return multiply_chain(operands.data(), ops.data(), n, binary->chain_order);
+}
+
+Variable Environment::evaluate_func(Func* func) {
+    if (func->builtin_id != NO_BUILTIN) return evaluate_builtin(func);
+    FuncDecl* funcDecl = (*frame.funcs)[func->func_id];
+    runtime_assert(funcDecl != nullptr, func->func, "Identifier doesn't correspond to a defined function name");
+    runtime_assert(func->args.size() == funcDecl->params.size(), func->paren, "Function called with different number of args than defined with");
+    size_t base = slots.size();
+    for (size_t i = 0; i < func->args.size(); i++) {
+        // Calls made by the argument push and pop their frames above it
+        Variable arg = evaluate_expr(func->args.at(i));
+        slots.push_back(std::move(arg));
+    }
+    return call(funcDecl->stmts, base, funcDecl->param_slots, funcDecl->num_slots);
+}
+
+Variable Environment::evaluate_builtin(Func* func) {
+    const Builtin& called = builtin(func->builtin_id);
+    runtime_assert(func->args.size() == called.num_args, func->paren, "Function called with different number of args than defined with");
+    Variable args[MAX_BUILTIN_ARGS];
+    for (size_t i = 0; i < func->args.size(); i++) args[i] = evaluate_expr(func->args[i]);
+    return called.call(args, func->func);
+}
+
+Variable Environment::evaluate_literal(Literal* literal) {
+    switch (literal->literal_type) {
+    case LITERAL_STRING: return Variable(literal->string_val);
+    case LITERAL_DOUBLE: return Variable(literal->double_val);
+    case LITERAL_BOOL: return Variable(literal->bool_val);
+    case LITERAL_NDARRAY: return Variable(literal->ndarray_val);
+    case LITERAL_ARRAY: {
+        Elements nums;
+        for (Expr* expr : literal->array_vals) {
+            Variable val = evaluate_expr(expr);
+            runtime_assert(val.is_double(), literal->token, "Expression in array literal evaluates to a non-number");
+            nums.push_back(std::get<double>(val.value));
+        }
+        size_t length = nums.size();
+        return Variable(NDArray(std::move(nums), {length}));
     }
-    else if (CAN_MAKE(Nil*, nil)_FROM(expr)) {
-		return Variable();
     }
     throw std::runtime_error("Couldn't evaluate expression (evaluation for expression type might not be implemented?)");
 }
 
-void Environment::runtime_assert(bool cond, Token loc, std::string error_msg) {
-    if (!cond) throw std::runtime_error(create_error(error_msg, loc));
+Variable Environment::evaluate_unary(Unary* unary) {
+    Variable val = evaluate_expr(unary->right);
+    return unary_operation(unary->op, val);
 }
 
-std::string Environment::create_error(std::string error_msg, Token loc) {
-    return "Runtime error: " + error_msg + ", occurred at line " + std::to_string(loc.line) + " at column " + std::to_string(loc.col);
+Variable Environment::evaluate_var(Var* var) {
+    runtime_assert(declared[frame.base + var->slot], var->name, "Identifier doesn't correspond to a declared variable name");
+    // Nothing reads the slot again before it is assigned, so taking the
+    // value leaves its buffer unshared for operators to reuse
+    if (var->last_use) return std::exchange(slots[frame.base + var->slot], Variable());
+    return slots[frame.base + var->slot];
 }
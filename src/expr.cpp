@@ -13,6 +13,8 @@
 #include "expr.hpp"
 #include<string>
 
+Expr::Expr(ExprKind kind): kind(kind) {}
+
 Expr::~Expr() {}
 
 std::pair<std::string, std::string> Expr::make_string(std::string label, std::vector<Expr*> children) {
@@ -63,39 +65,41 @@ std::pair<std::string, std::string> Expr::make_string(std::string label, Expr* c
 
 size_t Expr::node_counter = 0;
 
-ArrAccess::ArrAccess(Expr* id, Token brack, std::vector<Expr*> idx): id(id), brack(brack), idx(idx) {}
+ArrAccess::ArrAccess(Expr* id, Token brack, std::vector<Expr*> idx): Expr(EXPR_ARR_ACCESS), id(id), brack(brack), idx(idx) {}
 
 std::pair<std::string, std::string> ArrAccess::to_string() {
     return make_string("Array access", idx);
 }
 
-Assign::Assign(Token name, Expr* value): name(name), value(value) {}
+Assign::Assign(Token name, Expr* value): Expr(EXPR_ASSIGN), name(name), value(value) {}
 
-Assign::Assign(Token name, std::vector<Expr*> idx, Expr* value): name(name), idx(idx), value(value) {}
+Assign::Assign(Token name, std::vector<Expr*> idx, Expr* value): Expr(EXPR_ASSIGN), name(name), idx(idx), value(value) {}
 
 std::pair<std::string, std::string> Assign::to_string() {
     return make_string("Assignment of " + name.lexeme, value);
 }
 
-Binary::Binary(Expr* left, Token op, Expr* right): left(left), op(op), right(right) {}
+Binary::Binary(Expr* left, Token op, Expr* right): Expr(EXPR_BINARY), left(left), op(op), right(right) {}
 
 std::pair<std::string, std::string> Binary::to_string() {
     return make_string("Binary operator " + op.lexeme, {left, right});
 }
 
-Func::Func(Token func, Token paren, std::vector<Expr*> args): func(func), paren(paren), args(args) {}
+Func::Func(Token func, Token paren, std::vector<Expr*> args): Expr(EXPR_FUNC), func(func), paren(paren), args(args) {}
 
 std::pair<std::string, std::string> Func::to_string() {
     return make_string("Function call to " + func.lexeme, args);
 }
 
-Literal::Literal(Token token, std::string val): token(token), string_val(val), literal_type(LITERAL_STRING) {}
+Literal::Literal(Token token, std::string val): Expr(EXPR_LITERAL), token(token), string_val(val), literal_type(LITERAL_STRING) {}
+
+Literal::Literal(Token token, double val): Expr(EXPR_LITERAL), token(token), double_val(val), literal_type(LITERAL_DOUBLE) {}
 
-Literal::Literal(Token token, double val): token(token), double_val(val), literal_type(LITERAL_DOUBLE) {}
+Literal::Literal(Token token, bool val): Expr(EXPR_LITERAL), token(token), bool_val(val), literal_type(LITERAL_BOOL) {}
 
-Literal::Literal(Token token, bool val): token(token), bool_val(val), literal_type(LITERAL_BOOL) {}
+Literal::Literal(Token token, std::vector<Expr*> vals): Expr(EXPR_LITERAL), token(token), array_vals(vals), literal_type(LITERAL_ARRAY) {}
 
-Literal::Literal(Token token, std::vector<Expr*> vals): token(token), array_vals(vals), literal_type(LITERAL_ARRAY) {}
+Literal::Literal(Token token, NDArray val): Expr(EXPR_LITERAL), token(token), literal_type(LITERAL_NDARRAY), ndarray_val(val) {}
 
 std::pair<std::string, std::string> Literal::to_string() {
     std::string label = "Literal ";
@@ -105,25 +109,36 @@ std::pair<std::string, std::string> Literal::to_string() {
         label += string_val;
     } else if (literal_type == LITERAL_DOUBLE) {
         label += std::to_string(double_val);
+    } else if (literal_type == LITERAL_NDARRAY) {
+        label += "ndarray of size " + std::to_string(ndarray_val.size());
     } else {
         label += std::to_string(bool_val);
     }
     return make_string(label, {});
 }
 
-Nil::Nil() {}
+Nil::Nil(): Expr(EXPR_NIL) {}
 
 std::pair<std::string, std::string> Nil::to_string() {
     return make_string("NIL", {});
 }
 
-Unary::Unary(Token op, Expr* right): op(op), right(right) {}
+Slice::Slice(Token colon, Expr* begin, Expr* end): Expr(EXPR_SLICE), colon(colon), begin(begin), end(end) {}
+
+std::pair<std::string, std::string> Slice::to_string() {
+    std::vector<Expr*> bounds;
+    if (begin) bounds.push_back(begin);
+    if (end) bounds.push_back(end);
+    return make_string("Slice", bounds);
+}
+
+Unary::Unary(Token op, Expr* right): Expr(EXPR_UNARY), op(op), right(right) {}
 
 std::pair<std::string, std::string> Unary::to_string() {
     return make_string("Unary " + op.lexeme, right);
 }
 
-Var::Var(Token name): name(name) {}
+Var::Var(Token name): Expr(EXPR_VAR), name(name) {}
 
 std::pair<std::string, std::string> Var::to_string() {
     return make_string("Variable " + name.lexeme, {});
@@ -160,6 +175,11 @@ Literal::~Literal() {
 
 Nil::~Nil() {}
 
+Slice::~Slice() {
+    delete begin;
+    delete end;
+}
+
 Unary::~Unary() {
     delete right;
 }
@@ -0,0 +1,162 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+
+#include "fusion.hpp"
+#include "operations.hpp"
+#include "thread_pool.hpp"
+
+// Elements a step works on at a time, small enough for the blocks of a
+// whole tree to stay in cache
+#define BLOCK_SIZE 256
+
+bool is_elementwise(TokenType type) {
+    return type == PLUS || type == MINUS || type == STAR || type == SLASH || type == EXP;
+}
+
+void FusedExpr::clear() {
+    for (size_t i = 0; i < depth; i++) stack[i].value = Variable();
+    depth = 0;
+    num_steps = 0;
+    inputs.clear();
+}
+
+void FusedExpr::push(Variable val) {
+    Operand& operand = stack[depth++];
+    operand.value = std::move(val);
+    operand.deferred = false;
+}
+
+void FusedExpr::apply(const Token& op) {
+    Operand& left = stack[depth - 2];
+    Operand& right = stack[depth - 1];
+    bool left_array = left.deferred || left.value.is_ndarray();
+    bool right_array = right.deferred || right.value.is_ndarray();
+    if (!left_array && !right_array) {
+        if (left.value.is_double() && right.value.is_double()) {
+            left.value = elementwise_number(op.type, std::get<double>(left.value.value), std::get<double>(right.value.value));
+        }
+        // Anything else is an error, raised the usual way
+        else left.value = binary_operation(op, left.value, right.value);
+        depth--;
+        return;
+    }
+    runtime_assert((left_array || left.value.is_double()) && (right_array || right.value.is_double()), op, "At least one of left and right expressions are neither numbers nor ndarrays");
+    // The result's shape takes the place of the left operand's
+    if (!left_array) left.shape = shape(right);
+    else if (!right_array) left.shape = shape(left);
+    else if (shape(left) != shape(right)) left.shape = broadcast_shape(op, shape(left), shape(right));
+    else left.shape = shape(left);
+    Step& step = steps[num_steps];
+    step.op = kernel_op(op.type);
+    step.left = source(left, depth - 2);
+    step.right = source(right, depth - 1);
+    // The result takes the place of the left operand on the stack, and
+    // each stack position has a block of its own
+    step.block = depth - 2;
+    left.deferred = true;
+    left.step = num_steps++;
+    right.value = Variable();
+    depth--;
+}
+
+Variable FusedExpr::result() {
+    Operand& top = stack[0];
+    if (!top.deferred) {
+        depth = 0;
+        return std::move(top.value);
+    }
+    std::vector<size_t> shape = top.shape;
+    size_t size = 1;
+    for (size_t dim : shape) size *= dim;
+    const double* input_data[MAX_FUSED + 1];
+    for (size_t i = 0; i < inputs.size(); i++) {
+        // Computed inputs of the result's shape are computed a block at a
+        // time instead of being copied out whole
+        input_data[i] = inputs[i].is_computed() && inputs[i].shape() == shape ? nullptr : inputs[i].elements();
+        // Inputs of a smaller shape are read with zero strides along the
+        // dimensions they repeat along
+        if (inputs[i].shape() == shape) input_strides[i].clear();
+        else input_strides[i] = broadcast_strides(inputs[i].shape(), shape);
+    }
+    // The result is written over an input of its shape that no other array
+    // shares. Every step reads an element before writing the same element.
+    auto reused = std::find_if(inputs.begin(), inputs.end(), [&](const NDArray& input) { return input.unique() && input.shape() == shape; });
+    NDArray output = reused != inputs.end() ? std::move(*reused) : NDArray(Elements(size), shape);
+    output.set_mask(false);
+    double* out = output.mutable_data().data();
+    parallel_for(size, [&](size_t begin, size_t end) {
+        // Each stack position has a block of its own, and the last two take
+        // the elements of broadcast inputs
+        double blocks[(MAX_FUSED + 3) * BLOCK_SIZE];
+        run(begin, end, out, input_data, blocks);
+    });
+    clear();
+    return Variable(std::move(output));
+}
+
+// Runs the steps over elements [begin, end) a block at a time
+void FusedExpr::run(size_t begin, size_t end, double* out, const double* const* input_data, double* blocks) const {
+    const Kernels& k = kernels();
+    for (size_t start = begin; start < end; start += BLOCK_SIZE) {
+        size_t count = std::min((size_t) BLOCK_SIZE, end - start);
+        for (size_t s = 0; s < num_steps; s++) {
+            const Step& step = steps[s];
+            double* dst = s == num_steps - 1 ? out + start : blocks + step.block * BLOCK_SIZE;
+            const double* left = elements(step.left, input_data, blocks, start, count, blocks + (MAX_FUSED + 1) * BLOCK_SIZE);
+            const double* right = elements(step.right, input_data, blocks, start, count, blocks + (MAX_FUSED + 2) * BLOCK_SIZE);
+            if (!left && !right) {
+                k.array_number[step.op](dst, &step.left.number, step.right.number, 1);
+                std::fill(dst + 1, dst + count, dst[0]);
+            }
+            else if (!left) k.number_array[step.op](dst, step.left.number, right, count);
+            else if (!right) k.array_number[step.op](dst, left, step.right.number, count);
+            else k.array_array[step.op](dst, left, right, count);
+        }
+    }
+}
+
+FusedExpr::Source FusedExpr::source(Operand& operand, size_t position) {
+    if (operand.deferred) return {Source::BLOCK, 0, position};
+    if (operand.value.is_double()) return {Source::NUMBER, std::get<double>(operand.value.value), 0};
+    // The tree runs over the shape of the whole tree, across which a
+    // constant array is its number
+    const NDArray& array = std::get<NDArray>(operand.value.value);
+    if (array.repeats() && array.period() == 1) return {Source::NUMBER, array.pattern()[0], 0};
+    inputs.push_back(std::move(std::get<NDArray>(operand.value.value)));
+    operand.value = Variable();
+    return {Source::INPUT, 0, inputs.size() - 1};
+}
+
+// Elements of src in the block of count elements from start, null for a
+// number. The elements of a broadcast input are copied to scratch first.
+const double* FusedExpr::elements(const Source& src, const double* const* input_data, const double* blocks, size_t start, size_t count, double* scratch) const {
+    if (src.kind == Source::INPUT) {
+        if (!input_data[src.index]) {
+            inputs[src.index].compute(scratch, start, count);
+            return scratch;
+        }
+        const std::vector<size_t>& strides = input_strides[src.index];
+        if (strides.empty()) return input_data[src.index] + start;
+        broadcast_elements(scratch, input_data[src.index], stack[0].shape, strides, start, count);
+        return scratch;
+    }
+    if (src.kind == Source::BLOCK) return blocks + src.index * BLOCK_SIZE;
+    return nullptr;
+}
+
+const std::vector<size_t>& FusedExpr::shape(const Operand& operand) const {
+    if (operand.deferred) return operand.shape;
+    return std::get<NDArray>(operand.value.value).shape();
+}
@@ -0,0 +1,395 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+#ifndef WEB_TARGET
+    #include <cblas.h>
+#endif
+
+#include "blas.hpp"
+#include "gemm.hpp"
+#include "thread_pool.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define X86_KERNELS
+#endif
+
+// Rows of A and columns of B the micro-kernel works on
+#define MR 6
+#define NR 8
+// Block sizes, chosen so a KC x NR micro-panel of B stays in L1, an MC x KC
+// block of A in L2 and a KC x NC panel of B in L3
+#define KC 256
+#define MC 96
+#define NC 2048
+// Multiplications smaller than this many multiply-adds stay on one thread
+#define PARALLEL_GEMM_WORK (1 << 21)
+
+// c = a b (plus c when accumulate is set) for one MR x NR tile of c with
+// row stride ldc, from kc steps of a packed MR row panel of A and a packed
+// NR column panel of B
+typedef void (*MicroKernel)(size_t kc, const double* a, const double* b, double* c, size_t ldc, bool accumulate);
+
+static void portable_kernel(size_t kc, const double* a, const double* b, double* c, size_t ldc, bool accumulate) {
+    double acc[MR][NR] = {};
+    for (size_t p = 0; p < kc; p++) {
+        for (size_t i = 0; i < MR; i++) {
+            for (size_t j = 0; j < NR; j++) acc[i][j] += a[i] * b[j];
+        }
+        a += MR;
+        b += NR;
+    }
+    for (size_t i = 0; i < MR; i++) {
+        for (size_t j = 0; j < NR; j++) c[i * ldc + j] = accumulate ? c[i * ldc + j] + acc[i][j] : acc[i][j];
+    }
+}
+
+#ifdef X86_KERNELS
+// Twelve accumulators hold the tile: two vectors of four doubles per row
+#define FMA_ROW(i) \
+    row = _mm256_broadcast_sd(a + i); \
+    acc##i##0 = _mm256_fmadd_pd(row, b0, acc##i##0); \
+    acc##i##1 = _mm256_fmadd_pd(row, b1, acc##i##1);
+
+#define STORE_ROW(i) \
+    if (accumulate) { \
+        acc##i##0 = _mm256_add_pd(acc##i##0, _mm256_loadu_pd(c + i * ldc)); \
+        acc##i##1 = _mm256_add_pd(acc##i##1, _mm256_loadu_pd(c + i * ldc + 4)); \
+    } \
+    _mm256_storeu_pd(c + i * ldc, acc##i##0); \
+    _mm256_storeu_pd(c + i * ldc + 4, acc##i##1);
+
+__attribute__((target("avx2,fma")))
+static void avx2_kernel(size_t kc, const double* a, const double* b, double* c, size_t ldc, bool accumulate) {
+    __m256d acc00 = _mm256_setzero_pd(), acc01 = _mm256_setzero_pd();
+    __m256d acc10 = _mm256_setzero_pd(), acc11 = _mm256_setzero_pd();
+    __m256d acc20 = _mm256_setzero_pd(), acc21 = _mm256_setzero_pd();
+    __m256d acc30 = _mm256_setzero_pd(), acc31 = _mm256_setzero_pd();
+    __m256d acc40 = _mm256_setzero_pd(), acc41 = _mm256_setzero_pd();
+    __m256d acc50 = _mm256_setzero_pd(), acc51 = _mm256_setzero_pd();
+    for (size_t p = 0; p < kc; p++) {
+        __m256d b0 = _mm256_loadu_pd(b);
+        __m256d b1 = _mm256_loadu_pd(b + 4);
+        __m256d row;
+        FMA_ROW(0) FMA_ROW(1) FMA_ROW(2) FMA_ROW(3) FMA_ROW(4) FMA_ROW(5)
+        a += MR;
+        b += NR;
+    }
+    STORE_ROW(0) STORE_ROW(1) STORE_ROW(2) STORE_ROW(3) STORE_ROW(4) STORE_ROW(5)
+}
+#endif
+
+static MicroKernel choose_kernel(const char** name) {
+#ifdef X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        *name = "avx2";
+        return avx2_kernel;
+    }
+#endif
+    *name = "portable";
+    return portable_kernel;
+}
+
+static const char* kernel_name;
+static const MicroKernel micro_kernel = choose_kernel(&kernel_name);
+
+const char* gemm_kernel_name() {
+    return kernel_name;
+}
+
+// Copies rows [row, row + rows) and columns [col, col + kc) of a (element
+// (i, p) at a[i * rs + p * cs]) into panels of MR rows, each stored column
+// by column. Rows past the end are zero.
+static void pack_a(const double* a, size_t rs, size_t cs, size_t row, size_t rows, size_t col, size_t kc, double* packed) {
+    for (size_t panel = 0; panel < rows; panel += MR) {
+        for (size_t p = 0; p < kc; p++) {
+            for (size_t i = 0; i < MR; i++) {
+                *packed++ = panel + i < rows ? a[(row + panel + i) * rs + (col + p) * cs] : 0;
+            }
+        }
+    }
+}
+
+// Copies rows [row, row + kc) and columns [col, col + cols) of b (element
+// (p, j) at b[p * rs + j * cs]) into panels of NR columns, each stored row
+// by row. Columns past the end are zero.
+static void pack_b(const double* b, size_t rs, size_t cs, size_t row, size_t kc, size_t col, size_t cols, double* packed) {
+    for (size_t panel = 0; panel < cols; panel += NR) {
+        for (size_t p = 0; p < kc; p++) {
+            const double* src = b + (row + p) * rs + (col + panel) * cs;
+            for (size_t j = 0; j < NR; j++) *packed++ = panel + j < cols ? src[j * cs] : 0;
+        }
+    }
+}
+
+// Multiplies a packed mc x kc block of A by a packed kc x nc panel of B
+// into c, a tile at a time. Tiles past the edges of c go through a
+// scratch tile.
+static void multiply_block(size_t mc, size_t nc, size_t kc, const double* packed_a, const double* packed_b,
+                           double* c, size_t ldc, bool accumulate) {
+    for (size_t jr = 0; jr < nc; jr += NR) {
+        for (size_t ir = 0; ir < mc; ir += MR) {
+            double* tile = c + ir * ldc + jr;
+            size_t rows = std::min((size_t) MR, mc - ir);
+            size_t cols = std::min((size_t) NR, nc - jr);
+            if (rows == MR && cols == NR) {
+                micro_kernel(kc, packed_a + ir * kc, packed_b + jr * kc, tile, ldc, accumulate);
+                continue;
+            }
+            double edge[MR * NR];
+            micro_kernel(kc, packed_a + ir * kc, packed_b + jr * kc, edge, NR, false);
+            for (size_t i = 0; i < rows; i++) {
+                for (size_t j = 0; j < cols; j++) {
+                    tile[i * ldc + j] = accumulate ? tile[i * ldc + j] + edge[i * NR + j] : edge[i * NR + j];
+                }
+            }
+        }
+    }
+}
+
+// native_gemm for a with element (i, p) at a[i * a_rs + p * a_cs] and b
+// with element (p, j) at b[p * b_rs + j * b_cs]. Packing reads them in any
+// layout at the same cost.
+static void strided_gemm(size_t m, size_t n, size_t k, const double* a, size_t a_rs, size_t a_cs,
+                         const double* b, size_t b_rs, size_t b_cs, double* c) {
+    if (k == 0) {
+        std::fill(c, c + m * n, 0.0);
+        return;
+    }
+    size_t num_blocks = (m + MC - 1) / MC;
+    bool parallel = (double) m * n * k >= PARALLEL_GEMM_WORK;
+    std::vector<double> packed_b(KC * ((std::min(n, (size_t) NC) + NR - 1) / NR * NR));
+    for (size_t jc = 0; jc < n; jc += NC) {
+        size_t nc = std::min((size_t) NC, n - jc);
+        for (size_t pc = 0; pc < k; pc += KC) {
+            size_t kc = std::min((size_t) KC, k - pc);
+            pack_b(b, b_rs, b_cs, pc, kc, jc, nc, packed_b.data());
+            auto multiply_blocks = [&](size_t first, size_t last) {
+                static thread_local std::vector<double> packed_a;
+                packed_a.resize(MC * KC);
+                for (size_t block = first; block < last; block++) {
+                    size_t ic = block * MC;
+                    size_t mc = std::min((size_t) MC, m - ic);
+                    pack_a(a, a_rs, a_cs, ic, mc, pc, kc, packed_a.data());
+                    multiply_block(mc, nc, kc, packed_a.data(), packed_b.data(), c + ic * n + jc, n, pc > 0);
+                }
+            };
+            if (parallel) thread_pool().parallel_for(num_blocks, multiply_blocks);
+            else multiply_blocks(0, num_blocks);
+        }
+    }
+}
+
+void native_gemm(size_t m, size_t n, size_t k, const double* a, const double* b, double* c) {
+    strided_gemm(m, n, k, a, k, 1, b, n, 1, c);
+}
+
+double native_dot(size_t n, const double* a, const double* b) {
+    // Independent sums so the additions don't wait on each other
+    double sums[4] = {};
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        for (size_t j = 0; j < 4; j++) sums[j] += a[i + j] * b[i + j];
+    }
+    for (; i < n; i++) sums[0] += a[i] * b[i];
+    return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+}
+
+void native_gemv(bool transpose, size_t m, size_t n, const double* a, const double* x, double* y) {
+    bool parallel = (double) m * n >= PARALLEL_THRESHOLD;
+    if (!transpose) {
+        auto rows = [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++) y[i] = native_dot(n, a + i * n, x);
+        };
+        if (parallel) thread_pool().parallel_for(m, rows);
+        else rows(0, m);
+        return;
+    }
+    // Adds x[i] times row i of a to a range of y, a row at a time, so a is
+    // read in order
+    auto cols = [&](size_t first, size_t last) {
+        std::fill(y + first, y + last, 0.0);
+        for (size_t i = 0; i < m; i++) {
+            const double* row = a + i * n;
+            for (size_t j = first; j < last; j++) y[j] += x[i] * row[j];
+        }
+    };
+    if (parallel) thread_pool().parallel_for(n, cols);
+    else cols(0, n);
+}
+
+// c = a b for an M x K a and a K x N b, unrolled for these sizes and kept
+// in registers, so small products skip packing, blocking and any call into
+// BLAS. Sums are accumulated in order of k like the naive loop.
+template <size_t M, size_t N, size_t K>
+static void small_gemm(const double* a, const double* b, double* c) {
+    double acc[M * N] = {};
+    #pragma GCC unroll 8
+    for (size_t p = 0; p < K; p++) {
+        #pragma GCC unroll 8
+        for (size_t i = 0; i < M; i++) {
+            #pragma GCC unroll 8
+            for (size_t j = 0; j < N; j++) acc[i * N + j] += a[i * K + p] * b[p * N + j];
+        }
+    }
+    #pragma GCC unroll 64
+    for (size_t i = 0; i < M * N; i++) c[i] = acc[i];
+}
+
+typedef void (*SmallGemm)(const double* a, const double* b, double* c);
+
+// small_gemm for every size from 1 to SMALL_GEMM_SIZE, at
+// ((m - 1) * SMALL_GEMM_SIZE + n - 1) * SMALL_GEMM_SIZE + k - 1
+template <size_t... I>
+static constexpr std::array<SmallGemm, sizeof...(I)> make_small_gemms(std::index_sequence<I...>) {
+    return {small_gemm<I / (SMALL_GEMM_SIZE * SMALL_GEMM_SIZE) + 1, I / SMALL_GEMM_SIZE % SMALL_GEMM_SIZE + 1, I % SMALL_GEMM_SIZE + 1>...};
+}
+
+static constexpr std::array<SmallGemm, SMALL_GEMM_SIZE * SMALL_GEMM_SIZE * SMALL_GEMM_SIZE> small_gemms =
+    make_small_gemms(std::make_index_sequence<SMALL_GEMM_SIZE * SMALL_GEMM_SIZE * SMALL_GEMM_SIZE>());
+
+void matmul(size_t m, size_t n, size_t k, const double* a, const double* b, double* c) {
+    if (m == 0 || n == 0) return;
+    // BLAS rejects the leading dimension of 0 an empty a would have
+    if (k == 0) {
+        std::fill(c, c + m * n, 0.0);
+        return;
+    }
+    if (m <= SMALL_GEMM_SIZE && n <= SMALL_GEMM_SIZE && k <= SMALL_GEMM_SIZE) {
+        small_gemms[((m - 1) * SMALL_GEMM_SIZE + n - 1) * SMALL_GEMM_SIZE + k - 1](a, b, c);
+        return;
+    }
+    #ifndef WEB_TARGET
+        if (matmul_backend() == MATMUL_BLAS) {
+            const BlasProvider& blas = blas_provider();
+            if (m == 1 && n == 1) c[0] = blas.ddot(k, a, 1, b, 1);
+            else if (n == 1) blas.dgemv(CblasRowMajor, CblasNoTrans, m, k, 1., a, k, b, 1, 0., c, 1);
+            else if (m == 1) blas.dgemv(CblasRowMajor, CblasTrans, k, n, 1., b, n, a, 1, 0., c, 1);
+            else blas.dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, n, k, 1., a, k, b, n, 0., c, n);
+            return;
+        }
+    #endif
+    if (m == 1 && n == 1) c[0] = native_dot(k, a, b);
+    else if (n == 1) native_gemv(false, m, k, a, b, c);
+    else if (m == 1) native_gemv(true, k, n, b, a, c);
+    else native_gemm(m, n, k, a, b, c);
+}
+
+void matmul(size_t m, size_t n, size_t k, const double* a, size_t lda, bool trans_a,
+            const double* b, size_t ldb, bool trans_b, double* c) {
+    if (!trans_a && lda == k && !trans_b && ldb == n) return matmul(m, n, k, a, b, c);
+    if (m == 0 || n == 0) return;
+    if (k == 0) {
+        std::fill(c, c + m * n, 0.0);
+        return;
+    }
+    size_t a_rs = trans_a ? 1 : lda;
+    size_t a_cs = trans_a ? lda : 1;
+    size_t b_rs = trans_b ? 1 : ldb;
+    size_t b_cs = trans_b ? ldb : 1;
+    if (m <= SMALL_GEMM_SIZE && n <= SMALL_GEMM_SIZE && k <= SMALL_GEMM_SIZE) {
+        // Gathered into row major order for the unrolled kernels
+        double packed_a[SMALL_GEMM_SIZE * SMALL_GEMM_SIZE];
+        double packed_b[SMALL_GEMM_SIZE * SMALL_GEMM_SIZE];
+        for (size_t i = 0; i < m; i++) {
+            for (size_t p = 0; p < k; p++) packed_a[i * k + p] = a[i * a_rs + p * a_cs];
+        }
+        for (size_t p = 0; p < k; p++) {
+            for (size_t j = 0; j < n; j++) packed_b[p * n + j] = b[p * b_rs + j * b_cs];
+        }
+        small_gemms[((m - 1) * SMALL_GEMM_SIZE + n - 1) * SMALL_GEMM_SIZE + k - 1](packed_a, packed_b, c);
+        return;
+    }
+    #ifndef WEB_TARGET
+        if (matmul_backend() == MATMUL_BLAS) {
+            const BlasProvider& blas = blas_provider();
+            CBLAS_TRANSPOSE op_a = trans_a ? CblasTrans : CblasNoTrans;
+            CBLAS_TRANSPOSE op_b = trans_b ? CblasTrans : CblasNoTrans;
+            // dgemv takes the matrix as stored, so its dimensions swap with
+            // the transpose flag
+            if (m == 1 && n == 1) c[0] = blas.ddot(k, a, a_cs, b, b_rs);
+            else if (n == 1) blas.dgemv(CblasRowMajor, op_a, trans_a ? k : m, trans_a ? m : k, 1., a, lda, b, b_rs, 0., c, 1);
+            else if (m == 1) blas.dgemv(CblasRowMajor, trans_b ? CblasNoTrans : CblasTrans, trans_b ? n : k, trans_b ? k : n, 1., b, ldb, a, a_cs, 0., c, 1);
+            else blas.dgemm(CblasRowMajor, op_a, op_b, m, n, k, 1., a, lda, b, ldb, 0., c, n);
+            return;
+        }
+    #endif
+    if (m == 1 && n == 1) {
+        double sum = 0;
+        for (size_t p = 0; p < k; p++) sum += a[p * a_cs] * b[p * b_rs];
+        c[0] = sum;
+    }
+    else strided_gemm(m, n, k, a, a_rs, a_cs, b, b_rs, b_cs, c);
+}
+
+void batched_matmul(size_t count, size_t m, size_t n, size_t k, const double* a, size_t stride_a,
+                    const double* b, size_t stride_b, double* c) {
+    auto products = [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) matmul(m, n, k, a + i * stride_a, b + i * stride_b, c + i * m * n);
+    };
+    // Products big enough to be split between threads themselves run one
+    // after another
+    if (count > 1 && (double) m * n * k < PARALLEL_GEMM_WORK && (double) count * m * n * k >= PARALLEL_GEMM_WORK) {
+        // The backend and provider are chosen lazily, so they are chosen
+        // here first rather than by the workers at once
+        #ifndef WEB_TARGET
+            if (matmul_backend() == MATMUL_BLAS) blas_provider();
+        #endif
+        thread_pool().parallel_for(count, products);
+    } else {
+        products(0, count);
+    }
+}
+
+// Set once set_matmul_backend is called
+static bool backend_chosen = false;
+static MatmulBackend chosen_backend;
+
+static MatmulBackend default_backend() {
+    MatmulBackend backend;
+    const char* env = std::getenv("WEAK_MATMUL");
+    if (env && find_matmul_backend(env, backend)) return backend;
+    #ifdef MATMUL_BLAS
+        return MATMUL_BLAS;
+    #else
+        return MATMUL_NATIVE;
+    #endif
+}
+
+MatmulBackend matmul_backend() {
+    if (!backend_chosen) {
+        chosen_backend = default_backend();
+        backend_chosen = true;
+    }
+    return chosen_backend;
+}
+
+void set_matmul_backend(MatmulBackend backend) {
+    chosen_backend = backend;
+    backend_chosen = true;
+}
+
+bool find_matmul_backend(const std::string& name, MatmulBackend& backend) {
+    if (name == "native") backend = MATMUL_NATIVE;
+    #ifndef WEB_TARGET
+        else if (name == "blas") backend = MATMUL_BLAS;
+    #endif
+    else return false;
+    return true;
+}
@@ -0,0 +1,411 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "kernels.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define X86_KERNELS
+#endif
+
+#define ADD(a, b) ((a) + (b))
+#define SUB(a, b) ((a) - (b))
+#define MUL(a, b) ((a) * (b))
+#define DIV(a, b) ((a) / (b))
+#define LT(a, b) ((double) ((a) < (b)))
+#define LE(a, b) ((double) ((a) <= (b)))
+#define GT(a, b) ((double) ((a) > (b)))
+#define GE(a, b) ((double) ((a) >= (b)))
+#define EQ(a, b) ((double) ((a) == (b)))
+#define NE(a, b) ((double) ((a) != (b)))
+#define LOGICAL_AND(a, b) ((double) ((a) != 0 && (b) != 0))
+#define LOGICAL_OR(a, b) ((double) ((a) != 0 || (b) != 0))
+
+// Defines the three kernels of one operator for one instruction set. Each
+// handles WIDTH elements at a time with VOP, and the rest one at a time
+// with OP. ATTR enables the instruction set for just these functions, so
+// the rest of the build doesn't assume the CPU has it.
+#define DEFINE_KERNELS(ISA, ATTR, NAME, WIDTH, VEC, LOAD, STORE, SET1, VOP, OP) \
+    ATTR static void ISA##_##NAME##_array_array(double* dst, const double* left, const double* right, size_t n) { \
+        size_t i = 0; \
+        for (; i + WIDTH <= n; i += WIDTH) STORE(dst + i, VOP(LOAD(left + i), LOAD(right + i))); \
+        for (; i < n; i++) dst[i] = OP(left[i], right[i]); \
+    } \
+    ATTR static void ISA##_##NAME##_number_array(double* dst, double left, const double* right, size_t n) { \
+        VEC left_vec = SET1(left); \
+        size_t i = 0; \
+        for (; i + WIDTH <= n; i += WIDTH) STORE(dst + i, VOP(left_vec, LOAD(right + i))); \
+        for (; i < n; i++) dst[i] = OP(left, right[i]); \
+    } \
+    ATTR static void ISA##_##NAME##_array_number(double* dst, const double* left, double right, size_t n) { \
+        VEC right_vec = SET1(right); \
+        size_t i = 0; \
+        for (; i + WIDTH <= n; i += WIDTH) STORE(dst + i, VOP(LOAD(left + i), right_vec)); \
+        for (; i < n; i++) dst[i] = OP(left[i], right); \
+    }
+
+// Defines the reductions for one instruction set. Blocks are summed into
+// four vectors at a time to hide the latency of the additions. Vector max
+// and min drop NaNs, so a running sum of x - x, NaN for NaN and infinite
+// elements, sends ranges holding either to the exact one at a time loop.
+#define DEFINE_REDUCTIONS(ISA, ATTR, WIDTH, VEC, LOAD, STORE, SET1, VADD, VSUB, VMAX, VMIN) \
+    ATTR static double ISA##_sum_block(const double* x, size_t n) { \
+        VEC acc0 = SET1(0.0), acc1 = SET1(0.0), acc2 = SET1(0.0), acc3 = SET1(0.0); \
+        size_t i = 0; \
+        for (; i + 4 * WIDTH <= n; i += 4 * WIDTH) { \
+            acc0 = VADD(acc0, LOAD(x + i)); \
+            acc1 = VADD(acc1, LOAD(x + i + WIDTH)); \
+            acc2 = VADD(acc2, LOAD(x + i + 2 * WIDTH)); \
+            acc3 = VADD(acc3, LOAD(x + i + 3 * WIDTH)); \
+        } \
+        for (; i + WIDTH <= n; i += WIDTH) acc0 = VADD(acc0, LOAD(x + i)); \
+        double lanes[WIDTH]; \
+        STORE(lanes, VADD(VADD(acc0, acc1), VADD(acc2, acc3))); \
+        double sum = 0; \
+        for (size_t j = 0; j < WIDTH; j++) sum += lanes[j]; \
+        for (; i < n; i++) sum += x[i]; \
+        return sum; \
+    } \
+    static double ISA##_sum(const double* x, size_t n) { \
+        if (n <= PAIRWISE_BLOCK) return ISA##_sum_block(x, n); \
+        size_t half = n / 2 / WIDTH * WIDTH; \
+        return ISA##_sum(x, half) + ISA##_sum(x + half, n - half); \
+    } \
+    DEFINE_EXTREMUM(ISA, ATTR, max, WIDTH, VEC, LOAD, STORE, SET1, VADD, VSUB, VMAX, max_number) \
+    DEFINE_EXTREMUM(ISA, ATTR, min, WIDTH, VEC, LOAD, STORE, SET1, VADD, VSUB, VMIN, min_number)
+
+#define DEFINE_EXTREMUM(ISA, ATTR, NAME, WIDTH, VEC, LOAD, STORE, SET1, VADD, VSUB, VOP, OP) \
+    ATTR static double ISA##_##NAME(const double* x, size_t n) { \
+        VEC acc = SET1(x[0]), check = SET1(0.0); \
+        size_t i = 0; \
+        for (; i + WIDTH <= n; i += WIDTH) { \
+            VEC val = LOAD(x + i); \
+            acc = VOP(acc, val); \
+            check = VADD(check, VSUB(val, val)); \
+        } \
+        double lanes[WIDTH], checks[WIDTH]; \
+        STORE(lanes, acc); \
+        STORE(checks, check); \
+        double result = x[0], checked = 0; \
+        for (size_t j = 0; j < WIDTH; j++) { \
+            result = OP(result, lanes[j]); \
+            checked += checks[j]; \
+        } \
+        for (; i < n; i++) result = OP(result, x[i]); \
+        if (checked != checked) { \
+            result = x[0]; \
+            for (i = 1; i < n; i++) result = OP(result, x[i]); \
+        } \
+        return result; \
+    }
+
+// Defines array ^ number for one instruction set, taking the shortcuts
+// pow_number takes with vector instructions. Adding zero to square roots
+// turns the root of -0 into 0, as pow gives. A whole power is built a
+// block at a time by repeated squaring, in the same order pow_number
+// multiplies. Other exponents go to the portable loop calling pow.
+#define DEFINE_POWER(ISA, ATTR, WIDTH, VEC, LOAD, STORE, SET1, VADD, VSQRT) \
+    ATTR static void ISA##_sqrt_array(double* dst, const double* left, size_t n) { \
+        VEC zero = SET1(0.0); \
+        size_t i = 0; \
+        for (; i + WIDTH <= n; i += WIDTH) { \
+            double lanes[WIDTH]; \
+            STORE(lanes, VADD(VSQRT(LOAD(left + i)), zero)); \
+            for (size_t j = 0; j < WIDTH; j++) if (left[i + j] == -INFINITY) lanes[j] = INFINITY; \
+            memcpy(dst + i, lanes, sizeof(lanes)); \
+        } \
+        for (; i < n; i++) dst[i] = pow_number(left[i], 0.5); \
+    } \
+    static void ISA##_power_array_number(double* dst, const double* left, double right, size_t n) { \
+        if (right == 0.5) ISA##_sqrt_array(dst, left, n); \
+        else if (right == -1) ISA##_div_number_array(dst, 1.0, left, n); \
+        else if (!multiplied_power(right)) portable_pow_array_number(dst, left, right, n); \
+        else { \
+            for (size_t start = 0; start < n; start += POWER_BLOCK) { \
+                size_t count = std::min((size_t) POWER_BLOCK, n - start); \
+                double base[POWER_BLOCK]; \
+                memcpy(base, left + start, count * sizeof(double)); \
+                double* result = dst + start; \
+                bool first = true; \
+                for (int power = right; power; power >>= 1) { \
+                    if (power & 1) { \
+                        if (first) memcpy(result, base, count * sizeof(double)); \
+                        else ISA##_mul_array_array(result, result, base, count); \
+                        first = false; \
+                    } \
+                    if (power > 1) ISA##_mul_array_array(base, base, base, count); \
+                } \
+                if (first) for (size_t i = 0; i < count; i++) result[i] = 1; \
+            } \
+        } \
+    }
+
+// Defines the kernels giving and taking masks for one instruction set.
+// VCMP(a, b, PRED) compares vectors, giving 1 where the comparison named
+// PRED holds and 0 elsewhere, and VBLEND(mask, a, b) takes a where mask
+// isn't 0 and b elsewhere. Masks are counted a vector at a time, with the
+// count of each lane exact far past any array's length.
+#define DEFINE_MASKS(ISA, ATTR, WIDTH, VEC, LOAD, STORE, SET1, VADD, VMUL, VMAX, VCMP, VBLEND) \
+    ATTR static inline VEC ISA##_lt(VEC a, VEC b) { return VCMP(a, b, LT); } \
+    ATTR static inline VEC ISA##_le(VEC a, VEC b) { return VCMP(a, b, LE); } \
+    ATTR static inline VEC ISA##_gt(VEC a, VEC b) { return VCMP(a, b, GT); } \
+    ATTR static inline VEC ISA##_ge(VEC a, VEC b) { return VCMP(a, b, GE); } \
+    ATTR static inline VEC ISA##_eq(VEC a, VEC b) { return VCMP(a, b, EQ); } \
+    ATTR static inline VEC ISA##_ne(VEC a, VEC b) { return VCMP(a, b, NE); } \
+    ATTR static inline VEC ISA##_and(VEC a, VEC b) { return VMUL(ISA##_ne(a, SET1(0.0)), ISA##_ne(b, SET1(0.0))); } \
+    ATTR static inline VEC ISA##_or(VEC a, VEC b) { return VMAX(ISA##_ne(a, SET1(0.0)), ISA##_ne(b, SET1(0.0))); } \
+    DEFINE_KERNELS(ISA, ATTR, lt, WIDTH, VEC, LOAD, STORE, SET1, ISA##_lt, LT) \
+    DEFINE_KERNELS(ISA, ATTR, le, WIDTH, VEC, LOAD, STORE, SET1, ISA##_le, LE) \
+    DEFINE_KERNELS(ISA, ATTR, gt, WIDTH, VEC, LOAD, STORE, SET1, ISA##_gt, GT) \
+    DEFINE_KERNELS(ISA, ATTR, ge, WIDTH, VEC, LOAD, STORE, SET1, ISA##_ge, GE) \
+    DEFINE_KERNELS(ISA, ATTR, eq, WIDTH, VEC, LOAD, STORE, SET1, ISA##_eq, EQ) \
+    DEFINE_KERNELS(ISA, ATTR, ne, WIDTH, VEC, LOAD, STORE, SET1, ISA##_ne, NE) \
+    DEFINE_KERNELS(ISA, ATTR, and, WIDTH, VEC, LOAD, STORE, SET1, ISA##_and, LOGICAL_AND) \
+    DEFINE_KERNELS(ISA, ATTR, or, WIDTH, VEC, LOAD, STORE, SET1, ISA##_or, LOGICAL_OR) \
+    ATTR static size_t ISA##_count(const double* mask, size_t n) { \
+        VEC acc = SET1(0.0); \
+        size_t i = 0; \
+        for (; i + WIDTH <= n; i += WIDTH) acc = VADD(acc, ISA##_ne(LOAD(mask + i), SET1(0.0))); \
+        double lanes[WIDTH]; \
+        STORE(lanes, acc); \
+        size_t count = 0; \
+        for (size_t j = 0; j < WIDTH; j++) count += (size_t) lanes[j]; \
+        for (; i < n; i++) count += mask[i] != 0; \
+        return count; \
+    } \
+    ATTR static void ISA##_blend(double* dst, const double* mask, const double* a, size_t a_step, const double* b, size_t b_step, size_t n) { \
+        size_t i = 0; \
+        for (; i + WIDTH <= n; i += WIDTH) { \
+            VEC a_vec = a_step ? LOAD(a + i) : SET1(*a); \
+            VEC b_vec = b_step ? LOAD(b + i) : SET1(*b); \
+            STORE(dst + i, VBLEND(LOAD(mask + i), a_vec, b_vec)); \
+        } \
+        for (; i < n; i++) dst[i] = mask[i] != 0 ? a[i * a_step] : b[i * b_step]; \
+    }
+
+#define DEFINE_ISA(ISA, ATTR, WIDTH, VEC, LOAD, STORE, SET1, VADD, VSUB, VMUL, VDIV, VMAX, VMIN, VSQRT, VCMP, VBLEND) \
+    DEFINE_KERNELS(ISA, ATTR, add, WIDTH, VEC, LOAD, STORE, SET1, VADD, ADD) \
+    DEFINE_KERNELS(ISA, ATTR, sub, WIDTH, VEC, LOAD, STORE, SET1, VSUB, SUB) \
+    DEFINE_KERNELS(ISA, ATTR, mul, WIDTH, VEC, LOAD, STORE, SET1, VMUL, MUL) \
+    DEFINE_KERNELS(ISA, ATTR, div, WIDTH, VEC, LOAD, STORE, SET1, VDIV, DIV) \
+    DEFINE_REDUCTIONS(ISA, ATTR, WIDTH, VEC, LOAD, STORE, SET1, VADD, VSUB, VMAX, VMIN) \
+    DEFINE_POWER(ISA, ATTR, WIDTH, VEC, LOAD, STORE, SET1, VADD, VSQRT) \
+    DEFINE_MASKS(ISA, ATTR, WIDTH, VEC, LOAD, STORE, SET1, VADD, VMUL, VMAX, VCMP, VBLEND)
+
+#define MASK_KERNELS(ISA, KIND) \
+    ISA##_lt_##KIND, ISA##_le_##KIND, ISA##_gt_##KIND, ISA##_ge_##KIND, ISA##_eq_##KIND, ISA##_ne_##KIND, ISA##_and_##KIND, ISA##_or_##KIND
+
+// No instruction set has a vector pow, so every table shares the portable
+// loops for ^ apart from the shortcuts for array ^ number. Only AVX-512 can
+// compress and scatter a vector, and AVX2 and AVX-512 gather one, the other
+// sets use the portable loops.
+#define KERNEL_TABLE(ISA, NAME, COMPRESS, GATHER, SCATTER) { \
+    NAME, \
+    {ISA##_add_array_array, ISA##_sub_array_array, ISA##_mul_array_array, ISA##_div_array_array, portable_pow_array_array, \
+     MASK_KERNELS(ISA, array_array)}, \
+    {ISA##_add_number_array, ISA##_sub_number_array, ISA##_mul_number_array, ISA##_div_number_array, portable_pow_number_array, \
+     MASK_KERNELS(ISA, number_array)}, \
+    {ISA##_add_array_number, ISA##_sub_array_number, ISA##_mul_array_number, ISA##_div_array_number, ISA##_power_array_number, \
+     MASK_KERNELS(ISA, array_number)}, \
+    ISA##_sum, ISA##_max, ISA##_min, ISA##_count, ISA##_blend, COMPRESS, GATHER, SCATTER \
+}
+
+#define LOAD_DOUBLE(ptr) (*(ptr))
+#define STORE_DOUBLE(ptr, val) (*(ptr) = (val))
+#define SET1_DOUBLE(num) (num)
+#define CMP_DOUBLE(a, b, PRED) PRED(a, b)
+#define BLEND_DOUBLE(mask, a, b) ((mask) != 0 ? (a) : (b))
+
+static size_t portable_compress(double* dst, const double* x, const double* mask, size_t n) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (mask[i] != 0) dst[count++] = x[i];
+    }
+    return count;
+}
+
+static void portable_gather(double* dst, const double* src, const size_t* offsets, size_t n) {
+    for (size_t i = 0; i < n; i++) dst[i] = src[offsets[i]];
+}
+
+static void portable_scatter(double* dst, const size_t* offsets, const double* x, size_t x_step, size_t n) {
+    for (size_t i = 0; i < n; i++) dst[offsets[i]] = x[i * x_step];
+}
+
+// Elements of a whole power squared at a time
+#define POWER_BLOCK 256
+
+DEFINE_KERNELS(portable, , pow, 1, double, LOAD_DOUBLE, STORE_DOUBLE, SET1_DOUBLE, pow_number, pow_number)
+DEFINE_ISA(portable, , 1, double, LOAD_DOUBLE, STORE_DOUBLE, SET1_DOUBLE, ADD, SUB, MUL, DIV, max_number, min_number, sqrt,
+           CMP_DOUBLE, BLEND_DOUBLE)
+
+static const Kernels portable_kernels = KERNEL_TABLE(portable, "portable", portable_compress, portable_gather, portable_scatter);
+
+#ifdef X86_KERNELS
+// The comparisons of SSE2 are separate intrinsics, those of AVX and AVX-512
+// take the predicate as an argument. NE is unordered, true for NaNs, as !=
+// is. AVX-512 compares into mask registers.
+#define SSE2_LT _mm_cmplt_pd
+#define SSE2_LE _mm_cmple_pd
+#define SSE2_GT _mm_cmpgt_pd
+#define SSE2_GE _mm_cmpge_pd
+#define SSE2_EQ _mm_cmpeq_pd
+#define SSE2_NE _mm_cmpneq_pd
+#define AVX_LT _CMP_LT_OQ
+#define AVX_LE _CMP_LE_OQ
+#define AVX_GT _CMP_GT_OQ
+#define AVX_GE _CMP_GE_OQ
+#define AVX_EQ _CMP_EQ_OQ
+#define AVX_NE _CMP_NEQ_UQ
+
+#define SSE2_CMP(a, b, PRED) _mm_and_pd(SSE2_##PRED(a, b), _mm_set1_pd(1.0))
+#define SSE2_BLEND(mask, a, b) _mm_or_pd(_mm_and_pd(SSE2_NE(mask, _mm_setzero_pd()), a), _mm_andnot_pd(SSE2_NE(mask, _mm_setzero_pd()), b))
+#define AVX2_CMP(a, b, PRED) _mm256_and_pd(_mm256_cmp_pd(a, b, AVX_##PRED), _mm256_set1_pd(1.0))
+#define AVX2_BLEND(mask, a, b) _mm256_blendv_pd(b, a, _mm256_cmp_pd(mask, _mm256_setzero_pd(), AVX_NE))
+#define AVX512_CMP(a, b, PRED) _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(a, b, AVX_##PRED), _mm512_set1_pd(1.0))
+#define AVX512_BLEND(mask, a, b) _mm512_mask_blend_pd(_mm512_cmp_pd_mask(mask, _mm512_setzero_pd(), AVX_NE), b, a)
+
+DEFINE_ISA(sse2, __attribute__((target("sse2"))), 2, __m128d, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd,
+           _mm_add_pd, _mm_sub_pd, _mm_mul_pd, _mm_div_pd, _mm_max_pd, _mm_min_pd, _mm_sqrt_pd, SSE2_CMP, SSE2_BLEND)
+DEFINE_ISA(avx2, __attribute__((target("avx2"))), 4, __m256d, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd,
+           _mm256_add_pd, _mm256_sub_pd, _mm256_mul_pd, _mm256_div_pd, _mm256_max_pd, _mm256_min_pd, _mm256_sqrt_pd, AVX2_CMP, AVX2_BLEND)
+DEFINE_ISA(avx512, __attribute__((target("avx512f"))), 8, __m512d, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_set1_pd,
+           _mm512_add_pd, _mm512_sub_pd, _mm512_mul_pd, _mm512_div_pd, _mm512_max_pd, _mm512_min_pd, _mm512_sqrt_pd, AVX512_CMP, AVX512_BLEND)
+
+__attribute__((target("avx512f"))) static size_t avx512_compress(double* dst, const double* x, const double* mask, size_t n) {
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __mmask8 keep = _mm512_cmp_pd_mask(_mm512_loadu_pd(mask + i), _mm512_setzero_pd(), AVX_NE);
+        _mm512_mask_compressstoreu_pd(dst + count, keep, _mm512_loadu_pd(x + i));
+        count += __builtin_popcount(keep);
+    }
+    return count + portable_compress(dst + count, x + i, mask + i, n - i);
+}
+
+// Gathers and scatters take offsets as signed 64 bit integers, which the
+// offsets into a buffer always fit
+__attribute__((target("avx2"))) static void avx2_gather(double* dst, const double* src, const size_t* offsets, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i index = _mm256_loadu_si256((const __m256i*) (offsets + i));
+        _mm256_storeu_pd(dst + i, _mm256_i64gather_pd(src, index, sizeof(double)));
+    }
+    portable_gather(dst + i, src, offsets + i, n - i);
+}
+
+__attribute__((target("avx512f"))) static void avx512_gather(double* dst, const double* src, const size_t* offsets, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512i index = _mm512_loadu_si512(offsets + i);
+        _mm512_storeu_pd(dst + i, _mm512_i64gather_pd(index, src, sizeof(double)));
+    }
+    portable_gather(dst + i, src, offsets + i, n - i);
+}
+
+__attribute__((target("avx512f"))) static void avx512_scatter(double* dst, const size_t* offsets, const double* x, size_t x_step, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512i index = _mm512_loadu_si512(offsets + i);
+        _mm512_i64scatter_pd(dst, index, x_step ? _mm512_loadu_pd(x + i) : _mm512_set1_pd(x[0]), sizeof(double));
+    }
+    portable_scatter(dst, offsets + i, x + i * x_step, x_step, n - i);
+}
+
+static const Kernels sse2_kernels = KERNEL_TABLE(sse2, "sse2", portable_compress, portable_gather, portable_scatter);
+static const Kernels avx2_kernels = KERNEL_TABLE(avx2, "avx2", portable_compress, avx2_gather, portable_scatter);
+static const Kernels avx512_kernels = KERNEL_TABLE(avx512, "avx512", avx512_compress, avx512_gather, avx512_scatter);
+#endif
+
+std::vector<const Kernels*> supported_kernels() {
+    std::vector<const Kernels*> supported = {&portable_kernels};
+#ifdef X86_KERNELS
+    // Also checks that the OS saves the wider registers on context switches
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) supported.push_back(&sse2_kernels);
+    if (__builtin_cpu_supports("avx2")) supported.push_back(&avx2_kernels);
+    if (__builtin_cpu_supports("avx512f")) supported.push_back(&avx512_kernels);
+#endif
+    return supported;
+}
+
+static const Kernels& chosen_kernels = *supported_kernels().back();
+
+const Kernels& kernels() {
+    return chosen_kernels;
+}
+
+template <KernelOp OP>
+static inline double apply(double left, double right) {
+    if constexpr (OP == KERNEL_ADD) return left + right;
+    else if constexpr (OP == KERNEL_SUB) return left - right;
+    else if constexpr (OP == KERNEL_MUL) return left * right;
+    else if constexpr (OP == KERNEL_DIV) return left / right;
+    else return pow_number(left, right);
+}
+
+template <KernelOp OP, size_t N>
+static void small_array_array(double* dst, const double* left, const double* right) {
+    #pragma GCC unroll 64
+    for (size_t i = 0; i < N; i++) dst[i] = apply<OP>(left[i], right[i]);
+}
+
+template <KernelOp OP, size_t N>
+static void small_number_array(double* dst, double left, const double* right) {
+    #pragma GCC unroll 64
+    for (size_t i = 0; i < N; i++) dst[i] = apply<OP>(left, right[i]);
+}
+
+template <KernelOp OP, size_t N>
+static void small_array_number(double* dst, const double* left, double right) {
+    #pragma GCC unroll 64
+    for (size_t i = 0; i < N; i++) dst[i] = apply<OP>(left[i], right);
+}
+
+#define SMALL_KERNELS(KIND, N) { \
+    {small_##KIND<KERNEL_ADD, N>...}, {small_##KIND<KERNEL_SUB, N>...}, {small_##KIND<KERNEL_MUL, N>...}, \
+    {small_##KIND<KERNEL_DIV, N>...}, {small_##KIND<KERNEL_POW, N>...} \
+}
+
+template <size_t... N>
+static constexpr SmallKernels make_small_kernels(std::index_sequence<N...>) {
+    return {SMALL_KERNELS(array_array, N), SMALL_KERNELS(number_array, N), SMALL_KERNELS(array_number, N)};
+}
+
+static constexpr SmallKernels small = make_small_kernels(std::make_index_sequence<SMALL_KERNEL_SIZE + 1>());
+
+const SmallKernels& small_kernels() {
+    return small;
+}
+
+KernelOp kernel_op(TokenType type) {
+    switch (type) {
+    case PLUS: return KERNEL_ADD;
+    case MINUS: return KERNEL_SUB;
+    case STAR: return KERNEL_MUL;
+    case SLASH: return KERNEL_DIV;
+    case LESSER: return KERNEL_LT;
+    case LESSER_EQUALS: return KERNEL_LE;
+    case GREATER: return KERNEL_GT;
+    case GREATER_EQUALS: return KERNEL_GE;
+    case EQUALS_EQUALS: return KERNEL_EQ;
+    case EXCLA_EQUALS: return KERNEL_NE;
+    case AND: return KERNEL_AND;
+    case OR: return KERNEL_OR;
+    default: return KERNEL_POW;
+    }
+}
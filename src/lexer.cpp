@@ -64,6 +64,7 @@ const std::unordered_map<std::string, TokenType> Lexer::keywords = {
     {"w", WHILE},
     {"s", SHAPE},
     {"sa", AS_SHAPE},
+    {"tr", TRANSPOSE},
     {"v", ASSERT}
 };
 
@@ -75,6 +76,7 @@ const std::unordered_map<std::string, TokenType> Lexer::operators_flow = {
     {"^", EXP},
     {"@", AT},
     {",", COMMA},
+    {":", COLON},
     {";", SEMI},
     {"(", LEFT_PAREN},
     {")", RIGHT_PAREN},
@@ -14,10 +14,17 @@
 #include <iostream>
 #include <sstream>
 #include <cstring>
+#include <algorithm>
+#include <cstdlib>
 
 #include "lexer.hpp"
 #include "parser.hpp"
 #include "environment.hpp"
+#include "vm.hpp"
+#include "blas.hpp"
+#include "gemm.hpp"
+#include "kernels.hpp"
+#include "thread_pool.hpp"
 
 // We wrap this in an "extern" so that we can access it from
 // JavaScript
@@ -62,13 +69,81 @@ extern "C" {
   }
 }
 
+// Printed to stderr with --report before running the program
+void print_report(bool use_vm) {
+  std::cerr << "Engine: " << (use_vm ? "vm" : "tree") << std::endl;
+  std::cerr << "Threads: " << thread_pool().num_threads() << std::endl;
+  std::cerr << "Elementwise kernels: " << kernels().name << std::endl;
+  if (matmul_backend() == MATMUL_NATIVE) {
+    std::cerr << "Matmul: native (" << gemm_kernel_name() << " kernel)" << std::endl;
+  } else {
+    const BlasProvider& provider = blas_provider();
+    std::cerr << "Matmul: blas (" << provider.name;
+    if (!provider.path.empty()) std::cerr << ", " << provider.path;
+    std::cerr << ")" << std::endl;
+  }
+}
+
 int main(int argc, char* argv[]) {
-  if (argc == 1) {
-    std::cout << "Usage: " << argv[0] << " INPUT_FILE" << std::endl;
+  bool use_vm = false;
+  bool report = false;
+  // The environment variables count as given flags, which the flags
+  // themselves override
+  bool matmul_given = std::getenv("WEAK_MATMUL") != nullptr;
+  std::string blas = std::getenv("WEAK_BLAS") ? std::getenv("WEAK_BLAS") : "";
+  std::vector<std::string> files;
+  for (size_t i = 1; i < (size_t)argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--engine=vm") use_vm = true;
+    else if (arg == "--engine=tree") use_vm = false;
+    else if (arg.rfind("--engine=", 0) == 0) {
+      std::cout << "Unknown engine " << arg.substr(9) << ", expected tree or vm. Quitting." << std::endl;
+      return 1;
+    }
+    else if (arg.rfind("--matmul=", 0) == 0) {
+      MatmulBackend backend;
+      if (!find_matmul_backend(arg.substr(9), backend)) {
+        std::cout << "Unknown matmul backend " << arg.substr(9) << ", expected native or blas. Quitting." << std::endl;
+        return 1;
+      }
+      set_matmul_backend(backend);
+      matmul_given = true;
+    }
+    else if (arg.rfind("--blas=", 0) == 0) blas = arg.substr(7);
+    else if (arg == "--report") report = true;
+    else if (arg.rfind("--threads=", 0) == 0) {
+      size_t num_threads = strtoul(arg.c_str() + 10, nullptr, 10);
+      if (num_threads == 0) {
+        std::cout << "Invalid thread count " << arg.substr(10) << ", expected a positive number. Quitting." << std::endl;
+        return 1;
+      }
+      set_num_threads(num_threads);
+    }
+    else files.push_back(arg);
+  }
+  if (files.empty()) {
+    std::cout << "Usage: " << argv[0] << " [--engine=tree|vm] [--matmul=native|blas] [--blas=PROVIDER] [--threads=N] [--report] INPUT_FILE" << std::endl;
     return 1;
   }
-  for (size_t i = 1; i < (size_t)argc; i++) {
-    std::ifstream input_file(argv[i]);
+  // Naming a provider, with --blas or WEAK_BLAS, also switches @ to it
+  // unless --matmul or WEAK_MATMUL says otherwise
+  if (!blas.empty()) {
+    const std::vector<std::string>& names = blas_provider_names();
+    if (std::find(names.begin(), names.end(), blas) == names.end()) {
+      std::cout << "Unknown BLAS provider " << blas << ", expected one of";
+      for (const std::string& name : names) std::cout << " " << name;
+      std::cout << ". Quitting." << std::endl;
+      return 1;
+    }
+    if (!load_blas_provider(blas)) {
+      std::cout << "Couldn't load BLAS provider " << blas << ". Quitting." << std::endl;
+      return 1;
+    }
+    if (!matmul_given) set_matmul_backend(MATMUL_BLAS);
+  }
+  if (report) print_report(use_vm);
+  for (const std::string& file : files) {
+    std::ifstream input_file(file);
     if (input_file.is_open()) {
       std::string read((std::istreambuf_iterator<char>(input_file)),
                        (std::istreambuf_iterator<char>()));
@@ -81,11 +156,16 @@ int main(int argc, char* argv[]) {
       Parser p(tokens);
       std::vector<Stmt*> program = p.parse();
       //std::cout << p.as_dot() << std::endl;
-      Environment env;
-      for (Stmt* stmt : program) env.execute_stmt(stmt);
+      if (use_vm) {
+        VM vm;
+        vm.run(program);
+      } else {
+        Environment env;
+        for (Stmt* stmt : program) env.execute_stmt(stmt);
+      }
       for (auto stmt : program) delete stmt;
     } else {
-      std::cout << "Couldn't open file " << argv[i] << ". Quitting."
+      std::cout << "Couldn't open file " << file << ". Quitting."
                 << std::endl;
       return 1;
     }
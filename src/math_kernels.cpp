@@ -0,0 +1,346 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#include <cstdint>
+#include <cstring>
+#include <math.h>
+
+#include "math_kernels.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define X86_KERNELS
+#endif
+
+// The approximations are written once over GCC vector extensions and
+// instantiated at every width. They are always inlined into kernels built
+// for the instruction set of that width, so the ABI GCC warns about for wide
+// vectors never applies. Vectors are passed by reference since GCC reports
+// passing them by value even with the warning off.
+#if defined(__GNUC__) && !defined(__clang__)
+    #pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+#define ALWAYS_INLINE __attribute__((always_inline)) inline
+
+template <size_t N>
+struct Lanes {
+    typedef double Double __attribute__((vector_size(N * sizeof(double))));
+    typedef int64_t Int __attribute__((vector_size(N * sizeof(double))));
+    typedef uint64_t Bits __attribute__((vector_size(N * sizeof(double))));
+};
+
+// Adding this to a double below 2^51 in magnitude rounds it to an integer,
+// which ends up in the low bits of the sum
+const double ROUNDING_SHIFT = 0x1.8p52;
+const int64_t SIGN_BIT = INT64_MIN;
+const int64_t EXPONENT_BITS = 0x7ff0000000000000;
+
+// Range checks compare the bits of doubles as integers. Positive doubles
+// order the same way as their bits, NaNs above infinity, and GCC lowers
+// integer comparisons to vector instructions where it sometimes splits
+// floating point ones into one comparison per lane.
+
+template <typename V, typename I>
+ALWAYS_INLINE static V select(const I& mask, const V& a, const V& b) {
+    return (V) ((mask & (I) a) | (~mask & (I) b));
+}
+
+template <typename V, typename I>
+ALWAYS_INLINE static V abs_lanes(const V& x) {
+    return (V) ((I) x & ~SIGN_BIT);
+}
+
+// Doubles holding the integers i, |i| < 2^51
+template <typename V, typename I>
+ALWAYS_INLINE static V to_double(const I& i) {
+    V shift = ROUNDING_SHIFT + V{};
+    return (V) (i + (I) shift) - shift;
+}
+
+// 2^n for -1022 <= n <= 1023
+template <typename V, typename I>
+ALWAYS_INLINE static V exp2_integer(const I& n) {
+    return (V) ((n + 1023) << 52);
+}
+
+const double LOG2E = 1.44269504088896338700e+00;
+// ln 2 split so that n LN2_HI is exact for |n| < 2^11
+const double LN2_HI = 6.93147180369123816490e-01;
+const double LN2_LO = 1.90821492927058770002e-10;
+
+// x = n ln 2 + r with |r| <= ln 2 / 2
+template <typename V, typename I>
+ALWAYS_INLINE static V reduce_ln2(const V& x, I& n) {
+    V shift = ROUNDING_SHIFT + V{};
+    V t = x * LOG2E + shift;
+    V whole = t - shift;
+    n = (I) t - (I) shift;
+    return (x - whole * LN2_HI) - whole * LN2_LO;
+}
+
+// e^r - 1 by its Taylor series, to within an ulp for |r| < 0.75
+template <typename V>
+ALWAYS_INLINE static V expm1_series(const V& r) {
+    V p = 1.0 / 121645100408832000.0 + V{};
+    p = p * r + 1.0 / 6402373705728000.0;
+    p = p * r + 1.0 / 355687428096000.0;
+    p = p * r + 1.0 / 20922789888000.0;
+    p = p * r + 1.0 / 1307674368000.0;
+    p = p * r + 1.0 / 87178291200.0;
+    p = p * r + 1.0 / 6227020800.0;
+    p = p * r + 1.0 / 479001600.0;
+    p = p * r + 1.0 / 39916800.0;
+    p = p * r + 1.0 / 3628800.0;
+    p = p * r + 1.0 / 362880.0;
+    p = p * r + 1.0 / 40320.0;
+    p = p * r + 1.0 / 5040.0;
+    p = p * r + 1.0 / 720.0;
+    p = p * r + 1.0 / 120.0;
+    p = p * r + 1.0 / 24.0;
+    p = p * r + 1.0 / 6.0;
+    p = p * r + 0.5;
+    return r + r * r * p;
+}
+
+// Same as above for |r| <= ln 2 / 2, where fewer terms do
+template <typename V>
+ALWAYS_INLINE static V expm1_short_series(const V& r) {
+    V p = 1.0 / 6227020800.0 + V{};
+    p = p * r + 1.0 / 479001600.0;
+    p = p * r + 1.0 / 39916800.0;
+    p = p * r + 1.0 / 3628800.0;
+    p = p * r + 1.0 / 362880.0;
+    p = p * r + 1.0 / 40320.0;
+    p = p * r + 1.0 / 5040.0;
+    p = p * r + 1.0 / 720.0;
+    p = p * r + 1.0 / 120.0;
+    p = p * r + 1.0 / 24.0;
+    p = p * r + 1.0 / 6.0;
+    p = p * r + 0.5;
+    return r + r * r * p;
+}
+
+const double EXP_LIMIT = 708.0;
+
+// e^x = 2^n e^r
+template <typename V, typename I>
+ALWAYS_INLINE static V exp_lanes(const V& arg, I& special) {
+    I in_range = (I) abs_lanes<V, I>(arg) < (I) (EXP_LIMIT + V{});
+    special = ~in_range;
+    V x = select(in_range, arg, V{});
+    I n;
+    V r = reduce_ln2(x, n);
+    return (1.0 + expm1_short_series(r)) * exp2_integer<V, I>(n);
+}
+
+// log(x) = k ln 2 + log(m) for m in [sqrt(2) / 2, sqrt(2)), with log(m)
+// from the series of fdlibm's log
+const double SQRT2 = 1.41421356237309514547e+00;
+const double LG1 = 6.666666666666735130e-01, LG2 = 3.999999999940941908e-01, LG3 = 2.857142874366239149e-01,
+             LG4 = 2.222219843214978396e-01, LG5 = 1.818357216161805012e-01, LG6 = 1.531383769920937332e-01,
+             LG7 = 1.479819860511658591e-01;
+
+template <typename V, typename I>
+ALWAYS_INLINE static V log_lanes(const V& arg, I& special) {
+    typedef typename Lanes<sizeof(V) / sizeof(double)>::Bits U;
+    // Positive normal numbers, zero, negatives, subnormals, infinity and
+    // NaN go to libm
+    I normal = (I) ((U) arg - 0x0010000000000000 < 0x7fe0000000000000);
+    special = ~normal;
+    V x = select(normal, arg, 1.0 + V{});
+    I bits = (I) x;
+    I k = (bits >> 52) - 1023;
+    V m = (V) ((bits & 0x000fffffffffffff) | 0x3ff0000000000000);
+    I halve = (I) m > (I) (SQRT2 + V{});
+    m = select(halve, m * 0.5, m);
+    k = k - halve;
+    V whole = to_double<V, I>(k);
+    V f = m - 1.0;
+    V s = f / (2.0 + f);
+    V z = s * s;
+    V w = z * z;
+    V r = z * (LG1 + w * (LG3 + w * (LG5 + w * LG7))) + w * (LG2 + w * (LG4 + w * LG6));
+    V half_square = 0.5 * f * f;
+    return whole * LN2_HI - ((half_square - (s * (half_square + r) + whole * LN2_LO)) - f);
+}
+
+// x = n pi / 2 + y + lo, reduced as fdlibm does for medium arguments,
+// then sin and cos of y + lo from fdlibm's kernels
+const double TRIG_LIMIT = 1e5;
+const double TWO_OVER_PI = 6.36619772367581382433e-01;
+const double PIO2_1 = 1.57079632673412561417e+00, PIO2_2 = 6.07710050630396597660e-11,
+             PIO2_2T = 2.02226624879595063154e-21;
+const double S1 = -1.66666666666666324348e-01, S2 = 8.33333333332248946124e-03, S3 = -1.98412698298579493134e-04,
+             S4 = 2.75573137070700676789e-06, S5 = -2.50507602534068634195e-08, S6 = 1.58969099521155010221e-10;
+const double C1 = 4.16666666666666019037e-02, C2 = -1.38888888888741095749e-03, C3 = 2.48015872894767294178e-05,
+             C4 = -2.75573143513906633035e-07, C5 = 2.08757232129817482790e-09, C6 = -1.13596475577881948265e-11;
+
+template <typename V, typename I>
+ALWAYS_INLINE static void sin_cos_lanes(const V& arg, V& sin_y, V& cos_y, I& quadrant, I& special) {
+    I in_range = (I) abs_lanes<V, I>(arg) < (I) (TRIG_LIMIT + V{});
+    special = ~in_range;
+    V x = select(in_range, arg, V{});
+    V shift = ROUNDING_SHIFT + V{};
+    V t = x * TWO_OVER_PI + shift;
+    V n = t - shift;
+    quadrant = (I) t - (I) shift;
+    V hi = x - n * PIO2_1;
+    V w = n * PIO2_2;
+    V r = hi - w;
+    w = n * PIO2_2T - ((hi - r) - w);
+    V y = r - w;
+    V lo = (r - y) - w;
+    V z = y * y;
+    V v = z * y;
+    V s = S2 + z * (S3 + z * (S4 + z * (S5 + z * S6)));
+    sin_y = y - ((z * (0.5 * lo - v * s) - lo) - v * S1);
+    V c = z * (C1 + z * (C2 + z * (C3 + z * (C4 + z * (C5 + z * C6)))));
+    V half_z = 0.5 * z;
+    V one_minus = 1.0 - half_z;
+    cos_y = one_minus + (((1.0 - one_minus) - half_z) + (z * c - y * lo));
+}
+
+template <typename V, typename I>
+ALWAYS_INLINE static V sin_lanes(const V& x, I& special) {
+    V sin_y, cos_y;
+    I quadrant;
+    sin_cos_lanes(x, sin_y, cos_y, quadrant, special);
+    V result = select((quadrant & 1) != 0, cos_y, sin_y);
+    return (V) ((I) result ^ ((quadrant & 2) << 62));
+}
+
+template <typename V, typename I>
+ALWAYS_INLINE static V cos_lanes(const V& x, I& special) {
+    V sin_y, cos_y;
+    I quadrant;
+    sin_cos_lanes(x, sin_y, cos_y, quadrant, special);
+    V result = select((quadrant & 1) != 0, sin_y, cos_y);
+    return (V) ((I) result ^ (((quadrant + 1) & 2) << 62));
+}
+
+// tanh(x) = e / (e + 2) for e = e^2|x| - 1, with the sign of x. Past 20
+// the result rounds to 1.
+template <typename V, typename I>
+ALWAYS_INLINE static V tanh_lanes(const V& x, I& special) {
+    V a = abs_lanes<V, I>(x);
+    special = (I) a > EXPONENT_BITS;
+    a = select((I) a < (I) (20.0 + V{}), a, 20.0 + V{});
+    V twice = 2.0 * a;
+    // Small arguments skip the reduction, whose rounding would show
+    I n;
+    V r = reduce_ln2(twice, n);
+    I small = (I) twice < (I) (0.75 + V{});
+    r = select(small, twice, r);
+    n = select(small, I{}, n);
+    V scale = exp2_integer<V, I>(n);
+    V e = scale * expm1_series(r) + (scale - 1.0);
+    // Corrects for the rounding of the denominator
+    V d = e + 2.0;
+    V d_error = (2.0 - d) + e;
+    V q = e / d;
+    V t = q - q * (d_error / d);
+    return (V) ((I) t | ((I) x & SIGN_BIT));
+}
+
+// Applies F a vector of N elements at a time, then to the last few padded
+// out to a vector, and SCALAR to the elements F marks special
+template <size_t N, typename Lanes<N>::Double (*F)(const typename Lanes<N>::Double&, typename Lanes<N>::Int&), double (*SCALAR)(double)>
+ALWAYS_INLINE static void map_lanes(double* dst, const double* x, size_t n) {
+    typedef typename Lanes<N>::Double V;
+    typedef typename Lanes<N>::Int I;
+    size_t i = 0;
+    for (; i + N <= n; i += N) {
+        V val;
+        memcpy(&val, x + i, sizeof(V));
+        I special;
+        V result = F(val, special);
+        int64_t any = 0;
+        for (size_t j = 0; j < N; j++) any |= special[j];
+        if (any) {
+            for (size_t j = 0; j < N; j++) if (special[j]) result[j] = SCALAR(val[j]);
+        }
+        memcpy(dst + i, &result, sizeof(V));
+    }
+    if (i == n) return;
+    V val = 1.0 + V{};
+    for (size_t j = 0; i + j < n; j++) val[j] = x[i + j];
+    I special;
+    V result = F(val, special);
+    for (size_t j = 0; i + j < n; j++) dst[i + j] = special[j] ? SCALAR(val[j]) : result[j];
+}
+
+#define DEFINE_MATH_KERNEL(ISA, ATTR, WIDTH, NAME) \
+    ATTR static void ISA##_##NAME(double* dst, const double* x, size_t n) { \
+        map_lanes<WIDTH, NAME##_lanes<Lanes<WIDTH>::Double, Lanes<WIDTH>::Int>, NAME>(dst, x, n); \
+    }
+
+// Defines the kernels of one instruction set, named NAME. sqrt is one
+// instruction, VSQRT, a vector at a time.
+#define DEFINE_MATH(ISA, NAME, ATTR, WIDTH, LOAD, STORE, VSQRT) \
+    DEFINE_MATH_KERNEL(ISA, ATTR, WIDTH, exp) \
+    DEFINE_MATH_KERNEL(ISA, ATTR, WIDTH, log) \
+    DEFINE_MATH_KERNEL(ISA, ATTR, WIDTH, sin) \
+    DEFINE_MATH_KERNEL(ISA, ATTR, WIDTH, cos) \
+    DEFINE_MATH_KERNEL(ISA, ATTR, WIDTH, tanh) \
+    ATTR static void ISA##_sqrt(double* dst, const double* x, size_t n) { \
+        size_t i = 0; \
+        for (; i + WIDTH <= n; i += WIDTH) STORE(dst + i, VSQRT(LOAD(x + i))); \
+        for (; i < n; i++) dst[i] = sqrt(x[i]); \
+    } \
+    static const MathKernels ISA##_math_kernels = { \
+        NAME, {ISA##_exp, ISA##_log, ISA##_sqrt, ISA##_sin, ISA##_cos, ISA##_tanh} \
+    };
+
+// Without vector instructions the approximations are slower than libm, so
+// the portable loops call it
+#define DEFINE_LIBM_KERNEL(NAME) \
+    static void portable_##NAME(double* dst, const double* x, size_t n) { \
+        for (size_t i = 0; i < n; i++) dst[i] = NAME(x[i]); \
+    }
+
+DEFINE_LIBM_KERNEL(exp)
+DEFINE_LIBM_KERNEL(log)
+DEFINE_LIBM_KERNEL(sqrt)
+DEFINE_LIBM_KERNEL(sin)
+DEFINE_LIBM_KERNEL(cos)
+DEFINE_LIBM_KERNEL(tanh)
+
+static const MathKernels portable_math_kernels = {
+    "portable", {portable_exp, portable_log, portable_sqrt, portable_sin, portable_cos, portable_tanh}
+};
+
+#ifdef X86_KERNELS
+// The 2 wide set needs SSE4.2 for comparisons of 64 bit integers, which
+// SSE2 would split into one per lane
+DEFINE_MATH(sse42, "sse4.2", __attribute__((target("sse4.2"))), 2, _mm_loadu_pd, _mm_storeu_pd, _mm_sqrt_pd)
+DEFINE_MATH(avx2, "avx2", __attribute__((target("avx2"))), 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_sqrt_pd)
+DEFINE_MATH(avx512, "avx512", __attribute__((target("avx512f"))), 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_sqrt_pd)
+#endif
+
+std::vector<const MathKernels*> supported_math_kernels() {
+    std::vector<const MathKernels*> supported = {&portable_math_kernels};
+#ifdef X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) supported.push_back(&sse42_math_kernels);
+    if (__builtin_cpu_supports("avx2")) supported.push_back(&avx2_math_kernels);
+    if (__builtin_cpu_supports("avx512f")) supported.push_back(&avx512_math_kernels);
+#endif
+    return supported;
+}
+
+static const MathKernels& chosen_math_kernels = *supported_math_kernels().back();
+
+const MathKernels& math_kernels() {
+    return chosen_math_kernels;
+}
@@ -0,0 +1,88 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "matrix_chain.hpp"
+#include "operations.hpp"
+
+void check_chain(const Variable* operands, size_t n, const Token& op) {
+    bool left_array = operands[0].is_ndarray();
+    std::vector<size_t> left_shape;
+    if (left_array) left_shape = std::get<NDArray>(operands[0].value).shape();
+    for (size_t i = 1; i + 1 < n; i++) {
+        left_shape = matrix_product_shape(op, left_shape, std::get<NDArray>(operands[i].value).shape());
+        // Two vectors give a number
+        left_array = !left_shape.empty();
+    }
+    runtime_assert(left_array, op, "Left expression isn't an ndarray");
+    runtime_assert(operands[n - 1].is_ndarray(), op, "Right expression isn't an ndarray");
+    matrix_product_shape(op, left_shape, std::get<NDArray>(operands[n - 1].value).shape());
+}
+
+// Split of every range of the chain with matrices of dims[i] x dims[i + 1],
+// from the cheapest products of its shorter ranges. Ties go to the later
+// split, so equal costs keep the left to right order.
+static std::vector<size_t> choose_order(const std::vector<size_t>& dims) {
+    size_t n = dims.size() - 1;
+    std::vector<double> cost(n * n, 0);
+    std::vector<size_t> splits(n * n, 0);
+    for (size_t length = 2; length <= n; length++) {
+        for (size_t i = 0; i + length <= n; i++) {
+            size_t j = i + length - 1;
+            cost[i * n + j] = -1;
+            for (size_t s = i; s < j; s++) {
+                double c = cost[i * n + s] + cost[(s + 1) * n + j] + (double) dims[i] * dims[s + 1] * dims[j + 1];
+                if (cost[i * n + j] < 0 || c <= cost[i * n + j]) {
+                    cost[i * n + j] = c;
+                    splits[i * n + j] = s;
+                }
+            }
+        }
+    }
+    return splits;
+}
+
+static Variable multiply_range(const Variable* operands, const Token* const* ops, size_t n,
+                               const std::vector<size_t>& splits, size_t i, size_t j) {
+    if (i == j) return operands[i];
+    size_t s = splits[i * n + j];
+    Variable left = multiply_range(operands, ops, n, splits, i, s);
+    Variable right = multiply_range(operands, ops, n, splits, s + 1, j);
+    return binary_operation(*ops[s], left, right);
+}
+
+Variable multiply_chain(const Variable* operands, const Token* const* ops, size_t n, ChainOrder& order) {
+    // Any grouping gives the same value when every operand is a matrix,
+    // or a vector at either end of the chain
+    std::vector<size_t> dims(n + 1);
+    for (size_t i = 0; i < n; i++) {
+        const std::vector<size_t>& shape = std::get<NDArray>(operands[i].value).shape();
+        if (shape.size() == 2) {
+            dims[i] = shape[0];
+            dims[i + 1] = shape[1];
+        } else if (shape.size() == 1 && i == 0) {
+            dims[0] = 1;
+            dims[1] = shape[0];
+        } else if (shape.size() == 1 && i == n - 1) {
+            dims[n] = 1;
+        } else {
+            Variable result = operands[0];
+            for (size_t j = 1; j < n; j++) result = binary_operation(*ops[j - 1], result, operands[j]);
+            return result;
+        }
+    }
+    if (order.dims != dims) {
+        order.splits = choose_order(dims);
+        order.dims = std::move(dims);
+    }
+    return multiply_range(operands, ops, n, order.splits, 0, n - 1);
+}
@@ -0,0 +1,269 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#include <tuple>
+
+#include "ndarray.hpp"
+
+// Strides of a row major array of this shape
+static std::vector<size_t> row_major(const std::vector<size_t>& shape) {
+    std::vector<size_t> strides(shape.size());
+    size_t stride = 1;
+    for (size_t i = shape.size(); i-- > 0;) {
+        strides[i] = stride;
+        stride *= shape[i];
+    }
+    return strides;
+}
+
+NDArray::NDArray(Elements data, std::vector<size_t> shape):
+    buffer(std::make_shared<Elements>(std::move(data))), dims(std::move(shape)) {}
+
+NDArray NDArray::computed(Elements pattern, std::vector<size_t> shape, double drift) {
+    size_t period = pattern.size();
+    return computed(NDArray(std::move(pattern), {period}), std::move(shape), drift);
+}
+
+NDArray NDArray::computed(const NDArray& pattern, std::vector<size_t> shape, double drift) {
+    NDArray array;
+    array.dims = std::move(shape);
+    array.masks = pattern.masks;
+    array.count = 1;
+    for (size_t dim : array.dims) array.count *= dim;
+    if (array.count == 0) {
+        array.buffer = std::make_shared<Elements>();
+        return array;
+    }
+    // A pattern that repeats a period of its own repeats that period
+    if (pattern.repeats() && drift == 0 && pattern.count % pattern.cycle == 0) {
+        array.buffer = pattern.buffer;
+        array.start = pattern.start;
+        array.cycle = pattern.cycle;
+        return array;
+    }
+    const double* first = pattern.elements();
+    array.buffer = pattern.buffer;
+    array.start = first - pattern.buffer->data();
+    array.cycle = pattern.size();
+    array.drift = drift;
+    // All of a buffer once over is an ordinary array
+    if (drift == 0 && array.start == 0 && array.count == array.cycle && array.buffer->size() == array.count) array.cycle = 0;
+    return array;
+}
+
+NDArray::NDArray(const NDArray& parent, size_t offset, std::vector<size_t> shape, std::vector<size_t> strides):
+    buffer(parent.stored()), dims(std::move(shape)), steps(std::move(strides)), start(offset), count(1), masks(parent.masks) {
+    for (size_t dim : dims) count *= dim;
+    // A view of all of the buffer in order is an ordinary array
+    if (start == 0 && count == buffer->size() && dense()) steps.clear();
+}
+
+// Copies the elements of a view into a buffer of their own, a row of the
+// last dimension at a time
+void NDArray::materialize() const {
+    if (cycle) {
+        auto copy = std::make_shared<Elements>(count);
+        compute(copy->data(), 0, count);
+        buffer = std::move(copy);
+        cycle = 0;
+        start = 0;
+        return;
+    }
+    if (steps.empty()) return;
+    auto copy = std::make_shared<Elements>(count);
+    if (count > 0) {
+        const double* src = buffer->data();
+        double* dst = copy->data();
+        size_t last = dims.size() - 1;
+        size_t row = dims[last];
+        size_t step = steps[last];
+        std::vector<size_t> index(dims.size(), 0);
+        size_t pos = start;
+        for (size_t done = 0; done < count; done += row) {
+            for (size_t j = 0; j < row; j++) *dst++ = src[pos + j * step];
+            // Moves to the next row like an odometer
+            for (size_t i = last; i-- > 0;) {
+                pos += steps[i];
+                if (++index[i] < dims[i]) break;
+                pos -= index[i] * steps[i];
+                index[i] = 0;
+            }
+        }
+    }
+    buffer = std::move(copy);
+    steps.clear();
+    start = 0;
+}
+
+// Buffer of an array that stores its elements, computed ones being copied
+// out first
+const std::shared_ptr<Elements>& NDArray::stored() const {
+    if (cycle) materialize();
+    return buffer;
+}
+
+const Elements& NDArray::data() const {
+    materialize();
+    return *buffer;
+}
+
+Elements& NDArray::mutable_data() {
+    materialize();
+    if (buffer.use_count() > 1) buffer = std::make_shared<Elements>(*buffer);
+    return *buffer;
+}
+
+bool NDArray::unique() const {
+    return steps.empty() && !cycle && buffer.use_count() == 1;
+}
+
+const std::vector<size_t>& NDArray::shape() const {
+    return dims;
+}
+
+size_t NDArray::size() const {
+    return steps.empty() && !cycle ? buffer->size() : count;
+}
+
+const double* NDArray::elements() const {
+    if (!dense()) materialize();
+    return buffer->data() + start;
+}
+
+bool NDArray::is_view() const {
+    return !steps.empty();
+}
+
+bool NDArray::dense() const {
+    if (cycle) return false;
+    if (steps.empty()) return true;
+    size_t stride = 1;
+    for (size_t i = dims.size(); i-- > 0;) {
+        // Steps along a dimension of length 1 are never taken
+        if (dims[i] != 1 && steps[i] != stride) return false;
+        stride *= dims[i];
+    }
+    return true;
+}
+
+const double* NDArray::buffer_data() const {
+    return stored()->data();
+}
+
+size_t NDArray::offset() const {
+    stored();
+    return start;
+}
+
+bool NDArray::is_computed() const {
+    return cycle != 0;
+}
+
+bool NDArray::repeats() const {
+    return cycle != 0 && drift == 0;
+}
+
+const double* NDArray::pattern() const {
+    return buffer->data() + start;
+}
+
+size_t NDArray::period() const {
+    return cycle;
+}
+
+void NDArray::compute(double* dst, size_t begin, size_t n) const {
+    const double* table = pattern();
+    size_t i = begin % cycle;
+    if (drift == 0) {
+        for (size_t j = 0; j < n; j++) {
+            dst[j] = table[i];
+            if (++i == cycle) i = 0;
+        }
+        return;
+    }
+    size_t repetition = begin / cycle;
+    for (size_t j = 0; j < n; j++) {
+        dst[j] = table[i] + repetition * drift;
+        if (++i == cycle) {
+            i = 0;
+            repetition++;
+        }
+    }
+}
+
+std::vector<size_t> NDArray::strides() const {
+    return steps.empty() ? row_major(dims) : steps;
+}
+
+double NDArray::at(const size_t* indices) const {
+    if (steps.empty()) {
+        size_t flat = 0;
+        for (size_t i = 0; i < dims.size(); i++) flat = flat * dims[i] + indices[i];
+        if (!cycle) return (*buffer)[flat];
+        double element;
+        compute(&element, flat, 1);
+        return element;
+    }
+    size_t pos = start;
+    for (size_t i = 0; i < dims.size(); i++) pos += indices[i] * steps[i];
+    return (*buffer)[pos];
+}
+
+NDArray NDArray::transpose() const {
+    stored();
+    std::vector<size_t> strides = this->strides();
+    return NDArray(*this, start, std::vector<size_t>(dims.rbegin(), dims.rend()), std::vector<size_t>(strides.rbegin(), strides.rend()));
+}
+
+NDArray NDArray::reshape(std::vector<size_t> shape) const {
+    if (cycle) {
+        NDArray array = *this;
+        array.dims = std::move(shape);
+        return array;
+    }
+    if (!dense()) materialize();
+    std::vector<size_t> strides = row_major(shape);
+    return NDArray(*this, start, std::move(shape), std::move(strides));
+}
+
+bool NDArray::is_mask() const {
+    return masks;
+}
+
+void NDArray::set_mask(bool mask) {
+    masks = mask;
+}
+
+bool NDArray::operator==(const NDArray& other) const {
+    return data() == other.data() && dims == other.dims;
+}
+
+bool NDArray::operator!=(const NDArray& other) const {
+    return !(*this == other);
+}
+
+bool NDArray::operator<(const NDArray& other) const {
+    return std::tie(data(), dims) < std::tie(other.data(), other.dims);
+}
+
+bool NDArray::operator<=(const NDArray& other) const {
+    return !(other < *this);
+}
+
+bool NDArray::operator>(const NDArray& other) const {
+    return other < *this;
+}
+
+bool NDArray::operator>=(const NDArray& other) const {
+    return !(*this < other);
+}
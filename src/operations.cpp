@@ -0,0 +1,740 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+#include <algorithm>
+
+#include "operations.hpp"
+#include "gemm.hpp"
+#include "kernels.hpp"
+#include "thread_pool.hpp"
+
+std::vector<size_t> matrix_product_shape(const Token& op, std::vector<size_t> left_shape, std::vector<size_t> right_shape) {
+    bool left_vector = left_shape.size() == 1;
+    bool right_vector = right_shape.size() == 1;
+    if (left_vector && right_vector) {
+        runtime_assert(left_shape[0] == right_shape[0], op, "Arrays differ in length");
+    } else if (left_vector) {
+        runtime_assert(left_shape[0] == right_shape[right_shape.size() - 2], op, "Left array's length differs from right array's num of rows");
+    } else if (right_vector) {
+        runtime_assert(left_shape.back() == right_shape[0], op, "Left array's num of cols differs from right array's length");
+    } else {
+        runtime_assert(left_shape.back() == right_shape[right_shape.size() - 2], op, "Left array's num of cols differs from right array's num of rows");
+    }
+    if (left_vector) left_shape.insert(left_shape.begin(), 1);
+    if (right_vector) right_shape.push_back(1);
+    std::vector<size_t> left_batch (left_shape.begin(), left_shape.end() - 2);
+    std::vector<size_t> right_batch (right_shape.begin(), right_shape.end() - 2);
+    runtime_assert(left_batch.empty() || right_batch.empty() || left_batch == right_batch, op, "Arrays differ in the dimensions of their stacks of matrices");
+    std::vector<size_t> shape = left_batch.empty() ? right_batch : left_batch;
+    if (!left_vector) shape.push_back(left_shape[left_shape.size() - 2]);
+    if (!right_vector) shape.push_back(right_shape.back());
+    return shape;
+}
+
+// Layout of a matrix for matmul: row major with leading dimension ld, or
+// transposed with it when trans is set. A view that is neither, such as a
+// matrix with both strides above 1, is copied out first.
+static const double* matrix_layout(const NDArray& matrix, size_t& ld, bool& trans) {
+    const std::vector<size_t>& shape = matrix.shape();
+    if (matrix.is_view()) {
+        std::vector<size_t> strides = matrix.strides();
+        const double* first = matrix.buffer_data() + matrix.offset();
+        // The step along a dimension of length 1 is never taken
+        if (shape[1] == 1) strides[1] = 1;
+        if (strides[1] == 1) {
+            trans = false;
+            ld = shape[0] == 1 ? shape[1] : strides[0];
+            if (ld >= shape[1]) return first;
+        }
+        else if (strides[0] == 1 || shape[0] == 1) {
+            trans = true;
+            ld = strides[1];
+            if (ld >= shape[0]) return first;
+        }
+    }
+    trans = false;
+    ld = shape[1];
+    return matrix.elements();
+}
+
+static Variable matrix_product(const Token& op, const NDArray& left, const NDArray& right) {
+    const std::vector<size_t>& left_shape = left.shape();
+    const std::vector<size_t>& right_shape = right.shape();
+    // Two matrices, most often small ones, skip building the shapes of
+    // stacks and vectors
+    if (left_shape.size() == 2 && right_shape.size() == 2) {
+        runtime_assert(left_shape[1] == right_shape[0], op, "Left array's num of cols differs from right array's num of rows");
+        Elements result(left_shape[0] * right_shape[1]);
+        size_t lda, ldb;
+        bool trans_a, trans_b;
+        const double* a = matrix_layout(left, lda, trans_a);
+        const double* b = matrix_layout(right, ldb, trans_b);
+        matmul(left_shape[0], right_shape[1], left_shape[1], a, lda, trans_a, b, ldb, trans_b, result.data());
+        return Variable(NDArray(std::move(result), {left_shape[0], right_shape[1]}));
+    }
+    std::vector<size_t> shape = matrix_product_shape(op, left_shape, right_shape);
+    size_t k = right_shape.size() == 1 ? right_shape[0] : right_shape[right_shape.size() - 2];
+    size_t m = left_shape.size() == 1 ? 1 : left_shape[left_shape.size() - 2];
+    size_t n = right_shape.size() == 1 ? 1 : right_shape.back();
+    if (shape.empty()) {
+        double dot;
+        matmul(1, 1, k, left.elements(), right.elements(), &dot);
+        return Variable(dot);
+    }
+    // The dimensions of the result before its matrices index the stack. A
+    // side with no stack of its own multiplies every matrix of the other.
+    size_t matrix_dims = (left_shape.size() > 1) + (right_shape.size() > 1);
+    size_t count = 1;
+    for (size_t i = 0; i + matrix_dims < shape.size(); i++) count *= shape[i];
+    size_t stride_a = left_shape.size() > 2 ? m * k : 0;
+    size_t stride_b = right_shape.size() > 2 ? k * n : 0;
+    Elements result(count * m * n);
+    batched_matmul(count, m, n, k, left.elements(), stride_a, right.elements(), stride_b, result.data());
+    return Variable(NDArray(std::move(result), shape));
+}
+
+std::vector<size_t> broadcast_shape(const Token& op, const std::vector<size_t>& left_shape, const std::vector<size_t>& right_shape) {
+    size_t dims = std::max(left_shape.size(), right_shape.size());
+    std::vector<size_t> shape(dims);
+    for (size_t i = 0; i < dims; i++) {
+        size_t left = i < left_shape.size() ? left_shape[left_shape.size() - 1 - i] : 1;
+        size_t right = i < right_shape.size() ? right_shape[right_shape.size() - 1 - i] : 1;
+        runtime_assert(left == right || left == 1 || right == 1, op, "Expressions evaluate to arrays of differing sizes");
+        shape[dims - 1 - i] = left == 1 ? right : left;
+    }
+    return shape;
+}
+
+std::vector<size_t> broadcast_strides(const std::vector<size_t>& shape, const std::vector<size_t>& result_shape) {
+    std::vector<size_t> strides(result_shape.size(), 0);
+    size_t missing = result_shape.size() - shape.size();
+    size_t stride = 1;
+    for (size_t i = shape.size(); i-- > 0;) {
+        if (shape[i] != 1) strides[missing + i] = stride;
+        stride *= shape[i];
+    }
+    return strides;
+}
+
+// Splits elements [begin, end) of an array of shape into runs along its
+// last dimension, calling f(position, left_offset, right_offset, length)
+// for each with the offsets of its first element in two operands stepped
+// through with their strides
+template <typename F>
+static void for_each_run(const std::vector<size_t>& shape, const std::vector<size_t>& left_strides, const std::vector<size_t>& right_strides, size_t begin, size_t end, F f) {
+    size_t dims = shape.size();
+    size_t n = shape.back();
+    std::vector<size_t> index(dims);
+    size_t left = 0;
+    size_t right = 0;
+    size_t rest = begin / n;
+    for (size_t i = dims - 1; i-- > 0;) {
+        index[i] = rest % shape[i];
+        rest /= shape[i];
+        left += index[i] * left_strides[i];
+        right += index[i] * right_strides[i];
+    }
+    size_t col = begin % n;
+    for (size_t position = begin; position < end; col = 0) {
+        size_t length = std::min(n - col, end - position);
+        f(position, left + col * left_strides.back(), right + col * right_strides.back(), length);
+        position += length;
+        for (size_t i = dims - 1; i-- > 0;) {
+            left += left_strides[i];
+            right += right_strides[i];
+            if (++index[i] < shape[i]) break;
+            left -= shape[i] * left_strides[i];
+            right -= shape[i] * right_strides[i];
+            index[i] = 0;
+        }
+    }
+}
+
+void broadcast_elements(double* dst, const double* src, const std::vector<size_t>& shape, const std::vector<size_t>& strides, size_t start, size_t count) {
+    bool repeated = strides.back() == 0;
+    for_each_run(shape, strides, strides, start, start + count, [&](size_t position, size_t offset, size_t, size_t length) {
+        double* out = dst + (position - start);
+        if (repeated) std::fill(out, out + length, src[offset]);
+        else std::copy(src + offset, src + offset + length, out);
+    });
+}
+
+// Merges each dimension into the next when both operands step through
+// them as one, so the runs along the last dimension are as long as they
+// can be. Dimensions of length 1 are dropped.
+static void merge_dimensions(std::vector<size_t>& shape, std::vector<size_t>& left_strides, std::vector<size_t>& right_strides) {
+    size_t dims = 0;
+    for (size_t i = 0; i < shape.size(); i++) {
+        if (shape[i] == 1) continue;
+        if (dims > 0 && left_strides[dims - 1] == left_strides[i] * shape[i] && right_strides[dims - 1] == right_strides[i] * shape[i]) {
+            shape[dims - 1] *= shape[i];
+            left_strides[dims - 1] = left_strides[i];
+            right_strides[dims - 1] = right_strides[i];
+            continue;
+        }
+        shape[dims] = shape[i];
+        left_strides[dims] = left_strides[i];
+        right_strides[dims] = right_strides[i];
+        dims++;
+    }
+    if (dims == 0) {
+        shape = {1};
+        left_strides = {1};
+        right_strides = {1};
+        return;
+    }
+    shape.resize(dims);
+    left_strides.resize(dims);
+    right_strides.resize(dims);
+}
+
+// dst = left op right with both operands broadcast to shape. An operand
+// that repeats along the last dimension is passed to the kernels as a
+// number, so no operand is ever copied out to the full shape.
+static void broadcast_kernel(KernelOp kernel, double* dst, std::vector<size_t> shape, const double* left, const std::vector<size_t>& left_shape, const double* right, const std::vector<size_t>& right_shape) {
+    std::vector<size_t> left_strides = broadcast_strides(left_shape, shape);
+    std::vector<size_t> right_strides = broadcast_strides(right_shape, shape);
+    size_t size = 1;
+    for (size_t dim : shape) size *= dim;
+    merge_dimensions(shape, left_strides, right_strides);
+    bool left_repeated = left_strides.back() == 0;
+    bool right_repeated = right_strides.back() == 0;
+    parallel_for(size, [&](size_t begin, size_t end) {
+        for_each_run(shape, left_strides, right_strides, begin, end, [&](size_t position, size_t left_offset, size_t right_offset, size_t length) {
+            if (left_repeated) number_array_kernel(kernel, dst + position, left[left_offset], right + right_offset, length);
+            else if (right_repeated) array_number_kernel(kernel, dst + position, left + left_offset, right[right_offset], length);
+            else array_array_kernel(kernel, dst + position, left + left_offset, right + right_offset, length);
+        });
+    });
+}
+
+// Patterns shorter than this are repeated out to at least this length
+// before the kernels run along them
+#define TILE_SIZE 256
+
+// dst = left op right for an operand that repeats a pattern and one other
+// of the same size, on the left when pattern_left is set. The kernels run
+// along the pattern, repeated to a tile of at least TILE_SIZE elements for
+// a short one, so the repeating operand is never copied out to its size.
+static void repeating_kernel(KernelOp kernel, double* dst, const NDArray& repeating, const double* other, bool pattern_left, size_t size) {
+    const double* pattern = repeating.pattern();
+    size_t length = repeating.period();
+    if (length == 1) {
+        parallel_for(size, [&](size_t begin, size_t end) {
+            if (pattern_left) number_array_kernel(kernel, dst + begin, pattern[0], other + begin, end - begin);
+            else array_number_kernel(kernel, dst + begin, other + begin, pattern[0], end - begin);
+        });
+        return;
+    }
+    Elements tile;
+    if (length < TILE_SIZE) {
+        tile = Elements((TILE_SIZE + length - 1) / length * length);
+        for (size_t i = 0; i < tile.size(); i++) tile[i] = pattern[i % length];
+        pattern = tile.data();
+        length = tile.size();
+    }
+    parallel_for(size, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end;) {
+            size_t offset = i % length;
+            size_t n = std::min(length - offset, end - i);
+            if (pattern_left) array_array_kernel(kernel, dst + i, pattern + offset, other + i, n);
+            else array_array_kernel(kernel, dst + i, other + i, pattern + offset, n);
+            i += n;
+        }
+    });
+}
+
+// Applies op to two numbers, or to each element when either side is an
+// ndarray
+static Variable elementwise_values(const Token& op, const Variable& left_var, const Variable& right_var) {
+    KernelOp kernel = kernel_op(op.type);
+    if (left_var.is_double() && right_var.is_double()) {
+        return Variable(elementwise_number(op.type, std::get<double>(left_var.value), std::get<double>(right_var.value)));
+    }
+    if (left_var.is_double() && right_var.is_ndarray()) {
+        double left = std::get<double>(left_var.value);
+        const NDArray& right_arr = std::get<NDArray>(right_var.value);
+        // A repeating array gives one repeating the pattern's results
+        if (right_arr.repeats()) {
+            Elements pattern(right_arr.period());
+            number_array_kernel(kernel, pattern.data(), left, right_arr.pattern(), pattern.size());
+            return Variable(NDArray::computed(std::move(pattern), right_arr.shape()));
+        }
+        Elements result(right_arr.size());
+        double* dst = result.data();
+        const double* right = right_arr.elements();
+        parallel_for(result.size(), [&](size_t begin, size_t end) {
+            number_array_kernel(kernel, dst + begin, left, right + begin, end - begin);
+        });
+        return Variable(NDArray(std::move(result), right_arr.shape()));
+    }
+    if (left_var.is_ndarray() && right_var.is_double()) {
+        const NDArray& left_arr = std::get<NDArray>(left_var.value);
+        double right = std::get<double>(right_var.value);
+        if (left_arr.repeats()) {
+            Elements pattern(left_arr.period());
+            array_number_kernel(kernel, pattern.data(), left_arr.pattern(), right, pattern.size());
+            return Variable(NDArray::computed(std::move(pattern), left_arr.shape()));
+        }
+        Elements result(left_arr.size());
+        double* dst = result.data();
+        const double* left = left_arr.elements();
+        parallel_for(result.size(), [&](size_t begin, size_t end) {
+            array_number_kernel(kernel, dst + begin, left + begin, right, end - begin);
+        });
+        return Variable(NDArray(std::move(result), left_arr.shape()));
+    }
+    if (left_var.is_ndarray() && right_var.is_ndarray()) {
+        const NDArray& left_arr = std::get<NDArray>(left_var.value);
+        const NDArray& right_arr = std::get<NDArray>(right_var.value);
+        if (left_arr.shape() != right_arr.shape()) {
+            std::vector<size_t> shape = broadcast_shape(op, left_arr.shape(), right_arr.shape());
+            size_t size = 1;
+            for (size_t dim : shape) size *= dim;
+            Elements result(size);
+            broadcast_kernel(kernel, result.data(), shape, left_arr.elements(), left_arr.shape(), right_arr.elements(), right_arr.shape());
+            return Variable(NDArray(std::move(result), std::move(shape)));
+        }
+        if (left_arr.repeats() && right_arr.repeats() && left_arr.period() == right_arr.period()) {
+            Elements pattern(left_arr.period());
+            array_array_kernel(kernel, pattern.data(), left_arr.pattern(), right_arr.pattern(), pattern.size());
+            return Variable(NDArray::computed(std::move(pattern), left_arr.shape()));
+        }
+        Elements zipped(left_arr.size());
+        double* dst = zipped.data();
+        if (left_arr.repeats() || right_arr.repeats()) {
+            bool pattern_left = left_arr.repeats();
+            repeating_kernel(kernel, dst, pattern_left ? left_arr : right_arr, pattern_left ? right_arr.elements() : left_arr.elements(), pattern_left, zipped.size());
+            return Variable(NDArray(std::move(zipped), left_arr.shape()));
+        }
+        const double* left = left_arr.elements();
+        const double* right = right_arr.elements();
+        parallel_for(zipped.size(), [&](size_t begin, size_t end) {
+            array_array_kernel(kernel, dst + begin, left + begin, right + begin, end - begin);
+        });
+        return Variable(NDArray(std::move(zipped), left_arr.shape()));
+    }
+    runtime_assert(false, op, "At least one of left and right expressions are neither numbers nor ndarrays");
+    return Variable();
+}
+
+// Flags the arrays of comparisons, A and O as masks
+static Variable elementwise(const Token& op, const Variable& left_var, const Variable& right_var) {
+    Variable result = elementwise_values(op, left_var, right_var);
+    if (result.is_ndarray()) std::get<NDArray>(result.value).set_mask(gives_mask(kernel_op(op.type)));
+    return result;
+}
+
+// Same as elementwise with target as one of the operands, writing the result
+// over target's elements. Everything is checked before the first write.
+// Returns false without writing when other broadcasts target to a larger
+// shape than its own.
+static bool elementwise_in_place(const Token& op, NDArray& target, const Variable& other, bool target_left) {
+    KernelOp kernel = kernel_op(op.type);
+    if (other.is_double()) {
+        double num = std::get<double>(other.value);
+        double* data = target.mutable_data().data();
+        parallel_for(target.size(), [&](size_t begin, size_t end) {
+            if (target_left) array_number_kernel(kernel, data + begin, data + begin, num, end - begin);
+            else number_array_kernel(kernel, data + begin, num, data + begin, end - begin);
+        });
+        return true;
+    }
+    runtime_assert(other.is_ndarray(), op, "At least one of left and right expressions are neither numbers nor ndarrays");
+    const NDArray& other_arr = std::get<NDArray>(other.value);
+    if (target.shape() != other_arr.shape()) {
+        std::vector<size_t> shape = broadcast_shape(op, target.shape(), other_arr.shape());
+        if (shape != target.shape()) return false;
+        double* data = target.mutable_data().data();
+        if (target_left) broadcast_kernel(kernel, data, shape, data, shape, other_arr.elements(), other_arr.shape());
+        else broadcast_kernel(kernel, data, shape, other_arr.elements(), other_arr.shape(), data, shape);
+        return true;
+    }
+    double* data = target.mutable_data().data();
+    if (other_arr.repeats()) {
+        repeating_kernel(kernel, data, other_arr, data, !target_left, target.size());
+        return true;
+    }
+    // Fetched after mutable_data since other can be target itself
+    const double* other_data = other_arr.elements();
+    parallel_for(target.size(), [&](size_t begin, size_t end) {
+        if (target_left) array_array_kernel(kernel, data + begin, data + begin, other_data + begin, end - begin);
+        else array_array_kernel(kernel, data + begin, other_data + begin, data + begin, end - begin);
+    });
+    return true;
+}
+
+void runtime_assert(bool cond, const Token& loc, const std::string& error_msg) {
+    if (!cond) throw std::runtime_error(create_runtime_error(error_msg, loc));
+}
+
+std::string create_runtime_error(const std::string& error_msg, const Token& loc) {
+    return "Runtime error: " + error_msg + ", occurred at line " + std::to_string(loc.line) + " at column " + std::to_string(loc.col);
+}
+
+static bool is_comparison(TokenType type) {
+    switch (type) {
+    case EQUALS_EQUALS:
+    case EXCLA_EQUALS:
+    case GREATER_EQUALS:
+    case GREATER:
+    case LESSER_EQUALS:
+    case LESSER: return true;
+    default: return false;
+    }
+}
+
+// Whether a comparison of these values is made element by element, giving
+// a mask: an ndarray against a number or another ndarray
+static bool compares_elements(const Variable& left_var, const Variable& right_var) {
+    if (left_var.is_ndarray()) return right_var.is_ndarray() || right_var.is_double();
+    return left_var.is_double() && right_var.is_ndarray();
+}
+
+Variable binary_operation(const Token& op, const Variable& left_var, const Variable& right_var) {
+    if (is_comparison(op.type) && compares_elements(left_var, right_var)) return elementwise(op, left_var, right_var);
+    switch (op.type) {
+    case EQUALS_EQUALS: {
+        return left_var.value.index() == right_var.value.index() && left_var.value == right_var.value;
+    }
+    case EXCLA_EQUALS: {
+        return left_var.value.index() != right_var.value.index() || left_var.value != right_var.value;
+    }
+    case GREATER_EQUALS: {
+        runtime_assert(left_var.value.index() == right_var.value.index(), op, "Left and right expressions differ in type");
+        return left_var.value >= right_var.value;
+    }
+    case GREATER: {
+        runtime_assert(left_var.value.index() == right_var.value.index(), op, "Left and right expressions differ in type");
+        return left_var.value > right_var.value;
+    }
+    case LESSER_EQUALS: {
+        runtime_assert(left_var.value.index() == right_var.value.index(), op, "Left and right expressions differ in type");
+        return left_var.value <= right_var.value;
+    }
+    case LESSER: {
+        runtime_assert(left_var.value.index() == right_var.value.index(), op, "Left and right expressions differ in type");
+        return left_var.value < right_var.value;
+    }
+    case MINUS:
+    case PLUS:
+    case SLASH:
+    case STAR:
+    case EXP: return elementwise(op, left_var, right_var);
+    case AT: {
+        runtime_assert(left_var.is_ndarray(), op, "Left expression isn't an ndarray");
+        runtime_assert(right_var.is_ndarray(), op, "Right expression isn't an ndarray");
+        return matrix_product(op, std::get<NDArray>(left_var.value), std::get<NDArray>(right_var.value));
+    }
+    case AS_SHAPE: {
+        runtime_assert(left_var.is_ndarray(), op, "Left expression isn't an ndarray");
+        runtime_assert(right_var.is_ndarray(), op, "Right expression isn't an ndarray");
+        const Elements& new_size_double = std::get<NDArray>(right_var.value).data();
+        std::vector<size_t> new_size;
+        for (size_t i = 0; i < new_size_double.size(); i++) {
+            size_t casted = (size_t) new_size_double.at(i);
+            runtime_assert((double) casted == new_size_double.at(i), op, "An expression used in array size is not close to an integer");
+            new_size.push_back(casted);
+        }
+        size_t full_length = new_size_double[0];
+        auto it = new_size_double.begin();
+        it++;
+        while(it != new_size_double.end()) {
+            full_length *= *it;
+            it++;
+        }
+        // Keeping the number of elements only changes the shape
+        const NDArray& values = std::get<NDArray>(left_var.value);
+        if (full_length == values.size()) return Variable(values.reshape(std::move(new_size)));
+        runtime_assert(values.size() > 0 || full_length == 0, op, "Can't fill an ndarray from an empty ndarray");
+        // Otherwise the values repeat, which is computed as elements are
+        // read instead of filling a buffer
+        return Variable(NDArray::computed(values, std::move(new_size)));
+    }
+    default: runtime_assert(false, op, "Invalid binary operator");
+    }
+    throw std::runtime_error(create_runtime_error("Invalid binary operator", op));
+}
+
+Variable binary_operation(const Token& op, Variable&& left_var, Variable&& right_var) {
+    if (left_var.is_ndarray() && std::get<NDArray>(left_var.value).unique()) {
+        binary_operation_in_place(op, left_var, right_var, true);
+        return std::move(left_var);
+    }
+    if (right_var.is_ndarray() && std::get<NDArray>(right_var.value).unique()) {
+        binary_operation_in_place(op, right_var, left_var, false);
+        return std::move(right_var);
+    }
+    return binary_operation(op, left_var, right_var);
+}
+
+void binary_operation_in_place(const Token& op, Variable& target, const Variable& other, bool target_left) {
+    if (target.is_ndarray()) {
+        NDArray& arr = std::get<NDArray>(target.value);
+        switch (op.type) {
+        case MINUS:
+        case PLUS:
+        case SLASH:
+        case STAR:
+        case EXP:
+            if (elementwise_in_place(op, arr, other, target_left)) {
+                arr.set_mask(false);
+                return;
+            }
+            break;
+        default:
+            if (is_comparison(op.type) && compares_elements(target, other) && elementwise_in_place(op, arr, other, target_left)) {
+                arr.set_mask(true);
+                return;
+            }
+            break;
+        }
+    }
+    target = target_left ? binary_operation(op, target, other) : binary_operation(op, other, target);
+}
+
+Variable logical_operation(const Token& op, const Variable& left_var, const Variable& right_var) {
+    if (left_var.is_bool()) {
+        runtime_assert(right_var.is_bool(), op, "Right expression evaluates to non-boolean value");
+        return right_var;
+    }
+    runtime_assert(right_var.is_ndarray(), op, "Right expression isn't an ndarray");
+    return elementwise(op, left_var, right_var);
+}
+
+Variable unary_operation(const Token& op, const Variable& val) {
+    switch(op.type) {
+    case EXCLA: {
+        if (val.is_ndarray()) {
+            // 1 where the mask is 0
+            const NDArray& mask = std::get<NDArray>(val.value);
+            Elements result(mask.size());
+            double* dst = result.data();
+            const double* src = mask.elements();
+            parallel_for(result.size(), [&](size_t begin, size_t end) {
+                array_number_kernel(KERNEL_EQ, dst + begin, src + begin, 0, end - begin);
+            });
+            NDArray negated(std::move(result), mask.shape());
+            negated.set_mask(true);
+            return Variable(std::move(negated));
+        }
+        runtime_assert(val.is_bool(), op, "Expression evaluates to a non-bool");
+        return Variable(!std::get<bool>(val.value));
+    }
+    case MINUS: {
+        runtime_assert(val.is_double(), op, "Expression evaluates to a non-number");
+        return Variable(-std::get<double>(val.value));
+    }
+    case TRANSPOSE: {
+        runtime_assert(val.is_ndarray(), op, "Expression evaluates to a non-ndarray");
+        return Variable(std::get<NDArray>(val.value).transpose());
+    }
+    case SHAPE: {
+        runtime_assert(val.is_ndarray(), op, "Expression evaluates to a non-ndarray");
+        Elements casted_shape;
+        for (size_t d : std::get<NDArray>(val.value).shape()) {
+            casted_shape.push_back((double) d);
+        }
+        size_t dims = casted_shape.size();
+        return Variable(NDArray(std::move(casted_shape), {dims}));
+    }
+    default: runtime_assert(false, op, "Invalid unary operator");
+    }
+    throw std::runtime_error(create_runtime_error("Invalid unary operator", op));
+}
+
+void print_variable(std::ostream& out, const Variable& var) {
+    if (var.is_bool()) out << (std::get<bool>(var.value) ? "True" : "False") << std::endl;
+    else if (var.is_double()) out << std::get<double>(var.value) << std::endl;
+    else if (var.is_string()) out << std::get<std::string>(var.value) << std::endl;
+    else if (var.is_ndarray()) {
+        const NDArray& arr = std::get<NDArray>(var.value);
+        out << '[';
+        for (size_t i = 0; i < arr.size(); i++) {
+            out << arr.elements()[i];
+            if (i < arr.size() - 1) out << ", ";
+        }
+        out << "] sa [";
+        for (size_t i = 0; i < arr.shape().size(); i++) {
+            out << arr.shape().at(i);
+            if (i < arr.shape().size() - 1) out << ", ";
+        }
+        out << ']' << std::endl;
+    }
+    else out << "Nil" << std::endl;
+}
+
+void check_array_access(const Variable& var, size_t num_indices, const Token& loc) {
+    runtime_assert(var.is_ndarray(), loc, "Identifier in array access isn't an ndarray");
+    const NDArray& arr = std::get<NDArray>(var.value);
+    runtime_assert(arr.shape().size() == num_indices, loc, "Number of dimensions in array element access differs from number of dimensions in array");
+}
+
+// Position a number picks from a dimension of the given length
+static size_t check_position(double index, size_t length, const Token& loc) {
+    size_t casted = (size_t) index;
+    runtime_assert((double) casted == index, loc, "An expression used in array indexing is not close to an integer");
+    runtime_assert(casted < length, loc, "An expression used in array indexing is larger than a dimension of the ndarray");
+    return casted;
+}
+
+size_t check_index(const Variable& index_val, const std::vector<size_t>& shape, size_t dim, const Token& loc) {
+    runtime_assert(index_val.is_double(), loc, "An expression used in array indexing is not a number");
+    return check_position(std::get<double>(index_val.value), shape.at(dim), loc);
+}
+
+size_t flat_index(const size_t* indices, size_t num_indices, const std::vector<size_t>& shape) {
+    size_t flat = indices[0];
+    for (size_t i = 1; i < num_indices; i++) {
+        flat = indices[i] + flat * shape[i];
+    }
+    return flat;
+}
+
+static size_t check_slice_bound(const Variable& bound, size_t length, const Token& loc) {
+    runtime_assert(bound.is_double(), loc, "An expression used in array slicing is not a number");
+    size_t casted = (size_t) std::get<double>(bound.value);
+    runtime_assert((double) casted == std::get<double>(bound.value), loc, "An expression used in array slicing is not close to an integer");
+    runtime_assert(casted <= length, loc, "An expression used in array slicing is larger than a dimension of the ndarray");
+    return casted;
+}
+
+IndexRange check_slice(const Variable& begin, const Variable& end, const std::vector<size_t>& shape, size_t dim, const Token& loc) {
+    size_t length = shape.at(dim);
+    size_t first = check_slice_bound(begin, length, loc);
+    size_t last = end.is_nil() ? length : check_slice_bound(end, length, loc);
+    runtime_assert(first <= last, loc, "The start of a slice is past its end");
+    return {first, last, true};
+}
+
+Variable slice_positions(const IndexRange& slice) {
+    return Variable(NDArray::computed(Elements(1, slice.begin), {slice.end - slice.begin}, 1));
+}
+
+Variable check_selection(const Variable& index_val, const std::vector<size_t>& shape, size_t dim, const Token& loc) {
+    if (!index_val.is_ndarray()) {
+        check_index(index_val, shape, dim, loc);
+        return index_val;
+    }
+    const NDArray& index = std::get<NDArray>(index_val.value);
+    runtime_assert(index.shape().size() == 1, loc, "An ndarray used in array indexing isn't 1d");
+    size_t length = shape.at(dim);
+    const double* positions = index.elements();
+    if (index.is_mask()) {
+        runtime_assert(index.size() == length, loc, "A mask used in array indexing differs in length from a dimension of the ndarray");
+        Elements picked(kernels().count(positions, length));
+        size_t count = 0;
+        for (size_t i = 0; i < length; i++) {
+            if (positions[i] != 0) picked[count++] = i;
+        }
+        return Variable(NDArray(std::move(picked), {count}));
+    }
+    for (size_t i = 0; i < index.size(); i++) check_position(positions[i], length, loc);
+    return index_val;
+}
+
+IndexRange selection_range(const Variable& index) {
+    if (index.is_double()) {
+        size_t position = std::get<double>(index.value);
+        return {position, position + 1, false};
+    }
+    const NDArray& positions = std::get<NDArray>(index.value);
+    return {0, positions.size(), true, positions.elements()};
+}
+
+static bool picks_elements(const IndexRange* ranges, size_t dims) {
+    return std::any_of(ranges, ranges + dims, [](const IndexRange& range) { return range.picks; });
+}
+
+static std::vector<size_t> picked_shape(const IndexRange* ranges, size_t dims) {
+    std::vector<size_t> shape;
+    for (size_t i = 0; i < dims; i++) {
+        if (ranges[i].slice) shape.push_back(ranges[i].end - ranges[i].begin);
+    }
+    return shape;
+}
+
+// Offsets in arr's buffer of the elements picked by one range per
+// dimension, in row major order
+static std::vector<size_t> picked_offsets(const NDArray& arr, const IndexRange* ranges) {
+    std::vector<size_t> strides = arr.strides();
+    std::vector<size_t> offsets = {arr.offset()};
+    for (size_t i = 0; i < strides.size(); i++) {
+        const IndexRange& range = ranges[i];
+        std::vector<size_t> along;
+        for (size_t k = range.begin; k < range.end; k++) along.push_back((range.picks ? (size_t) range.picks[k] : k) * strides[i]);
+        std::vector<size_t> next;
+        next.reserve(offsets.size() * along.size());
+        for (size_t base : offsets) {
+            for (size_t step : along) next.push_back(base + step);
+        }
+        offsets = std::move(next);
+    }
+    return offsets;
+}
+
+Variable slice_array(const NDArray& arr, const IndexRange* ranges) {
+    std::vector<size_t> strides = arr.strides();
+    if (picks_elements(ranges, strides.size())) {
+        std::vector<size_t> offsets = picked_offsets(arr, ranges);
+        Elements result(offsets.size());
+        double* dst = result.data();
+        const double* src = arr.buffer_data();
+        auto gather = kernels().gather;
+        parallel_for(result.size(), [&](size_t begin, size_t end) {
+            gather(dst + begin, src, offsets.data() + begin, end - begin);
+        });
+        return Variable(NDArray(std::move(result), picked_shape(ranges, strides.size())));
+    }
+    size_t offset = arr.offset();
+    std::vector<size_t> shape;
+    std::vector<size_t> view_strides;
+    for (size_t i = 0; i < strides.size(); i++) {
+        offset += ranges[i].begin * strides[i];
+        if (!ranges[i].slice) continue;
+        shape.push_back(ranges[i].end - ranges[i].begin);
+        view_strides.push_back(strides[i]);
+    }
+    if (shape.empty()) return Variable(arr.buffer_data()[offset]);
+    return Variable(NDArray(arr, offset, std::move(shape), std::move(view_strides)));
+}
+
+Variable select(const NDArray& arr, const Variable* indices) {
+    std::vector<IndexRange> ranges;
+    for (size_t i = 0; i < arr.shape().size(); i++) ranges.push_back(selection_range(indices[i]));
+    return slice_array(arr, ranges.data());
+}
+
+void check_element_assign(const Variable& value, const Variable& target, const Token& loc) {
+    runtime_assert(value.is_double() || value.is_ndarray(), loc, "Can't assign a non-number to an entry in an array");
+    runtime_assert(target.is_ndarray(), loc, "Identifier isn't an array, so can't assign to an index of it");
+}
+
+void assign_selection(NDArray& arr, const Variable* indices, size_t num_indices, const Variable& value, const Token& loc) {
+    runtime_assert(arr.shape().size() == num_indices, loc, "Number of dimensions in array element access differs from number of dimensions in array");
+    std::vector<IndexRange> ranges;
+    for (size_t i = 0; i < num_indices; i++) ranges.push_back(selection_range(indices[i]));
+    std::vector<size_t> shape = picked_shape(ranges.data(), num_indices);
+    if (shape.empty()) runtime_assert(value.is_double(), loc, "Can't assign a non-number to an entry in an array");
+    else if (value.is_ndarray()) runtime_assert(std::get<NDArray>(value.value).shape() == shape, loc, "Assigned ndarray differs in shape from the part of the array assigned to");
+    // Offsets are taken once arr has a buffer of its own, which value keeps
+    // the old elements of if it shared them
+    double* dst = arr.mutable_data().data();
+    std::vector<size_t> offsets = picked_offsets(arr, ranges.data());
+    const double* src = value.is_double() ? &std::get<double>(value.value) : std::get<NDArray>(value.value).elements();
+    kernels().scatter(dst, offsets.data(), src, value.is_double() ? 0 : 1, offsets.size());
+}
+
+void check_assertion(const Variable& cond, const Token& loc) {
+    runtime_assert(cond.is_bool(), loc, "Assert statement expected a boolean condition");
+    runtime_assert(std::get<bool>(cond.value), loc, "Assert failed");
+}
@@ -226,18 +226,24 @@ Expr* Parser::assignment() {
         Expr* right = assignment();
         return new Assign(id, right);
     } else if (tokens.at(cur_index).type == IDENTIFIER && cur_index < tokens.size() - 1 && tokens.at(cur_index + 1).type == LEFT_BRACK) {
-        size_t dummy_index = cur_index;
-        while (dummy_index < tokens.size() && tokens.at(dummy_index).type != RIGHT_BRACK) dummy_index++;
+        // Finds the ']' matching the '[', skipping over the brackets of
+        // ndarrays in the indices
+        size_t dummy_index = cur_index + 1;
+        size_t depth = 0;
+        for (; dummy_index < tokens.size(); dummy_index++) {
+            if (tokens.at(dummy_index).type == LEFT_BRACK) depth++;
+            else if (tokens.at(dummy_index).type == RIGHT_BRACK && --depth == 0) break;
+        }
         if (dummy_index >= tokens.size() || (dummy_index < tokens.size() - 1 && tokens.at(dummy_index + 1).type != EQUALS)) return operation();
         Token id = consume(IDENTIFIER, "Expected identifier");
         Token left_b = consume(LEFT_BRACK, "Unreachable");
-        Expr* first_dim = expression();
+        Expr* first_dim = arrIndex();
         std::vector<Expr*> args;
         args.push_back(first_dim);
         while(cur_index < tokens.size() && tokens.at(cur_index).type != RIGHT_BRACK) {
             if (args.size() < MAX_ARGS) {
                 consume(COMMA, "Expected comma in array indexing");
-                Expr* arg = expression();
+                Expr* arg = arrIndex();
                 args.push_back(arg);
             }
             else {
@@ -328,7 +334,8 @@ Expr* Parser::unary() {
     switch(tokens.at(cur_index).type) {
         case EXCLA:
         case MINUS:
-        case SHAPE: {
+        case SHAPE:
+        case TRANSPOSE: {
             Token t = tokens.at(cur_index);
             cur_index += 1;
             Expr* next = unary();
@@ -343,13 +350,13 @@ Expr* Parser::arrAccess() {
     Expr* id = function();
     if(match(LEFT_BRACK)) {
         Token left_b = tokens.at(cur_index - 1);
-        Expr* first_dim = expression();
+        Expr* first_dim = arrIndex();
         std::vector<Expr*> args;
         args.push_back(first_dim);
         while(cur_index < tokens.size() && tokens.at(cur_index).type != RIGHT_BRACK) {
             if (args.size() < MAX_ARGS) {
                 consume(COMMA, "Expected comma in array indexing");
-                Expr* arg = expression();
+                Expr* arg = arrIndex();
                 args.push_back(arg);
             }
             else {
@@ -357,11 +364,23 @@ Expr* Parser::arrAccess() {
             }
         }
         consume(RIGHT_BRACK, "Expected ']' after indices");
-        return new ArrAccess(id, left_b, args);
+        ArrAccess* access = new ArrAccess(id, left_b, args);
+        for (Expr* arg : args) access->sliced = access->sliced || arg->kind == EXPR_SLICE;
+        return access;
     }
     return id;
 }
 
+// An index of an array access, or a slice begin:end of its dimension with
+// either bound left out
+Expr* Parser::arrIndex() {
+    Expr* begin = currently_at(COLON) ? nullptr : expression();
+    if (!currently_at(COLON)) return begin;
+    Token colon = consume(COLON, "Expected ':'");
+    Expr* end = currently_at({COMMA, RIGHT_BRACK}) ? nullptr : expression();
+    return new Slice(colon, begin, end);
+}
+
 Expr* Parser::function() {
     if(tokens.at(cur_index).type == IDENTIFIER && cur_index < tokens.size() - 1 && tokens.at(cur_index+1).type == LEFT_PAREN) {
         Token name = consume(IDENTIFIER, "");
@@ -0,0 +1,152 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <vector>
+
+#include "reductions.hpp"
+#include "kernels.hpp"
+#include "thread_pool.hpp"
+
+// Rows of a reduction along an axis other than the last are added in
+// groups of at most this many, then the groups are added pairwise
+#define PAIRWISE_ROWS 8
+// Columns of such a reduction handled at a time, few enough for the
+// running results to stay in L1
+#define COLUMN_BLOCK 512
+
+static double reduce_range(ReduceOp op, const double* x, size_t n) {
+    switch (op) {
+    case REDUCE_MAX: return kernels().max(x, n);
+    case REDUCE_MIN: return kernels().min(x, n);
+    default: return kernels().sum(x, n);
+    }
+}
+
+// Index of the first element of x equal to val, or the first NaN if val is
+// NaN. n if there is none.
+static size_t first_index_of(const double* x, size_t n, double val) {
+    size_t i = 0;
+    if (val != val) while (i < n && x[i] == x[i]) i++;
+    else while (i < n && x[i] != val) i++;
+    return i;
+}
+
+double reduce(ReduceOp op, const double* x, size_t n) {
+    // Means are sums and argmaxes look for the max
+    ReduceOp range_op = op == REDUCE_MEAN ? REDUCE_SUM : op == REDUCE_ARGMAX ? REDUCE_MAX : op;
+    double result;
+    if (n <= PARALLEL_THRESHOLD) result = reduce_range(range_op, x, n);
+    else {
+        size_t num_blocks = (n + PARALLEL_THRESHOLD - 1) / PARALLEL_THRESHOLD;
+        std::vector<double> partials (num_blocks);
+        std::function<void(size_t, size_t)> blocks = [&](size_t begin, size_t end) {
+            for (size_t block = begin; block < end; block++) {
+                size_t start = block * PARALLEL_THRESHOLD;
+                partials[block] = reduce_range(range_op, x + start, std::min(n - start, (size_t) PARALLEL_THRESHOLD));
+            }
+        };
+        if (thread_pool().num_threads() == 1) blocks(0, num_blocks);
+        else thread_pool().parallel_for(num_blocks, blocks);
+        result = reduce_range(range_op, partials.data(), num_blocks);
+    }
+    if (op == REDUCE_MEAN) return result / n;
+    if (op == REDUCE_ARGMAX) return first_index_of(x, n, result);
+    return result;
+}
+
+// out[j] = sum of x[l * stride + j] over l < len, for j < width
+static void sum_columns(const double* x, size_t len, size_t stride, size_t width, double* out) {
+    if (len <= PAIRWISE_ROWS) {
+        std::fill(out, out + width, 0.0);
+        for (size_t l = 0; l < len; l++) array_array_kernel(KERNEL_ADD, out, out, x + l * stride, width);
+        return;
+    }
+    double rest[COLUMN_BLOCK];
+    size_t half = len / 2;
+    sum_columns(x, half, stride, width, out);
+    sum_columns(x + half * stride, len - half, stride, width, rest);
+    array_array_kernel(KERNEL_ADD, out, out, rest, width);
+}
+
+// Same as sum_columns for the other reductions
+static void reduce_columns(ReduceOp op, const double* x, size_t len, size_t stride, size_t width, double* out) {
+    switch (op) {
+    case REDUCE_SUM:
+        sum_columns(x, len, stride, width, out);
+        break;
+    case REDUCE_MEAN:
+        sum_columns(x, len, stride, width, out);
+        array_number_kernel(KERNEL_DIV, out, out, (double) len, width);
+        break;
+    case REDUCE_MAX:
+        std::copy(x, x + width, out);
+        for (size_t l = 1; l < len; l++) {
+            const double* row = x + l * stride;
+            for (size_t j = 0; j < width; j++) out[j] = max_number(out[j], row[j]);
+        }
+        break;
+    case REDUCE_MIN:
+        std::copy(x, x + width, out);
+        for (size_t l = 1; l < len; l++) {
+            const double* row = x + l * stride;
+            for (size_t j = 0; j < width; j++) out[j] = min_number(out[j], row[j]);
+        }
+        break;
+    case REDUCE_ARGMAX: {
+        double best[COLUMN_BLOCK];
+        std::copy(x, x + width, best);
+        std::fill(out, out + width, 0.0);
+        for (size_t l = 1; l < len; l++) {
+            const double* row = x + l * stride;
+            for (size_t j = 0; j < width; j++) {
+                // A column's first NaN stays its best
+                if (row[j] > best[j] || (row[j] != row[j] && best[j] == best[j])) {
+                    best[j] = row[j];
+                    out[j] = l;
+                }
+            }
+        }
+        break;
+    }
+    }
+}
+
+void reduce_axis(ReduceOp op, const double* x, size_t outer, size_t len, size_t inner, double* out) {
+    bool parallel = (double) outer * len * inner >= PARALLEL_THRESHOLD && thread_pool().num_threads() > 1;
+    if (inner == 1) {
+        // Every result reduces a contiguous row. A single long row is
+        // split between threads by reduce itself.
+        std::function<void(size_t, size_t)> rows = [&](size_t begin, size_t end) {
+            for (size_t o = begin; o < end; o++) out[o] = reduce(op, x + o * len, len);
+        };
+        if (parallel && outer > 1) thread_pool().parallel_for(outer, rows);
+        else rows(0, outer);
+        return;
+    }
+    // Otherwise every result reduces a column of a len x inner matrix, and
+    // they are computed a block of columns at a time so that whole rows of
+    // the block are combined with the vector kernels
+    size_t column_blocks = (inner + COLUMN_BLOCK - 1) / COLUMN_BLOCK;
+    std::function<void(size_t, size_t)> blocks = [&](size_t begin, size_t end) {
+        for (size_t block = begin; block < end; block++) {
+            size_t o = block / column_blocks;
+            size_t col = block % column_blocks * COLUMN_BLOCK;
+            size_t width = std::min(inner - col, (size_t) COLUMN_BLOCK);
+            reduce_columns(op, x + o * len * inner + col, len, inner, width, out + o * inner + col);
+        }
+    };
+    size_t num_blocks = outer * column_blocks;
+    if (parallel && num_blocks > 1) thread_pool().parallel_for(num_blocks, blocks);
+    else blocks(0, num_blocks);
+}
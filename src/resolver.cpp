@@ -0,0 +1,452 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "resolver.hpp"
+#include "fusion.hpp"
+#include "operations.hpp"
+
+// Largest array sa is folded into, bigger ones are left for when the
+// program runs
+#define MAX_FOLDED_SIZE (1 << 20)
+
+// Later top level statements aren't known yet, so every variable counts as
+// read after the statement
+void Resolver::resolve(Stmt* stmt) {
+    scope = &globals;
+    resolve_stmt(stmt);
+    std::vector<char> live(globals.size(), true);
+    mark_last_uses(stmt, live, true);
+}
+
+void Resolver::resolve(const std::vector<Stmt*>& program) {
+    for (Stmt* stmt : program) resolve(stmt);
+}
+
+size_t Resolver::num_slots() const {
+    return globals.size();
+}
+
+size_t Resolver::num_funcs() const {
+    return funcs.size();
+}
+
+size_t Resolver::num_ops() const {
+    return ops.size();
+}
+
+size_t Resolver::var_slot(const std::string& name) {
+    return intern(globals, name);
+}
+
+size_t Resolver::func_id(const std::string& name) {
+    return intern(funcs, name);
+}
+
+size_t Resolver::op_id(const std::string& name) {
+    return intern(ops, name);
+}
+
+size_t Resolver::find_var(const std::string& name) const {
+    return find(globals, name);
+}
+
+size_t Resolver::find_func(const std::string& name) const {
+    return find(funcs, name);
+}
+
+size_t Resolver::find_op(const std::string& name) const {
+    return find(ops, name);
+}
+
+void Resolver::resolve_stmts(const std::vector<Stmt*>& stmts) {
+    for (Stmt* stmt : stmts) resolve_stmt(stmt);
+}
+
+void Resolver::resolve_stmt(Stmt* stmt) {
+    switch (stmt->kind) {
+    case STMT_EXPR: resolve_expr(static_cast<ExprStmt*>(stmt)->expr); break;
+    case STMT_PRINT: resolve_expr(static_cast<Print*>(stmt)->expr); break;
+    case STMT_RETURN: resolve_expr(static_cast<Return*>(stmt)->expr); break;
+    case STMT_ASSERT: resolve_expr(static_cast<Assert*>(stmt)->cond); break;
+    case STMT_VAR_DECL: {
+        VarDecl* varDecl = static_cast<VarDecl*>(stmt);
+        varDecl->slot = intern(*scope, varDecl->name.lexeme);
+        resolve_expr(varDecl->expr);
+        break;
+    }
+    case STMT_IF: {
+        If* ifStmt = static_cast<If*>(stmt);
+        resolve_expr(ifStmt->cond);
+        resolve_stmts(ifStmt->stmts);
+        break;
+    }
+    case STMT_WHILE: {
+        While* whileStmt = static_cast<While*>(stmt);
+        resolve_expr(whileStmt->cond);
+        resolve_stmts(whileStmt->stmts);
+        break;
+    }
+    // Bodies get a scope of their own, starting with the parameters. A
+    // repeated parameter name shares one slot.
+    case STMT_FUNC_DECL: {
+        FuncDecl* funcDecl = static_cast<FuncDecl*>(stmt);
+        funcDecl->func_id = intern(funcs, funcDecl->name.lexeme);
+        Names body;
+        Names* outer = scope;
+        scope = &body;
+        funcDecl->param_slots.clear();
+        for (const Token& param : funcDecl->params) {
+            funcDecl->param_slots.push_back(intern(body, param.lexeme));
+        }
+        resolve_stmts(funcDecl->stmts);
+        funcDecl->num_slots = body.size();
+        std::vector<char> live(body.size(), false);
+        mark_last_uses(funcDecl->stmts, live, true);
+        scope = outer;
+        break;
+    }
+    case STMT_OP_DECL: {
+        OpDecl* opDecl = static_cast<OpDecl*>(stmt);
+        opDecl->op_id = intern(ops, opDecl->name.lexeme);
+        Names body;
+        Names* outer = scope;
+        scope = &body;
+        opDecl->left_slot = intern(body, opDecl->left.lexeme);
+        opDecl->right_slot = intern(body, opDecl->right.lexeme);
+        resolve_stmts(opDecl->stmts);
+        opDecl->num_slots = body.size();
+        std::vector<char> live(body.size(), false);
+        mark_last_uses(opDecl->stmts, live, true);
+        scope = outer;
+        break;
+    }
+    }
+}
+
+void Resolver::resolve_expr(Expr*& expr) {
+    switch (expr->kind) {
+    case EXPR_ARR_ACCESS: {
+        ArrAccess* arrAccess = static_cast<ArrAccess*>(expr);
+        resolve_expr(arrAccess->id);
+        for (Expr*& index : arrAccess->idx) resolve_expr(index);
+        arrAccess->in_place = arrAccess->id->kind == EXPR_VAR && !arrAccess->sliced;
+        for (Expr* index : arrAccess->idx) {
+            if (assigns_to(index, static_cast<Var*>(arrAccess->id)->slot)) arrAccess->in_place = false;
+        }
+        break;
+    }
+    case EXPR_ASSIGN: {
+        Assign* assign = static_cast<Assign*>(expr);
+        assign->slot = intern(*scope, assign->name.lexeme);
+        for (Expr*& index : assign->idx) resolve_expr(index);
+        resolve_expr(assign->value);
+        break;
+    }
+    case EXPR_BINARY: {
+        Binary* binary = static_cast<Binary*>(expr);
+        if (binary->op.type == IDENTIFIER) binary->op_id = intern(ops, binary->op.lexeme);
+        resolve_expr(binary->left);
+        resolve_expr(binary->right);
+        if (fold(expr)) break;
+        if (binary->op.type == AT) {
+            // A left operand that is @ itself makes this the end of a chain
+            binary->chain_length = 2;
+            if (binary->left->kind == EXPR_BINARY && static_cast<Binary*>(binary->left)->op.type == AT) {
+                Binary* inner = static_cast<Binary*>(binary->left);
+                binary->chain_length = inner->chain_length + 1;
+                inner->chained = true;
+            }
+            break;
+        }
+        if (!is_elementwise(binary->op.type)) break;
+        // Elementwise operands join this operator's tree while it fits
+        binary->fused_ops = 1;
+        for (Expr* operand : {binary->left, binary->right}) {
+            if (operand->kind != EXPR_BINARY) continue;
+            Binary* inner = static_cast<Binary*>(operand);
+            if (inner->fused_ops == 0 || binary->fused_ops + inner->fused_ops > MAX_FUSED) continue;
+            binary->fused_ops += inner->fused_ops;
+            inner->fused = true;
+        }
+        break;
+    }
+    case EXPR_FUNC: {
+        Func* func = static_cast<Func*>(expr);
+        func->builtin_id = find_builtin(func->func.lexeme, func->args.size());
+        if (func->builtin_id == NO_BUILTIN) func->func_id = intern(funcs, func->func.lexeme);
+        for (Expr*& arg : func->args) resolve_expr(arg);
+        break;
+    }
+    case EXPR_LITERAL:
+        for (Expr*& val : static_cast<Literal*>(expr)->array_vals) resolve_expr(val);
+        fold(expr);
+        break;
+    case EXPR_SLICE: {
+        Slice* slice = static_cast<Slice*>(expr);
+        if (slice->begin) resolve_expr(slice->begin);
+        if (slice->end) resolve_expr(slice->end);
+        break;
+    }
+    case EXPR_UNARY:
+        resolve_expr(static_cast<Unary*>(expr)->right);
+        fold(expr);
+        break;
+    case EXPR_VAR: {
+        Var* var = static_cast<Var*>(expr);
+        var->slot = intern(*scope, var->name.lexeme);
+        break;
+    }
+    case EXPR_NIL: break;
+    }
+}
+
+// Value of expr if it is a literal that doesn't need evaluating
+static bool constant_value(Expr* expr, Variable& value) {
+    if (expr->kind != EXPR_LITERAL) return false;
+    Literal* literal = static_cast<Literal*>(expr);
+    switch (literal->literal_type) {
+    case LITERAL_STRING: value = Variable(literal->string_val); return true;
+    case LITERAL_DOUBLE: value = Variable(literal->double_val); return true;
+    case LITERAL_BOOL: value = Variable(literal->bool_val); return true;
+    case LITERAL_NDARRAY: value = Variable(literal->ndarray_val); return true;
+    default: return false;
+    }
+}
+
+// Whether left sa right makes an array small enough to fold. Leaves the
+// errors sa can raise for when it runs.
+static bool foldable_shape(const Variable& left, const Variable& right) {
+    if (!left.is_ndarray() || !right.is_ndarray() || std::get<NDArray>(left.value).size() == 0) return false;
+    const Elements& dims = std::get<NDArray>(right.value).data();
+    if (dims.empty()) return false;
+    double size = 1;
+    for (double dim : dims) size *= dim;
+    return size <= MAX_FOLDED_SIZE;
+}
+
+// Replaces an operator applied to literals, or an array literal of numbers,
+// with a literal of its value, which both engines then evaluate without
+// recomputing it. Custom operators and the short circuiting A and O are
+// left alone, and so is anything that raises an error, so the error is
+// still reported at its token when the expression runs. Returns whether
+// expr was replaced.
+bool Resolver::fold(Expr*& expr) {
+    Variable value;
+    const Token* token;
+    try {
+        switch (expr->kind) {
+        case EXPR_BINARY: {
+            Binary* binary = static_cast<Binary*>(expr);
+            Variable left, right;
+            if (binary->op.type == IDENTIFIER || binary->op.type == AND || binary->op.type == OR) return false;
+            if (!constant_value(binary->left, left) || !constant_value(binary->right, right)) return false;
+            if (binary->op.type == AS_SHAPE && !foldable_shape(left, right)) return false;
+            value = binary_operation(binary->op, left, right);
+            token = &binary->op;
+            break;
+        }
+        case EXPR_UNARY: {
+            Unary* unary = static_cast<Unary*>(expr);
+            Variable right;
+            if (!constant_value(unary->right, right)) return false;
+            value = unary_operation(unary->op, right);
+            token = &unary->op;
+            break;
+        }
+        case EXPR_LITERAL: {
+            Literal* literal = static_cast<Literal*>(expr);
+            if (literal->literal_type != LITERAL_ARRAY) return false;
+            Elements nums;
+            for (Expr* val : literal->array_vals) {
+                if (val->kind != EXPR_LITERAL || static_cast<Literal*>(val)->literal_type != LITERAL_DOUBLE) return false;
+                nums.push_back(static_cast<Literal*>(val)->double_val);
+            }
+            size_t length = nums.size();
+            value = Variable(NDArray(std::move(nums), {length}));
+            token = &literal->token;
+            break;
+        }
+        default: return false;
+        }
+    } catch (std::runtime_error&) {
+        return false;
+    }
+    Literal* folded;
+    if (value.is_double()) folded = new Literal(*token, std::get<double>(value.value));
+    else if (value.is_bool()) folded = new Literal(*token, std::get<bool>(value.value));
+    else if (value.is_ndarray()) folded = new Literal(*token, std::get<NDArray>(value.value));
+    else return false;
+    delete expr;
+    expr = folded;
+    return true;
+}
+
+// Whether evaluating expr can assign to slot of the current frame. Calls
+// can't, since functions and operators don't see their caller's variables.
+bool Resolver::assigns_to(Expr* expr, size_t slot) {
+    switch (expr->kind) {
+    case EXPR_ARR_ACCESS: {
+        ArrAccess* arrAccess = static_cast<ArrAccess*>(expr);
+        if (assigns_to(arrAccess->id, slot)) return true;
+        for (Expr* index : arrAccess->idx) if (assigns_to(index, slot)) return true;
+        return false;
+    }
+    case EXPR_ASSIGN: {
+        Assign* assign = static_cast<Assign*>(expr);
+        if (assign->slot == slot) return true;
+        for (Expr* index : assign->idx) if (assigns_to(index, slot)) return true;
+        return assigns_to(assign->value, slot);
+    }
+    case EXPR_BINARY: return assigns_to(static_cast<Binary*>(expr)->left, slot) || assigns_to(static_cast<Binary*>(expr)->right, slot);
+    case EXPR_FUNC:
+        for (Expr* arg : static_cast<Func*>(expr)->args) if (assigns_to(arg, slot)) return true;
+        return false;
+    case EXPR_LITERAL:
+        for (Expr* val : static_cast<Literal*>(expr)->array_vals) if (assigns_to(val, slot)) return true;
+        return false;
+    case EXPR_SLICE: {
+        Slice* slice = static_cast<Slice*>(expr);
+        return (slice->begin && assigns_to(slice->begin, slot)) || (slice->end && assigns_to(slice->end, slot));
+    }
+    case EXPR_UNARY: return assigns_to(static_cast<Unary*>(expr)->right, slot);
+    default: return false;
+    }
+}
+
+void Resolver::mark_last_uses(const std::vector<Stmt*>& stmts, std::vector<char>& live, bool mark) {
+    for (auto it = stmts.rbegin(); it != stmts.rend(); it++) mark_last_uses(*it, live, mark);
+}
+
+void Resolver::mark_last_uses(Stmt* stmt, std::vector<char>& live, bool mark) {
+    switch (stmt->kind) {
+    case STMT_EXPR: mark_last_uses(static_cast<ExprStmt*>(stmt)->expr, live, mark); break;
+    case STMT_PRINT: mark_last_uses(static_cast<Print*>(stmt)->expr, live, mark); break;
+    case STMT_ASSERT: mark_last_uses(static_cast<Assert*>(stmt)->cond, live, mark); break;
+    // Nothing after a return runs
+    case STMT_RETURN:
+        live.assign(live.size(), false);
+        mark_last_uses(static_cast<Return*>(stmt)->expr, live, mark);
+        break;
+    // A redeclaration keeps the old value, so declaring doesn't end it
+    case STMT_VAR_DECL: mark_last_uses(static_cast<VarDecl*>(stmt)->expr, live, mark); break;
+    case STMT_IF: {
+        If* ifStmt = static_cast<If*>(stmt);
+        std::vector<char> body = live;
+        mark_last_uses(ifStmt->stmts, body, mark);
+        join(live, body);
+        mark_last_uses(ifStmt->cond, live, mark);
+        break;
+    }
+    // Iterates to the slots live at the condition, then marks in one last
+    // pass since earlier passes see too few slots live
+    case STMT_WHILE: {
+        While* whileStmt = static_cast<While*>(stmt);
+        std::vector<char> head = live;
+        mark_last_uses(whileStmt->cond, head, false);
+        while (true) {
+            std::vector<char> next = head;
+            mark_last_uses(whileStmt->stmts, next, false);
+            join(next, live);
+            mark_last_uses(whileStmt->cond, next, false);
+            if (next == head) break;
+            head = next;
+        }
+        if (mark) {
+            std::vector<char> next = head;
+            mark_last_uses(whileStmt->stmts, next, true);
+            join(next, live);
+            mark_last_uses(whileStmt->cond, next, true);
+        }
+        live = head;
+        break;
+    }
+    // Bodies are analyzed on their own when resolved
+    case STMT_FUNC_DECL:
+    case STMT_OP_DECL: break;
+    }
+}
+
+// Visits the reads of expr in reverse evaluation order
+void Resolver::mark_last_uses(Expr* expr, std::vector<char>& live, bool mark) {
+    switch (expr->kind) {
+    case EXPR_ARR_ACCESS: {
+        ArrAccess* arrAccess = static_cast<ArrAccess*>(expr);
+        // An in place access reads the slot after its indices
+        if (arrAccess->in_place) live[static_cast<Var*>(arrAccess->id)->slot] = true;
+        for (auto it = arrAccess->idx.rbegin(); it != arrAccess->idx.rend(); it++) mark_last_uses(*it, live, mark);
+        if (!arrAccess->in_place) mark_last_uses(arrAccess->id, live, mark);
+        break;
+    }
+    case EXPR_ASSIGN: {
+        Assign* assign = static_cast<Assign*>(expr);
+        // Assigning an element updates the old value instead of replacing it
+        live[assign->slot] = assign->idx.size() > 0;
+        for (auto it = assign->idx.rbegin(); it != assign->idx.rend(); it++) mark_last_uses(*it, live, mark);
+        mark_last_uses(assign->value, live, mark);
+        break;
+    }
+    case EXPR_BINARY: {
+        Binary* binary = static_cast<Binary*>(expr);
+        if (binary->op.type == AND || binary->op.type == OR) {
+            // The right side might not run
+            std::vector<char> right = live;
+            mark_last_uses(binary->right, right, mark);
+            join(live, right);
+        }
+        else mark_last_uses(binary->right, live, mark);
+        mark_last_uses(binary->left, live, mark);
+        break;
+    }
+    case EXPR_FUNC: {
+        Func* func = static_cast<Func*>(expr);
+        for (auto it = func->args.rbegin(); it != func->args.rend(); it++) mark_last_uses(*it, live, mark);
+        break;
+    }
+    case EXPR_LITERAL: {
+        Literal* literal = static_cast<Literal*>(expr);
+        for (auto it = literal->array_vals.rbegin(); it != literal->array_vals.rend(); it++) mark_last_uses(*it, live, mark);
+        break;
+    }
+    case EXPR_SLICE: {
+        Slice* slice = static_cast<Slice*>(expr);
+        if (slice->end) mark_last_uses(slice->end, live, mark);
+        if (slice->begin) mark_last_uses(slice->begin, live, mark);
+        break;
+    }
+    case EXPR_UNARY: mark_last_uses(static_cast<Unary*>(expr)->right, live, mark); break;
+    case EXPR_VAR: {
+        Var* var = static_cast<Var*>(expr);
+        if (mark) var->last_use = !live[var->slot];
+        live[var->slot] = true;
+        break;
+    }
+    case EXPR_NIL: break;
+    }
+}
+
+void Resolver::join(std::vector<char>& into, const std::vector<char>& other) {
+    for (size_t i = 0; i < into.size(); i++) into[i] = into[i] || other[i];
+}
+
+size_t Resolver::intern(Names& names, const std::string& name) {
+    auto found = names.find(name);
+    if (found != names.end()) return found->second;
+    size_t id = names.size();
+    names.insert({name, id});
+    return id;
+}
+
+size_t Resolver::find(const Names& names, const std::string& name) {
+    auto found = names.find(name);
+    return found == names.end() ? UNRESOLVED : found->second;
+}
@@ -12,6 +12,8 @@
 
 #include "stmt.hpp"
 
+Stmt::Stmt(StmtKind kind): kind(kind) {}
+
 Stmt::~Stmt() {}
 
 size_t Stmt::statement_counter = 0;
@@ -65,55 +67,55 @@ std::pair<std::string, std::string> Stmt::make_string(std::string label, T* chil
     return make_string(label, c);
 }
 
-ExprStmt::ExprStmt(Expr* expr): expr(expr) {}
+ExprStmt::ExprStmt(Expr* expr): Stmt(STMT_EXPR), expr(expr) {}
 
 std::pair<std::string, std::string> ExprStmt::to_string() {
     return make_string("Expression statement", expr);
 }
 
-FuncDecl::FuncDecl(Token name, std::vector<Token> params, std::vector<Stmt*> stmts): name(name), params(params), stmts(stmts) {}
+FuncDecl::FuncDecl(Token name, std::vector<Token> params, std::vector<Stmt*> stmts): Stmt(STMT_FUNC_DECL), name(name), params(params), stmts(stmts) {}
 
 std::pair<std::string, std::string> FuncDecl::to_string() {
     return make_string("Declare Function " + name.lexeme, stmts);
 }
 
-If::If(Token keyword, Expr* cond, std::vector<Stmt*> stmts): keyword(keyword), cond(cond), stmts(stmts) {}
+If::If(Token keyword, Expr* cond, std::vector<Stmt*> stmts): Stmt(STMT_IF), keyword(keyword), cond(cond), stmts(stmts) {}
 
 std::pair<std::string, std::string> If::to_string() {
     return make_string("If Statement ", stmts);
 }
 
-OpDecl::OpDecl(Token name, Token left, Token right, std::vector<Stmt*> stmts): name(name), left(left), right(right), stmts(stmts) {}
+OpDecl::OpDecl(Token name, Token left, Token right, std::vector<Stmt*> stmts): Stmt(STMT_OP_DECL), name(name), left(left), right(right), stmts(stmts) {}
 
 std::pair<std::string, std::string> OpDecl::to_string() {
     return make_string("Declare Operator " + name.lexeme, stmts);
 }
 
-Print::Print(Token print_keyword, Expr* expr): print_keyword(print_keyword), expr(expr) {}
+Print::Print(Token print_keyword, Expr* expr): Stmt(STMT_PRINT), print_keyword(print_keyword), expr(expr) {}
 
 std::pair<std::string, std::string> Print::to_string() {
     return make_string("Print Statement", expr);
 }
 
-Return::Return(Token return_keyword, Expr* expr): return_keyword(return_keyword), expr(expr) {}
+Return::Return(Token return_keyword, Expr* expr): Stmt(STMT_RETURN), return_keyword(return_keyword), expr(expr) {}
 
 std::pair<std::string, std::string> Return::to_string() {
     return make_string("Return Statement", expr);
 }
 
-VarDecl::VarDecl(Token name, Expr* expr): name(name), expr(expr) {}
+VarDecl::VarDecl(Token name, Expr* expr): Stmt(STMT_VAR_DECL), name(name), expr(expr) {}
 
 std::pair<std::string, std::string> VarDecl::to_string() {
     return make_string("Declare variable " + name.lexeme, expr);
 }
 
-While::While(Token keyword, Expr* cond, std::vector<Stmt*> stmts): keyword(keyword), cond(cond), stmts(stmts) {}
+While::While(Token keyword, Expr* cond, std::vector<Stmt*> stmts): Stmt(STMT_WHILE), keyword(keyword), cond(cond), stmts(stmts) {}
 
 std::pair<std::string, std::string> While::to_string() {
     return make_string("While Statement", stmts);
 }
 
-Assert::Assert(Token keyword, Expr* cond): keyword(keyword), cond(cond) {} 
+Assert::Assert(Token keyword, Expr* cond): Stmt(STMT_ASSERT), keyword(keyword), cond(cond) {} 
 
 std::pair<std::string, std::string> Assert::to_string() {
     return make_string("Assert Statement", cond);
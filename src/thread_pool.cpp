@@ -0,0 +1,153 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "thread_pool.hpp"
+
+// Chunks each thread starts with, more than one so that stealing can even
+// out threads that fall behind
+#define CHUNKS_PER_THREAD 4
+
+ThreadPool::ThreadPool(size_t num_threads):
+    shares(new Share[std::max(num_threads, (size_t) 1)]), threads(std::max(num_threads, (size_t) 1)) {
+    // Thread 0 is whichever thread calls parallel_for
+    for (size_t id = 1; id < threads; id++) workers.emplace_back(&ThreadPool::run_worker, this, id);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    start.notify_all();
+    for (std::thread& worker : workers) worker.join();
+}
+
+size_t ThreadPool::num_threads() const {
+    return threads;
+}
+
+void ThreadPool::parallel_for(size_t n, const std::function<void(size_t, size_t)>& f) {
+    std::unique_lock<std::mutex> guard(lock);
+    if (busy || threads == 1) {
+        guard.unlock();
+        f(0, n);
+        return;
+    }
+    busy = true;
+    job = &f;
+    length = n;
+    chunk = (n + threads * CHUNKS_PER_THREAD - 1) / (threads * CHUNKS_PER_THREAD);
+    num_chunks = (n + chunk - 1) / chunk;
+    for (size_t id = 0; id < threads; id++) {
+        shares[id].next = num_chunks * id / threads;
+        shares[id].end = num_chunks * (id + 1) / threads;
+    }
+    running = threads - 1;
+    generation++;
+    guard.unlock();
+    start.notify_all();
+    work(0);
+    guard.lock();
+    done.wait(guard, [this]() { return running == 0; });
+    job = nullptr;
+    busy = false;
+}
+
+void ThreadPool::work(size_t id) {
+    size_t index;
+    while (take(id, index)) {
+        size_t begin = index * chunk;
+        (*job)(begin, std::min(begin + chunk, length));
+    }
+}
+
+void ThreadPool::run_worker(size_t id) {
+    size_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            start.wait(guard, [&]() { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+        work(id);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            running--;
+        }
+        done.notify_one();
+    }
+}
+
+// Next chunk for thread id: the front of its own share, else the back half
+// of the first other share with chunks left, which becomes its share
+bool ThreadPool::take(size_t id, size_t& chunk_index) {
+    {
+        std::lock_guard<std::mutex> guard(shares[id].lock);
+        if (shares[id].next < shares[id].end) {
+            chunk_index = shares[id].next++;
+            return true;
+        }
+    }
+    for (size_t i = 1; i < threads; i++) {
+        Share& victim = shares[(id + i) % threads];
+        size_t begin, end;
+        {
+            std::lock_guard<std::mutex> guard(victim.lock);
+            size_t left = victim.end - victim.next;
+            if (left == 0) continue;
+            end = victim.end;
+            begin = end - (left + 1) / 2;
+            victim.end = begin;
+        }
+        std::lock_guard<std::mutex> guard(shares[id].lock);
+        shares[id].next = begin + 1;
+        shares[id].end = end;
+        chunk_index = begin;
+        return true;
+    }
+    return false;
+}
+
+// 0 until set_num_threads is called
+static size_t chosen_threads = 0;
+static std::unique_ptr<ThreadPool> pool;
+
+static size_t default_threads() {
+    const char* env = std::getenv("WEAK_THREADS");
+    if (env) {
+        size_t num_threads = std::strtoul(env, nullptr, 10);
+        if (num_threads > 0) return num_threads;
+    }
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+ThreadPool& thread_pool() {
+    if (!pool) {
+        #ifdef WEB_TARGET
+            // The web build runs without threads
+            pool = std::make_unique<ThreadPool>(1);
+        #else
+            pool = std::make_unique<ThreadPool>(chosen_threads ? chosen_threads : default_threads());
+        #endif
+    }
+    return *pool;
+}
+
+void set_num_threads(size_t num_threads) {
+    chosen_threads = num_threads;
+    pool.reset();
+}
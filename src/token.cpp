@@ -29,6 +29,7 @@ std::string print_token_type(TokenType type) {
         case EXP: return std::string("EXP");
         case AT: return std::string("AT");
         case COMMA: return std::string("COMMA");
+        case COLON: return std::string("COLON");
         case SEMI: return std::string("SEMI");
         case LEFT_PAREN: return std::string("LEFT_PAREN");
         case RIGHT_PAREN: return std::string("RIGHT_PAREN");
@@ -63,6 +64,7 @@ std::string print_token_type(TokenType type) {
         case STRING: return std::string("STRING");
         case SHAPE: return std::string("SHAPE");
         case AS_SHAPE: return std::string("AS_SHAPE");
+        case TRANSPOSE: return std::string("TRANSPOSE");
         case EMPTY: return std::string("EMPTY");
         case ASSERT: return std::string("ASSERT"); 
     }
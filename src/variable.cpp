@@ -28,26 +28,26 @@ Variable::Variable(double var) {
     value.emplace<2>(var);
 }
 
-Variable::Variable(std::pair<std::vector<double>, std::vector<size_t>> var) {
-    value.emplace<3>(var);
+Variable::Variable(NDArray var) {
+    value.emplace<3>(std::move(var));
 }
 
-bool Variable::is_string() {
+bool Variable::is_string() const {
     return std::get_if<std::string>(&value);
 }
 
-bool Variable::is_bool() {
+bool Variable::is_bool() const {
     return std::get_if<bool>(&value);
 }
 
-bool Variable::is_double() {
+bool Variable::is_double() const {
     return std::get_if<double>(&value);
 }
 
-bool Variable::is_ndarray() {
-    return std::get_if<std::pair<std::vector<double>, std::vector<size_t>>>(&value);
+bool Variable::is_ndarray() const {
+    return std::get_if<NDArray>(&value);
 }
 
-bool Variable::is_nil() {
+bool Variable::is_nil() const {
     return std::get_if<void*>(&value);
 }
@@ -0,0 +1,330 @@
+// This file is part of weak-lang.
+// weak-lang is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+// weak-lang is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+// You should have received a copy of the GNU Affero General Public License
+// along with weak-lang. If not, see <https://www.gnu.org/licenses/>.
+
+#include "vm.hpp"
+#include "parser.hpp"
+
+#define RK(operand) ((operand) & RK_CONSTANT ? constants[(operand) & ~RK_CONSTANT] : regs[operand])
+#define LOC (*proto.locs[pc - 1])
+
+// Arithmetic and comparisons on two numbers are done inline, everything else
+// goes through the shared operator semantics
+#define NUMERIC_OP(OP, SET) { \
+    const Variable& left = RK(instr.b); \
+    const Variable& right = RK(instr.c); \
+    const double* left_num = std::get_if<double>(&left.value); \
+    const double* right_num = std::get_if<double>(&right.value); \
+    if (left_num && right_num) SET(regs[instr.a], *left_num OP *right_num); \
+    else binary_into(LOC, regs[instr.a], left, right); \
+    break; \
+}
+
+// Other values are compared by the shared semantics, into the register the
+// OP_BRANCH_FALSE after the instruction checks
+#define JUMP_UNLESS(OP) { \
+    const Variable& left = RK(instr.b); \
+    const Variable& right = RK(instr.c); \
+    const double* left_num = std::get_if<double>(&left.value); \
+    const double* right_num = std::get_if<double>(&right.value); \
+    const Instr& branch = code[pc]; \
+    if (left_num && right_num) pc = *left_num OP *right_num ? pc + 1 : branch.a; \
+    else regs[branch.b] = binary_operation(LOC, left, right); \
+    break; \
+}
+
+// dst = left op right. When dst is also an operand its old value is dead
+// once the result is stored, so the result is computed in its buffer.
+static inline void binary_into(const Token& op, Variable& dst, const Variable& left, const Variable& right) {
+    if (&dst == &left) binary_operation_in_place(op, dst, right, true);
+    else if (&dst == &right) binary_operation_in_place(op, dst, left, false);
+    else dst = binary_operation(op, left, right);
+}
+
+static inline void set_double(Variable& var, double val) {
+    if (double* num = std::get_if<double>(&var.value)) *num = val;
+    else var.value = val;
+}
+
+static inline void set_bool(Variable& var, bool val) {
+    if (bool* b = std::get_if<bool>(&var.value)) *b = val;
+    else var.value = val;
+}
+
+VM::VM(): out(std::cout) {}
+
+VM::VM(std::ostream& out_override): out(out_override) {}
+
+static void declare(std::shared_ptr<std::vector<uint32_t>>& table, uint32_t id, uint32_t proto) {
+    if ((*table)[id] != NO_PROTO) return;
+    if (table.use_count() > 1) table = std::make_shared<std::vector<uint32_t>>(*table);
+    (*table)[id] = proto;
+}
+
+void VM::run(const std::vector<Stmt*>& program) {
+    Compiler compiler;
+    compiled = compiler.compile(program);
+    const Proto& main = *compiled.protos.at(compiled.main);
+    stack.assign(main.num_regs, Variable());
+    declared.assign(main.num_regs, false);
+    Frame frame {
+        0,
+        std::make_shared<std::vector<uint32_t>>(compiled.num_funcs, NO_PROTO),
+        std::make_shared<std::vector<uint32_t>>(compiled.num_ops, NO_PROTO)
+    };
+    execute(main, frame);
+}
+
+Variable VM::call(const Proto& callee, Frame& caller, size_t args) {
+    Frame frame {stack.size(), caller.funcs, caller.ops};
+    stack.resize(frame.base + callee.num_regs);
+    declared.resize(stack.size(), false);
+    // Like declaring the parameters in order: a repeated name keeps its first
+    // value. The arguments are temporaries of the caller, so they are moved.
+    for (size_t i = 0; i < callee.params.size(); i++) {
+        size_t param = frame.base + callee.params[i];
+        if (declared[param]) continue;
+        stack[param] = std::move(stack[caller.base + args + i]);
+        declared[param] = true;
+    }
+    Variable result = execute(callee, frame);
+    stack.resize(frame.base);
+    declared.resize(frame.base);
+    return result;
+}
+
+void VM::fuse_arrays(const Proto& proto, const std::vector<FusedStep>& steps, size_t step,
+                     const double* nums, size_t top, Variable* regs, Variable& dst) {
+    const Variable* constants = proto.constants.data();
+    fused.clear();
+    for (size_t i = 0; i < top; i++) fused.push(nums[i]);
+    for (; step < steps.size(); step++) {
+        uint32_t operand = steps[step].operand;
+        if (steps[step].op) fused.apply(*steps[step].op);
+        // Temporaries aren't read again, so their buffers can be reused
+        else if (operand >= proto.num_locals && !(operand & RK_CONSTANT)) fused.push(std::move(regs[operand]));
+        else fused.push(RK(operand));
+    }
+    // The old value of dst is dead, dropping it lets its buffer be reused too
+    dst = Variable();
+    dst = fused.result();
+}
+
+Variable VM::execute(const Proto& proto, Frame& frame) {
+    const Instr* code = proto.code.data();
+    const Variable* constants = proto.constants.data();
+    // Calls can grow the stack, so regs is reloaded after each one
+    Variable* regs = stack.data() + frame.base;
+    char* is_declared = declared.data() + frame.base;
+    size_t pc = 0;
+    while (true) {
+        const Instr& instr = code[pc++];
+        switch (instr.op) {
+        case OP_MOVE: regs[instr.a] = RK(instr.b); break;
+        case OP_CHECK_DEFINED:
+            runtime_assert(is_declared[instr.a], LOC, "Identifier doesn't correspond to a declared variable name");
+            break;
+        case OP_DECLARE:
+            if (is_declared[instr.a]) break;
+            if (instr.b != instr.a) regs[instr.a] = RK(instr.b);
+            is_declared[instr.a] = true;
+            break;
+        case OP_DECL_FUNC:
+            declare(frame.funcs, instr.b, instr.a);
+            break;
+        case OP_DECL_OP:
+            declare(frame.ops, instr.b, instr.a);
+            break;
+        case OP_ADD: NUMERIC_OP(+, set_double)
+        case OP_SUB: NUMERIC_OP(-, set_double)
+        case OP_MUL: NUMERIC_OP(*, set_double)
+        case OP_DIV: NUMERIC_OP(/, set_double)
+        case OP_LT: NUMERIC_OP(<, set_bool)
+        case OP_LE: NUMERIC_OP(<=, set_bool)
+        case OP_GT: NUMERIC_OP(>, set_bool)
+        case OP_GE: NUMERIC_OP(>=, set_bool)
+        case OP_EQ: NUMERIC_OP(==, set_bool)
+        case OP_NE: NUMERIC_OP(!=, set_bool)
+        case OP_BINARY: binary_into(LOC, regs[instr.a], RK(instr.b), RK(instr.c)); break;
+        case OP_NOT: {
+            const Variable& val = RK(instr.b);
+            if (const bool* b = std::get_if<bool>(&val.value)) set_bool(regs[instr.a], !*b);
+            else regs[instr.a] = unary_operation(LOC, val);
+            break;
+        }
+        case OP_NEG: {
+            const Variable& val = RK(instr.b);
+            if (const double* num = std::get_if<double>(&val.value)) set_double(regs[instr.a], -*num);
+            else regs[instr.a] = unary_operation(LOC, val);
+            break;
+        }
+        case OP_UNARY: regs[instr.a] = unary_operation(LOC, RK(instr.b)); break;
+        case OP_JUMP: pc = instr.a; break;
+        case OP_BRANCH_FALSE: {
+            const Variable& cond = RK(instr.b);
+            runtime_assert(cond.is_bool(), LOC, proto.messages[instr.c]);
+            if (!std::get<bool>(cond.value)) pc = instr.a;
+            break;
+        }
+        case OP_JUMP_UNLESS_LT: JUMP_UNLESS(<)
+        case OP_JUMP_UNLESS_LE: JUMP_UNLESS(<=)
+        case OP_JUMP_UNLESS_GT: JUMP_UNLESS(>)
+        case OP_JUMP_UNLESS_GE: JUMP_UNLESS(>=)
+        case OP_JUMP_UNLESS_EQ: JUMP_UNLESS(==)
+        case OP_JUMP_UNLESS_NE: JUMP_UNLESS(!=)
+        case OP_SHORT_CIRCUIT: {
+            const Variable& val = regs[instr.b];
+            if (const bool* b = std::get_if<bool>(&val.value)) {
+                if (*b == (LOC.type == OR)) pc = instr.a;
+            }
+            else runtime_assert(val.is_ndarray(), LOC, "Left expression evaluates to non-boolean value");
+            break;
+        }
+        case OP_LOGICAL: regs[instr.a] = logical_operation(LOC, regs[instr.a], regs[instr.b]); break;
+        case OP_CHECK_NUMBER:
+            runtime_assert(RK(instr.a).is_double(), LOC, proto.messages[instr.b]);
+            break;
+        case OP_FUSE: {
+            // Numbers are combined on a stack of their own. From the first
+            // operand that isn't a number on, everything goes through fused.
+            const std::vector<FusedStep>& steps = proto.fusions[instr.b];
+            double nums[MAX_FUSED + 1];
+            size_t top = 0;
+            size_t step = 0;
+            for (; step < steps.size(); step++) {
+                if (steps[step].op) {
+                    nums[top - 2] = elementwise_number(steps[step].op->type, nums[top - 2], nums[top - 1]);
+                    top--;
+                    continue;
+                }
+                const double* num = std::get_if<double>(&RK(steps[step].operand).value);
+                if (!num) break;
+                nums[top++] = *num;
+            }
+            if (step == steps.size()) {
+                set_double(regs[instr.a], nums[0]);
+                break;
+            }
+            fuse_arrays(proto, steps, step, nums, top, regs, regs[instr.a]);
+            break;
+        }
+        case OP_CHECK_CHAIN: check_chain(regs + instr.a, instr.b, LOC); break;
+        case OP_CHAIN: {
+            const CompiledChain& chain = proto.chains[instr.c];
+            regs[instr.a] = multiply_chain(regs + instr.b, chain.ops.data(), chain.ops.size() + 1, *chain.order);
+            break;
+        }
+        case OP_NEW_ARRAY: {
+            Elements nums(instr.c);
+            for (size_t i = 0; i < instr.c; i++) nums[i] = std::get<double>(regs[instr.b + i].value);
+            regs[instr.a] = Variable(NDArray(std::move(nums), {instr.c}));
+            break;
+        }
+        case OP_CHECK_ARRAY: check_array_access(RK(instr.a), instr.b, LOC); break;
+        case OP_CHECK_INDEX: {
+            const NDArray& arr = std::get<NDArray>(RK(instr.b).value);
+            // An ndarray index is replaced by the positions it picks
+            if (regs[instr.a].is_ndarray()) regs[instr.a] = check_selection(regs[instr.a], arr.shape(), instr.c, LOC);
+            else check_index(RK(instr.a), arr.shape(), instr.c, LOC);
+            break;
+        }
+        case OP_GET_ELEM: {
+            const NDArray& arr = std::get<NDArray>(RK(instr.b).value);
+            size_t dims = arr.shape().size();
+            size_t indices[MAX_ARGS];
+            size_t i = 0;
+            for (; i < dims && regs[instr.c + i].is_double(); i++) indices[i] = (size_t) std::get<double>(regs[instr.c + i].value);
+            if (i < dims) regs[instr.a] = select(arr, &regs[instr.c]);
+            else set_double(regs[instr.a], arr.at(indices));
+            break;
+        }
+        case OP_CHECK_SLICE: {
+            const NDArray& arr = std::get<NDArray>(RK(instr.b).value);
+            IndexRange range = check_slice(regs[instr.a], regs[instr.a + 1], arr.shape(), instr.c, LOC);
+            set_double(regs[instr.a], range.begin);
+            set_double(regs[instr.a + 1], range.end);
+            break;
+        }
+        case OP_SLICE: {
+            const NDArray& arr = std::get<NDArray>(RK(instr.b).value);
+            IndexRange ranges[MAX_ARGS];
+            for (size_t i = 0; i < arr.shape().size(); i++) {
+                const Variable& end = regs[instr.c + 2 * i + 1];
+                if (end.is_nil()) {
+                    ranges[i] = selection_range(regs[instr.c + 2 * i]);
+                    continue;
+                }
+                ranges[i] = {(size_t) std::get<double>(regs[instr.c + 2 * i].value), (size_t) std::get<double>(end.value), true};
+            }
+            regs[instr.a] = slice_array(arr, ranges);
+            break;
+        }
+        case OP_CHECK_SET_ELEM: check_element_assign(regs[instr.b], regs[instr.a], LOC); break;
+        case OP_CHECK_SET_INDEX: {
+            const NDArray& arr = std::get<NDArray>(regs[instr.b].value);
+            if (regs[instr.a].is_ndarray()) regs[instr.a] = check_selection(regs[instr.a], arr.shape(), instr.c, LOC);
+            else check_index(RK(instr.a), arr.shape(), instr.c, LOC);
+            break;
+        }
+        case OP_CHECK_SET_SLICE: {
+            const NDArray& arr = std::get<NDArray>(regs[instr.b].value);
+            regs[instr.a] = slice_positions(check_slice(regs[instr.a + 1], regs[instr.a + 2], arr.shape(), instr.c, LOC));
+            break;
+        }
+        case OP_SET_ELEM: {
+            NDArray& arr = std::get<NDArray>(regs[instr.a].value);
+            size_t indices[MAX_ARGS];
+            size_t i = 0;
+            for (; i < instr.c && regs[instr.b + 1 + i].is_double(); i++) indices[i] = (size_t) std::get<double>(regs[instr.b + 1 + i].value);
+            if (i < instr.c || !regs[instr.b].is_double()) {
+                assign_selection(arr, &regs[instr.b + 1], instr.c, regs[instr.b], LOC);
+                break;
+            }
+            size_t flat = flat_index(indices, instr.c, arr.shape());
+            arr.mutable_data().at(flat) = std::get<double>(regs[instr.b].value);
+            break;
+        }
+        case OP_CHECK_FUNC:
+            runtime_assert((*frame.funcs)[instr.a] != NO_PROTO, LOC, "Identifier doesn't correspond to a defined function name");
+            break;
+        case OP_CHECK_ARGC: {
+            const Proto& callee = *compiled.protos[(*frame.funcs)[instr.a]];
+            runtime_assert(instr.b == callee.params.size(), LOC, "Function called with different number of args than defined with");
+            break;
+        }
+        case OP_CALL: {
+            const Proto& callee = *compiled.protos[(*frame.funcs)[instr.b]];
+            Variable result = call(callee, frame, instr.c);
+            regs = stack.data() + frame.base;
+            is_declared = declared.data() + frame.base;
+            regs[instr.a] = std::move(result);
+            break;
+        }
+        case OP_CALL_OP: {
+            uint32_t op = (*frame.ops)[instr.b];
+            runtime_assert(op != NO_PROTO, LOC, "Identifier doesn't correspond to a defined operator name");
+            Variable result = call(*compiled.protos[op], frame, instr.c);
+            regs = stack.data() + frame.base;
+            is_declared = declared.data() + frame.base;
+            regs[instr.a] = std::move(result);
+            break;
+        }
+        case OP_CHECK_BUILTIN:
+            runtime_assert(instr.b == builtin(instr.a).num_args, LOC, "Function called with different number of args than defined with");
+            break;
+        case OP_BUILTIN: regs[instr.a] = builtin(instr.b).call(regs + instr.c, LOC); break;
+        case OP_PRINT: print_variable(out, RK(instr.a)); break;
+        case OP_ASSERT: check_assertion(RK(instr.a), LOC); break;
+        case OP_RETURN: return RK(instr.a);
+        case OP_RETURN_NIL: return Variable();
+        }
+    }
+}
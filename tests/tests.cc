@@ -22,10 +22,21 @@
 #include "parser.hpp"
 #include "util.hpp"
 #include "environment.hpp"
+#include "vm.hpp"
+#include "resolver.hpp"
+#include "blas.hpp"
+#include "gemm.hpp"
+#include "kernels.hpp"
+#include "reductions.hpp"
+#include "math_kernels.hpp"
+#include "thread_pool.hpp"
 #include<iostream>
 #include<fstream>
 #include<sstream>
 #include<algorithm>
+#include<array>
+#include<cmath>
+#include<cstring>
 
 //////////////////////////////////////////////////////////////////////////////
 //                                Lexer tests                               //
@@ -228,6 +239,16 @@ TEST_CASE("Keywords", "[lexer]") {
         expect_tokens("[] sa [2,2]", {LEFT_BRACK, RIGHT_BRACK, AS_SHAPE, LEFT_BRACK, NUMBER, COMMA, NUMBER, RIGHT_BRACK, END});
     }
 
+    SECTION("Transpose") {
+        no_error("tr x");
+        expect_tokens("tr x", {TRANSPOSE, IDENTIFIER, END});
+    }
+
+    SECTION("Slice") {
+        no_error("m[1:, :2]");
+        expect_tokens("m[1:, :2]", {IDENTIFIER, LEFT_BRACK, NUMBER, COLON, COMMA, COLON, NUMBER, RIGHT_BRACK, END});
+    }
+
     SECTION("Let") {
         no_error("a x = 3");
         expect_tokens("a x = 3", {LET, IDENTIFIER, EQUALS, NUMBER, END});
@@ -771,6 +792,47 @@ TEST_CASE("Array access", "[parser]") {
         }
     }
 
+    SECTION("Slices") {
+        auto statements = getStatements("mat[1:b, :];");
+        required_if(CAN_MAKE(ExprStmt*, e)_FROM(statements[0])) {
+            required_if(CAN_MAKE(ArrAccess*, a)_FROM(e->expr)) {
+                REQUIRE(a->sliced);
+                REQUIRE(a->idx.size() == 2);
+                required_if(CAN_MAKE(Slice*, first)_FROM(a->idx[0])) {
+                    required_if(CAN_MAKE(Literal*, one)_FROM(first->begin)) {
+                        REQUIRE(one->double_val == 1);
+                    }
+                    required_if(CAN_MAKE(Var*, b)_FROM(first->end)) {
+                        REQUIRE(b->name.lexeme == "b");
+                    }
+                }
+                required_if(CAN_MAKE(Slice*, all)_FROM(a->idx[1])) {
+                    REQUIRE(all->begin == nullptr);
+                    REQUIRE(all->end == nullptr);
+                }
+            }
+        }
+        statements = getStatements("mat[1, b];");
+        required_if(CAN_MAKE(ExprStmt*, e)_FROM(statements[0])) {
+            required_if(CAN_MAKE(ArrAccess*, a)_FROM(e->expr)) {
+                REQUIRE_FALSE(a->sliced);
+            }
+        }
+    }
+
+    SECTION("Assignment with ndarray indices") {
+        auto statements = getStatements("mat[[1, 2], 0] = 5;");
+        required_if(CAN_MAKE(ExprStmt*, e)_FROM(statements[0])) {
+            required_if(CAN_MAKE(Assign*, a)_FROM(e->expr)) {
+                REQUIRE(a->name.lexeme == "mat");
+                REQUIRE(a->idx.size() == 2);
+                required_if(CAN_MAKE(Literal*, picks)_FROM(a->idx[0])) {
+                    REQUIRE(picks->array_vals.size() == 2);
+                }
+            }
+        }
+    }
+
     SECTION("Error - empty access") {
         REQUIRE_THROWS_WITH(getStatements("arr[];"), "Expected primary but instead found: \"]\", at line 1 and column 5, this token has type RIGHT_BRACK");
     }
@@ -1265,7 +1327,7 @@ TEST_CASE("Add function", "[environment]"){
         std::vector<Stmt*> stmts; 
         FuncDecl* decl = new FuncDecl(token, params, stmts);
         env.add_func(decl->name.lexeme, decl);
-        REQUIRE(env.func_symbol_table.find("test") != env.func_symbol_table.end());
+        REQUIRE(env.has_func("test"));
     }
     SECTION("Operator"){
         Token name = {OPERATOR, "at", 1, 1}; 
@@ -1274,12 +1336,578 @@ TEST_CASE("Add function", "[environment]"){
         std::vector<Stmt*> stmts; 
         OpDecl* decl = new OpDecl(name, left, right, stmts);
         env.add_op(decl->name.lexeme, decl); 
-        REQUIRE(env.op_symbol_table.find("at") != env.op_symbol_table.end()); 
+        REQUIRE(env.has_op("at")); 
     }
     SECTION("Variable"){
         Variable var = new Variable(); 
         env.add_var("test", var);
-        REQUIRE(env.var_symbol_table.find("test") != env.var_symbol_table.end()); 
+        REQUIRE(env.has_var("test")); 
+    }
+}
+
+TEST_CASE("Slots and ids", "[resolver]") {
+    Lexer lex;
+    auto lexed = lex.lex(R"V0G0N(
+        a x = 1;
+        a y = x;
+        f add(y, z) {
+            a x = y + z;
+            r x;
+        }
+        o add(lhs, rhs) {
+            r add(lhs, rhs);
+        }
+        p add(x, y) add y;
+    )V0G0N");
+    Parser p (lexed);
+    auto statements = p.parse();
+    Resolver resolver;
+    resolver.resolve(statements);
+    REQUIRE(resolver.num_slots() == 2);
+    REQUIRE(resolver.num_funcs() == 1);
+    REQUIRE(resolver.num_ops() == 1);
+
+    SECTION("Top level variables") {
+        VarDecl* x = static_cast<VarDecl*>(statements.at(0));
+        VarDecl* y = static_cast<VarDecl*>(statements.at(1));
+        REQUIRE(x->slot == 0);
+        REQUIRE(y->slot == 1);
+        REQUIRE(static_cast<Var*>(y->expr)->slot == x->slot);
+    }
+
+    SECTION("Bodies have their own slots") {
+        FuncDecl* add = static_cast<FuncDecl*>(statements.at(2));
+        REQUIRE(add->param_slots == std::vector<size_t>({0, 1}));
+        REQUIRE(add->num_slots == 3);
+        REQUIRE(static_cast<VarDecl*>(add->stmts.at(0))->slot == 2);
+        OpDecl* op = static_cast<OpDecl*>(statements.at(3));
+        REQUIRE(op->left_slot == 0);
+        REQUIRE(op->right_slot == 1);
+        REQUIRE(op->num_slots == 2);
+    }
+
+    SECTION("Functions and operators are bound by id") {
+        FuncDecl* add = static_cast<FuncDecl*>(statements.at(2));
+        OpDecl* op = static_cast<OpDecl*>(statements.at(3));
+        Func* call = static_cast<Func*>(static_cast<Return*>(op->stmts.at(0))->expr);
+        REQUIRE(call->func_id == add->func_id);
+        Binary* use = static_cast<Binary*>(static_cast<Print*>(statements.at(4))->expr);
+        REQUIRE(use->op_id == op->op_id);
+        REQUIRE(static_cast<Func*>(use->left)->func_id == add->func_id);
+    }
+    for (auto stmt : statements) delete stmt;
+}
+
+TEST_CASE("Constant folding", "[resolver]") {
+    Lexer lex;
+    auto lexed = lex.lex(R"V0G0N(
+        p 2 ^ 10 + 1;
+        p [0] sa [2, 3];
+        p [1, -2, 3];
+        p !(1 < 2);
+        p 1 + T;
+        p [1, 2] + [1, 2, 3];
+        p T A F;
+        a x = 1;
+        p [x, 2] * 2;
+    )V0G0N");
+    Parser p (lexed);
+    auto statements = p.parse();
+    Resolver resolver;
+    resolver.resolve(statements);
+    auto printed = [&](size_t i) { return static_cast<Print*>(statements.at(i))->expr; };
+    auto literal_type = [&](size_t i) {
+        REQUIRE(printed(i)->kind == EXPR_LITERAL);
+        return static_cast<Literal*>(printed(i))->literal_type;
+    };
+
+    SECTION("Operators on literals are folded") {
+        REQUIRE(literal_type(0) == LITERAL_DOUBLE);
+        REQUIRE(static_cast<Literal*>(printed(0))->double_val == 1025);
+        REQUIRE(literal_type(1) == LITERAL_NDARRAY);
+        const NDArray& zeros = static_cast<Literal*>(printed(1))->ndarray_val;
+        REQUIRE(zeros.data() == Elements(6, 0));
+        REQUIRE(zeros.shape() == std::vector<size_t>({2, 3}));
+        REQUIRE(literal_type(2) == LITERAL_NDARRAY);
+        REQUIRE(static_cast<Literal*>(printed(2))->ndarray_val.data() == Elements({1, -2, 3}));
+        REQUIRE(literal_type(3) == LITERAL_BOOL);
+        REQUIRE(static_cast<Literal*>(printed(3))->bool_val == false);
+    }
+
+    SECTION("Errors, short circuits and variables aren't folded") {
+        REQUIRE(printed(4)->kind == EXPR_BINARY);
+        REQUIRE(printed(5)->kind == EXPR_BINARY);
+        REQUIRE(printed(6)->kind == EXPR_BINARY);
+        Binary* scaled = static_cast<Binary*>(printed(8));
+        REQUIRE(scaled->left->kind == EXPR_LITERAL);
+        REQUIRE(static_cast<Literal*>(scaled->left)->literal_type == LITERAL_ARRAY);
+    }
+    for (auto stmt : statements) delete stmt;
+}
+
+TEST_CASE("Elementwise kernels", "[kernels]") {
+    const Kernels* portable = supported_kernels().front();
+    // Lengths around every vector width, so each kernel runs its tail loop
+    for (size_t n = 0; n < 20; n++) {
+        std::vector<double> left(n), right(n);
+        for (size_t i = 0; i < n; i++) {
+            left[i] = 0.5 + i * 0.75;
+            right[i] = 3.25 - i * 0.5;
+        }
+        for (const Kernels* k : supported_kernels()) {
+            for (size_t op = 0; op < NUM_KERNEL_OPS; op++) {
+                std::vector<double> expected(n), actual(n);
+                portable->array_array[op](expected.data(), left.data(), right.data(), n);
+                k->array_array[op](actual.data(), left.data(), right.data(), n);
+                REQUIRE(actual == expected);
+                portable->number_array[op](expected.data(), 1.5, right.data(), n);
+                k->number_array[op](actual.data(), 1.5, right.data(), n);
+                REQUIRE(actual == expected);
+                portable->array_number[op](expected.data(), left.data(), -2.5, n);
+                // Written over its own operand
+                actual = left;
+                k->array_number[op](actual.data(), actual.data(), -2.5, n);
+                REQUIRE(actual == expected);
+            }
+        }
+    }
+    REQUIRE(&kernels() == supported_kernels().back());
+
+    SECTION("Kernels unrolled for small lengths") {
+        for (size_t n = 0; n <= SMALL_KERNEL_SIZE; n++) {
+            std::vector<double> left(n), right(n), expected(n), actual(n);
+            for (size_t i = 0; i < n; i++) {
+                left[i] = 0.5 + i * 0.75;
+                right[i] = 3.25 - i * 0.5;
+            }
+            for (size_t op = 0; op < NUM_SMALL_KERNEL_OPS; op++) {
+                portable->array_array[op](expected.data(), left.data(), right.data(), n);
+                small_kernels().array_array[op][n](actual.data(), left.data(), right.data());
+                REQUIRE(actual == expected);
+                portable->number_array[op](expected.data(), 1.5, right.data(), n);
+                small_kernels().number_array[op][n](actual.data(), 1.5, right.data());
+                REQUIRE(actual == expected);
+                portable->array_number[op](expected.data(), left.data(), -2.5, n);
+                actual = left;
+                small_kernels().array_number[op][n](actual.data(), actual.data(), -2.5);
+                REQUIRE(actual == expected);
+            }
+        }
+    }
+
+    SECTION("Shortcuts for powers") {
+        std::vector<double> left = {2, -3, 0.5, 1e200, 1e-200, 0, -0.0, INFINITY, -INFINITY, 7, 1.1, -0.9, 12345.678, 3};
+        for (double exponent : {0.5, -1.0, 0.0, 1.0, 2.0, 3.0, 4.0}) {
+            std::vector<double> expected(left.size());
+            for (size_t i = 0; i < left.size(); i++) {
+                expected[i] = pow_number(left[i], exponent);
+                double exact = pow(left[i], exponent);
+                if (exponent < 3) REQUIRE(std::memcmp(&expected[i], &exact, sizeof(double)) == 0);
+                else REQUIRE((expected[i] == exact || std::abs(expected[i] - exact) <= 2 * (std::nextafter(std::abs(exact), INFINITY) - std::abs(exact))));
+            }
+            // Every set and the small kernels agree with numbers bit for bit
+            for (const Kernels* k : supported_kernels()) {
+                std::vector<double> actual = left;
+                k->array_number[KERNEL_POW](actual.data(), actual.data(), exponent, actual.size());
+                REQUIRE(std::memcmp(actual.data(), expected.data(), actual.size() * sizeof(double)) == 0);
+                actual = left;
+                small_kernels().array_number[KERNEL_POW][actual.size()](actual.data(), actual.data(), exponent);
+                REQUIRE(std::memcmp(actual.data(), expected.data(), actual.size() * sizeof(double)) == 0);
+            }
+        }
+        // Longer than a block of repeated squaring
+        std::vector<double> x(1000), expected(1000);
+        for (size_t i = 0; i < x.size(); i++) {
+            x[i] = 0.25 + i * 0.125;
+            expected[i] = x[i] * x[i] * x[i];
+        }
+        kernels().array_number[KERNEL_POW](x.data(), x.data(), 3, x.size());
+        REQUIRE(x == expected);
+    }
+
+    SECTION("Masks") {
+        // Ties, signed zeros and NaNs, which compare false but count as set
+        std::vector<double> left = {1, 2, NAN, -0.0, 5, 0, -7, 8, 9, NAN, 0, 12, 13, 0, 15, 16, 17};
+        std::vector<double> right = {1, 3, 1, 0.0, 4, 0, -7, NAN, 0, 2, 0, 12, -13, 1, 15, 0, 17};
+        for (size_t n = 0; n <= left.size(); n++) {
+            for (const Kernels* k : supported_kernels()) {
+                REQUIRE(k->count(left.data(), n) == portable->count(left.data(), n));
+                std::vector<double> expected(n), actual(n);
+                portable->blend(expected.data(), left.data(), right.data(), 1, left.data(), 1, n);
+                k->blend(actual.data(), left.data(), right.data(), 1, left.data(), 1, n);
+                REQUIRE(std::memcmp(actual.data(), expected.data(), n * sizeof(double)) == 0);
+                double number = -1;
+                portable->blend(expected.data(), right.data(), &number, 0, left.data(), 1, n);
+                k->blend(actual.data(), right.data(), &number, 0, left.data(), 1, n);
+                REQUIRE(std::memcmp(actual.data(), expected.data(), n * sizeof(double)) == 0);
+                size_t kept = portable->compress(expected.data(), right.data(), left.data(), n);
+                REQUIRE(k->compress(actual.data(), right.data(), left.data(), n) == kept);
+                REQUIRE(std::memcmp(actual.data(), expected.data(), kept * sizeof(double)) == 0);
+            }
+        }
+        std::vector<double> mask(left.size());
+        portable->array_array[KERNEL_LT](mask.data(), left.data(), right.data(), left.size());
+        REQUIRE(mask == std::vector<double>{0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0});
+        portable->array_array[KERNEL_NE](mask.data(), left.data(), right.data(), left.size());
+        REQUIRE(mask == std::vector<double>{0, 1, 1, 0, 1, 0, 0, 1, 1, 1, 0, 0, 1, 1, 0, 1, 0});
+        portable->array_array[KERNEL_AND](mask.data(), left.data(), right.data(), left.size());
+        REQUIRE(mask == std::vector<double>{1, 1, 1, 0, 1, 0, 1, 1, 0, 1, 0, 1, 1, 0, 1, 0, 1});
+        REQUIRE(portable->count(left.data(), left.size()) == 13);
+    }
+
+    SECTION("Gather and scatter") {
+        std::vector<double> src(40);
+        for (size_t i = 0; i < src.size(); i++) src[i] = i * 0.5 - 3;
+        // Out of order and repeated, so the last write of a scatter wins
+        std::vector<size_t> offsets = {39, 0, 7, 7, 12, 3, 38, 1, 20, 20, 5, 33, 2, 17, 7, 0, 26};
+        for (size_t n = 0; n <= offsets.size(); n++) {
+            for (const Kernels* k : supported_kernels()) {
+                std::vector<double> expected(n), actual(n);
+                portable->gather(expected.data(), src.data(), offsets.data(), n);
+                k->gather(actual.data(), src.data(), offsets.data(), n);
+                REQUIRE(actual == expected);
+                std::vector<double> scattered = src, portable_scattered = src;
+                portable->scatter(portable_scattered.data(), offsets.data(), expected.data(), 1, n);
+                k->scatter(scattered.data(), offsets.data(), expected.data(), 1, n);
+                REQUIRE(scattered == portable_scattered);
+                double number = 9;
+                portable->scatter(portable_scattered.data(), offsets.data(), &number, 0, n);
+                k->scatter(scattered.data(), offsets.data(), &number, 0, n);
+                REQUIRE(scattered == portable_scattered);
+            }
+        }
+        std::vector<double> picked(4);
+        portable->gather(picked.data(), src.data(), offsets.data(), 4);
+        REQUIRE(picked == std::vector<double>{16.5, -3, 0.5, 0.5});
+        std::vector<double> written(4, 0);
+        std::vector<double> values = {1, 2, 3, 4};
+        portable->scatter(written.data(), std::vector<size_t>{3, 1, 3, 0}.data(), values.data(), 1, 4);
+        REQUIRE(written == std::vector<double>{4, 2, 0, 3});
+    }
+}
+
+TEST_CASE("Math kernels", "[kernels]") {
+    long double (*exact[NUM_MATH_OPS])(long double) = {expl, logl, sqrtl, sinl, cosl, tanhl};
+    double (*libm[NUM_MATH_OPS])(double) = {exp, log, sqrt, sin, cos, tanh};
+    // Where each approximation applies, past which libm takes over
+    double from[NUM_MATH_OPS] = {-700, 1e-300, 0, -1e5, -1e5, -25};
+    double to[NUM_MATH_OPS] = {700, 1e300, 1e300, 1e5, 1e5, 25};
+    double specials[] = {NAN, INFINITY, -INFINITY, 0, -0.0, -1, 1e-310, 1e300, -1e300, 800, -800, 1e6, 1e-20};
+    size_t n = 20000;
+    std::vector<double> x(n), actual(n);
+    for (size_t op = 0; op < NUM_MATH_OPS; op++) {
+        for (size_t i = 0; i < n; i++) {
+            double t = (double) i / (n - 1);
+            // log and sqrt spread their samples over exponents, the rest
+            // evenly, with every other one near 0 where the polynomials take
+            // over alone
+            if (op == MATH_LOG || op == MATH_SQRT) x[i] = exp(::log(from[MATH_LOG]) + t * (::log(to[op]) - ::log(from[MATH_LOG])));
+            else if (i % 2) x[i] = -3 + 6 * t;
+            else x[i] = from[op] + t * (to[op] - from[op]);
+        }
+        for (const MathKernels* k : supported_math_kernels()) {
+            k->apply[op](actual.data(), x.data(), n);
+            for (size_t i = 0; i < n; i++) {
+                long double want = exact[op](x[i]);
+                double ulp = std::nextafter(std::abs((double) want), INFINITY) - std::abs((double) want);
+                REQUIRE((double) (std::abs(actual[i] - want) / ulp) <= (op == MATH_TANH ? 2 : 1));
+            }
+            // Lengths around every vector width, written over the source
+            for (size_t len = 0; len < 20; len++) {
+                std::vector<double> part(x.begin() + 100, x.begin() + 100 + len);
+                k->apply[op](part.data(), part.data(), len);
+                for (size_t i = 0; i < len; i++) REQUIRE(part[i] == actual[100 + i]);
+            }
+            for (double special : specials) {
+                double result;
+                k->apply[op](&result, &special, 1);
+                double expected = libm[op](special);
+                if (std::isnan(expected)) REQUIRE(std::isnan(result));
+                else REQUIRE(std::memcmp(&result, &expected, sizeof(double)) == 0);
+            }
+        }
+    }
+    REQUIRE(&math_kernels() == supported_math_kernels().back());
+}
+
+TEST_CASE("Reductions", "[kernels]") {
+    // Lengths around the vector widths and past one pairwise block, with
+    // small integers so every order of additions is exact
+    for (size_t n = 1; n < 2 * PAIRWISE_BLOCK + 20; n++) {
+        std::vector<double> x(n);
+        for (size_t i = 0; i < n; i++) x[i] = (double) ((i * 7) % 11) - 5;
+        double sum = 0, max = x[0], min = x[0];
+        for (double val : x) {
+            sum += val;
+            max = std::max(max, val);
+            min = std::min(min, val);
+        }
+        for (const Kernels* k : supported_kernels()) {
+            REQUIRE(k->sum(x.data(), n) == sum);
+            REQUIRE(k->max(x.data(), n) == max);
+            REQUIRE(k->min(x.data(), n) == min);
+        }
+        // A NaN anywhere carries through, an infinity doesn't
+        x[n / 2] = INFINITY;
+        for (const Kernels* k : supported_kernels()) REQUIRE(k->max(x.data(), n) == INFINITY);
+        x[n - 1] = NAN;
+        for (const Kernels* k : supported_kernels()) {
+            REQUIRE(std::isnan(k->max(x.data(), n)));
+            REQUIRE(std::isnan(k->min(x.data(), n)));
+        }
+    }
+    for (const Kernels* k : supported_kernels()) REQUIRE(k->sum(nullptr, 0) == 0);
+
+    SECTION("Whole arrays split between threads") {
+        size_t n = 3 * PARALLEL_THRESHOLD + 5;
+        std::vector<double> x(n, 0.1);
+        x[n - 7] = 4;
+        set_num_threads(1);
+        double sum = reduce(REDUCE_SUM, x.data(), n);
+        // Adding 0.1 one at a time would be off in the 11th digit
+        REQUIRE(std::abs(sum - (0.1 * (n - 1) + 4)) < 1e-13 * sum);
+        set_num_threads(3);
+        REQUIRE(reduce(REDUCE_SUM, x.data(), n) == sum);
+        REQUIRE(reduce(REDUCE_MEAN, x.data(), n) == sum / n);
+        REQUIRE(reduce(REDUCE_MAX, x.data(), n) == 4);
+        REQUIRE(reduce(REDUCE_MIN, x.data(), n) == 0.1);
+        REQUIRE(reduce(REDUCE_ARGMAX, x.data(), n) == n - 7);
+        x[n - 3] = NAN;
+        x[n - 2] = NAN;
+        REQUIRE(reduce(REDUCE_ARGMAX, x.data(), n) == n - 3);
+        set_num_threads(0);
+    }
+
+    SECTION("Along an axis") {
+        // Rows past one block of columns and longer than the pairwise groups
+        size_t outer = 3, len = 37, inner = 600;
+        std::vector<double> x(outer * len * inner);
+        for (size_t i = 0; i < x.size(); i++) x[i] = (double) ((i * 13) % 17) - 8;
+        for (size_t threads : {1, 3}) {
+            set_num_threads(threads);
+            for (auto [o, l, in] : std::vector<std::array<size_t, 3>>{{outer, len, inner}, {outer * len, inner, 1}, {1, outer, len * inner}}) {
+                for (ReduceOp op : {REDUCE_SUM, REDUCE_MAX, REDUCE_MIN, REDUCE_MEAN, REDUCE_ARGMAX}) {
+                    std::vector<double> out(o * in), expected(o * in);
+                    for (size_t i = 0; i < o; i++) {
+                        for (size_t j = 0; j < in; j++) {
+                            double sum = 0, best = x[i * l * in + j], index = 0;
+                            for (size_t p = 0; p < l; p++) {
+                                double val = x[(i * l + p) * in + j];
+                                sum += val;
+                                if (op == REDUCE_MIN ? val < best : val > best) {
+                                    best = val;
+                                    index = p;
+                                }
+                            }
+                            expected[i * in + j] = op == REDUCE_SUM ? sum : op == REDUCE_MEAN ? sum / l : op == REDUCE_ARGMAX ? index : best;
+                        }
+                    }
+                    reduce_axis(op, x.data(), o, l, in, out.data());
+                    REQUIRE(out == expected);
+                }
+            }
+        }
+        set_num_threads(0);
+    }
+}
+
+// Comes before every other product, so the workers of the batch are the
+// first to need the backend and, once it's BLAS, the provider
+TEST_CASE("Batched products split between threads", "[gemm]") {
+    size_t count = 100000, m = 4, n = 4, k = 9;
+    std::vector<double> a(count * m * k), b(count * k * n), expected(count * m * n, 0);
+    for (size_t i = 0; i < a.size(); i++) a[i] = (double) (i % 7) - 3;
+    for (size_t i = 0; i < b.size(); i++) b[i] = (double) (i % 5) * 0.5;
+    for (size_t batch = 0; batch < count; batch++) {
+        for (size_t i = 0; i < m; i++) {
+            for (size_t p = 0; p < k; p++) {
+                for (size_t j = 0; j < n; j++) expected[(batch * m + i) * n + j] += a[(batch * m + i) * k + p] * b[(batch * k + p) * n + j];
+            }
+        }
+    }
+    set_num_threads(4);
+    std::vector<double> c(count * m * n, -1);
+    batched_matmul(count, m, n, k, a.data(), m * k, b.data(), k * n, c.data());
+    REQUIRE(c == expected);
+    set_matmul_backend(MATMUL_BLAS);
+    std::fill(c.begin(), c.end(), -1);
+    batched_matmul(count, m, n, k, a.data(), m * k, b.data(), k * n, c.data());
+    REQUIRE(c == expected);
+    set_matmul_backend(MATMUL_NATIVE);
+    set_num_threads(0);
+}
+
+TEST_CASE("Native GEMM", "[gemm]") {
+    // Sizes around the tile and block edges, with k past one block, and
+    // single rows and columns that matmul hands to the dot and gemv loops
+    std::vector<std::array<size_t, 3>> sizes = {{1, 1, 1}, {7, 9, 5}, {6, 8, 256}, {97, 17, 300}, {13, 2050, 3}, {200, 130, 70}, {5, 4, 0},
+                                                {1, 1, 300}, {1, 9, 5}, {300, 1, 7}, {1, 300, 300}, {3, 1, 0}};
+    for (size_t threads : {1, 3}) {
+        set_num_threads(threads);
+        for (auto [m, n, k] : sizes) {
+            std::vector<double> a(m * k), b(k * n), c(m * n, -1), expected(m * n, 0);
+            for (size_t i = 0; i < a.size(); i++) a[i] = (double) (i % 7) - 3;
+            for (size_t i = 0; i < b.size(); i++) b[i] = (double) (i % 5) * 0.5;
+            for (size_t i = 0; i < m; i++) {
+                for (size_t p = 0; p < k; p++) {
+                    for (size_t j = 0; j < n; j++) expected[i * n + j] += a[i * k + p] * b[p * n + j];
+                }
+            }
+            native_gemm(m, n, k, a.data(), b.data(), c.data());
+            // Small integers and halves, so every order of additions is exact
+            REQUIRE(c == expected);
+            std::fill(c.begin(), c.end(), -1);
+            matmul(m, n, k, a.data(), b.data(), c.data());
+            REQUIRE(c == expected);
+        }
+    }
+    set_num_threads(0);
+
+    // Every size with an unrolled kernel, and one past it
+    for (size_t m = 1; m <= SMALL_GEMM_SIZE + 1; m++) {
+        for (size_t n = 1; n <= SMALL_GEMM_SIZE + 1; n++) {
+            for (size_t k = 1; k <= SMALL_GEMM_SIZE + 1; k++) {
+                std::vector<double> a(m * k), b(k * n), c(m * n, -1), expected(m * n, 0);
+                for (size_t i = 0; i < a.size(); i++) a[i] = (double) (i % 7) - 3;
+                for (size_t i = 0; i < b.size(); i++) b[i] = (double) (i % 5) * 0.5;
+                for (size_t i = 0; i < m; i++) {
+                    for (size_t p = 0; p < k; p++) {
+                        for (size_t j = 0; j < n; j++) expected[i * n + j] += a[i * k + p] * b[p * n + j];
+                    }
+                }
+                matmul(m, n, k, a.data(), b.data(), c.data());
+                REQUIRE(c == expected);
+            }
+        }
+    }
+
+    SECTION("Transposed and strided operands") {
+        // Leading dimensions past the rows, as slices of wider arrays have
+        std::vector<std::array<size_t, 3>> sizes = {{5, 7, 3}, {1, 1, 20}, {30, 1, 20}, {1, 30, 20}, {40, 33, 50}};
+        for (MatmulBackend backend : {MATMUL_NATIVE, MATMUL_BLAS}) {
+            set_matmul_backend(backend);
+            for (auto [m, n, k] : sizes) {
+                for (bool trans_a : {false, true}) {
+                    for (bool trans_b : {false, true}) {
+                        size_t lda = (trans_a ? m : k) + 2;
+                        size_t ldb = (trans_b ? k : n) + 3;
+                        std::vector<double> a((trans_a ? k : m) * lda), b((trans_b ? n : k) * ldb);
+                        for (size_t i = 0; i < a.size(); i++) a[i] = (double) (i % 7) - 3;
+                        for (size_t i = 0; i < b.size(); i++) b[i] = (double) (i % 5) * 0.5;
+                        std::vector<double> c(m * n, -1), expected(m * n, 0);
+                        for (size_t i = 0; i < m; i++) {
+                            for (size_t p = 0; p < k; p++) {
+                                double a_ip = trans_a ? a[p * lda + i] : a[i * lda + p];
+                                for (size_t j = 0; j < n; j++) expected[i * n + j] += a_ip * (trans_b ? b[j * ldb + p] : b[p * ldb + j]);
+                            }
+                        }
+                        matmul(m, n, k, a.data(), lda, trans_a, b.data(), ldb, trans_b, c.data());
+                        REQUIRE(c == expected);
+                    }
+                }
+            }
+        }
+        set_matmul_backend(MATMUL_NATIVE);
+    }
+}
+
+TEST_CASE("BLAS providers", "[blas]") {
+    REQUIRE(blas_provider_names().front() == "auto");
+    REQUIRE_FALSE(load_blas_provider("not a blas"));
+    REQUIRE(load_blas_provider("linked"));
+    REQUIRE(blas_provider().name == "linked");
+    REQUIRE(blas_provider().path.empty());
+    // Whichever of the others are installed must agree with the native GEMM
+    size_t m = 37, n = 21, k = 50;
+    std::vector<double> a(m * k), b(k * n), expected(m * n);
+    for (size_t i = 0; i < a.size(); i++) a[i] = (double) (i % 7) - 3;
+    for (size_t i = 0; i < b.size(); i++) b[i] = (double) (i % 5) * 0.5;
+    native_gemm(m, n, k, a.data(), b.data(), expected.data());
+    set_matmul_backend(MATMUL_BLAS);
+    for (const std::string& name : blas_provider_names()) {
+        if (!load_blas_provider(name)) continue;
+        REQUIRE(blas_provider().dgemm != nullptr);
+        std::vector<double> c(m * n, -1);
+        matmul(m, n, k, a.data(), b.data(), c.data());
+        REQUIRE(c == expected);
+        // ddot and dgemv for a single row or column
+        double dot;
+        matmul(1, 1, k, a.data(), b.data(), &dot);
+        REQUIRE(dot == native_dot(k, a.data(), b.data()));
+        matmul(m, 1, k, a.data(), b.data(), c.data());
+        native_gemv(false, m, k, a.data(), b.data(), expected.data());
+        REQUIRE(std::equal(c.begin(), c.begin() + m, expected.begin()));
+        matmul(1, n, k, a.data(), b.data(), c.data());
+        native_gemv(true, k, n, b.data(), a.data(), expected.data());
+        REQUIRE(std::equal(c.begin(), c.begin() + n, expected.begin()));
+        native_gemm(m, n, k, a.data(), b.data(), expected.data());
+    }
+    set_matmul_backend(MATMUL_NATIVE);
+    REQUIRE(load_blas_provider("linked"));
+}
+
+TEST_CASE("Matrix chain order", "[chain]") {
+    Token op (AT, "@", 0, 0);
+    const Token* ops[] = {&op, &op};
+    auto matrix = [](size_t rows, size_t cols) {
+        Elements data (rows * cols);
+        for (size_t i = 0; i < data.size(); i++) data[i] = (double) (i % 5) - 2;
+        return Variable(NDArray(std::move(data), {rows, cols}));
+    };
+    auto left_to_right = [&](const Variable* operands) {
+        return binary_operation(op, binary_operation(op, operands[0], operands[1]), operands[2]);
+    };
+    ChainOrder order;
+
+    SECTION("A narrow last operand is multiplied first") {
+        Variable operands[] = {matrix(50, 50), matrix(50, 50), matrix(50, 1)};
+        Variable product = multiply_chain(operands, ops, 3, order);
+        REQUIRE(order.dims == std::vector<size_t>({50, 50, 50, 1}));
+        REQUIRE(order.splits[2] == 0);
+        REQUIRE(std::get<NDArray>(product.value) == std::get<NDArray>(left_to_right(operands).value));
+    }
+
+    SECTION("Equal costs keep the left to right order") {
+        Variable operands[] = {matrix(4, 4), matrix(4, 4), matrix(4, 4)};
+        multiply_chain(operands, ops, 3, order);
+        REQUIRE(order.splits[2] == 1);
+    }
+
+    SECTION("The order is chosen again when the dimensions change") {
+        Variable wide[] = {matrix(1, 30), matrix(30, 30), matrix(30, 30)};
+        multiply_chain(wide, ops, 3, order);
+        REQUIRE(order.splits[2] == 1);
+        Variable narrow[] = {matrix(30, 30), matrix(30, 30), matrix(30, 1)};
+        multiply_chain(narrow, ops, 3, order);
+        REQUIRE(order.dims == std::vector<size_t>({30, 30, 30, 1}));
+        REQUIRE(order.splits[2] == 0);
+    }
+}
+
+TEST_CASE("Thread pool", "[threads]") {
+    ThreadPool pool(4);
+    REQUIRE(pool.num_threads() == 4);
+
+    SECTION("Every index is visited once") {
+        for (size_t n : {1, 7, 16, 1000, 123457}) {
+            std::vector<int> visits(n, 0);
+            pool.parallel_for(n, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) visits[i]++;
+            });
+            REQUIRE(visits == std::vector<int>(n, 1));
+        }
+    }
+
+    SECTION("A loop started inside a loop runs on its own thread") {
+        std::vector<int> visits(64, 0);
+        pool.parallel_for(8, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                pool.parallel_for(8, [&](size_t inner_begin, size_t inner_end) {
+                    for (size_t j = inner_begin; j < inner_end; j++) visits[i * 8 + j]++;
+                });
+            }
+        });
+        REQUIRE(visits == std::vector<int>(64, 1));
     }
 }
 
@@ -1333,6 +1961,17 @@ std::string getOutput(std::string program) {
     return output_stream.str();
 }
 
+std::string getVMOutput(std::string program) {
+    Lexer lex;
+    auto lexed = lex.lex(program);
+    Parser p (lexed);
+    auto statements = p.parse();
+    std::stringstream output_stream;
+    VM vm (output_stream);
+    vm.run(statements);
+    return output_stream.str();
+}
+
 TEST_CASE("Printing simple expressions", "[environment]") {
     SECTION("string literal") {
         REQUIRE_OUTPUT("p \"hello\";", "\"hello\"");
@@ -1446,6 +2085,180 @@ TEST_CASE("Variable declaration and usage", "[environment]") {
     }
 }
 
+TEST_CASE("Array value semantics", "[environment]") {
+    SECTION("Copies share a buffer until written to") {
+        NDArray original ({1, 2, 3}, {3});
+        NDArray copy = original;
+        REQUIRE(&copy.data() == &original.data());
+        copy.mutable_data()[0] = 5;
+        REQUIRE(&copy.data() != &original.data());
+        REQUIRE(original.data() == Elements({1, 2, 3}));
+        REQUIRE(copy.data() == Elements({5, 2, 3}));
+    }
+
+    SECTION("Reshaping to the same size shares the buffer") {
+        Token sa (AS_SHAPE, "sa", 0, 0);
+        NDArray original ({1, 2, 3, 4, 5, 6}, {6});
+        NDArray reshaped = std::get<NDArray>(binary_operation(sa, Variable(original), Variable(NDArray({2, 3}, {2}))).value);
+        REQUIRE(reshaped.shape() == std::vector<size_t>({2, 3}));
+        REQUIRE(reshaped.elements() == original.elements());
+        REQUIRE_FALSE(reshaped.is_view());
+        NDArray rows = std::get<NDArray>(slice_array(reshaped, std::vector<IndexRange>({{1, 2, true}, {0, 3, true}}).data()).value);
+        NDArray row = std::get<NDArray>(binary_operation(sa, Variable(rows), Variable(NDArray({3}, {1}))).value);
+        REQUIRE(row.elements() == original.elements() + 3);
+        NDArray repeated = std::get<NDArray>(binary_operation(sa, Variable(original), Variable(NDArray({4}, {1}))).value);
+        REQUIRE(repeated.elements() != original.elements());
+    }
+
+    SECTION("Reshaped arrays keep value semantics") {
+        auto program = R"V0G0N(
+            a vals = [1, 2, 3, 4, 5, 6];
+            a m = vals sa [2, 3];
+            m[0, 0] = 10;
+            p vals;
+            p m;
+            a col = (tr m) sa [6];
+            p col;
+            p m[1, :] sa [3, 1];
+            p vals sa [4];
+            p vals sa [2, 6];
+        )V0G0N";
+        auto output = R"V0G0N(
+            [1, 2, 3, 4, 5, 6] sa [6]
+            [10, 2, 3, 4, 5, 6] sa [2, 3]
+            [10, 4, 2, 5, 3, 6] sa [6]
+            [4, 5, 6] sa [3, 1]
+            [1, 2, 3, 4] sa [4]
+            [1, 2, 3, 4, 5, 6, 1, 2, 3, 4, 5, 6] sa [2, 6]
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+    }
+
+    SECTION("Buffers start on a cache line") {
+        Elements zeros (7, 0);
+        REQUIRE(zeros == Elements({0, 0, 0, 0, 0, 0, 0}));
+        for (size_t n : {1, 3, 1000}) REQUIRE((uintptr_t) Elements(n).data() % 64 == 0);
+        NDArray product = std::get<NDArray>(binary_operation(Token(AT, "@", 0, 0), Variable(NDArray({1, 2}, {1, 2})), Variable(NDArray({3, 4}, {2, 1}))).value);
+        REQUIRE((uintptr_t) product.data().data() % 64 == 0);
+        REQUIRE(product.data() == Elements({11}));
+    }
+
+    SECTION("Indices that reassign the array") {
+        auto program = R"V0G0N(
+            a m = [10, 20];
+            p m[(m = 0) + 1];
+            p m;
+        )V0G0N";
+        REQUIRE_OUTPUT(program, "20\n0");
+        REQUIRE(getVMOutput(program) == clean_output_string("20\n0"));
+    }
+
+    SECTION("Assigning an element doesn't change other variables") {
+        auto program = R"V0G0N(
+            f set_first(arr) {
+                arr[0] = 9;
+                r arr;
+            }
+            a x = [1, 2];
+            a y = x;
+            y[1] = 7;
+            a z = set_first(x);
+            p x;
+            p y;
+            p z;
+        )V0G0N";
+        auto output = R"V0G0N(
+            [1, 2] sa [2]
+            [1, 7] sa [2]
+            [9, 2] sa [2]
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+    }
+
+    SECTION("Updating an array in place doesn't change its copies") {
+        auto program = R"V0G0N(
+            f scale(m, k) {
+                r m * k + 1;
+            }
+            f keep(m) {
+                a doubled = m * 2;
+                a m = [0];
+                r m + doubled;
+            }
+            a x = [1, 2, 3];
+            a y = x;
+            x = x * 2;
+            x = 1 - x;
+            x = x + x;
+            a z = scale(x, 3);
+            a n = 0;
+            w (n < 2) {
+                a t = y * 1;
+                y = t * 10;
+                n = n + 1;
+            }
+            p x;
+            p y;
+            p z;
+            p keep(x);
+        )V0G0N";
+        auto output = R"V0G0N(
+            [-2, -6, -10] sa [3]
+            [10, 20, 30] sa [3]
+            [-5, -17, -29] sa [3]
+            [-6, -18, -30] sa [3]
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+        REQUIRE(getVMOutput(program) == clean_output_string(output));
+    }
+
+    SECTION("Large arrays split between threads") {
+        auto program = R"V0G0N(
+            a x = [1, 2, 3] sa [300001];
+            a y = x * 2 + 1;
+            a z = x ^ 2;
+            x = x - 1;
+            p [y[0], y[150001], y[300000]];
+            p [z[1], z[299999], x[2]];
+        )V0G0N";
+        auto output = R"V0G0N(
+            [3, 5, 3] sa [3]
+            [4, 9, 2] sa [3]
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+        set_num_threads(3);
+        REQUIRE_OUTPUT(program, output);
+        REQUIRE(getVMOutput(program) == clean_output_string(output));
+        set_num_threads(0);
+    }
+
+    SECTION("Chains of elementwise operators") {
+        auto program = R"V0G0N(
+            f half(m) {
+                r m / 2;
+            }
+            a x = [1, 2, 3, 4];
+            a y = [4, 3, 2, 1];
+            a k = 3;
+            p 2 * x + y * y - 1;
+            p (x - y) ^ 2 / k + half(y) * x;
+            p k * 2 + 1;
+            x = x * 0.5 + y * 0.25 + 1;
+            p x;
+            p y;
+        )V0G0N";
+        auto output = R"V0G0N(
+            [17, 12, 9, 8] sa [4]
+            [5, 3.33333, 3.33333, 5] sa [4]
+            7
+            [2.5, 2.75, 3, 3.25] sa [4]
+            [4, 3, 2, 1] sa [4]
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+        REQUIRE(getVMOutput(program) == clean_output_string(output));
+    }
+}
+
 TEST_CASE("Function declaration and usage", "[environment]") {
     SECTION("Function with no parameters") {
         auto program = R"V0G0N(
@@ -1585,6 +2398,596 @@ TEST_CASE("Assert usage", "[environment]") {
 // matrix multiplication, and it would not make sense to test something that's already
 // been tested.
 
+TEST_CASE("Matrix products", "[environment]") {
+    SECTION("Vectors and matrices") {
+        auto program = R"V0G0N(
+            a m = [1, 2, 3, 4, 5, 6] sa [2, 3];
+            p [1, 2, 3] @ [4, 5, 6];
+            p m @ [1, 0, 2];
+            p [1, 1] @ m;
+            p m @ ([1, 0, 0, 1, 1, 1] sa [3, 2]);
+        )V0G0N";
+        auto output = R"V0G0N(
+            32
+            [7, 16] sa [2]
+            [5, 7, 9] sa [3]
+            [4, 5, 10, 11] sa [2, 2]
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+    }
+
+    SECTION("Stacks of matrices") {
+        auto program = R"V0G0N(
+            a t = [1, 2, 3, 4, 5, 6, 7, 8] sa [2, 2, 2];
+            p t @ t;
+            p t @ [1, 1];
+            p [1, 1] @ t;
+            p ([0, 1, 1, 0] sa [2, 2]) @ t;
+        )V0G0N";
+        auto output = R"V0G0N(
+            [7, 10, 15, 22, 67, 78, 91, 106] sa [2, 2, 2]
+            [3, 7, 11, 15] sa [2, 2]
+            [4, 6, 12, 14] sa [2, 2]
+            [3, 4, 1, 2, 7, 8, 5, 6] sa [2, 2, 2]
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+    }
+
+    SECTION("Chains of products") {
+        auto program = R"V0G0N(
+            a x = [1, 2, 3, 4, 5, 6] sa [2, 3];
+            a y = [1, 0, 2, 1, 1, 1] sa [3, 2];
+            p x @ y @ x;
+            p x @ y @ [1, 2];
+            p [1, 1] @ x @ y @ [1, 2];
+            a t = [1, 2, 3, 4, 5, 6, 7, 8] sa [2, 2, 2];
+            p t @ t @ t;
+        )V0G0N";
+        auto output = R"V0G0N(
+            [28, 41, 54, 64, 95, 126] sa [2, 3]
+            [18, 42] sa [2]
+            60
+            [37, 54, 81, 118, 881, 1026, 1197, 1394] sa [2, 2, 2]
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+        // Each product is checked before the next operand is evaluated
+        REQUIRE_THROWS_WITH(getOutput("a q = [1, 2] sa [1, 2]; p q @ q @ dne;"), "Runtime error: Left array's num of cols differs from right array's num of rows, occurred at line 0 at column 28");
+        REQUIRE_THROWS_WITH(getOutput("p [1, 2] @ [3, 4] @ [1, 2];"), "Runtime error: Left expression isn't an ndarray, occurred at line 0 at column 18");
+    }
+
+    SECTION("Mismatched dimensions") {
+        REQUIRE_THROWS_WITH(getOutput("p [1, 2] @ [1, 2, 3];"), "Runtime error: Arrays differ in length, occurred at line 0 at column 9");
+        REQUIRE_THROWS_WITH(getOutput("p ([1, 2] sa [2, 1]) @ [1, 2];"), "Runtime error: Left array's num of cols differs from right array's length, occurred at line 0 at column 21");
+        REQUIRE_THROWS_WITH(getOutput("p [1, 2, 3] @ ([1] sa [2, 2]);"), "Runtime error: Left array's length differs from right array's num of rows, occurred at line 0 at column 12");
+        REQUIRE_THROWS_WITH(getOutput("p ([1] sa [2, 2, 2]) @ ([1] sa [3, 2, 2]);"), "Runtime error: Arrays differ in the dimensions of their stacks of matrices, occurred at line 0 at column 21");
+    }
+}
+
+TEST_CASE("Reduction builtins", "[environment]") {
+    SECTION("Whole arrays and axes") {
+        auto program = R"V0G0N(
+            a m = [1, 2, 3, 4, 5, 6] sa [2, 3];
+            p sum(m);
+            p sum(m, 0);
+            p sum(m, -1);
+            p max(m);
+            p min(m, 0);
+            p mean(m, 1);
+            p argmax(m);
+            p argmax([3, 9, 2, 9]);
+            p argmax(m, 0);
+            p max([1, 2, 3], 0);
+            a t = [1, 2, 3, 4, 5, 6, 7, 8] sa [2, 2, 2];
+            p sum(t, 1);
+            p sum([] sa [0]);
+        )V0G0N";
+        auto output = R"V0G0N(
+            21
+            [5, 7, 9] sa [3]
+            [6, 15] sa [2]
+            6
+            [1, 2, 3] sa [3]
+            [2, 5] sa [2]
+            5
+            1
+            [1, 1, 1] sa [3]
+            3
+            [4, 6, 12, 14] sa [2, 2]
+            0
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+    }
+
+    SECTION("Builtins come before the program's functions") {
+        REQUIRE_OUTPUT("f sum(x) { r 0; } p sum([1, 2]);", "3");
+    }
+
+    SECTION("Invalid arguments") {
+        REQUIRE_THROWS_WITH(getOutput("p sum(3);"), "Runtime error: Expression evaluates to a non-ndarray, occurred at line 0 at column 2");
+        REQUIRE_THROWS_WITH(getOutput("p max([] sa [0]);"), "Runtime error: Can't reduce an empty ndarray, occurred at line 0 at column 2");
+        REQUIRE_THROWS_WITH(getOutput("p sum([1, 2], 1);"), "Runtime error: An expression used as an axis is out of range of the dimensions of the ndarray, occurred at line 0 at column 2");
+        REQUIRE_THROWS_WITH(getOutput("p sum([1, 2], 0.5);"), "Runtime error: An expression used as an axis is not close to an integer, occurred at line 0 at column 2");
+        REQUIRE_THROWS_WITH(getOutput("p sum([1], 0, dne);"), "Runtime error: Function called with different number of args than defined with, occurred at line 0 at column 5");
+    }
+}
+
+TEST_CASE("Math builtins", "[environment]") {
+    SECTION("Numbers and ndarrays") {
+        auto program = R"V0G0N(
+            p exp(0);
+            p log(1);
+            p sqrt([4, 9, 2.25, 0] sa [2, 2]);
+            p sin(0) + cos(0);
+            p tanh([0, 100, -100]);
+            p exp(log(2)) == 2;
+            a x = [1, 4];
+            a y = sqrt(x);
+            p x;
+            p y;
+        )V0G0N";
+        auto output = R"V0G0N(
+            1
+            0
+            [2, 3, 1.5, 0] sa [2, 2]
+            1
+            [0, 1, -1] sa [3]
+            True
+            [1, 4] sa [2]
+            [1, 2] sa [2]
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+    }
+
+    SECTION("Shortcuts for powers") {
+        auto program = R"V0G0N(
+            p 2 ^ 0.5 == sqrt(2);
+            p [1, 2, 3] ^ 2;
+            p all([1, 2, 3] ^ 3 == [1, 8, 27]);
+            p 4 ^ -1;
+            p all([2, 4] ^ 0.5 == sqrt([2, 4]));
+        )V0G0N";
+        auto output = R"V0G0N(
+            True
+            [1, 4, 9] sa [3]
+            True
+            0.25
+            True
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+    }
+
+    SECTION("Invalid arguments") {
+        REQUIRE_THROWS_WITH(getOutput("p exp(\"a\");"), "Runtime error: Expression evaluates to neither a number nor an ndarray, occurred at line 0 at column 2");
+        REQUIRE_THROWS_WITH(getOutput("p sqrt(1, 2);"), "Runtime error: Function called with different number of args than defined with, occurred at line 0 at column 6");
+    }
+}
+
+TEST_CASE("Slices and transposes", "[environment]") {
+    SECTION("Views") {
+        auto program = R"V0G0N(
+            a m = [1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12] sa [3, 4];
+            p m[1, 0];
+            p m[1:3, :];
+            p m[:, 1];
+            p m[1:, 1:3];
+            p m[:2, 3];
+            p m[1:1, :];
+            p tr m;
+            p (tr m)[3, 1];
+            p tr m[1:3, 0:2];
+            p tr [1, 2, 3];
+            p tr ([1, 2, 3, 4, 5, 6, 7, 8] sa [2, 2, 2]);
+            p m[0:2, 1:3] * 10 + m[1:3, 0:2];
+            p sum(m[:, 1]);
+        )V0G0N";
+        auto output = R"V0G0N(
+            5
+            [5, 6, 7, 8, 9, 10, 11, 12] sa [2, 4]
+            [2, 6, 10] sa [3]
+            [6, 7, 10, 11] sa [2, 2]
+            [4, 8] sa [2]
+            [] sa [0, 4]
+            [1, 5, 9, 2, 6, 10, 3, 7, 11, 4, 8, 12] sa [4, 3]
+            8
+            [5, 9, 6, 10] sa [2, 2]
+            [1, 2, 3] sa [3]
+            [1, 5, 3, 7, 2, 6, 4, 8] sa [2, 2, 2]
+            [25, 36, 69, 80] sa [2, 2]
+            18
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+    }
+
+    SECTION("Products of views") {
+        auto program = R"V0G0N(
+            a m = [1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12] sa [3, 4];
+            p tr m @ m[:, 0:2];
+            p m[0:2, 0:2] @ m[1:3, 2:4];
+            p m[2:3, :] @ tr m[2:3, :];
+            p tr m[:, 1:2] @ m[:, 2:3];
+            p m[1, :] @ tr m;
+        )V0G0N";
+        auto output = R"V0G0N(
+            [107, 122, 122, 140, 137, 158, 152, 176] sa [4, 2]
+            [29, 32, 101, 112] sa [2, 2]
+            [446] sa [1, 1]
+            [158] sa [1, 1]
+            [70, 174, 278] sa [3]
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+    }
+
+    SECTION("Writing to a view leaves the original alone") {
+        auto program = R"V0G0N(
+            a m = [1, 2, 3, 4] sa [2, 2];
+            a row = m[1, :];
+            row[0] = 10;
+            a mt = tr m;
+            mt[0, 1] = 20;
+            p m;
+            p row;
+            p mt;
+        )V0G0N";
+        auto output = R"V0G0N(
+            [1, 2, 3, 4] sa [2, 2]
+            [10, 4] sa [2]
+            [1, 20, 2, 4] sa [2, 2]
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+    }
+
+    SECTION("Invalid slices") {
+        REQUIRE_THROWS_WITH(getOutput("a m = [1, 2, 3]; p m[1:4];"), "Runtime error: An expression used in array slicing is larger than a dimension of the ndarray, occurred at line 0 at column 20");
+        REQUIRE_THROWS_WITH(getOutput("a m = [1, 2, 3]; p m[2:1];"), "Runtime error: The start of a slice is past its end, occurred at line 0 at column 20");
+        REQUIRE_THROWS_WITH(getOutput("a m = [1, 2, 3]; p m[0.5:];"), "Runtime error: An expression used in array slicing is not close to an integer, occurred at line 0 at column 20");
+        REQUIRE_THROWS_WITH(getOutput("a m = [1, 2, 3]; p m[:T];"), "Runtime error: An expression used in array slicing is not a number, occurred at line 0 at column 20");
+        REQUIRE_THROWS_WITH(getOutput("a m = [1, 2] sa [1, 2]; p m[:];"), "Runtime error: Number of dimensions in array element access differs from number of dimensions in array, occurred at line 0 at column 27");
+        REQUIRE_THROWS_WITH(getOutput("p tr 3;"), "Runtime error: Expression evaluates to a non-ndarray, occurred at line 0 at column 2");
+    }
+}
+
+TEST_CASE("Broadcasting", "[environment]") {
+    SECTION("Rows and columns") {
+        auto program = R"V0G0N(
+            a m = [1, 2, 3, 4, 5, 6] sa [2, 3];
+            a col = [100, 200] sa [2, 1];
+            p m + [10, 20, 30];
+            p [10, 20, 30] - m;
+            p m * col;
+            p ([1, 2, 3] sa [3, 1]) * [1, 10];
+            p m > [2, 2, 5];
+            p ([1] sa [2, 2, 3]) + m;
+            p m + [1];
+            p ([0] sa [0, 3]) + [1, 2, 3];
+            p tr m + [1, 2];
+        )V0G0N";
+        auto output = R"V0G0N(
+            [11, 22, 33, 14, 25, 36] sa [2, 3]
+            [9, 18, 27, 6, 15, 24] sa [2, 3]
+            [100, 200, 300, 800, 1000, 1200] sa [2, 3]
+            [1, 10, 2, 20, 3, 30] sa [3, 2]
+            [0, 0, 0, 1, 1, 1] sa [2, 3]
+            [2, 3, 4, 5, 6, 7, 2, 3, 4, 5, 6, 7] sa [2, 2, 3]
+            [2, 3, 4, 5, 6, 7] sa [2, 3]
+            [] sa [0, 3]
+            [2, 6, 3, 7, 4, 8] sa [3, 2]
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+    }
+
+    SECTION("Fused trees and reused operands") {
+        auto program = R"V0G0N(
+            a m = [1, 2, 3, 4, 5, 6] sa [2, 3];
+            p (m + [1, 1, 1]) * ([1, 2] sa [2, 1]) - 1;
+            p [1, 2, 3] * 2 + ([10, 20] sa [2, 1]) * m;
+            a q = [1, 2, 3];
+            q = q + m;
+            p q;
+            m = m - [1, 2, 3];
+            p m;
+        )V0G0N";
+        auto output = R"V0G0N(
+            [1, 2, 3, 9, 11, 13] sa [2, 3]
+            [12, 24, 36, 82, 104, 126] sa [2, 3]
+            [2, 4, 6, 5, 7, 9] sa [2, 3]
+            [0, 0, 0, 3, 3, 3] sa [2, 3]
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+    }
+
+    SECTION("Large arrays match expanded copies") {
+        auto program = R"V0G0N(
+            a m = [1, 2, 3, 4, 5, 6, 7] sa [300, 517];
+            a row = [3, 1, 4, 1, 5, 9, 2, 6] sa [517];
+            a col = [2, 7, 1, 8] sa [300, 1];
+            a rows = row sa [300, 517];
+            a cols = tr ([2, 7, 1, 8] sa [300] sa [517, 300]);
+            p all(m + row == m + rows);
+            p all(m * col - row == m * cols - rows);
+            p all(col + row == cols + rows);
+            p all((m + row) * 2 / col == (m + rows) * 2 / cols);
+        )V0G0N";
+        auto output = R"V0G0N(
+            True
+            True
+            True
+            True
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+    }
+
+    SECTION("Shapes that don't line up") {
+        REQUIRE_THROWS_WITH(getOutput("p [1, 2] + [1, 2, 3];"), "Runtime error: Expressions evaluate to arrays of differing sizes, occurred at line 0 at column 9");
+        REQUIRE_THROWS_WITH(getOutput("p ([1] sa [2, 3]) * ([1] sa [3, 2]);"), "Runtime error: Expressions evaluate to arrays of differing sizes, occurred at line 0 at column 18");
+        REQUIRE_THROWS_WITH(getOutput("a m = [1] sa [2, 3]; m = m + [1, 2]; p m;"), "Runtime error: Expressions evaluate to arrays of differing sizes, occurred at line 0 at column 27");
+    }
+}
+
+TEST_CASE("Computed arrays", "[environment]") {
+    SECTION("Repeats and ranges") {
+        auto program = R"V0G0N(
+            a z = [0] sa [2, 3];
+            a q = [1, 2] sa [5];
+            p z;
+            p q;
+            p q + 10;
+            p q * [1, 2, 3, 4, 5];
+            p ([1] sa [5]) + q;
+            p (q + 1) sa [10];
+            p range(4);
+            p range(2, 5.5);
+            p range(3) * 2 + 1;
+            p range(-1);
+            p range(6) sa [2, 3];
+            p ([1, 2, 3] sa [3, 3])[2, 1];
+            p tr ([1, 2, 3] sa [3, 3]);
+            p sum(range(101));
+        )V0G0N";
+        auto output = R"V0G0N(
+            [0, 0, 0, 0, 0, 0] sa [2, 3]
+            [1, 2, 1, 2, 1] sa [5]
+            [11, 12, 11, 12, 11] sa [5]
+            [1, 4, 3, 8, 5] sa [5]
+            [2, 3, 2, 3, 2] sa [5]
+            [2, 3, 2, 3, 2, 2, 3, 2, 3, 2] sa [10]
+            [0, 1, 2, 3] sa [4]
+            [2, 3, 4, 5] sa [4]
+            [1, 3, 5] sa [3]
+            [] sa [0]
+            [0, 1, 2, 3, 4, 5] sa [2, 3]
+            2
+            [1, 1, 1, 2, 2, 2, 3, 3, 3] sa [3, 3]
+            5050
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+    }
+
+    SECTION("Writing to an element stores the elements") {
+        auto program = R"V0G0N(
+            a m = range(6) sa [2, 3];
+            a copy = m;
+            m[1, 1] = 40;
+            p m;
+            p copy;
+            a ones = [1] sa [4];
+            ones = ones + [1, 2, 3, 4];
+            ones[0] = 0;
+            p ones;
+        )V0G0N";
+        auto output = R"V0G0N(
+            [0, 1, 2, 3, 40, 5] sa [2, 3]
+            [0, 1, 2, 3, 4, 5] sa [2, 3]
+            [0, 3, 4, 5] sa [4]
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+    }
+
+    SECTION("Kernels read patterns without storing the elements") {
+        Token plus (PLUS, "+", 0, 0);
+        Token sa (AS_SHAPE, "sa", 0, 0);
+        NDArray repeated = std::get<NDArray>(binary_operation(sa, Variable(NDArray({1, 2, 3}, {3})), Variable(NDArray({1000000}, {1}))).value);
+        REQUIRE(repeated.is_computed());
+        REQUIRE(repeated.period() == 3);
+        NDArray shifted = std::get<NDArray>(binary_operation(plus, Variable(repeated), Variable(1.0)).value);
+        REQUIRE(shifted.is_computed());
+        REQUIRE(shifted.period() == 3);
+        REQUIRE(shifted.pattern()[2] == 4);
+        REQUIRE(repeated.is_computed());
+        Elements ones(1000000, 1);
+        NDArray sum = std::get<NDArray>(binary_operation(plus, Variable(repeated), Variable(NDArray(ones, {1000000}))).value);
+        REQUIRE(repeated.is_computed());
+        REQUIRE(sum.elements()[999999] == 2);
+    }
+
+    SECTION("Matching copies") {
+        auto program = R"V0G0N(
+            a n = 1000;
+            a pat = [1, 2, 3, 4, 5, 6, 7] sa [n, 7];
+            a dense = pat * 1;
+            dense[0, 0] = 1;
+            a c = [3] sa [n, 7];
+            a cd = c * 1;
+            cd[0, 0] = 3;
+            a rg = range(7000) sa [n, 7];
+            a rgd = range(7000) sa [n, 7];
+            rgd[0, 0] = 0;
+            p all(pat * 2 + c - rg / 3 == dense * 2 + cd - rgd / 3);
+            p all(rg + range(7) == rgd + range(7));
+            p all((pat > 3) == (dense > 3));
+            p all(([5, 1, 2] sa [n, 7]) - pat == ([5, 1, 2] sa [n, 7]) - dense);
+        )V0G0N";
+        auto output = R"V0G0N(
+            True
+            True
+            True
+            True
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+    }
+
+    SECTION("Invalid ranges") {
+        REQUIRE_THROWS_WITH(getOutput("p range(T);"), "Runtime error: Expression evaluates to a non-number, occurred at line 0 at column 2");
+        REQUIRE_THROWS_WITH(getOutput("p range(0, 1 / 0);"), "Runtime error: An expression used as a bound of a range is not finite, occurred at line 0 at column 2");
+        REQUIRE_THROWS_WITH(getOutput("a e = range(0); p e sa [3];"), "Runtime error: Can't fill an ndarray from an empty ndarray, occurred at line 0 at column 20");
+    }
+}
+
+TEST_CASE("Masks", "[environment]") {
+    SECTION("Comparisons and boolean operators") {
+        auto program = R"V0G0N(
+            a x = [1, 5, 3, 8];
+            p x > 3;
+            p 3 <= x;
+            p x == [1, 2, 3, 4];
+            p x != 5;
+            p x > 2 A x < 8;
+            p x < 2 O x > 7;
+            p !(x > 3);
+            p [1, 2] == N;
+        )V0G0N";
+        auto output = R"V0G0N(
+            [0, 1, 0, 1] sa [4]
+            [0, 1, 1, 1] sa [4]
+            [1, 0, 1, 0] sa [4]
+            [1, 0, 1, 1] sa [4]
+            [0, 1, 1, 0] sa [4]
+            [1, 0, 0, 1] sa [4]
+            [1, 0, 1, 0] sa [4]
+            False
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+    }
+
+    SECTION("Selection") {
+        auto program = R"V0G0N(
+            a x = [4, -2, 0, 7, -1, 3] sa [2, 3];
+            p filter(x, x > 0);
+            p where(x < 0, 0, x);
+            p where(x > 0, x, 0 - x);
+            p where(x > 0, 1, [1, 2, 3, 4, 5, 6] sa [2, 3]);
+            p any(x > 6);
+            p all(x > -3);
+            p any(x > 7);
+            p filter(x, x > 7);
+            a n = 0;
+            i (any(x == 0)) { n = sum(x > 0); }
+            p n;
+        )V0G0N";
+        auto output = R"V0G0N(
+            [4, 7, 3] sa [3]
+            [4, 0, 0, 7, 0, 3] sa [2, 3]
+            [4, 2, 0, 7, 1, 3] sa [2, 3]
+            [1, 2, 3, 1, 5, 1] sa [2, 3]
+            True
+            True
+            False
+            [] sa [0]
+            3
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+    }
+
+    SECTION("Invalid operands") {
+        REQUIRE_THROWS_WITH(getOutput("p [1, 2] < [1, 2, 3];"), "Runtime error: Expressions evaluate to arrays of differing sizes, occurred at line 0 at column 9");
+        REQUIRE_THROWS_WITH(getOutput("p [1] < 2 A T;"), "Runtime error: Right expression isn't an ndarray, occurred at line 0 at column 10");
+        REQUIRE_THROWS_WITH(getOutput("p F O [1];"), "Runtime error: Right expression evaluates to non-boolean value, occurred at line 0 at column 4");
+        REQUIRE_THROWS_WITH(getOutput("i ([1] < 2) {}"), "Runtime error: If statement expected a boolean condition, occurred at line 0 at column 0");
+        REQUIRE_THROWS_WITH(getOutput("p where(1, 2, 3);"), "Runtime error: Expression evaluates to a non-ndarray, occurred at line 0 at column 2");
+        REQUIRE_THROWS_WITH(getOutput("p where([1], [1, 2], 3);"), "Runtime error: Expressions evaluate to arrays of differing sizes, occurred at line 0 at column 2");
+        REQUIRE_THROWS_WITH(getOutput("p filter([1, 2], [1]);"), "Runtime error: Expressions evaluate to arrays of differing sizes, occurred at line 0 at column 2");
+        REQUIRE_THROWS_WITH(getOutput("p any(T);"), "Runtime error: Expression evaluates to a non-ndarray, occurred at line 0 at column 2");
+    }
+}
+
+TEST_CASE("Fancy indexing", "[environment]") {
+    SECTION("Reading with ndarrays of indices") {
+        auto program = R"V0G0N(
+            a x = [10, 20, 30, 40, 50];
+            p x[[4, 0, 0]];
+            p x[[]];
+            a m = [1, 2, 3, 4, 5, 6] sa [2, 3];
+            p m[[1, 0], 2];
+            p m[1, [2, 0]];
+            p m[[1, 0], [0, 2]];
+            p m[[1, 1], :];
+            p (tr m)[[2], 0:1];
+            a rows = [0, 1, 0];
+            p m[rows, 1] + 1;
+        )V0G0N";
+        auto output = R"V0G0N(
+            [50, 10, 10] sa [3]
+            [] sa [0]
+            [6, 3] sa [2]
+            [6, 4] sa [2]
+            [4, 6, 1, 3] sa [2, 2]
+            [4, 5, 6, 4, 5, 6] sa [2, 3]
+            [3] sa [1, 1]
+            [3, 6, 3] sa [3]
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+    }
+
+    SECTION("Reading with masks") {
+        auto program = R"V0G0N(
+            a x = [4, -2, 0, 7, -1, 3];
+            p x[x > 0];
+            a keep = x < 0 O x > 5;
+            p x[keep];
+            p x[!keep];
+            p x[x > 9];
+            a m = x sa [2, 3];
+            p m[[1, 0] > 0, :];
+            p m[:, m[0, :] != 0];
+            p x[(x > 0) + 0];
+        )V0G0N";
+        auto output = R"V0G0N(
+            [4, 7, 3] sa [3]
+            [-2, 7, -1] sa [3]
+            [4, 0, 3] sa [3]
+            [] sa [0]
+            [4, -2, 0] sa [1, 3]
+            [4, -2, 7, -1] sa [2, 2]
+            [-2, 4, 4, -2, 4, -2] sa [6]
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+    }
+
+    SECTION("Writing") {
+        auto program = R"V0G0N(
+            a x = [4, -2, 0, 7, -1, 3];
+            a y = x;
+            x[x < 0] = 0;
+            p x;
+            p y;
+            x[[5, 0, 5]] = [1, 2, 3];
+            p x;
+            a m = [1, 2, 3, 4, 5, 6] sa [2, 3];
+            m[[1], [0, 2]] = [8, 9] sa [1, 2];
+            p m;
+            m[:, 1] = 0;
+            m[1, m[1, :] > 5] = m[1, m[1, :] > 5] * 10;
+            p m;
+        )V0G0N";
+        auto output = R"V0G0N(
+            [4, 0, 0, 7, 0, 3] sa [6]
+            [4, -2, 0, 7, -1, 3] sa [6]
+            [2, 0, 0, 7, 0, 3] sa [6]
+            [1, 2, 3, 8, 5, 9] sa [2, 3]
+            [1, 0, 3, 80, 0, 90] sa [2, 3]
+        )V0G0N";
+        REQUIRE_OUTPUT(program, output);
+    }
+
+    SECTION("Invalid indices") {
+        REQUIRE_THROWS_WITH(getOutput("a x = [1, 2, 3]; p x[[0, 1.5]];"), "Runtime error: An expression used in array indexing is not close to an integer, occurred at line 0 at column 20");
+        REQUIRE_THROWS_WITH(getOutput("a x = [1, 2, 3]; p x[[3]];"), "Runtime error: An expression used in array indexing is larger than a dimension of the ndarray, occurred at line 0 at column 20");
+        REQUIRE_THROWS_WITH(getOutput("a x = [1, 2, 3]; p x[[0, 1] sa [1, 2]];"), "Runtime error: An ndarray used in array indexing isn't 1d, occurred at line 0 at column 20");
+        REQUIRE_THROWS_WITH(getOutput("a x = [1, 2, 3]; p x[[1, 2] > 0];"), "Runtime error: A mask used in array indexing differs in length from a dimension of the ndarray, occurred at line 0 at column 20");
+        REQUIRE_THROWS_WITH(getOutput("a x = [1, 2, 3]; x[[0, 1]] = [1, 2, 3];"), "Runtime error: Assigned ndarray differs in shape from the part of the array assigned to, occurred at line 0 at column 17");
+        REQUIRE_THROWS_WITH(getOutput("a x = [1, 2, 3]; x[0] = [1];"), "Runtime error: Can't assign a non-number to an entry in an array, occurred at line 0 at column 17");
+    }
+}
+
 TEST_CASE("Error tests", "[environment]") {
     SECTION("If statement without boolean condition") {
         REQUIRE_THROWS_WITH(getOutput("i (3) {}"), "Runtime error: If statement expected a boolean condition, occurred at line 0 at column 0");
@@ -1778,3 +3181,235 @@ TEST_CASE("Complete program evaluation", "[environment]") {
         REQUIRE_OUTPUT(program, output);
     };
 }
+
+// Runs a program with both engines and expects identical output, or the
+// identical error message
+#define REQUIRE_SAME_RESULT(prog) { \
+    std::string tree_result, vm_result; \
+    try { tree_result = getOutput(prog); } catch (std::runtime_error& e) { tree_result = e.what(); } \
+    try { vm_result = getVMOutput(prog); } catch (std::runtime_error& e) { vm_result = e.what(); } \
+    REQUIRE(tree_result == vm_result); \
+}
+
+TEST_CASE("Bytecode VM", "[vm]") {
+    SECTION("Scalar loop") {
+        auto program = R"V0G0N(
+            a total = 0;
+            a k = 0;
+            w (k < 100) {
+                i (k / 2 == 7 O k > 95) {
+                    total = total + k;
+                }
+                k = k + 1;
+            }
+            p total;
+        )V0G0N";
+        REQUIRE(getVMOutput(program) == clean_output_string("404"));
+        REQUIRE_SAME_RESULT(program);
+    }
+
+    SECTION("Functions, operators and arrays") {
+        auto program = R"V0G0N(
+            o x (b, c) {
+                r b ^ (c*2);
+            }
+            f y (b, c, d) {
+                a m = 0;
+                a mat = [0] sa [2, 2];
+                w (m < d) {
+                    mat = mat x mat;
+                    mat = mat @ mat;
+                    mat[0, 1] = m;
+                    m = m + 1;
+                }
+                p mat;
+                r mat[1, 0];
+            }
+            p y(1, 2, 3);
+            p y(2, 3, 4);
+        )V0G0N";
+        REQUIRE_SAME_RESULT(program);
+    }
+
+    SECTION("Redeclaration keeps the first value") {
+        auto program = R"V0G0N(
+            a val = 1;
+            a val = 2;
+            f g(q, q) {
+                r q;
+            }
+            f g() {
+                r 0;
+            }
+            p val;
+            p g(3, 4);
+        )V0G0N";
+        REQUIRE(getVMOutput(program) == clean_output_string("1\n3"));
+        REQUIRE_SAME_RESULT(program);
+    }
+
+    SECTION("Return inside a while loop") {
+        auto program = R"V0G0N(
+            f first_over(limit) {
+                a n = 0;
+                w (T) {
+                    i (n * n > limit) {
+                        r n;
+                    }
+                    n = n + 1;
+                }
+            }
+            p first_over(50);
+        )V0G0N";
+        REQUIRE(getVMOutput(program) == clean_output_string("8"));
+        REQUIRE_SAME_RESULT(program);
+    }
+
+    SECTION("Function declared inside a function") {
+        auto program = R"V0G0N(
+            f outer(x) {
+                i (x > 0) {
+                    f inner() {
+                        r 1;
+                    }
+                }
+                r inner();
+            }
+            p outer(1);
+            p outer(0);
+        )V0G0N";
+        REQUIRE_THROWS_WITH(getOutput(program), "Runtime error: Identifier doesn't correspond to a defined function name, occurred at line 7 at column 19");
+        REQUIRE_SAME_RESULT(program);
+    }
+
+    SECTION("Array value semantics") {
+        auto program = R"V0G0N(
+            f set_first(arr) {
+                arr[0] = 9;
+                r arr;
+            }
+            a x = [1, 2];
+            a y = x;
+            y[1] = 7;
+            a z = set_first(x);
+            p x;
+            p y;
+            p z;
+            w (x[0] < 3) {
+                a fresh = [0, 0];
+                fresh[0] = x[0];
+                x[0] = x[0] + 1;
+                p fresh;
+            }
+        )V0G0N";
+        REQUIRE_SAME_RESULT(program);
+    }
+
+    SECTION("Recursion") {
+        auto program = R"V0G0N(
+            f fib(n) {
+                i (n < 2) {
+                    r n;
+                }
+                r fib(n - 1) + fib(n - 2);
+            }
+            p fib(15);
+        )V0G0N";
+        REQUIRE(getVMOutput(program) == clean_output_string("610"));
+        REQUIRE_SAME_RESULT(program);
+    }
+
+    SECTION("Declarations in a call stay in its frame") {
+        auto program = R"V0G0N(
+            f declare(x) {
+                f helper() {
+                    r 2;
+                }
+                a local = x;
+                r helper() + local;
+            }
+            o plus(x, x) {
+                r x + declare(x);
+            }
+            p declare(1);
+            p 5 plus 10;
+            p helper();
+        )V0G0N";
+        REQUIRE_THROWS_WITH(getOutput(program), "Runtime error: Identifier doesn't correspond to a defined function name, occurred at line 13 at column 15");
+        REQUIRE_SAME_RESULT(program);
+    }
+
+    SECTION("Variable declared on only one branch") {
+        auto program = R"V0G0N(
+            i (F) {
+                a maybe = 1;
+            }
+            p maybe;
+        )V0G0N";
+        REQUIRE_SAME_RESULT(program);
+    }
+
+    SECTION("Runtime errors") {
+        REQUIRE_SAME_RESULT("i (3) {}");
+        REQUIRE_SAME_RESULT("w (34) {}");
+        REQUIRE_SAME_RESULT("v 2 == 1;");
+        REQUIRE_SAME_RESULT("a mat = [0, 1]; p mat[\"hi\"];");
+        REQUIRE_SAME_RESULT("a mat = [0, 1]; p mat[2];");
+        REQUIRE_SAME_RESULT("a mat = [0, 1]; mat[0] = \"hi\";");
+        REQUIRE_SAME_RESULT("a mat = 3; mat[0] = 1;");
+        REQUIRE_SAME_RESULT("p T xor F;");
+        REQUIRE_SAME_RESULT("p 2 <= \"a\";");
+        REQUIRE_SAME_RESULT("p dne();");
+        REQUIRE_SAME_RESULT("f func(arg) { r arg; } p func(1, 2);");
+        REQUIRE_SAME_RESULT("a mat = [1, T];");
+        REQUIRE_SAME_RESULT("p -T;");
+        REQUIRE_SAME_RESULT("p F A 3;");
+        REQUIRE_SAME_RESULT("a x = [1, 2]; a y = [1, 2, 3]; p x * 2 + y;");
+        REQUIRE_SAME_RESULT("a x = [1, 2]; p x + 1 + T - dne();");
+        REQUIRE_SAME_RESULT("a x = [1, 2]; p (x + [1]) * (x + \"a\");");
+        REQUIRE_SAME_RESULT("p 1; p [1, 2] sa [2, 0.5];");
+        REQUIRE_SAME_RESULT("i (F) { p 1 / T; } p -[1];");
+        REQUIRE_SAME_RESULT("a q = [1, 2] sa [1, 2]; p q @ q @ dne;");
+        REQUIRE_SAME_RESULT("a q = [1, 2] sa [2, 1]; p q @ [1, 2] @ 3 @ dne;");
+        REQUIRE_SAME_RESULT("a q = [1, 2] sa [2, 2]; p q @ [1, 2] @ [1, 2] @ q;");
+        REQUIRE_SAME_RESULT("a m = [1, 2, 3, 4] sa [2, 2]; p sum(m, 0) + max(m) * argmax(m, 1);");
+        REQUIRE_SAME_RESULT("p sum([1], 0, dne);");
+        REQUIRE_SAME_RESULT("p mean([1, 2] sa [1, 2], dne);");
+        REQUIRE_SAME_RESULT("p argmax(3);");
+        REQUIRE_SAME_RESULT("a x = [0.5, 2]; p exp(x) + log(x) * sin(x) - tanh(cos(x)) ^ 2 + sqrt(x) ^ 0.5;");
+        REQUIRE_SAME_RESULT("p sqrt(T);");
+        REQUIRE_SAME_RESULT("a x = [3, 1, 2]; p where(x > 1 A !(x == 3), x, 0) + filter(x, x >= 2);");
+        REQUIRE_SAME_RESULT("a x = [3, 1, 2]; a n = 0; w (any(x > n)) { n = n + 1; } p n;");
+        REQUIRE_SAME_RESULT("a x = [1]; i (x < 2) {}");
+        REQUIRE_SAME_RESULT("p F A [1]; p T O [1]; p [1] A 2;");
+        REQUIRE_SAME_RESULT("a m = [1, 2, 3, 4, 5, 6] sa [2, 3]; p m[1, 0] + m[0, 2]; p m[:, 1:] @ tr m[0:1, 1:]; p (tr m)[:, 0] * m[1, 0:2, 5];");
+        REQUIRE_SAME_RESULT("a m = [1, 2, 3, 4]; a x = 0; p m[(x = 1):x + 2]; p m[x:5];");
+        REQUIRE_SAME_RESULT("a m = [1, 2, 3, 4, 5, 6] sa [2, 3]; p m * [1, 2, 3] + ([1, 2] sa [2, 1]); m = m / [2, 2, 2]; p m; p m + [1, 2];");
+        REQUIRE_SAME_RESULT("a m = [1, 2] sa [2, 3]; p m * range(3) + ([0] sa [2, 3]); m[0, 0] = 5; p m + 1; p range(T);");
+        REQUIRE_SAME_RESULT("a m = [1, 2, 3, 4, 5, 6] sa [2, 3]; p m[[1, 0], m[0, :] > 1]; m[m > 2] = 0; p m; m[[0], [1, 1]] = [7, 8] sa [1, 2]; p m[0, [1]]; m[:, 1:] = 0; p m; p m[[2], 0];");
+    }
+
+    SECTION("Chains of matrix products") {
+        auto program = R"V0G0N(
+            a big = [1, 2, 3] sa [40, 40];
+            a k = 0;
+            w (k < 3) {
+                p s (big @ big @ ([1, k] sa [40]));
+                p s ([k] sa [3, 40] @ big @ big @ ([1] sa [40, 2]));
+                k = k + 1;
+            }
+        )V0G0N";
+        REQUIRE_SAME_RESULT(program);
+    }
+
+    SECTION("Constants") {
+        // A folded mask and a list of indices with the same elements are
+        // different constants
+        auto program = "a x = [10, 20, 30]; p x[[1, 0, 1]]; p x[[3, 0, 2] > 1];";
+        REQUIRE(getVMOutput(program) == clean_output_string("[20, 10, 20] sa [3]\n[10, 30] sa [2]"));
+        REQUIRE_SAME_RESULT(program);
+        // So are 0 and a folded -0
+        REQUIRE(getVMOutput("p 0; p -1 * 0;") == clean_output_string("0\n-0"));
+        REQUIRE_SAME_RESULT("p 0; p -1 * 0;");
+    }
+}